@@ -0,0 +1,496 @@
+﻿#include "../BakeLoader/AsyncReader.h"
+#include "../BakeLoader/BakeLoader.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __APPLE__
+#include <mach/mach.h>
+#endif
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Measures how fast the output of BakeModel can be consumed. Every method
+// loads the manifest, then the data of each mesh in manifest order, reading
+// every byte of it, and records when the first mesh became usable and when
+// all were.
+
+enum class LoadMethod {
+	// Parse the .json and read each mesh with std::ifstream into its own
+	// buffer, as a loader without mapping would.
+	Stream,
+	// LoadBakedModel on the .json, faulting pages in on touch.
+	Map,
+	// LoadBakedModel on the .bkm.
+	MapBinaryManifest,
+	// LoadBakedModel on the .bkm, then PrefetchMeshes on every mesh before
+	// touching them.
+	MapPrefetch,
+	// The .bkm, then every mesh read at once through AsyncReader into its
+	// own buffer, touched in the completion callback.
+	Async,
+	// Like Async, with direct reads that bypass the page cache.
+	AsyncDirect,
+};
+
+enum class CacheState {
+	// The files are dropped from the page cache before each run.
+	Cold,
+	// One untimed run first, so that every run reads from the page cache.
+	Warm,
+};
+
+struct BenchOptions {
+	std::vector<LoadMethod> Methods = { LoadMethod::Stream, LoadMethod::Map, LoadMethod::MapBinaryManifest, LoadMethod::MapPrefetch, LoadMethod::Async, LoadMethod::AsyncDirect };
+	std::vector<CacheState> Caches = { CacheState::Cold, CacheState::Warm };
+	int Runs = 5;
+	// Check the mesh data against the hashes of the manifest while loading.
+	bool Verify = false;
+};
+
+struct RunResult {
+	double FirstMesh = 0.0;
+	double Total = 0.0;
+	// Largest growth of the resident set during the run, file pages
+	// included.
+	size_t PeakResident = 0;
+	uint64_t Checksum = 0;
+};
+
+// The files of one baked model and the mesh ranges of its .bin, found once
+// before timing so that the Stream method knows what to read.
+struct BakedFiles {
+	std::filesystem::path Json;
+	std::filesystem::path Binary;
+	std::filesystem::path Bin;
+	std::vector<ByteRange> Meshes;
+	size_t Bytes = 0;
+};
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double milliseconds(Clock::time_point begin, Clock::time_point end) {
+	return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+// Reads every byte so that no method gets away with touching one per page.
+uint64_t touch(std::span<const std::byte> bytes) {
+	uint64_t sum = 0;
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= bytes.size(); i += sizeof(uint64_t)) {
+		uint64_t word;
+		std::memcpy(&word, bytes.data() + i, sizeof(word));
+		sum += word;
+	}
+	for (; i < bytes.size(); ++i) {
+		sum += static_cast<uint64_t>(bytes[i]);
+	}
+	return sum;
+}
+
+size_t residentBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = {};
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.WorkingSetSize;
+#elif defined(__linux__)
+	std::ifstream statm("/proc/self/statm");
+	size_t total = 0, resident = 0;
+	statm >> total >> resident;
+	return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#elif defined(__APPLE__)
+	mach_task_basic_info_data_t info = {};
+	mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+	task_info(mach_task_self(), MACH_TASK_BASIC_INFO, reinterpret_cast<task_info_t>(&info), &count);
+	return static_cast<size_t>(info.resident_size);
+#else
+	// Only the peak is available here, which never shrinks between runs.
+	rusage usage = {};
+	getrusage(RUSAGE_SELF, &usage);
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+}
+
+// Samples the resident set every millisecond on a thread of its own while a
+// run is timed, so that growth between the points the run reaches is seen,
+// and memory freed before the end of the run does not hide it.
+struct ResidentSampler {
+	size_t Baseline = residentBytes();
+	// Written by the sampling thread until Stop joins it.
+	size_t Peak = Baseline;
+	std::atomic<bool> Done = false;
+	std::thread Thread;
+
+	ResidentSampler() : Thread([this] {
+		while (!Done) {
+			sample();
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}) {}
+
+	~ResidentSampler() {
+		Stop();
+	}
+
+	// Stops sampling and returns the largest growth over the baseline.
+	size_t Stop() {
+		if (Thread.joinable()) {
+			Done = true;
+			Thread.join();
+			sample();
+		}
+		return Peak - Baseline;
+	}
+
+private:
+	void sample() {
+		Peak = std::max(Peak, residentBytes());
+	}
+};
+
+size_t peakResidentBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters = {};
+	GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage = {};
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return static_cast<size_t>(usage.ru_maxrss);
+#else
+	return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Evicts the file from the page cache. Needs no privileges, but pages still
+// mapped by this or another process stay resident.
+bool dropFromCache(const std::filesystem::path& path) {
+#ifdef _WIN32
+	// Opening a file unbuffered makes the cache manager discard its pages.
+	HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_NO_BUFFERING, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	CloseHandle(file);
+	return true;
+#elif defined(__linux__)
+	int descriptor = open(path.c_str(), O_RDONLY);
+	if (descriptor < 0) {
+		return false;
+	}
+	// Dirty pages, such as those of a model that was just baked, are not
+	// dropped until written back.
+	fsync(descriptor);
+	bool dropped = posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED) == 0;
+	close(descriptor);
+	return dropped;
+#else
+	(void)path;
+	return false;
+#endif
+}
+
+std::optional<BakedFiles> findFiles(const std::filesystem::path& path) {
+	BakedFiles files;
+	files.Json = path;
+	files.Json.replace_extension(".json");
+	files.Binary = path;
+	files.Binary.replace_extension(".bkm");
+	files.Bin = path;
+	files.Bin.replace_extension(".bin");
+
+	std::string error;
+	auto model = LoadBakedModel(files.Json, &error);
+	if (!model) {
+		std::cout << error << std::endl;
+		return std::nullopt;
+	}
+	for (const auto& mesh : model->Meshes) {
+		files.Meshes.push_back(mesh.Range);
+		files.Bytes += mesh.Range.Size;
+	}
+	return files;
+}
+
+std::optional<RunResult> runStream(const BakedFiles& files) {
+	RunResult result;
+	ResidentSampler resident;
+	auto begin = Clock::now();
+
+	std::ifstream json_in(files.Json, std::ios::binary);
+	std::string text((std::istreambuf_iterator<char>(json_in)), std::istreambuf_iterator<char>());
+	auto manifest = ParseManifest(text);
+	std::ifstream bin_in(files.Bin, std::ios::binary);
+	if (!manifest || !bin_in) {
+		return std::nullopt;
+	}
+	std::vector<std::vector<std::byte>> buffers(files.Meshes.size());
+	for (size_t i = 0; i < files.Meshes.size(); ++i) {
+		buffers[i].resize(files.Meshes[i].Size);
+		bin_in.seekg(static_cast<std::streamoff>(files.Meshes[i].Offset));
+		bin_in.read(reinterpret_cast<char*>(buffers[i].data()), static_cast<std::streamsize>(buffers[i].size()));
+		result.Checksum += touch(buffers[i]);
+		if (i == 0) {
+			result.FirstMesh = milliseconds(begin, Clock::now());
+		}
+	}
+
+	result.Total = milliseconds(begin, Clock::now());
+	result.PeakResident = resident.Stop();
+	return result;
+}
+
+std::optional<RunResult> runMapped(const BakedFiles& files, LoadMethod method, bool verify) {
+	RunResult result;
+	ResidentSampler resident;
+	auto begin = Clock::now();
+
+	auto model = LoadBakedModel(method == LoadMethod::Map ? files.Json : files.Binary);
+	if (!model) {
+		return std::nullopt;
+	}
+	std::vector<size_t> meshes(model->Meshes.size());
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		meshes[i] = i;
+	}
+	if (method == LoadMethod::MapPrefetch) {
+		PrefetchMeshes(model.value(), meshes);
+	}
+	// Verifying prefetches and hashes on all cores before the first touch.
+	std::string error;
+	if (verify && !VerifyMeshes(model.value(), meshes, &error)) {
+		std::cout << error << std::endl;
+		return std::nullopt;
+	}
+	for (size_t i = 0; i < model->Meshes.size(); ++i) {
+		const auto& range = model->Meshes[i].Range;
+		result.Checksum += touch(model->Bin.subspan(range.Offset, range.Size));
+		if (i == 0) {
+			result.FirstMesh = milliseconds(begin, Clock::now());
+		}
+	}
+
+	result.Total = milliseconds(begin, Clock::now());
+	result.PeakResident = resident.Stop();
+	return result;
+}
+
+std::optional<RunResult> runAsync(const BakedFiles& files, bool direct, bool verify) {
+	RunResult result;
+	ResidentSampler resident;
+	auto begin = Clock::now();
+
+	// The model is only used for its mesh ranges; its mapping of the .bin
+	// is never touched.
+	auto model = LoadBakedModel(files.Binary);
+	auto file = OpenReadable(files.Bin, direct);
+	if (!model || !file) {
+		return std::nullopt;
+	}
+	std::vector<AlignedBuffer> buffers;
+	std::vector<ReadRequest> requests;
+	std::atomic<uint64_t> checksum = 0;
+	std::atomic<bool> failed = false;
+	Clock::time_point first_mesh;
+	for (size_t i = 0; i < model->Meshes.size(); ++i) {
+		auto mesh = model->Meshes[i].Range;
+		auto range = direct ? DirectReadRange(mesh) : mesh;
+		buffers.emplace_back(range.Size);
+		auto buffer = buffers.back().Bytes().first(direct ? buffers.back().Size : range.Size);
+		requests.push_back({ &file.value(), range.Offset, buffer, [&, i, mesh, buffer, skip = mesh.Offset - range.Offset](const ReadResult& read) {
+			if (read.Error != 0 || read.Bytes < skip + mesh.Size) {
+				failed = true;
+				return;
+			}
+			if (verify && !VerifyMeshData(model->Meshes[i], buffer.subspan(skip, mesh.Size), mesh.Offset)) {
+				failed = true;
+				return;
+			}
+			checksum += touch(buffer.subspan(skip, mesh.Size));
+			if (i == 0) {
+				first_mesh = Clock::now();
+			}
+		} });
+	}
+	AsyncReader reader;
+	reader.Submit(std::move(requests));
+	reader.Wait();
+	if (failed) {
+		return std::nullopt;
+	}
+
+	result.Checksum = checksum;
+	result.FirstMesh = model->Meshes.empty() ? 0.0 : milliseconds(begin, first_mesh);
+	result.Total = milliseconds(begin, Clock::now());
+	result.PeakResident = resident.Stop();
+	return result;
+}
+
+std::optional<RunResult> run(const BakedFiles& files, LoadMethod method, CacheState cache, bool verify) {
+	if (cache == CacheState::Cold) {
+		for (const auto& path : { files.Json, files.Binary, files.Bin }) {
+			if (std::filesystem::exists(path)) {
+				dropFromCache(path);
+			}
+		}
+	}
+	switch (method) {
+	case LoadMethod::Stream: return runStream(files);
+	case LoadMethod::Async: return runAsync(files, false, verify);
+	case LoadMethod::AsyncDirect: return runAsync(files, true, verify);
+	default: return runMapped(files, method, verify);
+	}
+}
+
+const char* methodName(LoadMethod method) {
+	switch (method) {
+	case LoadMethod::Stream: return "ifstream";
+	case LoadMethod::Map: return "mmap";
+	case LoadMethod::MapBinaryManifest: return "mmap-bkm";
+	case LoadMethod::MapPrefetch: return "mmap-prefetch";
+	case LoadMethod::Async: return "async";
+	case LoadMethod::AsyncDirect: return "async-direct";
+	}
+	return "";
+}
+
+std::optional<LoadMethod> parseMethod(const std::string& value) {
+	for (auto method : { LoadMethod::Stream, LoadMethod::Map, LoadMethod::MapBinaryManifest, LoadMethod::MapPrefetch, LoadMethod::Async, LoadMethod::AsyncDirect }) {
+		if (value == methodName(method)) {
+			return method;
+		}
+	}
+	return std::nullopt;
+}
+
+double median(std::vector<double> values) {
+	std::sort(values.begin(), values.end());
+	return values[values.size() / 2];
+}
+
+std::optional<BenchOptions> parseOptions(int argc, char* argv[]) {
+	BenchOptions options;
+	bool methods_given = false;
+	for (int i = 2; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--method" && has_value) {
+			auto method = parseMethod(argv[++i]);
+			if (!method) {
+				std::cout << "Unknown load method " << argv[i] << std::endl;
+				return std::nullopt;
+			}
+			if (!methods_given) {
+				options.Methods.clear();
+				methods_given = true;
+			}
+			options.Methods.push_back(method.value());
+		}
+		else if (arg == "--cache" && has_value) {
+			std::string value = argv[++i];
+			if (value == "cold") options.Caches = { CacheState::Cold };
+			else if (value == "warm") options.Caches = { CacheState::Warm };
+			else if (value == "both") options.Caches = { CacheState::Cold, CacheState::Warm };
+			else {
+				std::cout << "Unknown cache state " << value << std::endl;
+				return std::nullopt;
+			}
+		}
+		else if (arg == "--runs" && has_value) {
+			options.Runs = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--verify") {
+			options.Verify = true;
+		}
+		else {
+			std::cout << "Unknown option " << arg << std::endl;
+			return std::nullopt;
+		}
+	}
+	return options;
+}
+
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2) {
+		std::cout << "Need the .json or .bkm of a baked model." << std::endl;
+		return 0;
+	}
+	auto options = parseOptions(argc, argv);
+	if (!options) {
+		return 0;
+	}
+	auto files = findFiles(argv[1]);
+	if (!files) {
+		return 0;
+	}
+	std::cout << files->Meshes.size() << " meshes, " << std::fixed << std::setprecision(1) << files->Bytes / (1024.0 * 1024.0) << " MiB of mesh data, " << options->Runs << " runs each, medians" << std::endl;
+	std::cout << std::left << std::setw(15) << "method" << std::setw(7) << "cache" << std::right
+		<< std::setw(14) << "first mesh ms" << std::setw(13) << "full load ms" << std::setw(9) << "GB/s" << std::setw(16) << "RSS growth MiB" << std::endl;
+
+	uint64_t checksum = 0;
+	for (auto method : options->Methods) {
+		if (method != LoadMethod::Stream && method != LoadMethod::Map && !std::filesystem::exists(files->Binary)) {
+			std::cout << std::left << std::setw(15) << methodName(method) << "skipped, no " << files->Binary.filename().string() << std::endl;
+			continue;
+		}
+		for (auto cache : options->Caches) {
+			if (cache == CacheState::Warm) {
+				run(files.value(), method, cache, options->Verify);
+			}
+			std::vector<double> first_mesh, total;
+			size_t peak_resident = 0;
+			bool failed = false;
+			for (int i = 0; i < options->Runs && !failed; ++i) {
+				auto result = run(files.value(), method, cache, options->Verify);
+				if (!result) {
+					failed = true;
+					break;
+				}
+				first_mesh.push_back(result->FirstMesh);
+				total.push_back(result->Total);
+				peak_resident = std::max(peak_resident, result->PeakResident);
+				if (checksum != 0 && result->Checksum != checksum) {
+					std::cout << methodName(method) << " read different bytes" << std::endl;
+				}
+				checksum = result->Checksum;
+			}
+			std::cout << std::left << std::setw(15) << methodName(method) << std::setw(7) << (cache == CacheState::Cold ? "cold" : "warm") << std::right;
+			if (failed) {
+				std::cout << "failed to load" << std::endl;
+				continue;
+			}
+			double seconds = median(total) / 1000.0;
+			std::cout << std::setprecision(2) << std::setw(14) << median(first_mesh) << std::setw(13) << median(total)
+				<< std::setw(9) << (seconds > 0.0 ? files->Bytes / seconds / 1e9 : 0.0)
+				<< std::setprecision(1) << std::setw(16) << peak_resident / (1024.0 * 1024.0) << std::endl;
+		}
+	}
+	std::cout << "Peak RSS of the process " << std::setprecision(1) << peakResidentBytes() / (1024.0 * 1024.0) << " MiB" << std::endl;
+	return 0;
+}
@@ -0,0 +1,595 @@
+﻿#include "AsyncReader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+ReadableFile::ReadableFile(ReadableFile&& other) noexcept {
+	*this = std::move(other);
+}
+
+ReadableFile& ReadableFile::operator=(ReadableFile&& other) noexcept {
+	if (this != &other) {
+		Close();
+		Size = std::exchange(other.Size, 0);
+		Direct = std::exchange(other.Direct, false);
+#ifdef _WIN32
+		Handle = std::exchange(other.Handle, nullptr);
+#else
+		Descriptor = std::exchange(other.Descriptor, -1);
+#endif
+	}
+	return *this;
+}
+
+ReadableFile::~ReadableFile() {
+	Close();
+}
+
+void ReadableFile::Close() {
+#ifdef _WIN32
+	if (Handle) {
+		CloseHandle(Handle);
+	}
+	Handle = nullptr;
+#else
+	if (Descriptor >= 0) {
+		close(Descriptor);
+	}
+	Descriptor = -1;
+#endif
+}
+
+std::optional<ReadableFile> OpenReadable(const std::filesystem::path& path, bool direct, std::string* error) {
+	auto fail = [&](const char* what) -> std::optional<ReadableFile> {
+		if (error) {
+			*error = std::string(what) + " " + path.string();
+		}
+		return std::nullopt;
+	};
+
+	ReadableFile file;
+	file.Direct = direct;
+#ifdef _WIN32
+	DWORD flags = direct ? FILE_FLAG_NO_BUFFERING : FILE_ATTRIBUTE_NORMAL;
+	file.Handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+	if (file.Handle == INVALID_HANDLE_VALUE) {
+		file.Handle = nullptr;
+		return fail("Failed to open");
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file.Handle, &size)) {
+		return fail("Failed to query the size of");
+	}
+	file.Size = static_cast<uint64_t>(size.QuadPart);
+#else
+	int flags = O_RDONLY | O_CLOEXEC;
+#ifdef O_DIRECT
+	if (direct) {
+		flags |= O_DIRECT;
+	}
+#endif
+	file.Descriptor = open(path.c_str(), flags);
+	if (file.Descriptor < 0) {
+		return fail(direct ? "Failed to open for direct reads" : "Failed to open");
+	}
+#if !defined(O_DIRECT) && defined(F_NOCACHE)
+	if (direct) {
+		fcntl(file.Descriptor, F_NOCACHE, 1);
+	}
+#endif
+	struct stat status;
+	if (fstat(file.Descriptor, &status) != 0) {
+		return fail("Failed to query the size of");
+	}
+	file.Size = static_cast<uint64_t>(status.st_size);
+#endif
+	return file;
+}
+
+AlignedBuffer::AlignedBuffer(size_t size) {
+	Size = (size + DIRECT_READ_ALIGNMENT - 1) / DIRECT_READ_ALIGNMENT * DIRECT_READ_ALIGNMENT;
+	if (Size > 0) {
+		Data = static_cast<std::byte*>(::operator new(Size, std::align_val_t(DIRECT_READ_ALIGNMENT)));
+	}
+}
+
+AlignedBuffer::AlignedBuffer(AlignedBuffer&& other) noexcept {
+	*this = std::move(other);
+}
+
+AlignedBuffer& AlignedBuffer::operator=(AlignedBuffer&& other) noexcept {
+	if (this != &other) {
+		if (Data) {
+			::operator delete(Data, std::align_val_t(DIRECT_READ_ALIGNMENT));
+		}
+		Data = std::exchange(other.Data, nullptr);
+		Size = std::exchange(other.Size, 0);
+	}
+	return *this;
+}
+
+AlignedBuffer::~AlignedBuffer() {
+	if (Data) {
+		::operator delete(Data, std::align_val_t(DIRECT_READ_ALIGNMENT));
+	}
+}
+
+ByteRange DirectReadRange(ByteRange range) {
+	size_t begin = range.Offset / DIRECT_READ_ALIGNMENT * DIRECT_READ_ALIGNMENT;
+	size_t end = (range.Offset + range.Size + DIRECT_READ_ALIGNMENT - 1) / DIRECT_READ_ALIGNMENT * DIRECT_READ_ALIGNMENT;
+	return { begin, end - begin };
+}
+
+namespace {
+
+struct Operation {
+	ReadRequest Request;
+	// Read so far; io_uring reads that come back short are issued again for
+	// the rest.
+	size_t Bytes = 0;
+#ifndef _WIN32
+	iovec Vector = {};
+#endif
+};
+
+using Completion = std::pair<Operation*, ReadResult>;
+
+#ifdef __linux__
+// The shared rings of an io_uring, set up with the raw system calls so that
+// the loader needs no liburing.
+struct Ring {
+	int Descriptor = -1;
+	void* SqMap = nullptr;
+	size_t SqMapSize = 0;
+	void* CqMap = nullptr;
+	size_t CqMapSize = 0;
+	io_uring_sqe* Sqes = nullptr;
+	size_t SqesSize = 0;
+	unsigned* SqTail = nullptr;
+	unsigned SqMask = 0;
+	unsigned* SqArray = nullptr;
+	unsigned* CqHead = nullptr;
+	unsigned* CqTail = nullptr;
+	unsigned CqMask = 0;
+	io_uring_cqe* Cqes = nullptr;
+
+	bool Setup(unsigned entries) {
+		io_uring_params params = {};
+		Descriptor = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+		if (Descriptor < 0) {
+			return false;
+		}
+		SqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+		CqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+		if (single_map) {
+			SqMapSize = CqMapSize = std::max(SqMapSize, CqMapSize);
+		}
+		SqMap = mmap(nullptr, SqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Descriptor, IORING_OFF_SQ_RING);
+		if (SqMap == MAP_FAILED) {
+			SqMap = nullptr;
+			return false;
+		}
+		CqMap = single_map ? SqMap : mmap(nullptr, CqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Descriptor, IORING_OFF_CQ_RING);
+		if (CqMap == MAP_FAILED) {
+			CqMap = nullptr;
+			return false;
+		}
+		SqesSize = params.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = mmap(nullptr, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Descriptor, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) {
+			return false;
+		}
+		Sqes = static_cast<io_uring_sqe*>(sqes);
+
+		auto sq = static_cast<char*>(SqMap);
+		auto cq = static_cast<char*>(CqMap);
+		SqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+		SqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+		SqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+		CqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+		CqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+		CqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+		Cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+		return true;
+	}
+
+	~Ring() {
+		if (Sqes) {
+			munmap(Sqes, SqesSize);
+		}
+		if (CqMap && CqMap != SqMap) {
+			munmap(CqMap, CqMapSize);
+		}
+		if (SqMap) {
+			munmap(SqMap, SqMapSize);
+		}
+		if (Descriptor >= 0) {
+			close(Descriptor);
+		}
+	}
+
+	int Enter(unsigned to_submit, unsigned min_complete, unsigned flags) {
+		int result;
+		do {
+			result = static_cast<int>(syscall(__NR_io_uring_enter, Descriptor, to_submit, min_complete, flags, nullptr, 0));
+		} while (result < 0 && errno == EINTR);
+		return result;
+	}
+};
+#endif
+
+}
+
+struct AsyncReader::State {
+	ReadBackend Backend = ReadBackend::Threads;
+	uint32_t QueueDepth = 0;
+
+	std::mutex Mutex;
+	// Signalled when Outstanding drops to zero and, for Threads, when work
+	// is queued.
+	std::condition_variable Idle;
+	std::condition_variable WorkQueued;
+	std::deque<Operation*> Pending;
+	// Submitted and not yet completed, pending ones included.
+	size_t Outstanding = 0;
+	bool Stopping = false;
+	std::vector<std::thread> Threads;
+
+#ifdef __linux__
+	Ring Uring;
+	uint32_t InFlight = 0;
+	// Placed in the ring by Enter but not yet consumed by the kernel.
+	unsigned Unsubmitted = 0;
+	// Every operation in the ring, so that they can be failed if it breaks.
+	std::unordered_set<Operation*> InRing;
+	// The errno that broke the ring, after which every read fails with it.
+	int Broken = 0;
+#endif
+
+	void Complete(Operation* operation, const ReadResult& result) {
+		if (operation->Request.Done) {
+			operation->Request.Done(result);
+		}
+		delete operation;
+		std::lock_guard lock(Mutex);
+		if (--Outstanding == 0) {
+			Idle.notify_all();
+		}
+	}
+
+	// A blocking read of the whole request, for the Threads backend.
+	static ReadResult ReadAt(const ReadRequest& request) {
+		ReadResult result;
+		while (result.Bytes < request.Buffer.size()) {
+			auto* destination = request.Buffer.data() + result.Bytes;
+			size_t remaining = request.Buffer.size() - result.Bytes;
+			uint64_t offset = request.Offset + result.Bytes;
+#ifdef _WIN32
+			OVERLAPPED position = {};
+			position.Offset = static_cast<DWORD>(offset);
+			position.OffsetHigh = static_cast<DWORD>(offset >> 32);
+			DWORD read = 0;
+			DWORD chunk = static_cast<DWORD>(std::min<size_t>(remaining, 1u << 30));
+			if (!ReadFile(request.File->Handle, destination, chunk, &read, &position)) {
+				DWORD code = GetLastError();
+				if (code != ERROR_HANDLE_EOF) {
+					result.Error = static_cast<int>(code);
+				}
+				break;
+			}
+#else
+			ssize_t read = pread(request.File->Descriptor, destination, remaining, static_cast<off_t>(offset));
+			if (read < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				result.Error = errno;
+				break;
+			}
+#endif
+			if (read == 0) {
+				break;
+			}
+			result.Bytes += static_cast<size_t>(read);
+		}
+		return result;
+	}
+
+	void WorkerLoop() {
+		for (;;) {
+			Operation* operation;
+			{
+				std::unique_lock lock(Mutex);
+				WorkQueued.wait(lock, [&]() { return Stopping || !Pending.empty(); });
+				if (Pending.empty()) {
+					return;
+				}
+				operation = Pending.front();
+				Pending.pop_front();
+			}
+			Complete(operation, ReadAt(operation->Request));
+		}
+	}
+
+#ifdef __linux__
+	// Moves pending reads into the submission ring while fewer than
+	// QueueDepth are in flight. Reads that cannot be submitted are taken
+	// out of the ring again and added to failed. Called with Mutex held.
+	void FlushRing(std::vector<Completion>& failed) {
+		unsigned tail = *Uring.SqTail;
+		unsigned added = 0;
+		while (!Pending.empty() && InFlight < QueueDepth) {
+			auto* operation = Pending.front();
+			Pending.pop_front();
+			const auto& request = operation->Request;
+			operation->Vector = { request.Buffer.data() + operation->Bytes, request.Buffer.size() - operation->Bytes };
+
+			unsigned index = tail & Uring.SqMask;
+			auto& sqe = Uring.Sqes[index];
+			std::memset(&sqe, 0, sizeof(sqe));
+			// READV rather than READ, which needs kernel 5.6.
+			sqe.opcode = IORING_OP_READV;
+			sqe.fd = request.File->Descriptor;
+			sqe.off = request.Offset + operation->Bytes;
+			sqe.addr = reinterpret_cast<uint64_t>(&operation->Vector);
+			sqe.len = 1;
+			sqe.user_data = reinterpret_cast<uint64_t>(operation);
+			Uring.SqArray[index] = index;
+			InRing.insert(operation);
+			++tail;
+			++added;
+			++InFlight;
+		}
+		if (added == 0 && Unsubmitted == 0) {
+			return;
+		}
+		std::atomic_ref<unsigned>(*Uring.SqTail).store(tail, std::memory_order_release);
+		unsigned to_submit = Unsubmitted + added;
+		int submitted = Uring.Enter(to_submit, 0, 0);
+		if (submitted >= 0) {
+			Unsubmitted = to_submit - static_cast<unsigned>(submitted);
+			return;
+		}
+		// EAGAIN and EBUSY clear once the kernel completes reads, after which
+		// the completion thread flushes again; that needs reads in flight.
+		int error = errno;
+		if ((error == EAGAIN || error == EBUSY) && InFlight > to_submit) {
+			Unsubmitted = to_submit;
+			return;
+		}
+		// Nothing would retry the entries, so take them back out of the ring,
+		// which the kernel has not read past, and fail them.
+		for (unsigned entry = tail - to_submit; entry != tail; ++entry) {
+			auto* operation = reinterpret_cast<Operation*>(Uring.Sqes[entry & Uring.SqMask].user_data);
+			InRing.erase(operation);
+			failed.push_back({ operation, { operation->Bytes, error } });
+		}
+		std::atomic_ref<unsigned>(*Uring.SqTail).store(tail - to_submit, std::memory_order_release);
+		InFlight -= to_submit;
+		Unsubmitted = 0;
+	}
+
+	// Fails every read in the ring or waiting for it, after an error that
+	// leaves the ring unusable, and every read submitted later.
+	void Drain(int error) {
+		std::vector<Completion> failed;
+		{
+			std::lock_guard lock(Mutex);
+			Broken = error;
+			for (auto* operation : InRing) {
+				failed.push_back({ operation, { operation->Bytes, error } });
+			}
+			for (auto* operation : Pending) {
+				failed.push_back({ operation, { operation->Bytes, error } });
+			}
+			InRing.clear();
+			Pending.clear();
+			InFlight = 0;
+			Unsubmitted = 0;
+		}
+		for (auto& [operation, result] : failed) {
+			Complete(operation, result);
+		}
+	}
+
+	// Queues a no-op that tells the completion thread to stop. Called with
+	// Mutex held once every read has completed.
+	void SubmitStop() {
+		unsigned tail = *Uring.SqTail;
+		unsigned index = tail & Uring.SqMask;
+		auto& sqe = Uring.Sqes[index];
+		std::memset(&sqe, 0, sizeof(sqe));
+		sqe.opcode = IORING_OP_NOP;
+		sqe.user_data = 0;
+		Uring.SqArray[index] = index;
+		std::atomic_ref<unsigned>(*Uring.SqTail).store(tail + 1, std::memory_order_release);
+		Uring.Enter(Unsubmitted + 1, 0, 0);
+		Unsubmitted = 0;
+	}
+
+	void CompletionLoop() {
+		std::vector<Completion> completed;
+		std::vector<Operation*> reaped;
+		std::vector<Operation*> resubmit;
+		for (;;) {
+			// Enter retries EINTR itself. EBUSY and EAGAIN mean the completion
+			// queue needs reaping, which happens below.
+			if (Uring.Enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EBUSY && errno != EAGAIN) {
+				Drain(errno);
+				return;
+			}
+			bool stop = false;
+			unsigned head = *Uring.CqHead;
+			unsigned tail = std::atomic_ref<unsigned>(*Uring.CqTail).load(std::memory_order_acquire);
+			for (; head != tail; ++head) {
+				const auto& cqe = Uring.Cqes[head & Uring.CqMask];
+				if (cqe.user_data == 0) {
+					stop = true;
+					continue;
+				}
+				auto* operation = reinterpret_cast<Operation*>(cqe.user_data);
+				reaped.push_back(operation);
+				size_t size = operation->Request.Buffer.size();
+				if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+					resubmit.push_back(operation);
+				}
+				else if (cqe.res < 0) {
+					completed.push_back({ operation, { operation->Bytes, -cqe.res } });
+				}
+				else {
+					// Reads end early at the end of the file, where the next
+					// read returns 0, or when interrupted; the rest is read
+					// like the Threads backend does.
+					operation->Bytes += static_cast<size_t>(cqe.res);
+					if (cqe.res > 0 && operation->Bytes < size) {
+						resubmit.push_back(operation);
+					}
+					else {
+						completed.push_back({ operation, { operation->Bytes, 0 } });
+					}
+				}
+			}
+			std::atomic_ref<unsigned>(*Uring.CqHead).store(head, std::memory_order_release);
+
+			{
+				std::lock_guard lock(Mutex);
+				InFlight -= static_cast<uint32_t>(reaped.size());
+				for (auto* operation : reaped) {
+					InRing.erase(operation);
+				}
+				// The rest of a short read goes ahead of reads not yet started.
+				Pending.insert(Pending.begin(), resubmit.begin(), resubmit.end());
+				FlushRing(completed);
+			}
+			for (auto& [operation, result] : completed) {
+				Complete(operation, result);
+			}
+			completed.clear();
+			reaped.clear();
+			resubmit.clear();
+			if (stop) {
+				return;
+			}
+		}
+	}
+#endif
+};
+
+AsyncReader::AsyncReader(ReadBackend preferred, uint32_t queue_depth)
+	: Impl(std::make_unique<State>()) {
+	Impl->QueueDepth = std::max(queue_depth, 1u);
+#ifdef __linux__
+	if (preferred == ReadBackend::IoUring && Impl->Uring.Setup(Impl->QueueDepth)) {
+		Impl->Backend = ReadBackend::IoUring;
+		Impl->Threads.emplace_back([state = Impl.get()]() { state->CompletionLoop(); });
+		return;
+	}
+#else
+	(void)preferred;
+#endif
+	// Each worker blocks on one read at a time.
+	uint32_t workers = std::min(Impl->QueueDepth, 16u);
+	for (uint32_t i = 0; i < workers; ++i) {
+		Impl->Threads.emplace_back([state = Impl.get()]() { state->WorkerLoop(); });
+	}
+}
+
+AsyncReader::~AsyncReader() {
+	Wait();
+	{
+		std::lock_guard lock(Impl->Mutex);
+		Impl->Stopping = true;
+#ifdef __linux__
+		if (Impl->Backend == ReadBackend::IoUring) {
+			Impl->SubmitStop();
+		}
+#endif
+	}
+	Impl->WorkQueued.notify_all();
+	for (auto& thread : Impl->Threads) {
+		thread.join();
+	}
+}
+
+void AsyncReader::Submit(std::vector<ReadRequest> requests) {
+	if (requests.empty()) {
+		return;
+	}
+#ifdef __linux__
+	std::vector<Completion> failed;
+#endif
+	{
+		std::lock_guard lock(Impl->Mutex);
+		for (auto& request : requests) {
+			Impl->Pending.push_back(new Operation{ std::move(request) });
+		}
+		Impl->Outstanding += requests.size();
+#ifdef __linux__
+		if (Impl->Backend == ReadBackend::IoUring) {
+			if (Impl->Broken != 0) {
+				for (auto* operation : Impl->Pending) {
+					failed.push_back({ operation, { 0, Impl->Broken } });
+				}
+				Impl->Pending.clear();
+			}
+			else {
+				Impl->FlushRing(failed);
+			}
+		}
+#endif
+	}
+#ifdef __linux__
+	if (Impl->Backend == ReadBackend::IoUring) {
+		for (auto& [operation, result] : failed) {
+			Impl->Complete(operation, result);
+		}
+		return;
+	}
+#endif
+	Impl->WorkQueued.notify_all();
+}
+
+std::future<ReadResult> AsyncReader::Read(const ReadableFile& file, uint64_t offset, std::span<std::byte> buffer) {
+	auto promise = std::make_shared<std::promise<ReadResult>>();
+	auto future = promise->get_future();
+	std::vector<ReadRequest> requests;
+	requests.push_back({ &file, offset, buffer, [promise](const ReadResult& result) { promise->set_value(result); } });
+	Submit(std::move(requests));
+	return future;
+}
+
+void AsyncReader::Wait() {
+	std::unique_lock lock(Impl->Mutex);
+	Impl->Idle.wait(lock, [&]() { return Impl->Outstanding == 0; });
+}
+
+ReadBackend AsyncReader::Backend() const {
+	return Impl->Backend;
+}
@@ -0,0 +1,126 @@
+﻿#pragma once
+
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+// Direct reads need offsets, sizes and buffer addresses that are multiples of
+// this, the largest logical block size of common devices.
+constexpr size_t DIRECT_READ_ALIGNMENT = 4096;
+
+// A file opened for AsyncReader. Move-only, closed on destruction.
+struct ReadableFile {
+	uint64_t Size = 0;
+	// Reads bypass the page cache: O_DIRECT on Linux, F_NOCACHE on macOS and
+	// FILE_FLAG_NO_BUFFERING on Windows.
+	bool Direct = false;
+
+	ReadableFile() = default;
+	ReadableFile(ReadableFile&& other) noexcept;
+	ReadableFile& operator=(ReadableFile&& other) noexcept;
+	ReadableFile(const ReadableFile&) = delete;
+	ReadableFile& operator=(const ReadableFile&) = delete;
+	~ReadableFile();
+
+private:
+	friend std::optional<ReadableFile> OpenReadable(const std::filesystem::path& path, bool direct, std::string* error);
+	friend struct AsyncReader;
+
+	void Close();
+
+#ifdef _WIN32
+	void* Handle = nullptr;
+#else
+	int Descriptor = -1;
+#endif
+};
+
+// Opens the file, or returns nullopt with the reason in error. Direct reads
+// are refused by some file systems, such as tmpfs.
+std::optional<ReadableFile> OpenReadable(const std::filesystem::path& path, bool direct = false, std::string* error = nullptr);
+
+// Heap memory at a multiple of DIRECT_READ_ALIGNMENT, its size rounded up to
+// one. Move-only.
+struct AlignedBuffer {
+	std::byte* Data = nullptr;
+	size_t Size = 0;
+
+	AlignedBuffer() = default;
+	explicit AlignedBuffer(size_t size);
+	AlignedBuffer(AlignedBuffer&& other) noexcept;
+	AlignedBuffer& operator=(AlignedBuffer&& other) noexcept;
+	AlignedBuffer(const AlignedBuffer&) = delete;
+	AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+	~AlignedBuffer();
+
+	std::span<std::byte> Bytes() const {
+		return { Data, Size };
+	}
+};
+
+// The range widened outwards to multiples of DIRECT_READ_ALIGNMENT, such as a
+// mesh Range to read directly. Meshes baked with --page-align start aligned.
+ByteRange DirectReadRange(ByteRange range);
+
+struct ReadResult {
+	// Less than requested only at the end of the file or with Error set.
+	size_t Bytes = 0;
+	// 0, or the errno or Windows error code of a failed read.
+	int Error = 0;
+};
+
+struct ReadRequest {
+	const ReadableFile* File = nullptr;
+	uint64_t Offset = 0;
+	std::span<std::byte> Buffer;
+	// Called once on a thread of the reader when the read completes. Keep it
+	// short; it holds up other completions.
+	std::function<void(const ReadResult&)> Done;
+};
+
+enum class ReadBackend {
+	// One io_uring per reader on Linux. A batch of reads costs one system
+	// call, and a single thread reaps the completions.
+	IoUring,
+	// Worker threads issuing blocking positional reads.
+	Threads,
+};
+
+// Reads many ranges of many files concurrently without blocking the caller.
+// At most queue_depth reads are in flight; the rest wait in the reader and
+// are issued as earlier reads complete. Falls back to Threads where io_uring
+// is missing or disabled, and always on other systems.
+struct AsyncReader {
+	explicit AsyncReader(ReadBackend preferred = ReadBackend::IoUring, uint32_t queue_depth = 256);
+	AsyncReader(const AsyncReader&) = delete;
+	AsyncReader& operator=(const AsyncReader&) = delete;
+	// Waits for every read to complete.
+	~AsyncReader();
+
+	// Queues the reads and returns at once. Files and buffers must stay valid
+	// until each read completes.
+	void Submit(std::vector<ReadRequest> requests);
+
+	// One read, completed through a future instead of a callback.
+	std::future<ReadResult> Read(const ReadableFile& file, uint64_t offset, std::span<std::byte> buffer);
+
+	// Blocks until every submitted read has completed. Must not be called
+	// from a Done callback.
+	void Wait();
+
+	ReadBackend Backend() const;
+
+	struct State;
+
+private:
+	std::unique_ptr<State> Impl;
+};
@@ -0,0 +1,215 @@
+﻿#pragma once
+
+#include <cstdint>
+
+// Layout of the data BakeModel writes to the .bin, shared by the writer and
+// BakeLoader. Every stream starts at a multiple of four bytes.
+
+// With --page-align the data of every mesh starts at a multiple of this, the
+// smallest page size of the platforms the loader runs on.
+constexpr uint32_t BAKE_PAGE_SIZE = 4096;
+
+// One vertex of the interleaved vertex stream.
+struct Vertex {
+	float Position[3];
+	float Normal[3];
+	float TexCoords[2];
+};
+static_assert(sizeof(Vertex) == 32, "The .bin stores 32-byte vertices");
+
+// One entry of the position stream, which holds the positions of the vertex
+// stream again, or once per distinct position when welded.
+struct VertexPosition {
+	float X;
+	float Y;
+	float Z;
+};
+static_assert(sizeof(VertexPosition) == 12);
+
+// One entry of the LightmapUV stream.
+struct LightmapTexCoord {
+	float U;
+	float V;
+};
+
+// The .bkm holds the same manifest as the .json in a form that is used in
+// place once mapped: a BakeManifestHeader, MeshCount BakeMeshRecords,
+// LevelCount BakeLevelRecords, the field table and the string table, each
+// starting at a multiple of eight.
+constexpr char BAKE_MANIFEST_MAGIC[4] = { 'B', 'K', 'M', '1' };
+constexpr uint32_t BAKE_MANIFEST_VERSION = 4;
+
+// Offsets, sizes and hashes of streams and sections the mesh was baked
+// without.
+constexpr uint64_t BAKE_ABSENT = UINT64_MAX;
+
+struct BakeManifestHeader {
+	char Magic[4];
+	uint32_t Version;
+	uint32_t MeshCount;
+	// The first ModelFieldCount entries of the field table are the top-level
+	// fields; the fields of each mesh follow.
+	uint32_t ModelFieldCount;
+	uint32_t FieldCount;
+	uint32_t StringTableSize;
+	// The coarse levels of all meshes, those of each mesh next to each other.
+	uint32_t LevelCount;
+	uint32_t Reserved;
+	uint64_t MeshTableOffset;
+	uint64_t LevelTableOffset;
+	uint64_t FieldTableOffset;
+	uint64_t StringTableOffset;
+};
+static_assert(sizeof(BakeManifestHeader) == 64);
+
+// The offsets and counts the loader needs to view the streams and sections
+// of a mesh in the .bin. Each member is the manifest field of the same name.
+struct BakeMeshRecord {
+	uint64_t VertexOffset;
+	uint64_t VertexCount;
+	uint64_t IndexOffset;
+	uint64_t IndexCount;
+	uint64_t LightmapUVOffset;
+	uint64_t VertexAOOffset;
+	uint64_t BvhOffset;
+	uint64_t BvhSize;
+	uint64_t SdfOffset;
+	uint64_t SdfSize;
+	uint64_t CollisionOffset;
+	uint64_t CollisionSize;
+	// PositionCount is VertexCount when the position stream pairs with the
+	// index stream. When welded it has one entry per distinct position and
+	// its own PositionIndex stream of IndexCount entries.
+	uint64_t PositionOffset;
+	uint64_t PositionCount;
+	uint64_t PositionIndexOffset;
+	// XXH64 of the bytes of each stream and section above, as the loader
+	// views them: VertexCount bytes of VertexAO, without the padding.
+	uint64_t VertexHash;
+	uint64_t IndexHash;
+	uint64_t LightmapUVHash;
+	uint64_t VertexAOHash;
+	uint64_t BvhHash;
+	uint64_t SdfHash;
+	uint64_t CollisionHash;
+	uint64_t PositionHash;
+	uint64_t PositionIndexHash;
+	// The coarse levels of a mesh baked with --progressive in the level
+	// table, coarsest first. LevelCount is the manifest field of that name.
+	uint32_t FirstLevel;
+	uint32_t LevelCount;
+	// The remaining fields of the mesh, such as texture names.
+	uint32_t FirstField;
+	uint32_t FieldCount;
+};
+static_assert(sizeof(BakeMeshRecord) == 208);
+
+// One coarse level of a mesh. Each member is the manifest field of the same
+// name after the Level<n> prefix of the level.
+struct BakeLevelRecord {
+	uint64_t IndexOffset;
+	uint64_t IndexCount;
+	uint64_t IndexHash;
+	uint64_t VertexCount;
+};
+static_assert(sizeof(BakeLevelRecord) == 32);
+
+// A manifest field without a member in BakeMeshRecord. Key and Value are
+// offsets of NUL-terminated strings in the string table, which starts with
+// the empty string.
+struct BakeManifestField {
+	uint32_t Key;
+	uint32_t Value;
+};
+
+// Manifest fields stored as BakeMeshRecord members instead of strings.
+struct BakeRecordField {
+	const char* Key;
+	uint64_t BakeMeshRecord::* Member;
+};
+
+inline constexpr BakeRecordField BAKE_RECORD_FIELDS[] = {
+	{ "VertexOffset", &BakeMeshRecord::VertexOffset },
+	{ "VertexCount", &BakeMeshRecord::VertexCount },
+	{ "IndexOffset", &BakeMeshRecord::IndexOffset },
+	{ "IndexCount", &BakeMeshRecord::IndexCount },
+	{ "LightmapUVOffset", &BakeMeshRecord::LightmapUVOffset },
+	{ "VertexAOOffset", &BakeMeshRecord::VertexAOOffset },
+	{ "BvhOffset", &BakeMeshRecord::BvhOffset },
+	{ "BvhSize", &BakeMeshRecord::BvhSize },
+	{ "SdfOffset", &BakeMeshRecord::SdfOffset },
+	{ "SdfSize", &BakeMeshRecord::SdfSize },
+	{ "CollisionOffset", &BakeMeshRecord::CollisionOffset },
+	{ "CollisionSize", &BakeMeshRecord::CollisionSize },
+	{ "PositionOffset", &BakeMeshRecord::PositionOffset },
+	{ "PositionCount", &BakeMeshRecord::PositionCount },
+	{ "PositionIndexOffset", &BakeMeshRecord::PositionIndexOffset },
+	{ "VertexHash", &BakeMeshRecord::VertexHash },
+	{ "IndexHash", &BakeMeshRecord::IndexHash },
+	{ "LightmapUVHash", &BakeMeshRecord::LightmapUVHash },
+	{ "VertexAOHash", &BakeMeshRecord::VertexAOHash },
+	{ "BvhHash", &BakeMeshRecord::BvhHash },
+	{ "SdfHash", &BakeMeshRecord::SdfHash },
+	{ "CollisionHash", &BakeMeshRecord::CollisionHash },
+	{ "PositionHash", &BakeMeshRecord::PositionHash },
+	{ "PositionIndexHash", &BakeMeshRecord::PositionIndexHash },
+};
+
+// Level<n> manifest fields stored as BakeLevelRecord members, by the key that
+// follows the prefix.
+struct BakeLevelField {
+	const char* Key;
+	uint64_t BakeLevelRecord::* Member;
+};
+
+inline constexpr BakeLevelField BAKE_LEVEL_FIELDS[] = {
+	{ "IndexOffset", &BakeLevelRecord::IndexOffset },
+	{ "IndexCount", &BakeLevelRecord::IndexCount },
+	{ "IndexHash", &BakeLevelRecord::IndexHash },
+	{ "VertexCount", &BakeLevelRecord::VertexCount },
+};
+
+// A pack holds the output of many models in one file: a BakePackHeader, the
+// blobs, then the model index sorted by name, the file and blob tables and a
+// string table, each table starting at a multiple of eight. Every model has a
+// .bkm and a .bin blob; its other files, such as textures, are listed by name.
+// Files with equal contents share one blob.
+constexpr char BAKE_PACK_MAGIC[4] = { 'B', 'K', 'P', '1' };
+constexpr uint32_t BAKE_PACK_VERSION = 1;
+
+// Blobs start at multiples of this, .bin blobs at multiples of BAKE_PAGE_SIZE
+// so that meshes baked with --page-align stay on their own pages.
+constexpr uint32_t BAKE_PACK_ALIGNMENT = 64;
+
+struct BakePackHeader {
+	char Magic[4];
+	uint32_t Version;
+	uint32_t ModelCount;
+	uint32_t FileCount;
+	uint32_t BlobCount;
+	uint32_t StringTableSize;
+	uint64_t ModelTableOffset;
+	uint64_t FileTableOffset;
+	uint64_t BlobTableOffset;
+	uint64_t StringTableOffset;
+};
+static_assert(sizeof(BakePackHeader) == 56);
+
+// Names are offsets into the string table, blobs indices into the blob table.
+struct BakePackModel {
+	uint32_t Name;
+	uint32_t Manifest;
+	uint32_t Bin;
+	uint32_t FirstFile;
+	uint32_t FileCount;
+};
+
+struct BakePackFile {
+	uint32_t Name;
+	uint32_t Blob;
+};
+
+struct BakePackBlob {
+	uint64_t Offset;
+	uint64_t Size;
+};
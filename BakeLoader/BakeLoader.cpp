@@ -0,0 +1,464 @@
+﻿#include "BakeLoader.h"
+
+#include "Hash.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// Points out at count elements of T at offset in the .bin. An absent offset
+// leaves out empty unless the stream is required.
+template <typename T>
+bool viewStream(const BakedModel& model, const char* offset_key, uint64_t offset, uint64_t count, bool required, std::span<const T>& out, std::string& error) {
+	if (offset == BAKE_ABSENT || count == BAKE_ABSENT) {
+		if (required || offset != BAKE_ABSENT) {
+			error = std::string("Missing or invalid ") + (offset != BAKE_ABSENT ? "count for " : "") + offset_key;
+			return false;
+		}
+		return true;
+	}
+	if (offset > model.Bin.size() || count > (model.Bin.size() - offset) / sizeof(T)) {
+		error = std::string(offset_key) + " lies outside the .bin";
+		return false;
+	}
+	if (offset % alignof(T) != 0) {
+		error = std::string(offset_key) + " is not aligned";
+		return false;
+	}
+	out = { reinterpret_cast<const T*>(model.Bin.data() + offset), static_cast<size_t>(count) };
+	return true;
+}
+
+// Grows range to cover the bytes of a non-empty span.
+template <typename T>
+void include(const BakedModel& model, std::span<const T> span, ByteRange& range) {
+	if (span.empty()) {
+		return;
+	}
+	size_t begin = static_cast<size_t>(reinterpret_cast<const std::byte*>(span.data()) - model.Bin.data());
+	size_t end = begin + span.size_bytes();
+	if (range.Size == 0) {
+		range = { begin, end - begin };
+		return;
+	}
+	size_t first = std::min(range.Offset, begin);
+	range = { first, std::max(range.Offset + range.Size, end) - first };
+}
+
+bool viewMesh(const BakedModel& model, const BakeMeshRecord& record, BakedMesh& mesh, std::string& error) {
+	// Either vertex stream will do for drawing.
+	bool has_positions = record.PositionOffset != BAKE_ABSENT;
+	bool viewed = viewStream(model, "VertexOffset", record.VertexOffset, record.VertexCount, !has_positions, mesh.Vertices, error)
+		&& viewStream(model, "IndexOffset", record.IndexOffset, record.IndexCount, true, mesh.Indices, error)
+		&& viewStream(model, "PositionOffset", record.PositionOffset, record.PositionCount, false, mesh.Positions, error)
+		&& viewStream(model, "PositionIndexOffset", record.PositionIndexOffset, record.IndexCount, false, mesh.PositionIndices, error)
+		&& viewStream(model, "LightmapUVOffset", record.LightmapUVOffset, record.VertexCount, false, mesh.LightmapUV, error)
+		&& viewStream(model, "VertexAOOffset", record.VertexAOOffset, record.VertexCount, false, mesh.VertexAO, error)
+		&& viewStream(model, "BvhOffset", record.BvhOffset, record.BvhSize, false, mesh.Bvh, error)
+		&& viewStream(model, "SdfOffset", record.SdfOffset, record.SdfSize, false, mesh.Sdf, error)
+		&& viewStream(model, "CollisionOffset", record.CollisionOffset, record.CollisionSize, false, mesh.Collision, error);
+	if (!viewed) {
+		return false;
+	}
+	mesh.Record = record;
+	include(model, mesh.Vertices, mesh.Range);
+	include(model, mesh.Indices, mesh.Range);
+	include(model, mesh.Positions, mesh.Range);
+	include(model, mesh.PositionIndices, mesh.Range);
+	include(model, mesh.LightmapUV, mesh.Range);
+	include(model, mesh.VertexAO, mesh.Range);
+	include(model, mesh.Bvh, mesh.Range);
+	include(model, mesh.Sdf, mesh.Range);
+	include(model, mesh.Collision, mesh.Range);
+	return true;
+}
+
+// Views the coarse levels of the mesh's record. The indices of the levels
+// come first in the mesh, so each level spans the start of the mesh up to the
+// end of its indices or its last vertex.
+bool viewLevels(const BakedModel& model, std::span<const BakeLevelRecord> levels, BakedMesh& mesh, std::string& error) {
+	const auto& record = mesh.Record;
+	if (record.LevelCount == 0) {
+		return true;
+	}
+	if (mesh.Vertices.empty()) {
+		error = "Levels without a vertex stream";
+		return false;
+	}
+	for (uint32_t i = 0; i < record.LevelCount; ++i) {
+		auto prefix = "Level" + std::to_string(i);
+		auto offset_key = prefix + "IndexOffset";
+		BakedLevel level;
+		level.Record = levels[record.FirstLevel + i];
+		if (!viewStream(model, offset_key.c_str(), level.Record.IndexOffset, level.Record.IndexCount, true, level.Indices, error)) {
+			return false;
+		}
+		if (level.Record.VertexCount > mesh.Vertices.size()) {
+			error = "Missing or invalid " + prefix + "VertexCount";
+			return false;
+		}
+		level.VertexCount = static_cast<uint32_t>(level.Record.VertexCount);
+		include(model, level.Indices, mesh.Range);
+		mesh.Levels.push_back(level);
+	}
+	for (auto& level : mesh.Levels) {
+		auto end = [&](auto span) {
+			return static_cast<size_t>(reinterpret_cast<const std::byte*>(span.data() + span.size()) - model.Bin.data());
+		};
+		size_t last = std::max(end(level.Indices), end(mesh.Vertices.first(level.VertexCount)));
+		level.Range = { mesh.Range.Offset, last - mesh.Range.Offset };
+	}
+	return true;
+}
+
+// The records the .bkm would hold for a mesh of the .json, its levels
+// appended to levels.
+bool jsonRecord(const ManifestFields& fields, BakeMeshRecord& record, std::vector<BakeLevelRecord>& levels, std::string& error) {
+	record = {};
+	for (const auto& field : BAKE_RECORD_FIELDS) {
+		record.*field.Member = ManifestInteger(fields, field.Key).value_or(BAKE_ABSENT);
+	}
+	auto level_count = ManifestInteger(fields, "LevelCount").value_or(0);
+	// Every level has fields of its own, so there cannot be more of them.
+	if (level_count > fields.size()) {
+		error = "Invalid LevelCount";
+		return false;
+	}
+	record.FirstLevel = static_cast<uint32_t>(levels.size());
+	record.LevelCount = static_cast<uint32_t>(level_count);
+	for (uint64_t n = 0; n < level_count; ++n) {
+		BakeLevelRecord level;
+		for (const auto& field : BAKE_LEVEL_FIELDS) {
+			level.*field.Member = ManifestInteger(fields, "Level" + std::to_string(n) + field.Key).value_or(BAKE_ABSENT);
+		}
+		levels.push_back(level);
+	}
+	return true;
+}
+
+bool loadJsonManifest(const std::filesystem::path& manifest_path, BakedModel& model, std::vector<BakeMeshRecord>& records, std::vector<BakeLevelRecord>& levels, std::string& error) {
+	std::ifstream json_in(manifest_path, std::ios::binary);
+	if (!json_in) {
+		error = "Failed to open " + manifest_path.string();
+		return false;
+	}
+	std::string text((std::istreambuf_iterator<char>(json_in)), std::istreambuf_iterator<char>());
+	auto manifest = ParseManifest(text, &error);
+	if (!manifest) {
+		error = manifest_path.string() + ": " + error;
+		return false;
+	}
+	model.Json = std::make_unique<Manifest>(std::move(manifest.value()));
+	model.Fields.Json = &model.Json->Fields;
+	model.Meshes.resize(model.Json->Meshes.size());
+	records.resize(model.Meshes.size());
+	for (size_t i = 0; i < model.Meshes.size(); ++i) {
+		if (!jsonRecord(model.Json->Meshes[i], records[i], levels, error)) {
+			error = manifest_path.string() + ": Mesh " + std::to_string(i) + ": " + error;
+			return false;
+		}
+		model.Meshes[i].Fields.Json = &model.Json->Meshes[i];
+	}
+	return true;
+}
+
+// Whether count elements of T at offset lie inside a file of size bytes.
+template <typename T>
+bool tableFits(uint64_t offset, uint64_t count, size_t size) {
+	return offset % alignof(T) == 0 && offset <= size && count <= (size - offset) / sizeof(T);
+}
+
+// Checks the tables of a .bkm, so that later lookups need no bounds checks,
+// and points the fields and records of the model at them.
+bool viewBinaryManifest(std::span<const std::byte> file, BakedModel& model, std::span<const BakeMeshRecord>& records, std::span<const BakeLevelRecord>& levels, std::string& error) {
+	BakeManifestHeader header;
+	if (file.size() < sizeof(header)) {
+		error = "Truncated header";
+		return false;
+	}
+	std::memcpy(&header, file.data(), sizeof(header));
+	if (std::memcmp(header.Magic, BAKE_MANIFEST_MAGIC, sizeof(header.Magic)) != 0 || header.Version != BAKE_MANIFEST_VERSION) {
+		error = "Not a version " + std::to_string(BAKE_MANIFEST_VERSION) + " binary manifest";
+		return false;
+	}
+	if (reinterpret_cast<uintptr_t>(file.data()) % alignof(BakeMeshRecord) != 0
+		|| !tableFits<BakeMeshRecord>(header.MeshTableOffset, header.MeshCount, file.size())
+		|| !tableFits<BakeLevelRecord>(header.LevelTableOffset, header.LevelCount, file.size())
+		|| !tableFits<BakeManifestField>(header.FieldTableOffset, header.FieldCount, file.size())
+		|| !tableFits<char>(header.StringTableOffset, header.StringTableSize, file.size())
+		|| header.ModelFieldCount > header.FieldCount) {
+		error = "A table lies outside the file";
+		return false;
+	}
+	const char* strings = reinterpret_cast<const char*>(file.data() + header.StringTableOffset);
+	if (header.StringTableSize == 0 || strings[header.StringTableSize - 1] != '\0') {
+		error = "The string table is not terminated";
+		return false;
+	}
+	std::span<const BakeManifestField> fields(reinterpret_cast<const BakeManifestField*>(file.data() + header.FieldTableOffset), header.FieldCount);
+	for (const auto& field : fields) {
+		if (field.Key >= header.StringTableSize || field.Value >= header.StringTableSize) {
+			error = "A field lies outside the string table";
+			return false;
+		}
+	}
+	records = { reinterpret_cast<const BakeMeshRecord*>(file.data() + header.MeshTableOffset), header.MeshCount };
+	for (const auto& record : records) {
+		if (record.FirstField > header.FieldCount || record.FieldCount > header.FieldCount - record.FirstField) {
+			error = "A mesh lists fields outside the field table";
+			return false;
+		}
+		if (record.FirstLevel > header.LevelCount || record.LevelCount > header.LevelCount - record.FirstLevel) {
+			error = "A mesh lists levels outside the level table";
+			return false;
+		}
+	}
+	levels = { reinterpret_cast<const BakeLevelRecord*>(file.data() + header.LevelTableOffset), header.LevelCount };
+
+	model.Fields = { nullptr, fields.first(header.ModelFieldCount), strings };
+	model.Meshes.resize(records.size());
+	for (size_t i = 0; i < records.size(); ++i) {
+		model.Meshes[i].Fields = { nullptr, fields.subspan(records[i].FirstField, records[i].FieldCount), strings };
+	}
+	return true;
+}
+
+bool viewMeshes(BakedModel& model, std::span<const BakeMeshRecord> records, std::span<const BakeLevelRecord> levels, std::string& error) {
+	for (size_t i = 0; i < model.Meshes.size(); ++i) {
+		if (!viewMesh(model, records[i], model.Meshes[i], error) || !viewLevels(model, levels, model.Meshes[i], error)) {
+			error = "Mesh " + std::to_string(i) + ": " + error;
+			return false;
+		}
+	}
+	return true;
+}
+
+// A stream or section of a mesh as placed in the .bin, with its hash.
+struct MeshSection {
+	std::string Name;
+	uint64_t Offset;
+	uint64_t Size;
+	uint64_t Hash;
+};
+
+std::vector<MeshSection> meshSections(const BakedMesh& mesh) {
+	const auto& record = mesh.Record;
+	std::vector<MeshSection> sections = {
+		{ "Vertex", record.VertexOffset, mesh.Vertices.size_bytes(), record.VertexHash },
+		{ "Index", record.IndexOffset, mesh.Indices.size_bytes(), record.IndexHash },
+		{ "LightmapUV", record.LightmapUVOffset, mesh.LightmapUV.size_bytes(), record.LightmapUVHash },
+		{ "VertexAO", record.VertexAOOffset, mesh.VertexAO.size_bytes(), record.VertexAOHash },
+		{ "Bvh", record.BvhOffset, mesh.Bvh.size_bytes(), record.BvhHash },
+		{ "Sdf", record.SdfOffset, mesh.Sdf.size_bytes(), record.SdfHash },
+		{ "Collision", record.CollisionOffset, mesh.Collision.size_bytes(), record.CollisionHash },
+		{ "Position", record.PositionOffset, mesh.Positions.size_bytes(), record.PositionHash },
+		{ "PositionIndex", record.PositionIndexOffset, mesh.PositionIndices.size_bytes(), record.PositionIndexHash },
+	};
+	for (size_t i = 0; i < mesh.Levels.size(); ++i) {
+		const auto& level = mesh.Levels[i].Record;
+		sections.push_back({ "Level" + std::to_string(i) + "Index", level.IndexOffset, mesh.Levels[i].Indices.size_bytes(), level.IndexHash });
+	}
+	return sections;
+}
+
+bool checked(const MeshSection& section) {
+	return section.Offset != BAKE_ABSENT && section.Hash != BAKE_ABSENT;
+}
+
+std::string damaged(size_t mesh, const MeshSection& section) {
+	return "Mesh " + std::to_string(mesh) + ": " + section.Name + " data does not match its hash";
+}
+
+std::optional<BakedModel> failed(std::string& message, std::string* error) {
+	if (error) {
+		*error = std::move(message);
+	}
+	return std::nullopt;
+}
+
+bool rejected(std::string message, std::string* error) {
+	if (error) {
+		*error = std::move(message);
+	}
+	return false;
+}
+
+}
+
+std::optional<std::string_view> ManifestView::Find(std::string_view key) const {
+	if (Json) {
+		auto found = Json->find(key);
+		if (found == Json->end()) {
+			return std::nullopt;
+		}
+		return found->second;
+	}
+	for (const auto& field : Binary) {
+		if (key == Strings + field.Key) {
+			return Strings + field.Value;
+		}
+	}
+	return std::nullopt;
+}
+
+std::optional<BakedModel> LoadBakedModel(const std::filesystem::path& manifest_path, std::string* error) {
+	std::string message;
+	BakedModel model;
+	std::vector<BakeMeshRecord> json_records;
+	std::vector<BakeLevelRecord> json_levels;
+	std::span<const BakeMeshRecord> records;
+	std::span<const BakeLevelRecord> levels;
+	if (manifest_path.extension() == ".bkm") {
+		auto mapped = MapFile(manifest_path, &message);
+		if (!mapped) {
+			return failed(message, error);
+		}
+		model.ManifestMapping = std::make_shared<const MappedFile>(std::move(mapped.value()));
+		if (!viewBinaryManifest(model.ManifestMapping->Bytes(), model, records, levels, message)) {
+			message = manifest_path.string() + ": " + message;
+			return failed(message, error);
+		}
+	}
+	else {
+		if (!loadJsonManifest(manifest_path, model, json_records, json_levels, message)) {
+			return failed(message, error);
+		}
+		records = json_records;
+		levels = json_levels;
+	}
+
+	auto bin_path = manifest_path;
+	bin_path.replace_extension(".bin");
+	auto bin = MapFile(bin_path, &message);
+	if (!bin) {
+		return failed(message, error);
+	}
+	model.BinMapping = std::make_shared<const MappedFile>(std::move(bin.value()));
+	model.Bin = model.BinMapping->Bytes();
+
+	if (!viewMeshes(model, records, levels, message)) {
+		return failed(message, error);
+	}
+	return model;
+}
+
+std::optional<BakedModel> LoadPackedModel(const BakePack& pack, std::string_view name, std::string* error) {
+	std::string message;
+	const auto* entry = pack.Find(name);
+	if (!entry) {
+		message = "No model named " + std::string(name) + " in the pack";
+		return failed(message, error);
+	}
+	BakedModel model;
+	std::span<const BakeMeshRecord> records;
+	std::span<const BakeLevelRecord> levels;
+	model.ManifestMapping = pack.File;
+	if (!viewBinaryManifest(pack.Blob(entry->Manifest), model, records, levels, message)) {
+		message = std::string(name) + ".bkm: " + message;
+		return failed(message, error);
+	}
+	model.BinMapping = pack.File;
+	model.Bin = pack.Blob(entry->Bin);
+	if (!viewMeshes(model, records, levels, message)) {
+		message = std::string(name) + ": " + message;
+		return failed(message, error);
+	}
+	return model;
+}
+
+void PrefetchMeshes(const BakedModel& model, std::span<const size_t> meshes) {
+	// Ranges are relative to the .bin, which a pack holds at an offset.
+	size_t base = static_cast<size_t>(model.Bin.data() - model.BinMapping->Data);
+	std::vector<ByteRange> ranges;
+	for (auto index : meshes) {
+		if (index < model.Meshes.size()) {
+			ranges.push_back({ base + model.Meshes[index].Range.Offset, model.Meshes[index].Range.Size });
+		}
+	}
+	model.BinMapping->Prefetch(ranges);
+}
+
+bool VerifyMeshes(const BakedModel& model, std::span<const size_t> meshes, std::string* error, unsigned threads) {
+	struct Job {
+		size_t Mesh;
+		MeshSection Section;
+	};
+	std::vector<Job> jobs;
+	for (auto index : meshes) {
+		if (index >= model.Meshes.size()) {
+			continue;
+		}
+		for (const auto& section : meshSections(model.Meshes[index])) {
+			if (checked(section)) {
+				jobs.push_back({ index, section });
+			}
+		}
+	}
+	if (jobs.empty()) {
+		return true;
+	}
+	PrefetchMeshes(model, meshes);
+
+	// Sections differ in size by orders of magnitude, so workers take the
+	// next one as they finish rather than a fixed share.
+	std::atomic<size_t> next = 0;
+	std::mutex mutex;
+	std::string message;
+	auto work = [&] {
+		for (size_t i = next++; i < jobs.size(); i = next++) {
+			const auto& job = jobs[i];
+			auto bytes = model.Bin.subspan(static_cast<size_t>(job.Section.Offset), static_cast<size_t>(job.Section.Size));
+			if (Xxh64(bytes) != job.Section.Hash) {
+				std::lock_guard lock(mutex);
+				if (message.empty()) {
+					message = damaged(job.Mesh, job.Section);
+				}
+			}
+		}
+	};
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	std::vector<std::thread> workers;
+	for (size_t i = 1; i < std::min<size_t>(threads, jobs.size()); ++i) {
+		workers.emplace_back(work);
+	}
+	work();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+	if (!message.empty()) {
+		return rejected(std::move(message), error);
+	}
+	return true;
+}
+
+bool VerifyMeshData(const BakedMesh& mesh, std::span<const std::byte> data, uint64_t data_offset, std::string* error) {
+	for (const auto& section : meshSections(mesh)) {
+		if (!checked(section)) {
+			continue;
+		}
+		if (section.Offset < data_offset || section.Offset - data_offset > data.size() || section.Size > data.size() - (section.Offset - data_offset)) {
+			return rejected(std::string(section.Name) + " data lies outside the bytes read", error);
+		}
+		if (Xxh64(data.subspan(static_cast<size_t>(section.Offset - data_offset), static_cast<size_t>(section.Size))) != section.Hash) {
+			return rejected(std::string(section.Name) + " data does not match its hash", error);
+		}
+	}
+	return true;
+}
+
+bool VerifyTexture(const ManifestView& fields, std::string_view texture_key, std::span<const std::byte> contents) {
+	auto text = fields.Find(std::string(texture_key) + "Hash");
+	if (!text) {
+		return true;
+	}
+	auto hash = ParseManifestInteger(*text);
+	return hash && Xxh64(contents) == hash.value();
+}
@@ -0,0 +1,120 @@
+﻿#pragma once
+
+#include "BakeFormat.h"
+#include "BakePack.h"
+#include "Manifest.h"
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// String fields of a manifest, in whichever form the model was loaded from.
+struct ManifestView {
+	const ManifestFields* Json = nullptr;
+	std::span<const BakeManifestField> Binary;
+	const char* Strings = nullptr;
+
+	// The value of key, or nullopt when the field is missing. The view stays
+	// valid as long as the BakedModel.
+	std::optional<std::string_view> Find(std::string_view key) const;
+};
+
+// A coarse level of a mesh baked with --progressive.
+struct BakedLevel {
+	// Triangles over the first VertexCount vertices of the mesh, and of its
+	// LightmapUV and VertexAO streams when present.
+	std::span<const uint32_t> Indices;
+	uint32_t VertexCount = 0;
+	// Bytes of the .bin that hold the level, a prefix of the mesh's Range, so
+	// that a streaming loader can draw the level before reading the rest.
+	ByteRange Range;
+	// Offset, count and hash of the indices, and the vertex count.
+	BakeLevelRecord Record = {};
+};
+
+// One mesh of a loaded model. The spans point into the mapped .bin and stay
+// valid as long as the BakedModel they came from.
+struct BakedMesh {
+	// Empty when the model was baked with --positions-only.
+	std::span<const Vertex> Vertices;
+	std::span<const uint32_t> Indices;
+	// Positions alone, for passes that need nothing else. They pair with
+	// Indices, or with PositionIndices when welded. Empty when the model was
+	// baked without --positions.
+	std::span<const VertexPosition> Positions;
+	std::span<const uint32_t> PositionIndices;
+	// Empty when the model was baked without the stream or section.
+	std::span<const LightmapTexCoord> LightmapUV;
+	std::span<const uint8_t> VertexAO;
+	// Sections in the layouts described in Bvh.h, DistanceField.h and
+	// Collision.h of BakeModel.
+	std::span<const std::byte> Bvh;
+	std::span<const std::byte> Sdf;
+	std::span<const std::byte> Collision;
+	// Coarse levels, coarsest first. Empty unless baked with --progressive.
+	std::vector<BakedLevel> Levels;
+	// Bytes of the .bin spanned by the streams, sections and levels above.
+	ByteRange Range;
+	// The manifest fields of the mesh that have no member above, such as
+	// texture names.
+	ManifestView Fields;
+	// Offsets, sizes and hashes of the streams and sections above.
+	BakeMeshRecord Record;
+};
+
+struct BakedModel {
+	// The bytes of the .bin and the mapping holding them: the model's own, or
+	// the pack's for a model loaded from a pack.
+	std::span<const std::byte> Bin;
+	std::shared_ptr<const MappedFile> BinMapping;
+	// The manifest the model was loaded from: parsed into Json from a .json,
+	// or used in place from a .bkm held by ManifestMapping. Json is held by
+	// pointer so that the views into it survive moving the model.
+	std::unique_ptr<Manifest> Json;
+	std::shared_ptr<const MappedFile> ManifestMapping;
+	// Top-level fields other than MeshCount.
+	ManifestView Fields;
+	std::vector<BakedMesh> Meshes;
+};
+
+// Reads the manifest at manifest_path and maps the <name>.bin next to it.
+// A .json is parsed; a .bkm is mapped and its mesh records used as they are,
+// which makes opening many models cheap. Mesh data is faulted in when first
+// touched. Returns nullopt with the reason in error when a file is missing,
+// the manifest is malformed, or a stream lies outside the .bin or is
+// misaligned for its type.
+std::optional<BakedModel> LoadBakedModel(const std::filesystem::path& manifest_path, std::string* error = nullptr);
+
+// Loads the model of the given name from the pack, with the same checks as
+// LoadBakedModel. Nothing is mapped or read beyond the .bkm of the model; the
+// model shares the mapping of the pack and keeps it alive.
+std::optional<BakedModel> LoadPackedModel(const BakePack& pack, std::string_view name, std::string* error = nullptr);
+
+// Starts reading the data of the given meshes in the background, so that a
+// streaming system can request geometry before it is drawn. Meshes baked
+// with --page-align share no pages, so this reads nothing of other meshes.
+void PrefetchMeshes(const BakedModel& model, std::span<const size_t> meshes);
+
+// Checks the streams and sections of the given meshes against the hashes in
+// the manifest, hashing them on threads (all cores when 0) after prefetching
+// them. Sections without a recorded hash, as in manifests from before hashes
+// were written, are not checked. Returns false with the damaged mesh and
+// section in error.
+bool VerifyMeshes(const BakedModel& model, std::span<const size_t> meshes, std::string* error = nullptr, unsigned threads = 0);
+
+// Checks the mesh against bytes of its .bin read some other way, such as
+// through AsyncReader, where data holds the bytes from data_offset on. data
+// must cover mesh.Range.
+bool VerifyMeshData(const BakedMesh& mesh, std::span<const std::byte> data, uint64_t data_offset, std::string* error = nullptr);
+
+// Checks the contents of the texture named by the field texture_key, such as
+// "BaseColorTexture", against the <texture_key>Hash field next to it. A texture
+// without a recorded hash passes.
+bool VerifyTexture(const ManifestView& fields, std::string_view texture_key, std::span<const std::byte> contents);
@@ -0,0 +1,107 @@
+﻿#include "BakePack.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+template <typename T>
+bool tableFits(uint64_t offset, uint64_t count, size_t size) {
+	return offset % alignof(T) == 0 && offset <= size && count <= (size - offset) / sizeof(T);
+}
+
+template <typename T>
+std::span<const T> table(const MappedFile& file, uint64_t offset, uint32_t count) {
+	return { reinterpret_cast<const T*>(file.Data + offset), count };
+}
+
+}
+
+std::string_view BakePack::Name(const BakePackModel& model) const {
+	return Strings + model.Name;
+}
+
+const BakePackModel* BakePack::Find(std::string_view name) const {
+	auto found = std::lower_bound(Models.begin(), Models.end(), name, [&](const BakePackModel& model, std::string_view key) {
+		return Name(model) < key;
+	});
+	if (found == Models.end() || Name(*found) != name) {
+		return nullptr;
+	}
+	return &*found;
+}
+
+std::span<const std::byte> BakePack::Blob(uint32_t index) const {
+	return File->Bytes().subspan(Blobs[index].Offset, Blobs[index].Size);
+}
+
+std::optional<std::span<const std::byte>> BakePack::FindFile(const BakePackModel& model, std::string_view file_name) const {
+	for (const auto& file : Files.subspan(model.FirstFile, model.FileCount)) {
+		if (file_name == Strings + file.Name) {
+			return Blob(file.Blob);
+		}
+	}
+	return std::nullopt;
+}
+
+std::optional<BakePack> OpenPack(const std::filesystem::path& path, std::string* error) {
+	std::string message;
+	auto fail = [&](std::string reason) -> std::optional<BakePack> {
+		if (error) {
+			*error = message.empty() ? path.string() + ": " + reason : std::move(message);
+		}
+		return std::nullopt;
+	};
+
+	auto mapped = MapFile(path, &message);
+	if (!mapped) {
+		return fail("");
+	}
+	BakePack pack;
+	pack.File = std::make_shared<const MappedFile>(std::move(mapped.value()));
+	const auto& file = *pack.File;
+
+	BakePackHeader header;
+	if (file.Size < sizeof(header)) {
+		return fail("Truncated header");
+	}
+	std::memcpy(&header, file.Data, sizeof(header));
+	if (std::memcmp(header.Magic, BAKE_PACK_MAGIC, sizeof(header.Magic)) != 0 || header.Version != BAKE_PACK_VERSION) {
+		return fail("Not a version " + std::to_string(BAKE_PACK_VERSION) + " pack");
+	}
+	if (!tableFits<BakePackModel>(header.ModelTableOffset, header.ModelCount, file.Size)
+		|| !tableFits<BakePackFile>(header.FileTableOffset, header.FileCount, file.Size)
+		|| !tableFits<BakePackBlob>(header.BlobTableOffset, header.BlobCount, file.Size)
+		|| !tableFits<char>(header.StringTableOffset, header.StringTableSize, file.Size)) {
+		return fail("A table lies outside the file");
+	}
+	pack.Models = table<BakePackModel>(file, header.ModelTableOffset, header.ModelCount);
+	pack.Files = table<BakePackFile>(file, header.FileTableOffset, header.FileCount);
+	pack.Blobs = table<BakePackBlob>(file, header.BlobTableOffset, header.BlobCount);
+	pack.Strings = reinterpret_cast<const char*>(file.Data + header.StringTableOffset);
+
+	if (header.StringTableSize == 0 || pack.Strings[header.StringTableSize - 1] != '\0') {
+		return fail("The string table is not terminated");
+	}
+	for (const auto& blob : pack.Blobs) {
+		if (blob.Offset > file.Size || blob.Size > file.Size - blob.Offset) {
+			return fail("A blob lies outside the file");
+		}
+	}
+	for (const auto& entry : pack.Files) {
+		if (entry.Name >= header.StringTableSize || entry.Blob >= header.BlobCount) {
+			return fail("A file entry is out of range");
+		}
+	}
+	for (size_t i = 0; i < pack.Models.size(); ++i) {
+		const auto& model = pack.Models[i];
+		if (model.Name >= header.StringTableSize || model.Manifest >= header.BlobCount || model.Bin >= header.BlobCount
+			|| model.FirstFile > header.FileCount || model.FileCount > header.FileCount - model.FirstFile) {
+			return fail("Model " + std::to_string(i) + " is out of range");
+		}
+		if (i > 0 && !(pack.Name(pack.Models[i - 1]) < pack.Name(model))) {
+			return fail("The model index is not sorted");
+		}
+	}
+	return pack;
+}
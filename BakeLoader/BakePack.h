@@ -0,0 +1,40 @@
+﻿#pragma once
+
+#include "BakeFormat.h"
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+// A pack written by BakeModel --pack, mapped whole. The tables are checked
+// once when it is opened and then used in place; blobs are only read when
+// touched. Load its models with LoadPackedModel.
+struct BakePack {
+	std::shared_ptr<const MappedFile> File;
+	// Sorted by name.
+	std::span<const BakePackModel> Models;
+	std::span<const BakePackFile> Files;
+	std::span<const BakePackBlob> Blobs;
+	const char* Strings = nullptr;
+
+	std::string_view Name(const BakePackModel& model) const;
+
+	// The model of the given name, or nullptr. A binary search of the index.
+	const BakePackModel* Find(std::string_view name) const;
+
+	std::span<const std::byte> Blob(uint32_t index) const;
+
+	// The contents of a file of the model, such as a texture named in its
+	// manifest, or nullopt when the model has no such file.
+	std::optional<std::span<const std::byte>> FindFile(const BakePackModel& model, std::string_view file_name) const;
+};
+
+// Maps the pack, or returns nullopt with the reason in error when the file is
+// missing or its tables are malformed.
+std::optional<BakePack> OpenPack(const std::filesystem::path& path, std::string* error = nullptr);
@@ -0,0 +1,80 @@
+﻿#include "Hash.h"
+
+#include <cstring>
+
+namespace {
+
+constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ull;
+constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4Full;
+constexpr uint64_t PRIME3 = 0x165667B19E3779F9ull;
+constexpr uint64_t PRIME4 = 0x85EBCA77C2B2AE63ull;
+constexpr uint64_t PRIME5 = 0x27D4EB2F165667C5ull;
+
+uint64_t rotate(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+// Words are read as little-endian, the byte order of every platform the
+// baker and loader run on.
+uint64_t read64(const std::byte* data) {
+	uint64_t value;
+	std::memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+uint32_t read32(const std::byte* data) {
+	uint32_t value;
+	std::memcpy(&value, data, sizeof(value));
+	return value;
+}
+
+uint64_t round(uint64_t accumulator, uint64_t input) {
+	return rotate(accumulator + input * PRIME2, 31) * PRIME1;
+}
+
+uint64_t merge(uint64_t hash, uint64_t lane) {
+	return (hash ^ round(0, lane)) * PRIME1 + PRIME4;
+}
+
+}
+
+uint64_t Xxh64(std::span<const std::byte> data, uint64_t seed) {
+	const std::byte* p = data.data();
+	const std::byte* end = p + data.size();
+	uint64_t hash;
+	if (data.size() >= 32) {
+		uint64_t lanes[4] = { seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 };
+		for (; end - p >= 32; p += 32) {
+			lanes[0] = round(lanes[0], read64(p));
+			lanes[1] = round(lanes[1], read64(p + 8));
+			lanes[2] = round(lanes[2], read64(p + 16));
+			lanes[3] = round(lanes[3], read64(p + 24));
+		}
+		hash = rotate(lanes[0], 1) + rotate(lanes[1], 7) + rotate(lanes[2], 12) + rotate(lanes[3], 18);
+		for (auto lane : lanes) {
+			hash = merge(hash, lane);
+		}
+	}
+	else {
+		hash = seed + PRIME5;
+	}
+	hash += data.size();
+
+	for (; end - p >= 8; p += 8) {
+		hash = rotate(hash ^ round(0, read64(p)), 27) * PRIME1 + PRIME4;
+	}
+	if (end - p >= 4) {
+		hash = rotate(hash ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	for (; p < end; ++p) {
+		hash = rotate(hash ^ (static_cast<uint64_t>(*p) * PRIME5), 11) * PRIME1;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
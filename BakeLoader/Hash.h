@@ -0,0 +1,10 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// XXH64 of the bytes, compatible with the reference xxHash. Four independent
+// lanes of 8-byte words keep a core busy at memory speed, so checking a
+// section costs about as much as reading it.
+uint64_t Xxh64(std::span<const std::byte> data, uint64_t seed = 0);
@@ -0,0 +1,265 @@
+﻿#include "Manifest.h"
+
+#include <charconv>
+#include <cstdint>
+
+namespace {
+
+struct Parser {
+	std::string_view Text;
+	size_t Position = 0;
+	std::string Error;
+
+	bool Fail(const char* what) {
+		if (Error.empty()) {
+			Error = std::string(what) + " at offset " + std::to_string(Position);
+		}
+		return false;
+	}
+
+	void SkipSpace() {
+		while (Position < Text.size() && (Text[Position] == ' ' || Text[Position] == '\t' || Text[Position] == '\n' || Text[Position] == '\r')) {
+			++Position;
+		}
+	}
+
+	bool Consume(char c) {
+		SkipSpace();
+		if (Position < Text.size() && Text[Position] == c) {
+			++Position;
+			return true;
+		}
+		return false;
+	}
+
+	char Peek() {
+		SkipSpace();
+		return Position < Text.size() ? Text[Position] : '\0';
+	}
+
+	static void AppendUtf8(std::string& out, uint32_t code) {
+		if (code < 0x80) {
+			out += static_cast<char>(code);
+		}
+		else if (code < 0x800) {
+			out += static_cast<char>(0xC0 | (code >> 6));
+			out += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000) {
+			out += static_cast<char>(0xE0 | (code >> 12));
+			out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else {
+			out += static_cast<char>(0xF0 | (code >> 18));
+			out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+			out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+			out += static_cast<char>(0x80 | (code & 0x3F));
+		}
+	}
+
+	bool Hex4(uint32_t& value) {
+		if (Position + 4 > Text.size()) {
+			return Fail("Truncated escape");
+		}
+		auto result = std::from_chars(Text.data() + Position, Text.data() + Position + 4, value, 16);
+		if (result.ptr != Text.data() + Position + 4) {
+			return Fail("Invalid escape");
+		}
+		Position += 4;
+		return true;
+	}
+
+	bool String(std::string& out) {
+		if (!Consume('"')) {
+			return Fail("Expected a string");
+		}
+		out.clear();
+		while (Position < Text.size()) {
+			char c = Text[Position++];
+			if (c == '"') {
+				return true;
+			}
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+			if (Position >= Text.size()) {
+				break;
+			}
+			char escape = Text[Position++];
+			switch (escape) {
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '/': out += '/'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u': {
+				uint32_t code = 0;
+				if (!Hex4(code)) {
+					return false;
+				}
+				// A high surrogate followed by a low one encodes one code point.
+				// Surrogates have no UTF-8 form on their own.
+				if (code >= 0xD800 && code < 0xDC00) {
+					if (Text.substr(Position, 2) != "\\u") {
+						return Fail("Unpaired surrogate");
+					}
+					Position += 2;
+					uint32_t low = 0;
+					if (!Hex4(low)) {
+						return false;
+					}
+					if (low < 0xDC00 || low > 0xDFFF) {
+						return Fail("Invalid low surrogate");
+					}
+					code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				}
+				else if (code >= 0xDC00 && code <= 0xDFFF) {
+					return Fail("Unpaired surrogate");
+				}
+				AppendUtf8(out, code);
+				break;
+			}
+			default:
+				return Fail("Invalid escape");
+			}
+		}
+		return Fail("Unterminated string");
+	}
+
+	// A number, true, false or null, kept as its text.
+	bool Literal(std::string& out) {
+		SkipSpace();
+		size_t start = Position;
+		while (Position < Text.size() && std::string_view("+-.0123456789eEtrufalsn").find(Text[Position]) != std::string_view::npos) {
+			++Position;
+		}
+		if (Position == start) {
+			return Fail("Expected a value");
+		}
+		out.assign(Text.substr(start, Position - start));
+		return true;
+	}
+
+	bool SkipValue() {
+		std::string ignored;
+		switch (Peek()) {
+		case '"':
+			return String(ignored);
+		case '{':
+			++Position;
+			if (Consume('}')) {
+				return true;
+			}
+			do {
+				if (!String(ignored) || !Consume(':') || !SkipValue()) {
+					return Fail("Invalid object");
+				}
+			} while (Consume(','));
+			return Consume('}') || Fail("Expected '}'");
+		case '[':
+			++Position;
+			if (Consume(']')) {
+				return true;
+			}
+			do {
+				if (!SkipValue()) {
+					return false;
+				}
+			} while (Consume(','));
+			return Consume(']') || Fail("Expected ']'");
+		default:
+			return Literal(ignored);
+		}
+	}
+
+	// An object whose scalar members go into fields. on_nested gets the key
+	// of any object or array member and parses or skips it.
+	template <typename NestedFunc>
+	bool Object(ManifestFields& fields, NestedFunc&& on_nested) {
+		if (!Consume('{')) {
+			return Fail("Expected '{'");
+		}
+		if (Consume('}')) {
+			return true;
+		}
+		std::string key, value;
+		do {
+			if (!String(key) || !Consume(':')) {
+				return Fail("Expected a member");
+			}
+			char next = Peek();
+			if (next == '{' || next == '[') {
+				if (!on_nested(key)) {
+					return false;
+				}
+				continue;
+			}
+			if (!(next == '"' ? String(value) : Literal(value))) {
+				return false;
+			}
+			fields.insert_or_assign(key, value);
+		} while (Consume(','));
+		return Consume('}') || Fail("Expected '}'");
+	}
+};
+
+}
+
+std::optional<Manifest> ParseManifest(std::string_view text, std::string* error) {
+	// Tolerate a UTF-8 byte order mark.
+	if (text.substr(0, 3) == "\xEF\xBB\xBF") {
+		text.remove_prefix(3);
+	}
+	Parser parser;
+	parser.Text = text;
+	Manifest manifest;
+	auto skip_nested = [&](const std::string&) { return parser.SkipValue(); };
+	bool parsed = parser.Object(manifest.Fields, [&](const std::string& key) {
+		if (key != "MeshAttributes" || parser.Peek() != '[') {
+			return parser.SkipValue();
+		}
+		++parser.Position;
+		if (parser.Consume(']')) {
+			return true;
+		}
+		do {
+			manifest.Meshes.emplace_back();
+			if (!parser.Object(manifest.Meshes.back(), skip_nested)) {
+				return false;
+			}
+		} while (parser.Consume(','));
+		return parser.Consume(']') || parser.Fail("Expected ']'");
+	});
+	if (parsed && parser.Peek() != '\0') {
+		parsed = parser.Fail("Trailing data");
+	}
+	if (!parsed) {
+		if (error) {
+			*error = parser.Error;
+		}
+		return std::nullopt;
+	}
+	return manifest;
+}
+
+std::optional<uint64_t> ParseManifestInteger(std::string_view text) {
+	uint64_t value = 0;
+	auto result = std::from_chars(text.data(), text.data() + text.size(), value);
+	if (result.ec != std::errc() || result.ptr != text.data() + text.size()) {
+		return std::nullopt;
+	}
+	return value;
+}
+
+std::optional<uint64_t> ManifestInteger(const ManifestFields& fields, std::string_view key) {
+	auto found = fields.find(key);
+	if (found == fields.end()) {
+		return std::nullopt;
+	}
+	return ParseManifestInteger(found->second);
+}
@@ -0,0 +1,30 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using ManifestFields = std::map<std::string, std::string, std::less<>>;
+
+// The .json BakeModel writes: top-level fields such as MeshCount and the
+// preview textures, and the fields of every entry of MeshAttributes. All
+// values are kept as the strings the manifest stores them as.
+struct Manifest {
+	ManifestFields Fields;
+	std::vector<ManifestFields> Meshes;
+};
+
+// Parses the manifest in one pass. Numbers and booleans are kept as their
+// text; nested values other than MeshAttributes are skipped. Returns nullopt
+// with the reason in error when the text is not valid JSON.
+std::optional<Manifest> ParseManifest(std::string_view text, std::string* error = nullptr);
+
+// A field's text as an unsigned integer, or nullopt when it is not a number.
+std::optional<uint64_t> ParseManifestInteger(std::string_view text);
+
+// The field as an unsigned integer, or nullopt when it is missing or not a
+// number.
+std::optional<uint64_t> ManifestInteger(const ManifestFields& fields, std::string_view key);
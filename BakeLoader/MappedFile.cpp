@@ -0,0 +1,200 @@
+﻿#include "MappedFile.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(MappedFile&& other) noexcept {
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+	if (this != &other) {
+		Unmap();
+		Data = std::exchange(other.Data, nullptr);
+		Size = std::exchange(other.Size, 0);
+#ifdef _WIN32
+		Mapping = std::exchange(other.Mapping, nullptr);
+#else
+		Descriptor = std::exchange(other.Descriptor, -1);
+#endif
+	}
+	return *this;
+}
+
+MappedFile::~MappedFile() {
+	Unmap();
+}
+
+void MappedFile::Unmap() {
+#ifdef _WIN32
+	if (Data) {
+		UnmapViewOfFile(Data);
+	}
+	if (Mapping) {
+		CloseHandle(Mapping);
+	}
+	Mapping = nullptr;
+#else
+	if (Data) {
+		munmap(const_cast<std::byte*>(Data), Size);
+	}
+	if (Descriptor >= 0) {
+		close(Descriptor);
+	}
+	Descriptor = -1;
+#endif
+	Data = nullptr;
+	Size = 0;
+}
+
+std::optional<MappedFile> MapFile(const std::filesystem::path& path, std::string* error) {
+	auto fail = [&](const char* what) -> std::optional<MappedFile> {
+		if (error) {
+			*error = std::string(what) + " " + path.string();
+		}
+		return std::nullopt;
+	};
+
+	MappedFile file;
+#ifdef _WIN32
+	HANDLE handle = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (handle == INVALID_HANDLE_VALUE) {
+		return fail("Failed to open");
+	}
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(handle, &size)) {
+		CloseHandle(handle);
+		return fail("Failed to query the size of");
+	}
+	if (size.QuadPart == 0) {
+		CloseHandle(handle);
+		return file;
+	}
+	// The mapping keeps the file open, so the file handle can go right away.
+	file.Mapping = CreateFileMappingW(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	CloseHandle(handle);
+	if (!file.Mapping) {
+		return fail("Failed to map");
+	}
+	file.Data = static_cast<const std::byte*>(MapViewOfFile(file.Mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!file.Data) {
+		return fail("Failed to map");
+	}
+	file.Size = static_cast<size_t>(size.QuadPart);
+#else
+	int descriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (descriptor < 0) {
+		return fail("Failed to open");
+	}
+	struct stat status;
+	if (fstat(descriptor, &status) != 0) {
+		close(descriptor);
+		return fail("Failed to query the size of");
+	}
+	if (status.st_size == 0) {
+		close(descriptor);
+		return file;
+	}
+	file.Descriptor = descriptor;
+	void* data = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, descriptor, 0);
+	if (data == MAP_FAILED) {
+		return fail("Failed to map");
+	}
+	file.Data = static_cast<const std::byte*>(data);
+	file.Size = static_cast<size_t>(status.st_size);
+	madvise(data, file.Size, MADV_RANDOM);
+#endif
+	return file;
+}
+
+namespace {
+
+size_t pageSize() {
+#ifdef _WIN32
+	SYSTEM_INFO system;
+	GetSystemInfo(&system);
+	return system.dwPageSize;
+#else
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+}
+
+void MappedFile::Prefetch(std::span<const ByteRange> ranges) const {
+	if (!Data) {
+		return;
+	}
+	size_t page = pageSize();
+	std::vector<ByteRange> pages;
+	for (const auto& range : ranges) {
+		if (range.Offset >= Size || range.Size == 0) {
+			continue;
+		}
+		size_t begin = range.Offset / page * page;
+		size_t end = range.Offset + std::min(range.Size, Size - range.Offset);
+		pages.push_back({ begin, end - begin });
+	}
+	if (pages.empty()) {
+		return;
+	}
+
+#ifdef _WIN32
+	std::vector<WIN32_MEMORY_RANGE_ENTRY> entries;
+	for (const auto& range : pages) {
+		entries.push_back({ const_cast<std::byte*>(Data + range.Offset), range.Size });
+	}
+	PrefetchVirtualMemory(GetCurrentProcess(), entries.size(), entries.data(), 0);
+#else
+	for (const auto& range : pages) {
+		// readahead fills the page cache through the descriptor on Linux;
+		// WILLNEED covers the other POSIX systems.
+		madvise(const_cast<std::byte*>(Data + range.Offset), range.Size, MADV_WILLNEED);
+#ifdef __linux__
+		readahead(Descriptor, static_cast<off_t>(range.Offset), range.Size);
+#endif
+	}
+#endif
+}
+
+void MappedFile::Evict(std::span<const ByteRange> ranges) const {
+	if (!Data) {
+		return;
+	}
+	size_t page = pageSize();
+	for (const auto& range : ranges) {
+		if (range.Offset >= Size) {
+			continue;
+		}
+		size_t begin = (range.Offset + page - 1) / page * page;
+		size_t end = range.Offset + std::min(range.Size, Size - range.Offset);
+		// The last page of the file counts as whole; nothing follows it.
+		end = end == Size ? end : end / page * page;
+		if (begin >= end) {
+			continue;
+		}
+#ifdef _WIN32
+		// Unlocking pages that are not locked takes them out of the working
+		// set, which is what is wanted here; the call reports
+		// ERROR_NOT_LOCKED regardless.
+		VirtualUnlock(const_cast<std::byte*>(Data + begin), end - begin);
+#else
+		madvise(const_cast<std::byte*>(Data + begin), end - begin, MADV_DONTNEED);
+#ifdef __linux__
+		posix_fadvise(Descriptor, static_cast<off_t>(begin), static_cast<off_t>(end - begin), POSIX_FADV_DONTNEED);
+#endif
+#endif
+	}
+}
@@ -0,0 +1,58 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+
+struct ByteRange {
+	size_t Offset = 0;
+	size_t Size = 0;
+};
+
+// A whole file mapped read-only. Nothing is read up front; pages are faulted
+// in one at a time when first touched, without reading ahead, so touching one
+// part of the file does not pull in its neighbours. Prefetch reads ranges
+// ahead explicitly. Move-only, unmapped on destruction.
+struct MappedFile {
+	const std::byte* Data = nullptr;
+	size_t Size = 0;
+
+	MappedFile() = default;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+
+	std::span<const std::byte> Bytes() const {
+		return { Data, Size };
+	}
+
+	// Asks the OS to start reading the ranges in the background and returns
+	// immediately. Ranges are widened to whole pages and clipped to the file.
+	void Prefetch(std::span<const ByteRange> ranges) const;
+
+	// Releases the pages of the ranges from the process, and on Linux from
+	// the page cache where no one else maps them. The view stays valid;
+	// touching the ranges again reads them back. Ranges are narrowed to the
+	// pages they cover whole, so that neighbours sharing a page stay.
+	void Evict(std::span<const ByteRange> ranges) const;
+
+private:
+	friend std::optional<MappedFile> MapFile(const std::filesystem::path& path, std::string* error);
+
+	void Unmap();
+
+#ifdef _WIN32
+	void* Mapping = nullptr;
+#else
+	// Kept open for readahead.
+	int Descriptor = -1;
+#endif
+};
+
+// Maps the file, or returns nullopt with the reason in error. An empty file
+// maps to an empty view.
+std::optional<MappedFile> MapFile(const std::filesystem::path& path, std::string* error = nullptr);
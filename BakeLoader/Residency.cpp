@@ -0,0 +1,188 @@
+﻿#include "Residency.h"
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <tuple>
+#include <utility>
+
+namespace {
+
+// Identifies a resource: a mesh by its model and index, a pack file by the
+// pack mapping and its offset, a loose file by its path.
+struct ResourceKey {
+	const void* Owner = nullptr;
+	uint64_t Index = 0;
+	std::string Path;
+
+	auto operator<=>(const ResourceKey&) const = default;
+};
+
+struct Resource {
+	std::shared_ptr<const MappedFile> Mapping;
+	// The model of a mesh, kept alive for the handles.
+	std::shared_ptr<const BakedModel> Model;
+	const BakedMesh* Mesh = nullptr;
+	// Bytes of the mapping the resource spans.
+	ByteRange Range;
+	int Priority = 0;
+	uint32_t Pins = 0;
+	// When the last handle went, for ordering evictions.
+	uint64_t Released = 0;
+};
+
+}
+
+struct ResidencyManager::State {
+	mutable std::mutex Mutex;
+	ResidencyStats Stats;
+	uint64_t Clock = 0;
+	std::map<ResourceKey, Resource> Resources;
+	// Resources without handles, in eviction order. Keys point into
+	// Resources, whose nodes stay put.
+	std::set<std::tuple<int, uint64_t, const ResourceKey*>> Evictable;
+
+	// Pins the resource of the key, tracking it first with make() when it
+	// is not resident, and prefetches it in that case. make() returns
+	// nullopt when the resource cannot be tracked.
+	template <typename Make>
+	std::optional<ResidencyHandle> Acquire(const std::shared_ptr<State>& self, ResourceKey key, int priority, Make make);
+
+	void Release(const ResourceKey* key);
+
+	// Evicts released resources until the budget holds. Called with Mutex
+	// held.
+	void Trim();
+};
+
+struct ResidencyPin {
+	std::shared_ptr<ResidencyManager::State> Owner;
+	const ResourceKey* Key = nullptr;
+
+	~ResidencyPin() {
+		Owner->Release(Key);
+	}
+};
+
+template <typename Make>
+std::optional<ResidencyHandle> ResidencyManager::State::Acquire(const std::shared_ptr<State>& self, ResourceKey key, int priority, Make make) {
+	std::unique_lock lock(Mutex);
+	auto found = Resources.find(key);
+	bool missed = found == Resources.end();
+	if (missed) {
+		auto resource = make();
+		if (!resource) {
+			return std::nullopt;
+		}
+		found = Resources.emplace(std::move(key), std::move(resource.value())).first;
+		Stats.Resident += found->second.Range.Size;
+		Stats.Resources = Resources.size();
+		++Stats.Misses;
+	}
+	else {
+		++Stats.Hits;
+	}
+	auto& resource = found->second;
+	if (resource.Pins == 0) {
+		Evictable.erase({ resource.Priority, resource.Released, &found->first });
+		Stats.Pinned += resource.Range.Size;
+	}
+	++resource.Pins;
+	resource.Priority = priority;
+
+	ResidencyHandle handle;
+	handle.Mesh = resource.Mesh;
+	handle.Bytes = resource.Mapping->Bytes().subspan(resource.Range.Offset, resource.Range.Size);
+	handle.Pin = std::make_shared<const ResidencyPin>(self, &found->first);
+	// A new resource may push released ones out of the budget.
+	Trim();
+	auto mapping = resource.Mapping;
+	auto range = resource.Range;
+	lock.unlock();
+
+	// Readahead can block on the device queue, so it runs unlocked. The pin
+	// keeps the mapping alive.
+	if (missed) {
+		mapping->Prefetch({ &range, 1 });
+	}
+	return handle;
+}
+
+void ResidencyManager::State::Release(const ResourceKey* key) {
+	std::lock_guard lock(Mutex);
+	auto& resource = Resources.find(*key)->second;
+	if (--resource.Pins > 0) {
+		return;
+	}
+	Stats.Pinned -= resource.Range.Size;
+	resource.Released = ++Clock;
+	Evictable.insert({ resource.Priority, resource.Released, key });
+	Trim();
+}
+
+void ResidencyManager::State::Trim() {
+	while (Stats.Resident > Stats.Budget && !Evictable.empty()) {
+		auto key = std::get<2>(*Evictable.begin());
+		Evictable.erase(Evictable.begin());
+		auto found = Resources.find(*key);
+		found->second.Mapping->Evict({ &found->second.Range, 1 });
+		Stats.Resident -= found->second.Range.Size;
+		++Stats.Evictions;
+		Resources.erase(found);
+	}
+	Stats.Resources = Resources.size();
+}
+
+ResidencyManager::ResidencyManager(size_t budget) : Impl(std::make_shared<State>()) {
+	Impl->Stats.Budget = budget;
+}
+
+ResidencyManager::~ResidencyManager() = default;
+
+std::optional<ResidencyHandle> ResidencyManager::AcquireMesh(const std::shared_ptr<const BakedModel>& model, size_t mesh, int priority) {
+	if (!model || mesh >= model->Meshes.size()) {
+		return std::nullopt;
+	}
+	return Impl->Acquire(Impl, { model.get(), mesh, {} }, priority, [&]() -> std::optional<Resource> {
+		// The mesh Range is relative to the .bin, which a pack holds at an
+		// offset.
+		const auto& range = model->Meshes[mesh].Range;
+		size_t base = static_cast<size_t>(model->Bin.data() - model->BinMapping->Data);
+		return Resource{ model->BinMapping, model, &model->Meshes[mesh], { base + range.Offset, range.Size } };
+	});
+}
+
+std::optional<ResidencyHandle> ResidencyManager::AcquireFile(const std::filesystem::path& path, int priority, std::string* error) {
+	return Impl->Acquire(Impl, { nullptr, 0, path.lexically_normal().string() }, priority, [&]() -> std::optional<Resource> {
+		auto mapped = MapFile(path, error);
+		if (!mapped) {
+			return std::nullopt;
+		}
+		auto mapping = std::make_shared<const MappedFile>(std::move(mapped.value()));
+		ByteRange range = { 0, mapping->Size };
+		return Resource{ std::move(mapping), nullptr, nullptr, range };
+	});
+}
+
+std::optional<ResidencyHandle> ResidencyManager::AcquirePackFile(const BakePack& pack, const BakePackModel& model, std::string_view file_name, int priority) {
+	auto contents = pack.FindFile(model, file_name);
+	if (!contents) {
+		return std::nullopt;
+	}
+	// Files with equal contents share a blob, and so a resource.
+	ByteRange range = { static_cast<size_t>(contents->data() - pack.File->Data), contents->size() };
+	return Impl->Acquire(Impl, { pack.File.get(), range.Offset, {} }, priority, [&]() -> std::optional<Resource> {
+		return Resource{ pack.File, nullptr, nullptr, range };
+	});
+}
+
+void ResidencyManager::SetBudget(size_t budget) {
+	std::lock_guard lock(Impl->Mutex);
+	Impl->Stats.Budget = budget;
+	Impl->Trim();
+}
+
+ResidencyStats ResidencyManager::Stats() const {
+	std::lock_guard lock(Impl->Mutex);
+	return Impl->Stats;
+}
@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include "BakeLoader.h"
+#include "BakePack.h"
+#include "MappedFile.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+struct ResidencyPin;
+
+// Keeps a mesh or texture resident while any copy of it is alive. Copies
+// share one reference; the last one to go lets the manager evict the
+// resource again. May outlive the manager.
+struct ResidencyHandle {
+	// The mesh, for a handle from AcquireMesh. Stays valid with the handle.
+	const BakedMesh* Mesh = nullptr;
+	// The resident bytes: the Range of the mesh in the .bin, or the file.
+	std::span<const std::byte> Bytes;
+
+	explicit operator bool() const {
+		return Pin != nullptr;
+	}
+
+private:
+	friend struct ResidencyManager;
+
+	std::shared_ptr<const ResidencyPin> Pin;
+};
+
+struct ResidencyStats {
+	size_t Budget = 0;
+	// Bytes of all tracked resources, and of those held by handles.
+	size_t Resident = 0;
+	size_t Pinned = 0;
+	size_t Resources = 0;
+	// Acquires that found the resource resident, and those that did not.
+	uint64_t Hits = 0;
+	uint64_t Misses = 0;
+	uint64_t Evictions = 0;
+};
+
+// Tracks which meshes and textures of baked models are in memory and keeps
+// them under a byte budget, so that servers loading many models on demand
+// share one cache. Acquiring a resource prefetches it and hands out a handle;
+// released resources stay resident until the budget needs their bytes, and
+// are then evicted lowest priority first, least recently released among
+// equal priorities. Resources still held by handles are never evicted, so
+// they alone can exceed the budget. Resources are counted by the bytes they
+// span, and evicting one releases its pages with MappedFile::Evict. All
+// members may be called from any thread.
+struct ResidencyManager {
+	explicit ResidencyManager(size_t budget);
+	ResidencyManager(const ResidencyManager&) = delete;
+	ResidencyManager& operator=(const ResidencyManager&) = delete;
+	~ResidencyManager();
+
+	// The mesh of the model, or nullopt when there is no such mesh. The
+	// model is kept alive as long as the mesh is tracked.
+	std::optional<ResidencyHandle> AcquireMesh(const std::shared_ptr<const BakedModel>& model, size_t mesh, int priority = 0);
+
+	// A file mapped whole, such as a texture next to a .json. Returns nullopt
+	// with the reason in error when it cannot be mapped.
+	std::optional<ResidencyHandle> AcquireFile(const std::filesystem::path& path, int priority = 0, std::string* error = nullptr);
+
+	// A file of a packed model, such as a texture named in its manifest, or
+	// nullopt when the model has no such file.
+	std::optional<ResidencyHandle> AcquirePackFile(const BakePack& pack, const BakePackModel& model, std::string_view file_name, int priority = 0);
+
+	// Changes the budget, evicting released resources until it holds.
+	void SetBudget(size_t budget);
+
+	ResidencyStats Stats() const;
+
+	struct State;
+
+private:
+	std::shared_ptr<State> Impl;
+};
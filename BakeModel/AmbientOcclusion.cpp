@@ -0,0 +1,133 @@
+﻿#include "AmbientOcclusion.h"
+#include "../BakeRender/Parallel.h"
+#include "Sampling.h"
+#include "UvRasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace {
+
+float sceneDiagonal(const Bvh& scene) {
+	return XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&scene.Max), XMLoadFloat3(&scene.Min))));
+}
+
+// Fraction of the hemisphere rays around normal that escape.
+float occlusion(const Bvh& scene, XMVECTOR origin, XMVECTOR normal, int samples, float distance, uint32_t seed) {
+	Hemisphere hemisphere(normal, seed);
+	int open = 0;
+	BvhRay ray;
+	XMStoreFloat3(&ray.Origin, origin);
+	ray.TMax = distance;
+	for (int i = 0; i < samples; ++i) {
+		XMStoreFloat3(&ray.Direction, hemisphere.Direction(i, samples));
+		if (!OccludedBvh(scene, ray)) {
+			++open;
+		}
+	}
+	return static_cast<float>(open) / samples;
+}
+
+}
+
+std::optional<Image> BakeAmbientOcclusion(const MeshGeometry& mesh, const Bvh& scene, const AOSettings& settings) {
+	int size = settings.Size;
+	auto coverage = RasterizeUv(mesh, size, size);
+	if (std::none_of(coverage.begin(), coverage.end(), [](const TexelCoverage& texel) { return texel.Covered(); })) {
+		return std::nullopt;
+	}
+
+	float diagonal = sceneDiagonal(scene);
+	float distance = settings.Distance > 0.f ? settings.Distance : diagonal * 0.1f;
+	float bias = diagonal * 1e-4f;
+	int samples = std::max(settings.Samples, 1);
+
+	Image image;
+	image.Width = size;
+	image.Height = size;
+	image.Channels = 1;
+	image.Pixels.assign(static_cast<size_t>(size) * size, 255);
+
+	ParallelFor(size, [&](size_t y) {
+		for (int x = 0; x < size; ++x) {
+			size_t index = y * size + x;
+			const auto& texel = coverage[index];
+			if (!texel.Covered()) {
+				continue;
+			}
+			const uint32_t* corners = &mesh.Indices[texel.Triangle * 3];
+			XMVECTOR p0 = XMLoadFloat3(&mesh.Positions[corners[0]]);
+			XMVECTOR p1 = XMLoadFloat3(&mesh.Positions[corners[1]]);
+			XMVECTOR p2 = XMLoadFloat3(&mesh.Positions[corners[2]]);
+			float b0 = 1.f - texel.B1 - texel.B2;
+			XMVECTOR position = XMVectorAdd(XMVectorAdd(XMVectorScale(p0, b0), XMVectorScale(p1, texel.B1)), XMVectorScale(p2, texel.B2));
+
+			XMVECTOR geometric = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0)));
+			XMVECTOR normal = geometric;
+			if (!mesh.Normals.empty()) {
+				XMVECTOR n = XMVectorAdd(XMVectorAdd(
+					XMVectorScale(XMLoadFloat3(&mesh.Normals[corners[0]]), b0),
+					XMVectorScale(XMLoadFloat3(&mesh.Normals[corners[1]]), texel.B1)),
+					XMVectorScale(XMLoadFloat3(&mesh.Normals[corners[2]]), texel.B2));
+				if (XMVectorGetX(XMVector3LengthSq(n)) > 1e-12f) {
+					normal = XMVector3Normalize(n);
+				}
+			}
+			if (XMVectorGetX(XMVector3Dot(geometric, normal)) < 0.f) {
+				geometric = XMVectorNegate(geometric);
+			}
+
+			XMVECTOR origin = XMVectorAdd(position, XMVectorScale(geometric, bias));
+			float ao = occlusion(scene, origin, normal, samples, distance, static_cast<uint32_t>(index));
+			image.Pixels[index] = static_cast<uint8_t>(std::lround(ao * 255.f));
+		}
+	});
+
+	DilateImage(image, coverage, GUTTER_PASSES);
+	return image;
+}
+
+std::vector<uint8_t> BakeVertexAmbientOcclusion(const MeshGeometry& mesh, const Bvh& scene, const AOSettings& settings) {
+	std::vector<uint8_t> result(mesh.Positions.size(), 255);
+	if (mesh.Normals.size() != mesh.Positions.size()) {
+		return result;
+	}
+
+	float diagonal = sceneDiagonal(scene);
+	float distance = settings.Distance > 0.f ? settings.Distance : diagonal * 0.1f;
+	float bias = diagonal * 1e-4f;
+	int packets = std::max((settings.Samples + 3) / 4, 1);
+	int samples = packets * 4;
+
+	constexpr size_t BATCH = 256;
+	ParallelFor((mesh.Positions.size() + BATCH - 1) / BATCH, [&](size_t batch) {
+		size_t end = std::min(mesh.Positions.size(), (batch + 1) * BATCH);
+		for (size_t v = batch * BATCH; v < end; ++v) {
+			XMVECTOR normal = XMLoadFloat3(&mesh.Normals[v]);
+			if (XMVectorGetX(XMVector3LengthSq(normal)) < 1e-12f) {
+				continue;
+			}
+			normal = XMVector3Normalize(normal);
+			Hemisphere hemisphere(normal, static_cast<uint32_t>(v));
+
+			BvhRay rays[4];
+			for (auto& ray : rays) {
+				XMStoreFloat3(&ray.Origin, XMVectorAdd(XMLoadFloat3(&mesh.Positions[v]), XMVectorScale(normal, bias)));
+				ray.TMax = distance;
+			}
+			int open = 0;
+			for (int packet = 0; packet < packets; ++packet) {
+				for (int lane = 0; lane < 4; ++lane) {
+					XMStoreFloat3(&rays[lane].Direction, hemisphere.Direction(packet * 4 + lane, samples));
+				}
+				bool occluded[4];
+				OccludedBvh4(scene, rays, occluded);
+				open += static_cast<int>(std::count(occluded, occluded + 4, false));
+			}
+			result[v] = static_cast<uint8_t>(std::lround(255.f * open / samples));
+		}
+	});
+	return result;
+}
@@ -0,0 +1,30 @@
+﻿#pragma once
+
+#include "../BakeRender/Geometry.h"
+#include "../BakeRender/Image.h"
+#include "Bvh.h"
+
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+struct AOSettings {
+	int Size = 512;
+	int Samples = 64;
+	// Only hits closer than this occlude. 0 uses a tenth of the diagonal of
+	// the scene bounds.
+	float Distance = 0.f;
+};
+
+// Bakes ambient occlusion of one mesh into a single-channel Size x Size image
+// laid out by its texture coordinates. Every covered texel casts Samples
+// cosine-weighted rays over the hemisphere of the interpolated normal against
+// the whole scene, with rows traced in parallel. Returns nullopt when the
+// texture coordinates cover no texel.
+std::optional<Image> BakeAmbientOcclusion(const MeshGeometry& mesh, const Bvh& scene, const AOSettings& settings);
+
+// Ambient occlusion per vertex, 255 for fully open. Rays leave each vertex over
+// the hemisphere of its normal in packets of four that share the vertex as
+// origin, with vertices processed in parallel. Samples is rounded up to a
+// multiple of four.
+std::vector<uint8_t> BakeVertexAmbientOcclusion(const MeshGeometry& mesh, const Bvh& scene, const AOSettings& settings);
@@ -5,6 +5,7 @@
 #include <assimp/postprocess.h>
 #include <assimp/material.h>
 #include <assimp/GltfMaterial.h>
+#include <assimp/light.h>
 
 #include <Windows.h>
 #include <WinBase.h>
@@ -12,29 +13,46 @@
 #include <DirectXMath.h>
 
 #include <iostream>
+#include <chrono>
+#include <memory>
 #include <vector>
 #include <cstdint>
+#include <cstdlib>
 #include <string>
 #include <optional>
 #include <filesystem>
 #include <fstream>
+#include <iterator>
 #include <limits>
+#include <map>
+#include <set>
 
 #include "winrt/base.h"
 #include "winrt/windows.foundation.h"
 #include "winrt/windows.foundation.collections.h"
 #include "winrt/windows.data.json.h"
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-
-struct Vertex {
-	float Position[3];
-	float Normal[3];
-	float TexCoords[2];
-};
+#include "../BakeLoader/BakeFormat.h"
+#include "../BakeLoader/Hash.h"
+#include "../BakeRender/Geometry.h"
+#include "../BakeRender/Image.h"
+#include "../BakeRender/Parallel.h"
+#include "../BakeRender/Png.h"
+#include "../BakeRender/Preview.h"
+#include "../BakeRender/Rasterizer.h"
+#include "AmbientOcclusion.h"
+#include "BinaryManifest.h"
+#include "BlockCompression.h"
+#include "Bvh.h"
+#include "Collision.h"
+#include "DistanceField.h"
+#include "Lightmap.h"
+#include "LightmapUv.h"
+#include "NormalMap.h"
+#include "Pack.h"
+#include "Progressive.h"
+#include "SurfaceMaps.h"
+#include "TextureContainer.h"
 
 struct Texture {
 	std::string FileName;
@@ -42,21 +60,40 @@ struct Texture {
 	std::optional<DirectX::XMFLOAT2> MetallicRoughnessFactor;
 	std::optional<DirectX::XMFLOAT3> NormalFactor;
 	std::optional<float> AOFactor;
+	// Generated by the baker, used in place of the factor.
+	std::optional<Image> Baked;
 };
 
 struct Mesh {
 	std::vector<Vertex> Vertices;
 	std::vector<uint32_t> Indices;
+	// Tangent and bitangent sign per vertex, only filled when the importer
+	// computed tangents. Not written to the .bin.
+	std::vector<DirectX::XMFLOAT4> Tangents;
+	// Baked occlusion per vertex, written as its own stream when not empty.
+	std::vector<uint8_t> VertexAO;
+	// Non-overlapping second UV set, written as its own stream when not empty.
+	std::vector<DirectX::XMFLOAT2> LightmapUV;
+	// Coarse levels over a prefix of the vertices, coarsest first, written
+	// before the vertex stream when not empty.
+	std::vector<ProgressiveLevel> Levels;
 
 	Texture BaseColor;
 	Texture MetallicRoughness;
 	Texture Normal;
 	Texture AO;
+	// Emitted radiance, only used by the lightmap bake.
+	DirectX::XMFLOAT3 Emissive{ 0.f, 0.f, 0.f };
+
+	// Node-to-world transform for row vectors, as DirectXMath expects.
+	DirectX::XMFLOAT4X4 Transform;
 };
 
-void processMesh(std::vector<Mesh> &mMesh,aiMesh* mesh, const aiScene* scene)
+void processMesh(std::vector<Mesh> &mMesh,aiMesh* mesh, const aiScene* scene, const aiMatrix4x4& transform)
 {
 	Mesh my_mesh;
+	// assimp matrices transform column vectors.
+	DirectX::XMStoreFloat4x4(&my_mesh.Transform, DirectX::XMMatrixTranspose(DirectX::XMLoadFloat4x4(reinterpret_cast<const DirectX::XMFLOAT4X4*>(&transform))));
 	for (unsigned int i = 0; i < mesh->mNumVertices; i++)
 	{
 		Vertex vertex{};
@@ -78,6 +115,16 @@ void processMesh(std::vector<Mesh> &mMesh,aiMesh* mesh, const aiScene* scene)
 		my_mesh.Vertices.push_back(vertex);
 	}
 
+	if (mesh->mTangents && mesh->mBitangents) {
+		for (unsigned int i = 0; i < mesh->mNumVertices; i++)
+		{
+			const auto& t = mesh->mTangents[i];
+			aiVector3D handedness = mesh->mNormals[i] ^ t;
+			float w = handedness * mesh->mBitangents[i] < 0.f ? -1.f : 1.f;
+			my_mesh.Tangents.emplace_back(t.x, t.y, t.z, w);
+		}
+	}
+
 	for (unsigned int i = 0; i < mesh->mNumFaces; i++)
 	{
 		aiFace face = mesh->mFaces[i];
@@ -132,20 +179,82 @@ void processMesh(std::vector<Mesh> &mMesh,aiMesh* mesh, const aiScene* scene)
 		my_mesh.AO.AOFactor = 1.f;
 	}
 
+	if (aiColor3D emissive; material->Get(AI_MATKEY_COLOR_EMISSIVE, emissive) == aiReturn_SUCCESS) {
+		float strength = 1.f;
+		material->Get(AI_MATKEY_EMISSIVE_INTENSITY, strength);
+		my_mesh.Emissive = DirectX::XMFLOAT3(emissive.r * strength, emissive.g * strength, emissive.b * strength);
+	}
+
 	mMesh.push_back(my_mesh);
 }
 
-void processNode(std::vector<Mesh>& mMesh,aiNode* node, const aiScene* scene)
+void processNode(std::vector<Mesh>& mMesh,aiNode* node, const aiScene* scene, const aiMatrix4x4& parent_transform = aiMatrix4x4())
 {
+	aiMatrix4x4 transform = parent_transform * node->mTransformation;
 	for (unsigned int i = 0; i < node->mNumMeshes; i++)
 	{
 		aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-		processMesh(mMesh, mesh, scene);
+		processMesh(mMesh, mesh, scene, transform);
 	}
 	for (unsigned int i = 0; i < node->mNumChildren; i++)
 	{
-		processNode(mMesh, node->mChildren[i], scene);
+		processNode(mMesh, node->mChildren[i], scene, transform);
+	}
+}
+
+// Lights of the scene in world space, each placed by the node of the same name.
+std::vector<SceneLight> readLights(const aiScene* scene) {
+	std::vector<SceneLight> lights;
+	for (unsigned int i = 0; i < scene->mNumLights; i++)
+	{
+		const aiLight* light = scene->mLights[i];
+		SceneLight my_light;
+		switch (light->mType) {
+		case aiLightSource_DIRECTIONAL:
+			my_light.Type = LightType::Directional;
+			break;
+		case aiLightSource_POINT:
+			my_light.Type = LightType::Point;
+			break;
+		case aiLightSource_SPOT:
+			my_light.Type = LightType::Spot;
+			break;
+		case aiLightSource_AREA:
+			my_light.Type = LightType::Area;
+			break;
+		case aiLightSource_AMBIENT:
+			my_light.Type = LightType::Ambient;
+			break;
+		default:
+			continue;
+		}
+
+		aiMatrix4x4 transform;
+		for (const aiNode* node = scene->mRootNode->FindNode(light->mName); node; node = node->mParent) {
+			transform = node->mTransformation * transform;
+		}
+		aiMatrix3x3 rotation(transform);
+		aiVector3D position = transform * light->mPosition;
+		aiVector3D direction = rotation * light->mDirection;
+		aiVector3D up = rotation * light->mUp;
+		my_light.Position = DirectX::XMFLOAT3(position.x, position.y, position.z);
+		my_light.Direction = DirectX::XMFLOAT3(direction.x, direction.y, direction.z);
+		my_light.Up = DirectX::XMFLOAT3(up.x, up.y, up.z);
+		my_light.Size = DirectX::XMFLOAT2(light->mSize.x, light->mSize.y);
+
+		aiColor3D color = light->mColorDiffuse;
+		if (my_light.Type == LightType::Ambient && !light->mColorAmbient.IsBlack()) {
+			color = light->mColorAmbient;
+		}
+		my_light.Color = DirectX::XMFLOAT3(color.r, color.g, color.b);
+		my_light.Constant = light->mAttenuationConstant;
+		my_light.Linear = light->mAttenuationLinear;
+		my_light.Quadratic = light->mAttenuationQuadratic;
+		my_light.InnerCone = light->mAngleInnerCone;
+		my_light.OuterCone = light->mAngleOuterCone;
+		lights.push_back(my_light);
 	}
+	return lights;
 }
 
 inline uint8_t float_to_int_color(const double color) {
@@ -153,7 +262,827 @@ inline uint8_t float_to_int_color(const double color) {
 	return static_cast<uint8_t>(color * MAXCOLOR);
 }
 
-void Bake(std::filesystem::path& path, std::vector<Mesh>& mMesh) {
+enum class TextureSlot {
+	BaseColor,
+	MetallicRoughness,
+	Normal,
+	AO,
+	ORM,
+};
+
+struct BakeOptions {
+	bool CompressTextures = false;
+	BlockFormat BaseColorFormat = BlockFormat::BC7;
+	BlockQuality CompressionQuality = BlockQuality::Normal;
+	bool PackORM = false;
+	ContainerFormat Container = ContainerFormat::DDS;
+	// Longest side allowed per slot, 0 for no limit.
+	std::map<TextureSlot, int> MaxTextureSize;
+	// Estimated GPU memory of all source textures in bytes, 0 for no limit.
+	size_t TextureBudget = 0;
+	PngOptions Png;
+	// Bake ambient occlusion for meshes without an AO texture.
+	bool BakeAO = false;
+	// Bake ambient occlusion per vertex into an extra 8-bit stream.
+	bool VertexAO = false;
+	AOSettings AO;
+	// Source of the normal map bake, empty to keep the Normal slot as is.
+	std::string HighPolyPath;
+	NormalBakeSettings NormalBake;
+	// Write a BVH of every mesh after its index data.
+	bool WriteBvh = false;
+	int BvhWidth = 4;
+	bool QuantizeBvh = false;
+	// Generate a lightmap UV set for every mesh, splitting vertices at chart seams.
+	bool LightmapUV = false;
+	LightmapUvSettings LightmapUv;
+	// Path trace a lightmap of every mesh at its lightmap UVs, at the atlas
+	// size above. Passes stop at LightmapSamples, or once LightmapSeconds
+	// have passed when it is positive.
+	bool BakeLightmaps = false;
+	LightmapSettings Lightmap;
+	int LightmapSamples = 256;
+	double LightmapSeconds = 0.0;
+	// Curvature and thickness maps, written as extra textures.
+	SurfaceMapSettings SurfaceMaps;
+	// Write a signed distance field of every mesh after its BVH.
+	bool WriteSdf = false;
+	SdfSettings Sdf;
+	// Write collision hulls of every mesh after its distance field.
+	bool WriteCollision = false;
+	CollisionSettings Collision;
+	// Start the data of every mesh in the .bin on a page boundary, so that
+	// loaders can map, prefetch and evict meshes independently.
+	bool PageAlign = false;
+	// Order the data of every mesh coarse first: the indices of coarse
+	// levels, then the vertices those levels use, then the rest.
+	bool Progressive = false;
+	ProgressiveSettings ProgressiveLevels;
+	// Write a position-only stream of every mesh after its indices, for
+	// depth, shadow and physics passes, in addition to or instead of the
+	// interleaved vertex stream. Welding stores every distinct position
+	// once, with an index stream of its own.
+	bool WritePositions = false;
+	bool PositionsOnly = false;
+	bool WeldPositions = false;
+	// Software-rendered previews of the whole model: a thumbnail of this
+	// size when positive, and an octahedral impostor atlas.
+	int ThumbnailSize = 0;
+	bool WriteImpostor = false;
+	int ImpostorViews = 8;
+	int ImpostorCellSize = 128;
+};
+
+struct TexturePlan {
+	int SourceWidth = 0;
+	int SourceHeight = 0;
+	int SourceChannels = 0;
+	int Width = 0;
+	int Height = 0;
+	double BytesPerTexel = 4.0;
+
+	bool Resized() const {
+		return Width != SourceWidth || Height != SourceHeight;
+	}
+};
+
+struct BakeContext {
+	std::filesystem::path SourcePath;
+	std::filesystem::path OutputDir;
+	BakeOptions Options;
+	std::map<std::string, CompressedTexture> CompressedTextures;
+	std::map<std::string, std::string> PackedTextures;
+	std::map<std::string, TexturePlan> TexturePlans;
+	std::set<std::string> ResizedTextures;
+	// Decoded source textures shared by the bakes that sample them.
+	std::map<std::string, std::shared_ptr<const Image>> SourceImages;
+	// Hashes of written textures by resolved path, as most are shared by
+	// several meshes.
+	std::map<std::filesystem::path, std::wstring> TextureHashes;
+};
+
+const char* slotName(TextureSlot slot) {
+	switch (slot) {
+	case TextureSlot::BaseColor: return "BaseColor";
+	case TextureSlot::MetallicRoughness: return "MetallicRoughness";
+	case TextureSlot::Normal: return "Normal";
+	case TextureSlot::AO: return "AO";
+	default: return "ORM";
+	}
+}
+
+std::wstring widen(const std::string& str) {
+	return std::wstring(str.begin(), str.end());
+}
+
+int mipCount(int width, int height) {
+	int count = 1;
+	while (width > 1 || height > 1) {
+		width = std::max(width / 2, 1);
+		height = std::max(height / 2, 1);
+		++count;
+	}
+	return count;
+}
+
+Image makeFactorImage(const Texture& texture) {
+	uint8_t color[3] = {};
+	if (texture.BaseColorFactor.has_value()) {
+		auto factor_value = texture.BaseColorFactor.value();
+		color[0] = float_to_int_color(factor_value.x);
+		color[1] = float_to_int_color(factor_value.y);
+		color[2] = float_to_int_color(factor_value.z);
+	}
+	else if (texture.MetallicRoughnessFactor.has_value()) {
+		auto factor_value = texture.MetallicRoughnessFactor.value();
+		color[0] = float_to_int_color(factor_value.x);
+		color[1] = float_to_int_color(factor_value.y);
+		color[2] = 0;
+	}
+	else if (texture.NormalFactor.has_value()) {
+		auto factor_value = texture.NormalFactor.value();
+		color[0] = float_to_int_color(factor_value.x);
+		color[1] = float_to_int_color(factor_value.y);
+		color[2] = float_to_int_color(factor_value.z);
+	}
+	else if (texture.AOFactor.has_value()) {
+		color[0] = float_to_int_color(texture.AOFactor.value());
+		color[1] = 255;
+		color[2] = 255;
+	}
+	return MakeConstantImage(16, 16, 3, color);
+}
+
+BlockFormat compressedFormat(TextureSlot slot, const BakeOptions& options) {
+	switch (slot) {
+	case TextureSlot::BaseColor: return options.BaseColorFormat;
+	case TextureSlot::MetallicRoughness: return BlockFormat::BC5;
+	case TextureSlot::Normal: return BlockFormat::BC5;
+	case TextureSlot::AO: return BlockFormat::BC4;
+	default: return options.BaseColorFormat;
+	}
+}
+
+// Moves the channels a slot needs to the front, in the order its block
+// format reads them. Metallic-roughness is stored as (metallic, roughness);
+// glTF files keep metallic in blue, the factor images keep it in red.
+Image compressedChannels(TextureSlot slot, const Image& image, bool from_file) {
+	switch (slot) {
+	case TextureSlot::BaseColor: return image;
+	case TextureSlot::MetallicRoughness: return ExtractChannels(image, from_file ? std::vector<int>{ 2, 1 } : std::vector<int>{ 0, 1 });
+	case TextureSlot::Normal: return ExtractChannels(image, { 0, 1 });
+	case TextureSlot::AO: return ExtractChannels(image, { 0 });
+	default: return image;
+	}
+}
+
+std::string planKey(const std::filesystem::path& texture_path, TextureSlot slot) {
+	return texture_path.string() + "|" + slotName(slot);
+}
+
+// GPU memory of a texture with its mip chain.
+double textureMemory(int width, int height, double bytes_per_texel) {
+	return static_cast<double>(width) * height * bytes_per_texel * 4.0 / 3.0;
+}
+
+// Decides the resolution of every source texture before anything is written.
+// Per-slot caps are applied first, then the largest textures are halved until
+// the estimated GPU memory fits the budget.
+void planTextures(BakeContext& context, const std::vector<Mesh>& mMesh) {
+	const auto& options = context.Options;
+	if (options.MaxTextureSize.empty() && options.TextureBudget == 0) {
+		return;
+	}
+
+	for (const auto& mesh : mMesh) {
+		std::pair<TextureSlot, const Texture*> slots[] = {
+			{ TextureSlot::BaseColor, &mesh.BaseColor },
+			{ TextureSlot::MetallicRoughness, &mesh.MetallicRoughness },
+			{ TextureSlot::Normal, &mesh.Normal },
+			{ TextureSlot::AO, &mesh.AO },
+		};
+		for (auto [slot, texture] : slots) {
+			if (texture->FileName.empty()) {
+				continue;
+			}
+			auto texture_path = context.SourcePath.parent_path() / texture->FileName;
+			auto key = planKey(texture_path, slot);
+			if (context.TexturePlans.count(key)) {
+				continue;
+			}
+
+			TexturePlan plan;
+			if (!ReadImageSize(texture_path, plan.SourceWidth, plan.SourceHeight, plan.SourceChannels)) {
+				continue;
+			}
+			plan.Width = plan.SourceWidth;
+			plan.Height = plan.SourceHeight;
+			if (options.CompressTextures) {
+				plan.BytesPerTexel = BlockSize(compressedFormat(slot, options)) / 16.0;
+			}
+
+			auto max_size = options.MaxTextureSize.find(slot);
+			int longest = std::max(plan.Width, plan.Height);
+			if (max_size != options.MaxTextureSize.end() && max_size->second > 0 && longest > max_size->second) {
+				double scale = static_cast<double>(max_size->second) / longest;
+				plan.Width = std::max(1, static_cast<int>(plan.Width * scale + 0.5));
+				plan.Height = std::max(1, static_cast<int>(plan.Height * scale + 0.5));
+			}
+			context.TexturePlans.emplace(key, plan);
+		}
+	}
+
+	double original = 0.0, planned = 0.0;
+	for (const auto& [key, plan] : context.TexturePlans) {
+		original += textureMemory(plan.SourceWidth, plan.SourceHeight, plan.BytesPerTexel);
+		planned += textureMemory(plan.Width, plan.Height, plan.BytesPerTexel);
+	}
+
+	while (options.TextureBudget > 0 && planned > options.TextureBudget) {
+		TexturePlan* largest = nullptr;
+		for (auto& [key, plan] : context.TexturePlans) {
+			if (std::max(plan.Width, plan.Height) > 4 && (!largest || textureMemory(plan.Width, plan.Height, plan.BytesPerTexel) > textureMemory(largest->Width, largest->Height, largest->BytesPerTexel))) {
+				largest = &plan;
+			}
+		}
+		if (!largest) {
+			break;
+		}
+		planned -= textureMemory(largest->Width, largest->Height, largest->BytesPerTexel);
+		largest->Width = std::max(largest->Width / 2, 1);
+		largest->Height = std::max(largest->Height / 2, 1);
+		planned += textureMemory(largest->Width, largest->Height, largest->BytesPerTexel);
+	}
+
+	constexpr double MIB = 1024.0 * 1024.0;
+	std::cout << "Texture memory: " << original / MIB << " MiB -> " << planned / MIB << " MiB, saved " << (original - planned) / MIB << " MiB" << std::endl;
+}
+
+// Decodes a source texture as RGBA at the resolution chosen by planTextures.
+std::optional<Image> readPlannedImage(const BakeContext& context, const std::filesystem::path& texture_path, TextureSlot slot) {
+	auto image = ReadImage(texture_path, 4);
+	if (!image) {
+		std::cout << "Failed to read texture " << texture_path.string() << std::endl;
+		return image;
+	}
+	auto plan = context.TexturePlans.find(planKey(texture_path, slot));
+	if (plan != context.TexturePlans.end() && plan->second.Resized()) {
+		image = DownscaleImage(image.value(), plan->second.Width, plan->second.Height, slot == TextureSlot::BaseColor);
+	}
+	return image;
+}
+
+// Compresses the full mip chain of a slot into the configured container and
+// records it in the manifest. Textures shared between meshes are written once.
+void compressTexture(BakeContext& context, TextureSlot slot, const Image& image, bool from_file, const std::string& base_name, winrt::Windows::Data::Json::JsonObject& meshData) {
+	auto output_name = base_name + ContainerExtension(context.Options.Container);
+	auto written = context.CompressedTextures.find(output_name);
+	if (written == context.CompressedTextures.end()) {
+		CompressedTexture texture;
+		texture.Format = compressedFormat(slot, context.Options);
+		texture.SRGB = slot == TextureSlot::BaseColor;
+
+		auto level = compressedChannels(slot, image, from_file);
+		texture.Width = level.Width;
+		texture.Height = level.Height;
+		while (true) {
+			texture.Levels.push_back(CompressBlocks(level, texture.Format, context.Options.CompressionQuality));
+			if (level.Width == 1 && level.Height == 1) {
+				break;
+			}
+			level = HalveImage(level, texture.SRGB);
+		}
+
+		WriteContainer(context.OutputDir / output_name, context.Options.Container, texture);
+		texture.Levels.clear();
+		written = context.CompressedTextures.emplace(output_name, std::move(texture)).first;
+	}
+
+	const auto& texture = written->second;
+	auto key = widen(slotName(slot));
+	meshData.Insert(key + L"CompressedTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(widen(output_name)));
+	meshData.Insert(key + L"CompressedFormat", winrt::Windows::Data::Json::JsonValue::CreateStringValue(widen(BlockFormatName(texture.Format))));
+	meshData.Insert(key + L"CompressedWidth", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(texture.Width)));
+	meshData.Insert(key + L"CompressedHeight", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(texture.Height)));
+	meshData.Insert(key + L"CompressedMipCount", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(mipCount(texture.Width, texture.Height))));
+}
+
+void bakeTexture(BakeContext& context, size_t mesh_index, TextureSlot slot, const Texture& texture, winrt::Windows::Data::Json::JsonObject& meshData) {
+	auto key = widen(slotName(slot)) + L"Texture";
+
+	if (texture.FileName.empty()) {
+		auto image = texture.Baked ? texture.Baked.value() : makeFactorImage(texture);
+		auto output_name = "Mesh" + std::to_string(mesh_index) + slotName(slot);
+		WritePng(context.OutputDir / (output_name + ".png"), image, context.Options.Png);
+		meshData.Insert(key, winrt::Windows::Data::Json::JsonValue::CreateStringValue(widen(output_name + ".png")));
+
+		if (context.Options.CompressTextures) {
+			compressTexture(context, slot, image, false, output_name, meshData);
+		}
+		return;
+	}
+
+	auto texture_path = context.SourcePath.parent_path();
+	texture_path /= texture.FileName;
+	auto output_name = texture_path.stem().string();
+	std::optional<Image> image;
+
+	auto plan = context.TexturePlans.find(planKey(texture_path, slot));
+	if (plan != context.TexturePlans.end() && plan->second.Resized()) {
+		output_name += "_" + std::to_string(plan->second.Width) + "x" + std::to_string(plan->second.Height);
+		if (context.ResizedTextures.insert(output_name).second) {
+			image = readPlannedImage(context, texture_path, slot);
+			if (image) {
+				constexpr int PNG_CHANNELS[5][4] = { {}, { 0 }, { 0, 3 }, { 0, 1, 2 }, { 0, 1, 2, 3 } };
+				int channels = std::clamp(plan->second.SourceChannels, 1, 4);
+				WritePng(context.OutputDir / (output_name + ".png"), ExtractChannels(image.value(), std::vector<int>(PNG_CHANNELS[channels], PNG_CHANNELS[channels] + channels)), context.Options.Png);
+			}
+		}
+		meshData.Insert(key, winrt::Windows::Data::Json::JsonValue::CreateStringValue(widen(output_name + ".png")));
+	}
+	else {
+		std::filesystem::copy(texture_path, context.OutputDir, std::filesystem::copy_options::skip_existing);
+
+		auto json_filename = texture_path.filename();
+		auto json_tex_path = json_filename.wstring();
+		meshData.Insert(key, winrt::Windows::Data::Json::JsonValue::CreateStringValue(json_tex_path));
+	}
+
+	if (context.Options.CompressTextures) {
+		output_name += std::string("_") + slotName(slot);
+		if (context.CompressedTextures.count(output_name + ContainerExtension(context.Options.Container))) {
+			compressTexture(context, slot, Image{}, true, output_name, meshData);
+			return;
+		}
+		if (!image) {
+			image = readPlannedImage(context, texture_path, slot);
+		}
+		if (image) {
+			compressTexture(context, slot, image.value(), true, output_name, meshData);
+		}
+	}
+}
+
+// Packs AO, roughness and metallic into the R, G and B channels of one
+// texture. Sources of different sizes are resampled to the largest of them.
+// Meshes sharing the same sources share the packed texture.
+void bakeORMTexture(BakeContext& context, size_t mesh_index, const Texture& ao, const Texture& metallic_roughness, winrt::Windows::Data::Json::JsonObject& meshData) {
+	auto factorKey = [mesh_index](const Texture& texture) {
+		if (!texture.FileName.empty()) {
+			return texture.FileName;
+		}
+		if (texture.Baked) {
+			return "Mesh" + std::to_string(mesh_index);
+		}
+		if (texture.MetallicRoughnessFactor.has_value()) {
+			auto factor_value = texture.MetallicRoughnessFactor.value();
+			return std::to_string(factor_value.x) + "," + std::to_string(factor_value.y);
+		}
+		return std::to_string(texture.AOFactor.value_or(1.f));
+	};
+	auto key = factorKey(ao) + "|" + factorKey(metallic_roughness);
+
+	auto packed = context.PackedTextures.find(key);
+	if (packed != context.PackedTextures.end()) {
+		meshData.Insert(L"ORMTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(widen(packed->second + ".png")));
+		if (context.Options.CompressTextures) {
+			compressTexture(context, TextureSlot::ORM, Image{}, false, packed->second, meshData);
+		}
+		return;
+	}
+
+	auto readSource = [&](const Texture& texture, TextureSlot slot) -> std::optional<Image> {
+		if (texture.FileName.empty()) {
+			return texture.Baked;
+		}
+		return readPlannedImage(context, context.SourcePath.parent_path() / texture.FileName, slot);
+	};
+	auto ao_image = readSource(ao, TextureSlot::AO);
+	auto mr_image = readSource(metallic_roughness, TextureSlot::MetallicRoughness);
+
+	int width = 16, height = 16;
+	if (ao_image || mr_image) {
+		width = std::max(ao_image ? ao_image->Width : 0, mr_image ? mr_image->Width : 0);
+		height = std::max(ao_image ? ao_image->Height : 0, mr_image ? mr_image->Height : 0);
+	}
+	for (auto* image : { &ao_image, &mr_image }) {
+		if (image->has_value() && ((*image)->Width != width || (*image)->Height != height)) {
+			*image = ResizeImage(image->value(), width, height);
+		}
+	}
+
+	ChannelSource occlusion, roughness, metallic;
+	if (ao_image) {
+		occlusion = { &ao_image.value(), 0 };
+	}
+	else {
+		occlusion.Constant = float_to_int_color(ao.AOFactor.value_or(1.f));
+	}
+	if (mr_image) {
+		roughness = { &mr_image.value(), 1 };
+		metallic = { &mr_image.value(), 2 };
+	}
+	else {
+		auto factor_value = metallic_roughness.MetallicRoughnessFactor.value_or(DirectX::XMFLOAT2(1.f, 1.f));
+		roughness.Constant = float_to_int_color(factor_value.y);
+		metallic.Constant = float_to_int_color(factor_value.x);
+	}
+	auto image = PackChannels(width, height, { occlusion, roughness, metallic });
+
+	auto output_name = "Mesh" + std::to_string(mesh_index) + slotName(TextureSlot::ORM);
+	context.PackedTextures.emplace(key, output_name);
+	WritePng(context.OutputDir / (output_name + ".png"), image, context.Options.Png);
+	meshData.Insert(L"ORMTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(widen(output_name + ".png")));
+
+	if (context.Options.CompressTextures) {
+		compressTexture(context, TextureSlot::ORM, image, false, output_name, meshData);
+	}
+}
+
+MeshGeometry worldGeometry(const Mesh& mesh) {
+	auto transform = DirectX::XMLoadFloat4x4(&mesh.Transform);
+	auto normal_transform = DirectX::XMMatrixTranspose(DirectX::XMMatrixInverse(nullptr, transform));
+
+	// A mirroring transform flips the handedness of the tangent frame.
+	float mirror = DirectX::XMVectorGetX(DirectX::XMMatrixDeterminant(transform)) < 0.f ? -1.f : 1.f;
+
+	MeshGeometry geometry;
+	geometry.Indices = mesh.Indices;
+	for (const auto& tangent : mesh.Tangents) {
+		DirectX::XMFLOAT4 world;
+		DirectX::XMStoreFloat4(&world, DirectX::XMVector3Normalize(DirectX::XMVector3TransformNormal(DirectX::XMVectorSet(tangent.x, tangent.y, tangent.z, 0.f), transform)));
+		world.w = tangent.w * mirror;
+		geometry.Tangents.push_back(world);
+	}
+	for (const auto& vertex : mesh.Vertices) {
+		DirectX::XMFLOAT3 position, normal;
+		DirectX::XMStoreFloat3(&position, DirectX::XMVector3TransformCoord(DirectX::XMVectorSet(vertex.Position[0], vertex.Position[1], vertex.Position[2], 1.f), transform));
+		DirectX::XMStoreFloat3(&normal, DirectX::XMVector3Normalize(DirectX::XMVector3TransformNormal(DirectX::XMVectorSet(vertex.Normal[0], vertex.Normal[1], vertex.Normal[2], 0.f), normal_transform)));
+		geometry.Positions.push_back(position);
+		geometry.Normals.push_back(normal);
+		geometry.TexCoords.emplace_back(vertex.TexCoords[0], vertex.TexCoords[1]);
+	}
+	return geometry;
+}
+
+Bvh buildSceneBvh(const std::vector<MeshGeometry>& geometries) {
+	std::vector<BvhTriangle> triangles;
+	for (size_t i = 0; i < geometries.size(); ++i) {
+		const auto& geometry = geometries[i];
+		for (size_t t = 0; t < geometry.TriangleCount(); ++t) {
+			const uint32_t* corners = &geometry.Indices[t * 3];
+			triangles.push_back({ geometry.Positions[corners[0]], geometry.Positions[corners[1]], geometry.Positions[corners[2]], static_cast<uint32_t>(i), static_cast<uint32_t>(t) });
+		}
+	}
+	return BuildBvh(std::move(triangles));
+}
+
+// Traces occlusion against every mesh of the scene: texture AO replaces the
+// constant AO of meshes without an AO texture, vertex AO fills Mesh::VertexAO.
+void bakeAmbientOcclusion(std::vector<Mesh>& mMesh, const BakeOptions& options) {
+	std::vector<MeshGeometry> geometries;
+	for (const auto& mesh : mMesh) {
+		geometries.push_back(worldGeometry(mesh));
+	}
+	auto scene = buildSceneBvh(geometries);
+
+	for (size_t i = 0; i < mMesh.size(); ++i) {
+		if (options.VertexAO) {
+			mMesh[i].VertexAO = BakeVertexAmbientOcclusion(geometries[i], scene, options.AO);
+		}
+		if (!options.BakeAO || !mMesh[i].AO.FileName.empty()) {
+			continue;
+		}
+		std::cout << "Baking AO for mesh " << i << std::endl;
+		mMesh[i].AO.Baked = BakeAmbientOcclusion(geometries[i], scene, options.AO);
+		if (!mMesh[i].AO.Baked) {
+			std::cout << "Mesh " << i << " has no texture coordinates, keeping constant AO" << std::endl;
+		}
+	}
+}
+
+// Triangles of the mesh as stored in the .bin, so that structures built from
+// them match the vertex data the runtime loads.
+std::vector<BvhTriangle> meshTriangles(const Mesh& mesh) {
+	std::vector<BvhTriangle> triangles;
+	triangles.reserve(mesh.Indices.size() / 3);
+	for (size_t t = 0; t + 2 < mesh.Indices.size(); t += 3) {
+		BvhTriangle triangle;
+		DirectX::XMFLOAT3* corners[3] = { &triangle.V0, &triangle.V1, &triangle.V2 };
+		for (int c = 0; c < 3; ++c) {
+			const auto& position = mesh.Vertices[mesh.Indices[t + c]].Position;
+			*corners[c] = DirectX::XMFLOAT3(position[0], position[1], position[2]);
+		}
+		triangle.Primitive = static_cast<uint32_t>(t / 3);
+		triangles.push_back(triangle);
+	}
+	return triangles;
+}
+
+// Replaces the Normal slot of every low-poly mesh with normals traced from the
+// high-poly meshes.
+void bakeNormalMaps(std::vector<Mesh>& mMesh, const std::vector<Mesh>& high_poly, const NormalBakeSettings& settings) {
+	std::vector<MeshGeometry> high;
+	for (const auto& mesh : high_poly) {
+		high.push_back(worldGeometry(mesh));
+	}
+	auto high_bvh = buildSceneBvh(high);
+
+	for (size_t i = 0; i < mMesh.size(); ++i) {
+		std::cout << "Baking normal map for mesh " << i << std::endl;
+		auto image = BakeNormalMap(worldGeometry(mMesh[i]), high, high_bvh, settings);
+		if (!image) {
+			std::cout << "Mesh " << i << " has no texture coordinates or tangents, keeping its normal texture" << std::endl;
+			continue;
+		}
+		mMesh[i].Normal.FileName.clear();
+		mMesh[i].Normal.Baked = std::move(image);
+	}
+}
+
+// Decodes a source texture as RGBA once per run. Null when it cannot be read.
+std::shared_ptr<const Image> sourceImage(BakeContext& context, const std::string& file_name) {
+	auto found = context.SourceImages.find(file_name);
+	if (found != context.SourceImages.end()) {
+		return found->second;
+	}
+	auto texture_path = context.SourcePath.parent_path() / file_name;
+	auto image = ReadImage(texture_path, 4);
+	if (!image) {
+		std::cout << "Failed to read texture " << texture_path.string() << std::endl;
+	}
+	auto shared = image ? std::make_shared<const Image>(std::move(image.value())) : nullptr;
+	context.SourceImages.emplace(file_name, shared);
+	return shared;
+}
+
+// The image a texture slot ends up with: a baked one or the source file.
+// Null for slots that only have a factor.
+std::shared_ptr<const Image> resolvedImage(BakeContext& context, const Texture& texture) {
+	if (texture.Baked) {
+		return std::make_shared<const Image>(texture.Baked.value());
+	}
+	if (!texture.FileName.empty()) {
+		return sourceImage(context, texture.FileName);
+	}
+	return nullptr;
+}
+
+// Diffuse albedo and emission of every mesh for the lightmap bake.
+std::vector<SurfaceMaterial> surfaceMaterials(BakeContext& context, const std::vector<Mesh>& mMesh) {
+	std::vector<SurfaceMaterial> materials;
+	for (const auto& mesh : mMesh) {
+		SurfaceMaterial material;
+		if (!mesh.BaseColor.FileName.empty()) {
+			material.AlbedoTexture = sourceImage(context, mesh.BaseColor.FileName);
+		}
+		else if (mesh.BaseColor.BaseColorFactor) {
+			material.Albedo = mesh.BaseColor.BaseColorFactor.value();
+		}
+		material.Emission = mesh.Emissive;
+		materials.push_back(std::move(material));
+	}
+	return materials;
+}
+
+// Accumulates passes into one mesh's lightmap and writes it next to the
+// albedo and normal buffers a denoiser takes as guides.
+void bakeLightmap(BakeContext& context, const LightmapScene& scene, size_t mesh_index, const Mesh& mesh, winrt::Windows::Data::Json::JsonObject& meshData) {
+	constexpr int PASS_SAMPLES = 16;
+	const auto& options = context.Options;
+	auto target = PrepareLightmap(scene, static_cast<uint32_t>(mesh_index), mesh.LightmapUV, options.LightmapUv.Size);
+	if (!target) {
+		std::cout << "Mesh " << mesh_index << " has no lightmap texels, skipping its lightmap" << std::endl;
+		return;
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	while (target->Samples < options.LightmapSamples) {
+		AccumulateLightmap(target.value(), scene, options.Lightmap, std::min(PASS_SAMPLES, options.LightmapSamples - target->Samples));
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "Lightmap " << mesh_index << ": " << target->Samples << "/" << options.LightmapSamples << " samples, " << seconds << " s" << std::endl;
+		if (options.LightmapSeconds > 0.0 && seconds >= options.LightmapSeconds) {
+			break;
+		}
+	}
+
+	auto base_name = "Mesh" + std::to_string(mesh_index) + "Lightmap";
+	std::pair<std::string, FloatImage> outputs[] = {
+		{ "", ResolveLightmap(target.value()) },
+		{ "Albedo", ResolveLightmapAlbedo(target.value()) },
+		{ "Normal", ResolveLightmapNormal(target.value()) },
+	};
+	for (const auto& [suffix, image] : outputs) {
+		auto file_name = base_name + suffix + ".pfm";
+		if (!WritePfm(context.OutputDir / file_name, image)) {
+			std::cout << "Failed to write " << file_name << std::endl;
+		}
+		meshData.Insert(widen("Lightmap" + suffix + "Texture"), winrt::Windows::Data::Json::JsonValue::CreateStringValue(widen(file_name)));
+	}
+	meshData.Insert(L"LightmapSamples", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(target->Samples)));
+}
+
+// Writes the curvature and thickness maps of one mesh together with the
+// ranges needed to decode them.
+void bakeSurfaceMaps(BakeContext& context, size_t mesh_index, const Mesh& mesh, winrt::Windows::Data::Json::JsonObject& meshData) {
+	auto maps = BakeSurfaceMaps(worldGeometry(mesh), context.Options.SurfaceMaps);
+	if (!maps.Curvature && !maps.Thickness) {
+		std::cout << "Mesh " << mesh_index << " has no texture coordinates, skipping its curvature and thickness maps" << std::endl;
+		return;
+	}
+
+	auto base_name = "Mesh" + std::to_string(mesh_index);
+	if (maps.Curvature) {
+		WritePng(context.OutputDir / (base_name + "Curvature.png"), maps.Curvature.value(), context.Options.Png);
+		meshData.Insert(L"CurvatureTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(widen(base_name + "Curvature.png")));
+		meshData.Insert(L"CurvatureRange", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(maps.CurvatureRange)));
+	}
+	if (maps.Thickness) {
+		WritePng(context.OutputDir / (base_name + "Thickness.png"), maps.Thickness.value(), context.Options.Png);
+		meshData.Insert(L"ThicknessTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(widen(base_name + "Thickness.png")));
+		meshData.Insert(L"ThicknessDistance", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(maps.ThicknessDistance)));
+	}
+}
+
+// Renders the thumbnail and impostor atlas of the whole model with its
+// resolved base colour and normal textures.
+void renderPreviews(BakeContext& context, const std::vector<Mesh>& mMesh, winrt::Windows::Data::Json::JsonObject& json) {
+	const auto& options = context.Options;
+	std::vector<MeshGeometry> geometries;
+	for (const auto& mesh : mMesh) {
+		geometries.push_back(worldGeometry(mesh));
+	}
+	std::vector<RasterMesh> meshes(mMesh.size());
+	for (size_t i = 0; i < mMesh.size(); ++i) {
+		meshes[i].Geometry = &geometries[i];
+		meshes[i].BaseColor = resolvedImage(context, mMesh[i].BaseColor);
+		meshes[i].Normal = resolvedImage(context, mMesh[i].Normal);
+		if (mMesh[i].BaseColor.BaseColorFactor) {
+			meshes[i].BaseColorFactor = mMesh[i].BaseColor.BaseColorFactor.value();
+		}
+	}
+
+	PreviewSettings settings;
+	settings.ThumbnailSize = options.ThumbnailSize;
+	settings.Impostor = options.WriteImpostor;
+	settings.ImpostorViews = options.ImpostorViews;
+	settings.ImpostorCellSize = options.ImpostorCellSize;
+	settings.Png = options.Png;
+	std::cout << "Rendering previews" << std::endl;
+	std::string error;
+	auto rendered = RenderPreviews(meshes, context.OutputDir, context.OutputDir.string(), settings, &error);
+	if (!rendered) {
+		std::cout << error << ", skipping the previews" << std::endl;
+		return;
+	}
+	const auto& files = rendered.value();
+	if (!files.Thumbnail.empty()) {
+		json.Insert(L"ThumbnailTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(widen(files.Thumbnail)));
+	}
+	if (!files.ImpostorAlbedo.empty()) {
+		json.Insert(L"ImpostorAlbedoTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(widen(files.ImpostorAlbedo)));
+		json.Insert(L"ImpostorNormalDepthTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(widen(files.ImpostorNormalDepth)));
+		json.Insert(L"ImpostorViews", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(options.ImpostorViews)));
+		json.Insert(L"ImpostorCenterX", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(files.ImpostorCenter.x)));
+		json.Insert(L"ImpostorCenterY", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(files.ImpostorCenter.y)));
+		json.Insert(L"ImpostorCenterZ", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(files.ImpostorCenter.z)));
+		json.Insert(L"ImpostorRadius", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(files.ImpostorRadius)));
+	}
+}
+
+// Runs before the other bakes so that they see the split vertices.
+void generateLightmapUvs(std::vector<Mesh>& mMesh, const LightmapUvSettings& settings) {
+	for (size_t i = 0; i < mMesh.size(); ++i) {
+		auto& mesh = mMesh[i];
+		std::string error;
+		auto generated = GenerateLightmapUv(worldGeometry(mesh), settings, &error);
+		if (!generated) {
+			std::cout << "Mesh " << i << ": " << error << ", skipping its lightmap UVs" << std::endl;
+			continue;
+		}
+		auto& result = generated.value();
+		std::cout << "Mesh " << i << ": " << result.ChartCount << " lightmap charts, " << mesh.Vertices.size() << " -> " << result.Remap.size() << " vertices" << std::endl;
+
+		std::vector<Vertex> vertices;
+		std::vector<DirectX::XMFLOAT4> tangents;
+		vertices.reserve(result.Remap.size());
+		for (auto source : result.Remap) {
+			vertices.push_back(mesh.Vertices[source]);
+			if (!mesh.Tangents.empty()) {
+				tangents.push_back(mesh.Tangents[source]);
+			}
+		}
+		mesh.Vertices = std::move(vertices);
+		mesh.Tangents = std::move(tangents);
+		mesh.Indices = std::move(result.Indices);
+		mesh.LightmapUV = std::move(result.TexCoords);
+	}
+}
+
+// Runs after the bakes that add vertex streams, so that they are reordered
+// along with the vertices.
+void buildProgressiveLevels(std::vector<Mesh>& mMesh, const ProgressiveSettings& settings) {
+	for (size_t i = 0; i < mMesh.size(); ++i) {
+		auto& mesh = mMesh[i];
+		auto result = BuildProgressiveLevels(worldGeometry(mesh), settings);
+		std::cout << "Mesh " << i << ": " << result.Levels.size() << " coarse levels,";
+		for (const auto& level : result.Levels) {
+			std::cout << " " << level.Indices.size() / 3;
+		}
+		std::cout << " of " << mesh.Indices.size() / 3 << " triangles" << std::endl;
+
+		auto reorder = [&](auto& stream) {
+			if (stream.empty()) {
+				return;
+			}
+			std::remove_reference_t<decltype(stream)> reordered;
+			reordered.reserve(result.Remap.size());
+			for (auto source : result.Remap) {
+				reordered.push_back(stream[source]);
+			}
+			stream = std::move(reordered);
+		};
+		reorder(mesh.Vertices);
+		reorder(mesh.Tangents);
+		reorder(mesh.VertexAO);
+		reorder(mesh.LightmapUV);
+		mesh.Indices = std::move(result.Indices);
+		mesh.Levels = std::move(result.Levels);
+	}
+}
+
+// The position stream of the mesh: one entry per vertex, or with weld one
+// per distinct position and the triangles over them in indices.
+std::vector<VertexPosition> positionStream(const Mesh& mesh, bool weld, std::vector<uint32_t>& indices) {
+	std::vector<VertexPosition> positions;
+	for (const auto& vertex : mesh.Vertices) {
+		positions.push_back({ vertex.Position[0], vertex.Position[1], vertex.Position[2] });
+	}
+	if (!weld) {
+		return positions;
+	}
+	MeshGeometry geometry;
+	for (const auto& p : positions) {
+		geometry.Positions.push_back({ p.X, p.Y, p.Z });
+	}
+	auto welded = WeldPositions(geometry);
+	std::vector<VertexPosition> distinct;
+	std::vector<uint32_t> slot(welded.size());
+	for (uint32_t i = 0; i < welded.size(); ++i) {
+		if (welded[i] == i) {
+			slot[i] = static_cast<uint32_t>(distinct.size());
+			distinct.push_back(positions[i]);
+		}
+	}
+	indices.clear();
+	for (auto index : mesh.Indices) {
+		indices.push_back(slot[welded[index]]);
+	}
+	return distinct;
+}
+
+std::wstring hashString(const void* data, size_t size) {
+	return std::to_wstring(Xxh64({ static_cast<const std::byte*>(data), size }));
+}
+
+// Adds <key>Hash with the XXH64 of the written file for every texture field
+// of the manifest object, so that loaders can detect damaged textures.
+void hashTextures(BakeContext& context, winrt::Windows::Data::Json::JsonObject& object) {
+	std::vector<std::pair<std::wstring, std::wstring>> hashes;
+	for (const auto& pair : object) {
+		std::wstring key(pair.Key());
+		if (key.size() < 7 || key.compare(key.size() - 7, 7, L"Texture") != 0 || pair.Value().ValueType() != winrt::Windows::Data::Json::JsonValueType::String) {
+			continue;
+		}
+		auto path = (context.OutputDir / std::wstring(pair.Value().GetString())).lexically_normal();
+		auto found = context.TextureHashes.find(path);
+		if (found == context.TextureHashes.end()) {
+			std::ifstream in(path, std::ios::binary);
+			if (!in) {
+				continue;
+			}
+			std::vector<char> contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			found = context.TextureHashes.emplace(path, hashString(contents.data(), contents.size())).first;
+		}
+		hashes.push_back({ key + L"Hash", found->second });
+	}
+	for (const auto& [key, hash] : hashes) {
+		object.Insert(key, winrt::Windows::Data::Json::JsonValue::CreateStringValue(hash));
+	}
+}
+
+// The string fields of a manifest object, which are all but MeshAttributes.
+ManifestFields manifestFields(const winrt::Windows::Data::Json::JsonObject& object) {
+	ManifestFields fields;
+	for (const auto& pair : object) {
+		if (pair.Value().ValueType() == winrt::Windows::Data::Json::JsonValueType::String) {
+			fields.emplace(winrt::to_string(pair.Key()), winrt::to_string(pair.Value().GetString()));
+		}
+	}
+	return fields;
+}
+
+void Bake(std::filesystem::path& path, std::vector<Mesh>& mMesh, const std::vector<Mesh>& high_poly, const std::vector<SceneLight>& lights, const BakeOptions& options) {
 	auto file_name = path.stem();
 
 	auto file_name_str = file_name.string();
@@ -162,172 +1091,566 @@ void Bake(std::filesystem::path& path, std::vector<Mesh>& mMesh) {
 	auto json_file= file_name_str + "\\" + file_name_str + ".json";
 	std::ofstream json_file_out(json_file, std::fstream::out);
 	auto json_bin = file_name_str + "\\" + file_name_str + ".bin";
-	std::ofstream json_bin_out(json_bin, std::fstream::out);
+	std::ofstream json_bin_out(json_bin, std::fstream::out | std::fstream::binary);
+
+	BakeContext context;
+	context.SourcePath = path;
+	context.OutputDir = file_name;
+	context.Options = options;
+
+	if (options.LightmapUV) {
+		generateLightmapUvs(mMesh, options.LightmapUv);
+	}
+	if (!high_poly.empty()) {
+		bakeNormalMaps(mMesh, high_poly, options.NormalBake);
+	}
+	if (options.BakeAO || options.VertexAO) {
+		bakeAmbientOcclusion(mMesh, options);
+	}
+	if (options.Progressive) {
+		buildProgressiveLevels(mMesh, options.ProgressiveLevels);
+	}
+	planTextures(context, mMesh);
+
+	std::optional<LightmapScene> lightmap_scene;
+	if (options.BakeLightmaps) {
+		std::vector<MeshGeometry> geometries;
+		for (const auto& mesh : mMesh) {
+			geometries.push_back(worldGeometry(mesh));
+		}
+		lightmap_scene = BuildLightmapScene(std::move(geometries), surfaceMaterials(context, mMesh), lights);
+		std::cout << lightmap_scene->Lights.size() << " lights, " << lightmap_scene->Emitters.size() << " emissive triangles" << std::endl;
+	}
+
+	// Each mesh is built on its own thread; the decomposition of one mesh is
+	// mostly serial.
+	std::vector<std::vector<ConvexHull>> collision_hulls(options.WriteCollision ? mMesh.size() : 0);
+	if (options.WriteCollision) {
+		std::cout << "Building collision hulls" << std::endl;
+		ParallelFor(collision_hulls.size(), [&](size_t i) {
+			collision_hulls[i] = BuildCollisionHulls(meshTriangles(mMesh[i]), options.Collision);
+		});
+	}
 
 	winrt::Windows::Data::Json::JsonObject json;
 	json.Insert(L"MeshCount", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(mMesh.size())));
 	winrt::Windows::Data::Json::JsonArray mesh_attributes;
 
-	int offset = 0;
+	size_t offset = 0;
 	for (size_t i = 0;i < mMesh.size(); ++i) {
 		winrt::Windows::Data::Json::JsonObject meshData;
+		if (options.PageAlign && offset % BAKE_PAGE_SIZE != 0) {
+			std::vector<char> padding(BAKE_PAGE_SIZE - offset % BAKE_PAGE_SIZE);
+			json_bin_out.write(padding.data(), padding.size());
+			offset += padding.size();
+		}
+		if (!mMesh[i].Levels.empty()) {
+			meshData.Insert(L"LevelCount", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(mMesh[i].Levels.size())));
+		}
+		for (size_t level = 0; level < mMesh[i].Levels.size(); ++level) {
+			const auto& indices = mMesh[i].Levels[level].Indices;
+			auto prefix = L"Level" + std::to_wstring(level);
+			auto level_data_size = indices.size() * sizeof(uint32_t);
+			meshData.Insert(prefix + L"IndexCount", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(indices.size())));
+			meshData.Insert(prefix + L"IndexOffset", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(offset)));
+			meshData.Insert(prefix + L"IndexHash", winrt::Windows::Data::Json::JsonValue::CreateStringValue(hashString(indices.data(), level_data_size)));
+			meshData.Insert(prefix + L"VertexCount", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(mMesh[i].Levels[level].VertexCount)));
+			offset += level_data_size;
+			json_bin_out.write((const char*)indices.data(), level_data_size);
+		}
 		meshData.Insert(L"VertexCount", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(mMesh[i].Vertices.size())));
-		meshData.Insert(L"VertexOffset", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(offset)));
-
-		auto vertex_data_size = mMesh[i].Vertices.size() * sizeof(float) * 8;
-		offset += vertex_data_size;
-		json_bin_out.write((const char*)mMesh[i].Vertices.data(), vertex_data_size);
+		if (!options.PositionsOnly) {
+			meshData.Insert(L"VertexOffset", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(offset)));
+			auto vertex_data_size = mMesh[i].Vertices.size() * sizeof(Vertex);
+			meshData.Insert(L"VertexHash", winrt::Windows::Data::Json::JsonValue::CreateStringValue(hashString(mMesh[i].Vertices.data(), vertex_data_size)));
+			offset += vertex_data_size;
+			json_bin_out.write((const char*)mMesh[i].Vertices.data(), vertex_data_size);
+		}
 		
 		meshData.Insert(L"IndexCount", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(mMesh[i].Indices.size())));
 		meshData.Insert(L"IndexOffset", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(offset)));
 		auto index_data_size = mMesh[i].Indices.size() * sizeof(uint32_t);
+		meshData.Insert(L"IndexHash", winrt::Windows::Data::Json::JsonValue::CreateStringValue(hashString(mMesh[i].Indices.data(), index_data_size)));
 		offset += index_data_size;
 		json_bin_out.write((const char*)mMesh[i].Indices.data(), index_data_size);
 
-		if (mMesh[i].BaseColor.BaseColorFactor.has_value()) {
-
-			auto texture_path = file_name_str + "\\Mesh" + std::to_string(i) + "BaseColor.png";
-			uint8_t* picData = new uint8_t[16 * 16 * 3]{};
-			for (int x = 0; x < 16; ++x) {
-				for (int y = 0; y < 16; ++y) {
-					auto factor_value = mMesh[i].BaseColor.BaseColorFactor.value();
-					picData[x * 48 + y * 3 + 0] = float_to_int_color(factor_value.x);
-					picData[x * 48 + y * 3 + 1] = float_to_int_color(factor_value.y);
-					picData[x * 48 + y * 3 + 2] = float_to_int_color(factor_value.z);
-				}
+		if (options.WritePositions) {
+			std::vector<uint32_t> position_indices;
+			auto positions = positionStream(mMesh[i], options.WeldPositions, position_indices);
+			meshData.Insert(L"PositionCount", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(positions.size())));
+			meshData.Insert(L"PositionOffset", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(offset)));
+			auto position_data_size = positions.size() * sizeof(VertexPosition);
+			meshData.Insert(L"PositionHash", winrt::Windows::Data::Json::JsonValue::CreateStringValue(hashString(positions.data(), position_data_size)));
+			offset += position_data_size;
+			json_bin_out.write((const char*)positions.data(), position_data_size);
+			if (options.WeldPositions) {
+				meshData.Insert(L"PositionIndexOffset", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(offset)));
+				auto position_index_size = position_indices.size() * sizeof(uint32_t);
+				meshData.Insert(L"PositionIndexHash", winrt::Windows::Data::Json::JsonValue::CreateStringValue(hashString(position_indices.data(), position_index_size)));
+				offset += position_index_size;
+				json_bin_out.write((const char*)position_indices.data(), position_index_size);
 			}
-			
-			stbi_write_png(texture_path.c_str(), 16, 16, 3, picData, 0);
-			auto json_tex_path = L"Mesh" + std::to_wstring(i) + L"BaseColor.png";
-			
-			meshData.Insert(L"BaseColorTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(json_tex_path));
-			delete []picData;
 		}
-		else {
-			auto texture_path = path.parent_path();
-			texture_path /= mMesh[i].BaseColor.FileName;
-			std::filesystem::copy(texture_path, file_name, std::filesystem::copy_options::skip_existing);
-			
-			auto json_filename = texture_path.filename();
-			auto json_tex_path = json_filename.wstring();
-			meshData.Insert(L"BaseColorTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(json_tex_path));
-		}
-
-		if (mMesh[i].MetallicRoughness.MetallicRoughnessFactor.has_value()) {
-			auto texture_path = file_name_str + "\\Mesh" + std::to_string(i) + "MetallicRoughness.png";
-			uint8_t* picData = new uint8_t[16 * 16 * 3]{};
-
-			for (int x = 0; x < 16; ++x) {
-				for (int y = 0; y < 16; ++y) {
-					auto factor_value = mMesh[i].MetallicRoughness.MetallicRoughnessFactor.value();
-					picData[x * 48 + y * 3 + 0] = float_to_int_color(factor_value.x);
-					picData[x * 48 + y * 3 + 1] = float_to_int_color(factor_value.y);
-					picData[x * 48 + y * 3 + 2] = 0;
-				}
-			}
-			stbi_write_png(texture_path.c_str(), 16, 16, 3, picData, 0);
-			auto json_tex_path = L"Mesh" + std::to_wstring(i) + L"MetallicRoughness.png";
 
-			meshData.Insert(L"MetallicRoughnessTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(json_tex_path));
-			delete[]picData;
+		if (!mMesh[i].LightmapUV.empty()) {
+			meshData.Insert(L"LightmapUVOffset", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(offset)));
+			auto uv_data_size = mMesh[i].LightmapUV.size() * sizeof(DirectX::XMFLOAT2);
+			meshData.Insert(L"LightmapUVHash", winrt::Windows::Data::Json::JsonValue::CreateStringValue(hashString(mMesh[i].LightmapUV.data(), uv_data_size)));
+			offset += uv_data_size;
+			json_bin_out.write((const char*)mMesh[i].LightmapUV.data(), uv_data_size);
 		}
-		else {
-			auto texture_path = path.parent_path();
-			texture_path /= mMesh[i].MetallicRoughness.FileName;
-			std::filesystem::copy(texture_path, file_name, std::filesystem::copy_options::skip_existing);
-
-			auto json_filename = texture_path.filename();
-			auto json_tex_path = json_filename.wstring();
-			meshData.Insert(L"MetallicRoughnessTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(json_tex_path));
-		}
-
-		if (mMesh[i].Normal.NormalFactor.has_value()) {
-			auto texture_path = file_name_str + "\\Mesh" + std::to_string(i) + "Normal.png";
-			uint8_t* picData = new uint8_t[16 * 16 * 3]{};
-
-			for (int x = 0; x < 16; ++x) {
-				for (int y = 0; y < 16; ++y) {
-					auto factor_value = mMesh[i].Normal.NormalFactor.value();
-					picData[x * 48 + y * 3 + 0] = float_to_int_color(factor_value.x);
-					picData[x * 48 + y * 3 + 1] = float_to_int_color(factor_value.y);
-					picData[x * 48 + y * 3 + 2] = float_to_int_color(factor_value.z);
-				}
-			}
-			stbi_write_png(texture_path.c_str(), 16, 16, 3, picData, 0);
-			auto json_tex_path = L"Mesh" + std::to_wstring(i) + L"Normal.png";
 
-			meshData.Insert(L"NormalTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(json_tex_path));
-			delete[]picData;
+		if (!mMesh[i].VertexAO.empty()) {
+			// Padded so that later sections stay four-byte aligned.
+			auto ao_data = mMesh[i].VertexAO;
+			ao_data.resize((ao_data.size() + 3) & ~size_t(3), 255);
+			meshData.Insert(L"VertexAOOffset", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(offset)));
+			meshData.Insert(L"VertexAOHash", winrt::Windows::Data::Json::JsonValue::CreateStringValue(hashString(mMesh[i].VertexAO.data(), mMesh[i].VertexAO.size())));
+			offset += ao_data.size();
+			json_bin_out.write((const char*)ao_data.data(), ao_data.size());
 		}
-		else {
-			auto texture_path = path.parent_path();
-			texture_path /= mMesh[i].Normal.FileName;
-			std::filesystem::copy(texture_path, file_name, std::filesystem::copy_options::skip_existing);
-			auto json_filename = texture_path.filename();
-			auto json_tex_path = json_filename.wstring();
-			meshData.Insert(L"NormalTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(json_tex_path));
-		}
-
-		if (mMesh[i].AO.AOFactor.has_value()) {
-			auto texture_path = file_name_str + "\\Mesh" + std::to_string(i) + "AO.png";
-			uint8_t* picData = new uint8_t[16 * 16 * 3]{};
-
-			for (int x = 0; x < 16; ++x) {
-				for (int y = 0; y < 16; ++y) {
-					auto factor_value = mMesh[i].AO.AOFactor.value();
-					picData[x * 48 + y * 3 + 0] = float_to_int_color(factor_value);
-					picData[x * 48 + y * 3 + 1] = 255;
-					picData[x * 48 + y * 3 + 2] = 255;
-				}
-			}
-			stbi_write_png(texture_path.c_str(), 16, 16, 3, picData, 0);
-			auto json_tex_path = L"Mesh" + std::to_wstring(i) + L"AO.png";
 
-			meshData.Insert(L"AOTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(json_tex_path));
-			delete[]picData;
+		if (options.WriteBvh) {
+			auto bvh_data = BuildSerializedBvh(meshTriangles(mMesh[i]), options.BvhWidth, options.QuantizeBvh);
+			meshData.Insert(L"BvhOffset", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(offset)));
+			meshData.Insert(L"BvhSize", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(bvh_data.size())));
+			meshData.Insert(L"BvhHash", winrt::Windows::Data::Json::JsonValue::CreateStringValue(hashString(bvh_data.data(), bvh_data.size())));
+			offset += bvh_data.size();
+			json_bin_out.write((const char*)bvh_data.data(), bvh_data.size());
+		}
+
+		if (options.WriteSdf) {
+			std::cout << "Building distance field for mesh " << i << std::endl;
+			auto sdf_data = BuildSerializedSdf(meshTriangles(mMesh[i]), options.Sdf);
+			meshData.Insert(L"SdfOffset", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(offset)));
+			meshData.Insert(L"SdfSize", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(sdf_data.size())));
+			meshData.Insert(L"SdfHash", winrt::Windows::Data::Json::JsonValue::CreateStringValue(hashString(sdf_data.data(), sdf_data.size())));
+			offset += sdf_data.size();
+			json_bin_out.write((const char*)sdf_data.data(), sdf_data.size());
+		}
+
+		if (options.WriteCollision) {
+			auto collision_data = SerializeCollisionHulls(collision_hulls[i]);
+			meshData.Insert(L"CollisionOffset", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(offset)));
+			meshData.Insert(L"CollisionSize", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(collision_data.size())));
+			meshData.Insert(L"CollisionHash", winrt::Windows::Data::Json::JsonValue::CreateStringValue(hashString(collision_data.data(), collision_data.size())));
+			meshData.Insert(L"CollisionHullCount", winrt::Windows::Data::Json::JsonValue::CreateStringValue(std::to_wstring(collision_hulls[i].size())));
+			offset += collision_data.size();
+			json_bin_out.write((const char*)collision_data.data(), collision_data.size());
+		}
+
+		if (lightmap_scene) {
+			bakeLightmap(context, lightmap_scene.value(), i, mMesh[i], meshData);
+		}
+		if (options.SurfaceMaps.Curvature || options.SurfaceMaps.Thickness) {
+			bakeSurfaceMaps(context, i, mMesh[i], meshData);
 		}
-		else {
-			auto texture_path = path.parent_path();
-			texture_path /= mMesh[i].AO.FileName;
-			std::filesystem::copy(texture_path, file_name, std::filesystem::copy_options::skip_existing);
 
-			auto json_filename = texture_path.filename();
-			auto json_tex_path = json_filename.wstring();
-			meshData.Insert(L"AOTexture", winrt::Windows::Data::Json::JsonValue::CreateStringValue(json_tex_path));
+		bakeTexture(context, i, TextureSlot::BaseColor, mMesh[i].BaseColor, meshData);
+		bakeTexture(context, i, TextureSlot::Normal, mMesh[i].Normal, meshData);
+		if (options.PackORM) {
+			bakeORMTexture(context, i, mMesh[i].AO, mMesh[i].MetallicRoughness, meshData);
+		}
+		else {
+			bakeTexture(context, i, TextureSlot::MetallicRoughness, mMesh[i].MetallicRoughness, meshData);
+			bakeTexture(context, i, TextureSlot::AO, mMesh[i].AO, meshData);
 		}
 
+		hashTextures(context, meshData);
 		mesh_attributes.InsertAt(i, meshData);
 	}
 	
 	json.Insert(L"MeshAttributes", mesh_attributes);
 
+	if (options.ThumbnailSize > 0 || options.WriteImpostor) {
+		renderPreviews(context, mMesh, json);
+	}
+	hashTextures(context, json);
+
 	auto jsonStr = json.Stringify();
 	auto json_s_Str = winrt::to_string(jsonStr);
 	json_file_out.write(json_s_Str.data(), json_s_Str.size());
+
+	std::vector<ManifestFields> mesh_fields;
+	for (uint32_t i = 0; i < mesh_attributes.Size(); ++i) {
+		mesh_fields.push_back(manifestFields(mesh_attributes.GetObjectAt(i)));
+	}
+	auto manifest_data = SerializeBinaryManifest(manifestFields(json), mesh_fields);
+	std::ofstream manifest_out(file_name_str + "\\" + file_name_str + ".bkm", std::fstream::out | std::fstream::binary);
+	manifest_out.write((const char*)manifest_data.data(), manifest_data.size());
+}
+
+std::optional<BlockQuality> parseQuality(const std::string& value) {
+	if (value == "fast") return BlockQuality::Fast;
+	if (value == "normal") return BlockQuality::Normal;
+	if (value == "high") return BlockQuality::High;
+	return std::nullopt;
+}
+
+std::optional<PngFilter> parsePngFilter(const std::string& value) {
+	if (value == "none") return PngFilter::None;
+	if (value == "sub") return PngFilter::Sub;
+	if (value == "up") return PngFilter::Up;
+	if (value == "average") return PngFilter::Average;
+	if (value == "paeth") return PngFilter::Paeth;
+	if (value == "adaptive") return PngFilter::Adaptive;
+	return std::nullopt;
 }
 
+std::optional<CollisionMode> parseCollisionMode(const std::string& value) {
+	if (value == "hull") return CollisionMode::Hull;
+	if (value == "decompose") return CollisionMode::Decompose;
+	return std::nullopt;
+}
+
+std::optional<BakeOptions> parseOptions(int argc, char* argv[], int first = 2) {
+	BakeOptions options;
+	for (int i = first; i < argc; ++i) {
+		std::string arg = argv[i];
+		bool has_value = i + 1 < argc;
+		if (arg == "--compress") {
+			options.CompressTextures = true;
+		}
+		else if (arg == "--pack-orm") {
+			options.PackORM = true;
+		}
+		else if (arg == "--compress-quality" && has_value) {
+			auto quality = parseQuality(argv[++i]);
+			if (!quality) {
+				std::cout << "Unknown compression quality " << argv[i] << std::endl;
+				return std::nullopt;
+			}
+			options.CompressionQuality = quality.value();
+		}
+		else if (arg.rfind("--max-size", 0) == 0 && has_value) {
+			int size = std::atoi(argv[++i]);
+			std::map<std::string, std::vector<TextureSlot>> targets = {
+				{ "--max-size", { TextureSlot::BaseColor, TextureSlot::MetallicRoughness, TextureSlot::Normal, TextureSlot::AO } },
+				{ "--max-size-basecolor", { TextureSlot::BaseColor } },
+				{ "--max-size-metallicroughness", { TextureSlot::MetallicRoughness } },
+				{ "--max-size-normal", { TextureSlot::Normal } },
+				{ "--max-size-ao", { TextureSlot::AO } },
+			};
+			auto target = targets.find(arg);
+			if (target == targets.end()) {
+				std::cout << "Unknown option " << arg << std::endl;
+				return std::nullopt;
+			}
+			for (auto slot : target->second) {
+				options.MaxTextureSize[slot] = size;
+			}
+		}
+		else if (arg == "--texture-budget" && has_value) {
+			options.TextureBudget = static_cast<size_t>(std::atof(argv[++i]) * 1024.0 * 1024.0);
+		}
+		else if (arg == "--container" && has_value) {
+			std::string value = argv[++i];
+			if (value == "dds") {
+				options.Container = ContainerFormat::DDS;
+			}
+			else if (value == "ktx2") {
+				options.Container = ContainerFormat::KTX2;
+			}
+			else {
+				std::cout << "Unknown container " << value << std::endl;
+				return std::nullopt;
+			}
+		}
+		else if (arg == "--basecolor-format" && has_value) {
+			std::string value = argv[++i];
+			if (value == "bc7") {
+				options.BaseColorFormat = BlockFormat::BC7;
+			}
+			else if (value == "bc1") {
+				options.BaseColorFormat = BlockFormat::BC1;
+			}
+			else {
+				std::cout << "Unknown base color format " << value << std::endl;
+				return std::nullopt;
+			}
+		}
+		else if (arg == "--bake-ao") {
+			options.BakeAO = true;
+		}
+		else if (arg == "--vertex-ao") {
+			options.VertexAO = true;
+		}
+		else if (arg == "--ao-size" && has_value) {
+			options.AO.Size = std::atoi(argv[++i]);
+			if (options.AO.Size <= 0) {
+				std::cout << "AO size must be positive" << std::endl;
+				return std::nullopt;
+			}
+		}
+		else if (arg == "--ao-samples" && has_value) {
+			options.AO.Samples = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--ao-distance" && has_value) {
+			options.AO.Distance = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (arg == "--high-poly" && has_value) {
+			options.HighPolyPath = argv[++i];
+		}
+		else if (arg == "--normal-size" && has_value) {
+			options.NormalBake.Size = std::atoi(argv[++i]);
+			if (options.NormalBake.Size <= 0) {
+				std::cout << "Normal map size must be positive" << std::endl;
+				return std::nullopt;
+			}
+		}
+		else if (arg == "--normal-distance" && has_value) {
+			options.NormalBake.Distance = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (arg == "--bvh") {
+			options.WriteBvh = true;
+		}
+		else if (arg == "--bvh-width" && has_value) {
+			options.BvhWidth = std::atoi(argv[++i]);
+			if (options.BvhWidth != 2 && options.BvhWidth != 4 && options.BvhWidth != 8) {
+				std::cout << "BVH width must be 2, 4 or 8" << std::endl;
+				return std::nullopt;
+			}
+		}
+		else if (arg == "--bvh-quantize") {
+			options.QuantizeBvh = true;
+		}
+		else if (arg == "--lightmap-uv") {
+			options.LightmapUV = true;
+		}
+		else if (arg == "--lightmap-size" && has_value) {
+			options.LightmapUv.Size = std::atoi(argv[++i]);
+			if (options.LightmapUv.Size <= 0) {
+				std::cout << "Lightmap size must be positive" << std::endl;
+				return std::nullopt;
+			}
+		}
+		else if (arg == "--lightmap-padding" && has_value) {
+			options.LightmapUv.Padding = std::max(std::atoi(argv[++i]), 0);
+		}
+		else if (arg == "--lightmap") {
+			options.BakeLightmaps = true;
+			options.LightmapUV = true;
+		}
+		else if (arg == "--lightmap-samples" && has_value) {
+			options.LightmapSamples = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--lightmap-bounces" && has_value) {
+			options.Lightmap.Bounces = std::max(std::atoi(argv[++i]), 0);
+		}
+		else if (arg == "--lightmap-time" && has_value) {
+			options.LightmapSeconds = std::atof(argv[++i]);
+		}
+		else if (arg == "--curvature") {
+			options.SurfaceMaps.Curvature = true;
+		}
+		else if (arg == "--curvature-range" && has_value) {
+			options.SurfaceMaps.CurvatureRange = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (arg == "--thickness") {
+			options.SurfaceMaps.Thickness = true;
+		}
+		else if (arg == "--thickness-samples" && has_value) {
+			options.SurfaceMaps.ThicknessSamples = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--thickness-distance" && has_value) {
+			options.SurfaceMaps.ThicknessDistance = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (arg == "--surface-map-size" && has_value) {
+			options.SurfaceMaps.Size = std::atoi(argv[++i]);
+			if (options.SurfaceMaps.Size <= 0) {
+				std::cout << "Surface map size must be positive" << std::endl;
+				return std::nullopt;
+			}
+		}
+		else if (arg == "--sdf") {
+			options.WriteSdf = true;
+		}
+		else if (arg == "--sdf-sparse") {
+			options.WriteSdf = true;
+			options.Sdf.Sparse = true;
+		}
+		else if (arg == "--sdf-voxel" && has_value) {
+			options.Sdf.VoxelSize = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (arg == "--sdf-range" && has_value) {
+			options.Sdf.MaxDistance = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (arg == "--collision" && has_value) {
+			auto mode = parseCollisionMode(argv[++i]);
+			if (!mode) {
+				std::cout << "Unknown collision mode " << argv[i] << std::endl;
+				return std::nullopt;
+			}
+			options.WriteCollision = true;
+			options.Collision.Mode = mode.value();
+		}
+		else if (arg == "--collision-resolution" && has_value) {
+			options.Collision.Resolution = std::max(std::atoi(argv[++i]), 2);
+		}
+		else if (arg == "--collision-max-hulls" && has_value) {
+			options.Collision.MaxHulls = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--collision-concavity" && has_value) {
+			options.Collision.MaxConcavity = static_cast<float>(std::atof(argv[++i]));
+		}
+		else if (arg == "--collision-hull-vertices" && has_value) {
+			options.Collision.MaxHullVertices = std::max(std::atoi(argv[++i]), 4);
+		}
+		else if (arg == "--page-align") {
+			options.PageAlign = true;
+		}
+		else if (arg == "--positions") {
+			options.WritePositions = true;
+		}
+		else if (arg == "--positions-only") {
+			options.WritePositions = true;
+			options.PositionsOnly = true;
+		}
+		else if (arg == "--weld-positions") {
+			options.WritePositions = true;
+			options.WeldPositions = true;
+		}
+		else if (arg == "--progressive") {
+			options.Progressive = true;
+		}
+		else if (arg == "--progressive-levels" && has_value) {
+			options.Progressive = true;
+			options.ProgressiveLevels.Levels = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--progressive-resolution" && has_value) {
+			options.Progressive = true;
+			options.ProgressiveLevels.Resolution = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--thumbnail" && has_value) {
+			options.ThumbnailSize = std::atoi(argv[++i]);
+			if (options.ThumbnailSize <= 0) {
+				std::cout << "Thumbnail size must be positive" << std::endl;
+				return std::nullopt;
+			}
+		}
+		else if (arg == "--impostor") {
+			options.WriteImpostor = true;
+		}
+		else if (arg == "--impostor-views" && has_value) {
+			options.ImpostorViews = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--impostor-cell" && has_value) {
+			options.ImpostorCellSize = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--png-level" && has_value) {
+			options.Png.Level = std::atoi(argv[++i]);
+			if (options.Png.Level < 0 || options.Png.Level > 9) {
+				std::cout << "PNG level must be between 0 and 9" << std::endl;
+				return std::nullopt;
+			}
+		}
+		else if (arg == "--png-filter" && has_value) {
+			auto filter = parsePngFilter(argv[++i]);
+			if (!filter) {
+				std::cout << "Unknown PNG filter " << argv[i] << std::endl;
+				return std::nullopt;
+			}
+			options.Png.Filter = filter.value();
+		}
+		else {
+			std::cout << "Unknown option " << arg << std::endl;
+			return std::nullopt;
+		}
+	}
+	if (options.QuantizeBvh && options.BvhWidth == 2) {
+		std::cout << "Quantized BVH needs width 4 or 8" << std::endl;
+		return std::nullopt;
+	}
+	if (options.PositionsOnly && options.Progressive) {
+		std::cout << "Progressive levels need the vertex stream, which --positions-only leaves out" << std::endl;
+		return std::nullopt;
+	}
+	return options;
+}
+
+// Imports the model and bakes it into a directory named after it.
+bool bakeModelFile(const std::string& file, const BakeOptions& options) {
+	Assimp::Importer importer;
+	std::vector<Mesh> mMesh;
+	unsigned int flags = aiProcess_Triangulate | aiProcess_GenNormals;
+	if (!options.HighPolyPath.empty()) {
+		flags |= aiProcess_CalcTangentSpace;
+	}
+	const aiScene* scene = importer.ReadFile(file, flags);
+	std::filesystem::path my_path{ file };
+	if (scene) {
+		processNode(mMesh, scene->mRootNode, scene);
+	}
+
+	std::vector<SceneLight> lights;
+	if (scene) {
+		lights = readLights(scene);
+	}
+
+	std::vector<Mesh> high_poly;
+	if (!options.HighPolyPath.empty()) {
+		Assimp::Importer high_importer;
+		const aiScene* high_scene = high_importer.ReadFile(options.HighPolyPath, aiProcess_Triangulate | aiProcess_GenNormals);
+		if (!high_scene) {
+			std::cout << "Failed to read high-poly model " << options.HighPolyPath << std::endl;
+			return false;
+		}
+		processNode(high_poly, high_scene->mRootNode, high_scene);
+	}
+
+	Bake(my_path, mMesh, high_poly, lights, options);
+	return true;
+}
+
+// BakeModel --pack <archive> <model or baked directory>... [options]
+// Models are baked with the options first; directories are packed as they
+// are.
+int packModels(int argc, char* argv[]) {
+	if (argc < 4) {
+		std::cout << "Need an archive name and models to pack." << std::endl;
+		return 0;
+	}
+	int first_option = 3;
+	while (first_option < argc && std::string(argv[first_option]).rfind("--", 0) != 0) {
+		++first_option;
+	}
+	auto options = parseOptions(argc, argv, first_option);
+	if (!options) {
+		return 0;
+	}
+	std::vector<std::filesystem::path> model_dirs;
+	for (int i = 3; i < first_option; ++i) {
+		std::filesystem::path input{ argv[i] };
+		if (std::filesystem::is_directory(input)) {
+			model_dirs.push_back(input);
+			continue;
+		}
+		std::cout << "Baking " << input.string() << std::endl;
+		if (!bakeModelFile(input.string(), options.value())) {
+			return 1;
+		}
+		model_dirs.push_back(input.stem());
+	}
+	// WritePack has already said what failed.
+	return WritePack(argv[2], std::move(model_dirs)) ? 0 : 1;
+}
 
 int main(int argc, char* argv[])
 {
 	winrt::init_apartment();
 
-	Assimp::Importer importer;
-	const aiScene* scene = nullptr;
-	if (argc >= 2) {
-		scene = importer.ReadFile(argv[1], aiProcess_Triangulate | aiProcess_GenNormals);
+	if (argc >= 2 && std::string(argv[1]) == "--pack") {
+		return packModels(argc, argv);
 	}
-	else {
+	if (argc < 2) {
 		std::cout << "Need file name." << std::endl;
 		return 0;
 	}
-	std::vector<Mesh> mMesh;
-	scene = importer.ReadFile(argv[1], aiProcess_Triangulate | aiProcess_GenNormals);
-	std::filesystem::path my_path{ argv[1] };
-	if (scene) {
-		processNode(mMesh, scene->mRootNode, scene);
+	auto options = parseOptions(argc, argv);
+	if (!options) {
+		return 0;
 	}
-
-	Bake(my_path, mMesh);
+	bakeModelFile(argv[1], options.value());
 
 	return 0;
 }
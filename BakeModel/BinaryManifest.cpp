@@ -0,0 +1,134 @@
+﻿#include "BinaryManifest.h"
+
+#include "../BakeLoader/BakeFormat.h"
+
+#include <charconv>
+#include <cstring>
+#include <string>
+
+uint32_t StringTable::Add(std::string_view text) {
+	auto found = Offsets.find(text);
+	if (found != Offsets.end()) {
+		return found->second;
+	}
+	auto offset = static_cast<uint32_t>(Data.size());
+	Data.insert(Data.end(), text.begin(), text.end());
+	Data.push_back('\0');
+	Offsets.emplace(std::string(text), offset);
+	return offset;
+}
+
+namespace {
+
+bool isRecordField(std::string_view key) {
+	for (const auto& field : BAKE_RECORD_FIELDS) {
+		if (key == field.Key) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// LevelCount and the Level<n> fields, which go into the level records.
+bool isLevelField(std::string_view key) {
+	if (key == "LevelCount") {
+		return true;
+	}
+	if (key.rfind("Level", 0) != 0) {
+		return false;
+	}
+	size_t end = 5;
+	while (end < key.size() && key[end] >= '0' && key[end] <= '9') {
+		++end;
+	}
+	if (end == 5) {
+		return false;
+	}
+	for (const auto& field : BAKE_LEVEL_FIELDS) {
+		if (key.substr(end) == field.Key) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Parsed here rather than with ManifestInteger, which lives in BakeLoader.
+uint64_t recordValue(const ManifestFields& fields, const std::string& key) {
+	auto found = fields.find(key);
+	uint64_t value = BAKE_ABSENT;
+	if (found == fields.end()) {
+		return value;
+	}
+	const auto& text = found->second;
+	auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+	return error == std::errc() && end == text.data() + text.size() ? value : BAKE_ABSENT;
+}
+
+size_t alignUp(size_t value) {
+	return (value + 7) & ~size_t(7);
+}
+
+template <typename T>
+void write(std::vector<uint8_t>& out, size_t offset, const T* data, size_t count) {
+	std::memcpy(out.data() + offset, data, count * sizeof(T));
+}
+
+}
+
+std::vector<uint8_t> SerializeBinaryManifest(const ManifestFields& fields, std::span<const ManifestFields> meshes) {
+	StringTable strings;
+	std::vector<BakeManifestField> table;
+	for (const auto& [key, value] : fields) {
+		if (key != "MeshCount") {
+			table.push_back({ strings.Add(key), strings.Add(value) });
+		}
+	}
+	auto model_field_count = static_cast<uint32_t>(table.size());
+
+	std::vector<BakeMeshRecord> records(meshes.size());
+	std::vector<BakeLevelRecord> levels;
+	for (size_t i = 0; i < meshes.size(); ++i) {
+		auto& record = records[i];
+		for (const auto& field : BAKE_RECORD_FIELDS) {
+			record.*field.Member = recordValue(meshes[i], field.Key);
+		}
+		record.FirstLevel = static_cast<uint32_t>(levels.size());
+		auto level_count = recordValue(meshes[i], "LevelCount");
+		for (uint64_t n = 0; level_count != BAKE_ABSENT && n < level_count; ++n) {
+			BakeLevelRecord level;
+			for (const auto& field : BAKE_LEVEL_FIELDS) {
+				level.*field.Member = recordValue(meshes[i], "Level" + std::to_string(n) + field.Key);
+			}
+			levels.push_back(level);
+		}
+		record.LevelCount = static_cast<uint32_t>(levels.size()) - record.FirstLevel;
+		record.FirstField = static_cast<uint32_t>(table.size());
+		for (const auto& [key, value] : meshes[i]) {
+			if (!isRecordField(key) && !isLevelField(key)) {
+				table.push_back({ strings.Add(key), strings.Add(value) });
+			}
+		}
+		record.FieldCount = static_cast<uint32_t>(table.size()) - record.FirstField;
+	}
+
+	BakeManifestHeader header = {};
+	std::memcpy(header.Magic, BAKE_MANIFEST_MAGIC, sizeof(header.Magic));
+	header.Version = BAKE_MANIFEST_VERSION;
+	header.MeshCount = static_cast<uint32_t>(records.size());
+	header.ModelFieldCount = model_field_count;
+	header.FieldCount = static_cast<uint32_t>(table.size());
+	header.StringTableSize = static_cast<uint32_t>(strings.Data.size());
+	header.LevelCount = static_cast<uint32_t>(levels.size());
+	header.MeshTableOffset = alignUp(sizeof(header));
+	header.LevelTableOffset = alignUp(header.MeshTableOffset + records.size() * sizeof(BakeMeshRecord));
+	header.FieldTableOffset = alignUp(header.LevelTableOffset + levels.size() * sizeof(BakeLevelRecord));
+	header.StringTableOffset = alignUp(header.FieldTableOffset + table.size() * sizeof(BakeManifestField));
+
+	std::vector<uint8_t> out(alignUp(header.StringTableOffset + strings.Data.size()));
+	write(out, 0, &header, 1);
+	write(out, header.MeshTableOffset, records.data(), records.size());
+	write(out, header.LevelTableOffset, levels.data(), levels.size());
+	write(out, header.FieldTableOffset, table.data(), table.size());
+	write(out, header.StringTableOffset, strings.Data.data(), strings.Data.size());
+	return out;
+}
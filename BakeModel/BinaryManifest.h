@@ -0,0 +1,27 @@
+﻿#pragma once
+
+#include "../BakeLoader/Manifest.h"
+
+#include <cstdint>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// NUL-terminated strings stored once each, starting with the empty string at
+// offset 0, as the string tables of the .bkm and of packs hold them.
+struct StringTable {
+	std::vector<char> Data{ '\0' };
+	std::map<std::string, uint32_t, std::less<>> Offsets{ { "", 0 } };
+
+	// The offset of text, added if it is new.
+	uint32_t Add(std::string_view text);
+};
+
+// Flattens the manifest into the .bkm layout of BakeFormat.h. Fields listed
+// in BAKE_RECORD_FIELDS go into the mesh records, absent ones as BAKE_ABSENT,
+// and the LevelCount levels of a mesh into level records from their Level<n>
+// fields; every other field is kept as a string. Equal strings are stored
+// once.
+std::vector<uint8_t> SerializeBinaryManifest(const ManifestFields& fields, std::span<const ManifestFields> meshes);
@@ -0,0 +1,702 @@
+﻿#include "BlockCompression.h"
+#include "../BakeRender/Parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+using Block = std::array<std::array<uint8_t, 4>, 16>;
+
+constexpr uint16_t BC7_PARTITIONS2[64] = {
+	0xCCCC, 0x8888, 0xEEEE, 0xECC8, 0xC880, 0xFEEC, 0xFEC8, 0xEC80,
+	0xC800, 0xFFEC, 0xFE80, 0xE800, 0xFFE8, 0xFF00, 0xFFF0, 0xF000,
+	0xF710, 0x008E, 0x7100, 0x08CE, 0x008C, 0x7310, 0x3100, 0x8CCE,
+	0x088C, 0x3110, 0x6666, 0x366C, 0x17E8, 0x0FF0, 0x718E, 0x399C,
+	0xAAAA, 0xF0F0, 0x5A5A, 0x33CC, 0x3C3C, 0x55AA, 0x9696, 0xA55A,
+	0x73CE, 0x13C8, 0x324C, 0x3BDC, 0x6996, 0xC33C, 0x9966, 0x0660,
+	0x0272, 0x04E4, 0x4E40, 0x2720, 0xC936, 0x936C, 0x39C6, 0x639C,
+	0x9336, 0x9CC6, 0x817E, 0xE718, 0xCCF0, 0x0FCC, 0x7744, 0xEE22,
+};
+
+constexpr uint8_t BC7_ANCHORS2[64] = {
+	15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+	15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+	15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+	 6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15,
+};
+
+constexpr int BC7_WEIGHTS3[8] = { 0, 9, 18, 27, 37, 46, 55, 64 };
+constexpr int BC7_WEIGHTS4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct Endpoints {
+	float Low[4];
+	float High[4];
+};
+
+struct BitWriter {
+	uint8_t* Out;
+	int Position = 0;
+
+	void Write(uint32_t value, int bits) {
+		for (int i = 0; i < bits; ++i, ++Position) {
+			if ((value >> i) & 1) {
+				Out[Position >> 3] |= static_cast<uint8_t>(1 << (Position & 7));
+			}
+		}
+	}
+};
+
+Block fetchBlock(const Image& image, int block_x, int block_y) {
+	Block block{};
+	int channels = std::min(image.Channels, 4);
+	for (int y = 0; y < 4; ++y) {
+		for (int x = 0; x < 4; ++x) {
+			const uint8_t* texel = image.Texel(std::min(block_x * 4 + x, image.Width - 1), std::min(block_y * 4 + y, image.Height - 1));
+			auto& color = block[y * 4 + x];
+			color = { 0, 0, 0, 255 };
+			std::copy(texel, texel + channels, color.begin());
+		}
+	}
+	return block;
+}
+
+float channelError(const uint8_t* a, const int* b, int channels) {
+	float error = 0.f;
+	for (int c = 0; c < channels; ++c) {
+		float d = static_cast<float>(a[c]) - static_cast<float>(b[c]);
+		error += d * d;
+	}
+	return error;
+}
+
+// Fits a line through the member texels using the principal axis of their
+// covariance and returns the extremes of their projections on it.
+Endpoints fitLine(const Block& block, const uint8_t* members, int count, int channels, float* residual = nullptr) {
+	float mean[4] = {};
+	for (int i = 0; i < count; ++i) {
+		for (int c = 0; c < channels; ++c) {
+			mean[c] += block[members[i]][c];
+		}
+	}
+	for (int c = 0; c < channels; ++c) {
+		mean[c] /= static_cast<float>(count);
+	}
+
+	float covariance[4][4] = {};
+	for (int i = 0; i < count; ++i) {
+		float d[4] = {};
+		for (int c = 0; c < channels; ++c) {
+			d[c] = block[members[i]][c] - mean[c];
+		}
+		for (int r = 0; r < channels; ++r) {
+			for (int c = 0; c < channels; ++c) {
+				covariance[r][c] += d[r] * d[c];
+			}
+		}
+	}
+
+	float axis[4] = { 1.f, 1.f, 1.f, 1.f };
+	float eigenvalue = 0.f;
+	for (int iteration = 0; iteration < 8; ++iteration) {
+		float next[4] = {};
+		for (int r = 0; r < channels; ++r) {
+			for (int c = 0; c < channels; ++c) {
+				next[r] += covariance[r][c] * axis[c];
+			}
+		}
+		float length = 0.f;
+		for (int c = 0; c < channels; ++c) {
+			length += next[c] * next[c];
+		}
+		length = std::sqrt(length);
+		if (length < 1e-6f) {
+			std::fill(std::begin(axis), std::end(axis), 0.f);
+			eigenvalue = 0.f;
+			break;
+		}
+		for (int c = 0; c < channels; ++c) {
+			axis[c] = next[c] / length;
+		}
+		eigenvalue = length;
+	}
+	if (residual) {
+		float trace = 0.f;
+		for (int c = 0; c < channels; ++c) {
+			trace += covariance[c][c];
+		}
+		*residual = std::max(trace - eigenvalue, 0.f);
+	}
+
+	float t_min = 0.f, t_max = 0.f;
+	for (int i = 0; i < count; ++i) {
+		float t = 0.f;
+		for (int c = 0; c < channels; ++c) {
+			t += (block[members[i]][c] - mean[c]) * axis[c];
+		}
+		t_min = std::min(t_min, t);
+		t_max = std::max(t_max, t);
+	}
+
+	Endpoints endpoints{};
+	for (int c = 0; c < channels; ++c) {
+		endpoints.Low[c] = std::clamp(mean[c] + axis[c] * t_min, 0.f, 255.f);
+		endpoints.High[c] = std::clamp(mean[c] + axis[c] * t_max, 0.f, 255.f);
+	}
+	return endpoints;
+}
+
+// Least-squares endpoints for texels reconstructed as low + (high - low) * w.
+bool refineEndpoints(const Block& block, const uint8_t* members, int count, int channels, const float* weights, Endpoints& endpoints) {
+	float aa = 0.f, ab = 0.f, bb = 0.f;
+	float ax[4] = {}, bx[4] = {};
+	for (int i = 0; i < count; ++i) {
+		float b = weights[i];
+		float a = 1.f - b;
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+		for (int c = 0; c < channels; ++c) {
+			ax[c] += a * block[members[i]][c];
+			bx[c] += b * block[members[i]][c];
+		}
+	}
+	float determinant = aa * bb - ab * ab;
+	if (std::fabs(determinant) < 1e-6f) {
+		return false;
+	}
+	for (int c = 0; c < channels; ++c) {
+		endpoints.Low[c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.f, 255.f);
+		endpoints.High[c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.f, 255.f);
+	}
+	return true;
+}
+
+int refinementPasses(BlockQuality quality) {
+	switch (quality) {
+	case BlockQuality::Fast: return 0;
+	case BlockQuality::Normal: return 2;
+	default: return 6;
+	}
+}
+
+// BC1
+
+uint16_t packColor565(const int* color) {
+	return static_cast<uint16_t>((color[0] << 11) | (color[1] << 5) | color[2]);
+}
+
+void quantize565(const float* color, int* quantized) {
+	quantized[0] = std::clamp(static_cast<int>(std::lround(color[0] * 31.f / 255.f)), 0, 31);
+	quantized[1] = std::clamp(static_cast<int>(std::lround(color[1] * 63.f / 255.f)), 0, 63);
+	quantized[2] = std::clamp(static_cast<int>(std::lround(color[2] * 31.f / 255.f)), 0, 31);
+}
+
+void expand565(const int* quantized, int* color) {
+	color[0] = (quantized[0] << 3) | (quantized[0] >> 2);
+	color[1] = (quantized[1] << 2) | (quantized[1] >> 4);
+	color[2] = (quantized[2] << 3) | (quantized[2] >> 2);
+}
+
+struct BC1Result {
+	int Color0[3];
+	int Color1[3];
+	uint8_t Indices[16];
+	float Error;
+};
+
+// Evaluates a pair of 565 endpoints in four-color mode.
+BC1Result evaluateBC1(const Block& block, const int* q0, const int* q1) {
+	BC1Result result{};
+	std::copy(q0, q0 + 3, result.Color0);
+	std::copy(q1, q1 + 3, result.Color1);
+	if (packColor565(result.Color0) < packColor565(result.Color1)) {
+		std::swap(result.Color0, result.Color1);
+	}
+
+	int palette[4][3];
+	expand565(result.Color0, palette[0]);
+	expand565(result.Color1, palette[1]);
+	for (int c = 0; c < 3; ++c) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+	int palette_size = packColor565(result.Color0) == packColor565(result.Color1) ? 1 : 4;
+
+	for (int i = 0; i < 16; ++i) {
+		float best = std::numeric_limits<float>::max();
+		for (int p = 0; p < palette_size; ++p) {
+			float error = channelError(block[i].data(), palette[p], 3);
+			if (error < best) {
+				best = error;
+				result.Indices[i] = static_cast<uint8_t>(p);
+			}
+		}
+		result.Error += best;
+	}
+	return result;
+}
+
+void encodeBC1(const Block& block, BlockQuality quality, uint8_t* out) {
+	uint8_t members[16];
+	std::iota(std::begin(members), std::end(members), uint8_t(0));
+	Endpoints endpoints = fitLine(block, members, 16, 3);
+
+	int q0[3], q1[3];
+	quantize565(endpoints.High, q0);
+	quantize565(endpoints.Low, q1);
+	BC1Result best = evaluateBC1(block, q0, q1);
+
+	constexpr float INDEX_WEIGHTS[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+	for (int pass = 0; pass < refinementPasses(quality); ++pass) {
+		float weights[16];
+		for (int i = 0; i < 16; ++i) {
+			weights[i] = INDEX_WEIGHTS[best.Indices[i]];
+		}
+		Endpoints refined{};
+		if (!refineEndpoints(block, members, 16, 3, weights, refined)) {
+			break;
+		}
+		quantize565(refined.Low, q0);
+		quantize565(refined.High, q1);
+		BC1Result candidate = evaluateBC1(block, q0, q1);
+		if (candidate.Error >= best.Error) {
+			break;
+		}
+		best = candidate;
+	}
+
+	if (quality == BlockQuality::High) {
+		constexpr int LIMITS[3] = { 31, 63, 31 };
+		bool improved = true;
+		for (int pass = 0; pass < 4 && improved; ++pass) {
+			improved = false;
+			for (int component = 0; component < 6; ++component) {
+				for (int delta : { -1, 1 }) {
+					std::copy(best.Color0, best.Color0 + 3, q0);
+					std::copy(best.Color1, best.Color1 + 3, q1);
+					int* target = component < 3 ? &q0[component] : &q1[component - 3];
+					*target = std::clamp(*target + delta, 0, LIMITS[component % 3]);
+					BC1Result candidate = evaluateBC1(block, q0, q1);
+					if (candidate.Error < best.Error) {
+						best = candidate;
+						improved = true;
+					}
+				}
+			}
+		}
+	}
+
+	uint16_t color0 = packColor565(best.Color0);
+	uint16_t color1 = packColor565(best.Color1);
+	uint32_t indices = 0;
+	for (int i = 0; i < 16; ++i) {
+		indices |= static_cast<uint32_t>(best.Indices[i]) << (i * 2);
+	}
+	out[0] = static_cast<uint8_t>(color0);
+	out[1] = static_cast<uint8_t>(color0 >> 8);
+	out[2] = static_cast<uint8_t>(color1);
+	out[3] = static_cast<uint8_t>(color1 >> 8);
+	std::memcpy(out + 4, &indices, 4);
+}
+
+// BC4
+
+struct BC4Result {
+	int Endpoint0;
+	int Endpoint1;
+	uint8_t Indices[16];
+	float Error;
+};
+
+BC4Result evaluateBC4(const uint8_t* values, int e0, int e1) {
+	BC4Result result{};
+	result.Endpoint0 = e0;
+	result.Endpoint1 = e1;
+
+	int palette[8];
+	palette[0] = e0;
+	palette[1] = e1;
+	if (e0 > e1) {
+		for (int i = 2; i < 8; ++i) {
+			palette[i] = ((8 - i) * e0 + (i - 1) * e1 + 3) / 7;
+		}
+	}
+	else {
+		for (int i = 2; i < 6; ++i) {
+			palette[i] = ((6 - i) * e0 + (i - 1) * e1 + 2) / 5;
+		}
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+
+	for (int i = 0; i < 16; ++i) {
+		int best = std::numeric_limits<int>::max();
+		for (int p = 0; p < 8; ++p) {
+			int d = values[i] - palette[p];
+			if (d * d < best) {
+				best = d * d;
+				result.Indices[i] = static_cast<uint8_t>(p);
+			}
+		}
+		result.Error += static_cast<float>(best);
+	}
+	return result;
+}
+
+void encodeBC4(const uint8_t* values, BlockQuality quality, uint8_t* out) {
+	int min_value = 255, max_value = 0;
+	int inner_min = 255, inner_max = 0;
+	for (int i = 0; i < 16; ++i) {
+		min_value = std::min<int>(min_value, values[i]);
+		max_value = std::max<int>(max_value, values[i]);
+		if (values[i] != 0 && values[i] != 255) {
+			inner_min = std::min<int>(inner_min, values[i]);
+			inner_max = std::max<int>(inner_max, values[i]);
+		}
+	}
+
+	BC4Result best = evaluateBC4(values, max_value, min_value);
+	if (quality != BlockQuality::Fast) {
+		if (inner_min <= inner_max) {
+			BC4Result candidate = evaluateBC4(values, inner_min, inner_max);
+			if (candidate.Error < best.Error) {
+				best = candidate;
+			}
+		}
+
+		for (int pass = 0; pass < refinementPasses(quality) && best.Endpoint0 > best.Endpoint1; ++pass) {
+			float aa = 0.f, ab = 0.f, bb = 0.f, ax = 0.f, bx = 0.f;
+			for (int i = 0; i < 16; ++i) {
+				int index = best.Indices[i];
+				float b = index == 0 ? 0.f : index == 1 ? 1.f : (index - 1) / 7.f;
+				float a = 1.f - b;
+				aa += a * a;
+				ab += a * b;
+				bb += b * b;
+				ax += a * values[i];
+				bx += b * values[i];
+			}
+			float determinant = aa * bb - ab * ab;
+			if (std::fabs(determinant) < 1e-6f) {
+				break;
+			}
+			int e0 = std::clamp(static_cast<int>(std::lround((bb * ax - ab * bx) / determinant)), 0, 255);
+			int e1 = std::clamp(static_cast<int>(std::lround((aa * bx - ab * ax) / determinant)), 0, 255);
+			if (e0 < e1) {
+				std::swap(e0, e1);
+			}
+			if (e0 == e1) {
+				e0 < 255 ? ++e0 : --e1;
+			}
+			BC4Result candidate = evaluateBC4(values, e0, e1);
+			if (candidate.Error >= best.Error) {
+				break;
+			}
+			best = candidate;
+		}
+
+		if (quality == BlockQuality::High) {
+			bool improved = true;
+			for (int pass = 0; pass < 8 && improved; ++pass) {
+				improved = false;
+				for (int endpoint = 0; endpoint < 2; ++endpoint) {
+					for (int delta : { -1, 1 }) {
+						int e[2] = { best.Endpoint0, best.Endpoint1 };
+						e[endpoint] = std::clamp(e[endpoint] + delta, 0, 255);
+						// Keep the interpolation mode of the current best.
+						if ((e[0] > e[1]) != (best.Endpoint0 > best.Endpoint1)) {
+							continue;
+						}
+						BC4Result candidate = evaluateBC4(values, e[0], e[1]);
+						if (candidate.Error < best.Error) {
+							best = candidate;
+							improved = true;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	out[0] = static_cast<uint8_t>(best.Endpoint0);
+	out[1] = static_cast<uint8_t>(best.Endpoint1);
+	uint64_t indices = 0;
+	for (int i = 0; i < 16; ++i) {
+		indices |= static_cast<uint64_t>(best.Indices[i]) << (i * 3);
+	}
+	for (int i = 0; i < 6; ++i) {
+		out[2 + i] = static_cast<uint8_t>(indices >> (i * 8));
+	}
+}
+
+void encodeBC4Channel(const Block& block, int channel, BlockQuality quality, uint8_t* out) {
+	uint8_t values[16];
+	for (int i = 0; i < 16; ++i) {
+		values[i] = block[i][channel];
+	}
+	encodeBC4(values, quality, out);
+}
+
+// BC7, modes 1 and 6
+
+int interpolateBC7(int e0, int e1, int weight) {
+	return ((64 - weight) * e0 + weight * e1 + 32) >> 6;
+}
+
+struct BC7Subset {
+	int Endpoint0[4];
+	int Endpoint1[4];
+	int Quantized0[4];
+	int Quantized1[4];
+	int PBit0;
+	int PBit1;
+	uint8_t Indices[16];
+	float Error;
+};
+
+// Quantizes endpoints to (bits + 1) bits with a p-bit, assigns indices and
+// measures the error of the member texels. shared_pbit forces both endpoints
+// to use the same p-bit (mode 1).
+BC7Subset evaluateBC7Subset(const Block& block, const uint8_t* members, int count, const Endpoints& endpoints, int channels, int bits, int pbit0, int pbit1, int index_bits) {
+	BC7Subset subset{};
+	subset.PBit0 = pbit0;
+	subset.PBit1 = pbit1;
+	int max_value = (1 << bits) - 1;
+	for (int c = 0; c < 4; ++c) {
+		if (c >= channels) {
+			subset.Endpoint0[c] = subset.Endpoint1[c] = 255;
+			continue;
+		}
+		subset.Quantized0[c] = std::clamp(static_cast<int>(std::lround((endpoints.Low[c] - pbit0 * (1 << (7 - bits))) / (1 << (8 - bits)))), 0, max_value);
+		subset.Quantized1[c] = std::clamp(static_cast<int>(std::lround((endpoints.High[c] - pbit1 * (1 << (7 - bits))) / (1 << (8 - bits)))), 0, max_value);
+		int value0 = (subset.Quantized0[c] << 1) | pbit0;
+		int value1 = (subset.Quantized1[c] << 1) | pbit1;
+		subset.Endpoint0[c] = (value0 << (7 - bits)) | (value0 >> (2 * bits + 2 - 8));
+		subset.Endpoint1[c] = (value1 << (7 - bits)) | (value1 >> (2 * bits + 2 - 8));
+	}
+
+	const int* weights = index_bits == 3 ? BC7_WEIGHTS3 : BC7_WEIGHTS4;
+	int palette_size = 1 << index_bits;
+	int palette[16][4];
+	for (int p = 0; p < palette_size; ++p) {
+		for (int c = 0; c < 4; ++c) {
+			palette[p][c] = interpolateBC7(subset.Endpoint0[c], subset.Endpoint1[c], weights[p]);
+		}
+	}
+
+	for (int i = 0; i < count; ++i) {
+		float best = std::numeric_limits<float>::max();
+		for (int p = 0; p < palette_size; ++p) {
+			float error = channelError(block[members[i]].data(), palette[p], 4);
+			if (error < best) {
+				best = error;
+				subset.Indices[i] = static_cast<uint8_t>(p);
+			}
+		}
+		subset.Error += best;
+	}
+	return subset;
+}
+
+BC7Subset encodeBC7Subset(const Block& block, const uint8_t* members, int count, int channels, int bits, bool shared_pbit, int index_bits, BlockQuality quality) {
+	Endpoints endpoints = fitLine(block, members, count, channels);
+	const int* weights = index_bits == 3 ? BC7_WEIGHTS3 : BC7_WEIGHTS4;
+
+	BC7Subset best{};
+	best.Error = std::numeric_limits<float>::max();
+	for (int pass = 0; pass <= refinementPasses(quality); ++pass) {
+		bool improved = false;
+		for (int pbits = 0; pbits < 4; ++pbits) {
+			int pbit0 = pbits & 1;
+			int pbit1 = pbits >> 1;
+			if (shared_pbit && pbit0 != pbit1) {
+				continue;
+			}
+			BC7Subset candidate = evaluateBC7Subset(block, members, count, endpoints, channels, bits, pbit0, pbit1, index_bits);
+			if (candidate.Error < best.Error) {
+				best = candidate;
+				improved = true;
+			}
+		}
+		if (!improved || best.Error == 0.f) {
+			break;
+		}
+
+		float texel_weights[16];
+		for (int i = 0; i < count; ++i) {
+			texel_weights[i] = weights[best.Indices[i]] / 64.f;
+		}
+		if (!refineEndpoints(block, members, count, channels, texel_weights, endpoints)) {
+			break;
+		}
+	}
+	return best;
+}
+
+// Swaps the endpoints of a subset so that the index of its anchor texel has
+// a zero most significant bit, which the format leaves implicit.
+void fixAnchor(BC7Subset& subset, int anchor_member, int index_bits) {
+	int half = 1 << (index_bits - 1);
+	if (subset.Indices[anchor_member] < half) {
+		return;
+	}
+	std::swap(subset.Quantized0, subset.Quantized1);
+	std::swap(subset.PBit0, subset.PBit1);
+	for (auto& index : subset.Indices) {
+		index = static_cast<uint8_t>((1 << index_bits) - 1 - index);
+	}
+}
+
+float encodeBC7Mode6(const Block& block, BlockQuality quality, uint8_t* out) {
+	uint8_t members[16];
+	std::iota(std::begin(members), std::end(members), uint8_t(0));
+	BC7Subset subset = encodeBC7Subset(block, members, 16, 4, 7, false, 4, quality);
+	fixAnchor(subset, 0, 4);
+
+	std::memset(out, 0, 16);
+	BitWriter writer{ out };
+	writer.Write(1 << 6, 7);
+	for (int c = 0; c < 4; ++c) {
+		writer.Write(subset.Quantized0[c], 7);
+		writer.Write(subset.Quantized1[c], 7);
+	}
+	writer.Write(subset.PBit0, 1);
+	writer.Write(subset.PBit1, 1);
+	for (int i = 0; i < 16; ++i) {
+		writer.Write(subset.Indices[i], i == 0 ? 3 : 4);
+	}
+	return subset.Error;
+}
+
+float encodeBC7Mode1(const Block& block, int partition, BlockQuality quality, uint8_t* out) {
+	uint8_t members[2][16];
+	int counts[2] = {};
+	int member_index[16];
+	for (int i = 0; i < 16; ++i) {
+		int subset = (BC7_PARTITIONS2[partition] >> i) & 1;
+		member_index[i] = counts[subset];
+		members[subset][counts[subset]++] = static_cast<uint8_t>(i);
+	}
+
+	BC7Subset subsets[2];
+	for (int s = 0; s < 2; ++s) {
+		subsets[s] = encodeBC7Subset(block, members[s], counts[s], 3, 6, true, 3, quality);
+	}
+	fixAnchor(subsets[0], 0, 3);
+	fixAnchor(subsets[1], member_index[BC7_ANCHORS2[partition]], 3);
+
+	std::memset(out, 0, 16);
+	BitWriter writer{ out };
+	writer.Write(1 << 1, 2);
+	writer.Write(partition, 6);
+	for (int c = 0; c < 3; ++c) {
+		for (int s = 0; s < 2; ++s) {
+			writer.Write(subsets[s].Quantized0[c], 6);
+			writer.Write(subsets[s].Quantized1[c], 6);
+		}
+	}
+	writer.Write(subsets[0].PBit0, 1);
+	writer.Write(subsets[1].PBit0, 1);
+	for (int i = 0; i < 16; ++i) {
+		int subset = (BC7_PARTITIONS2[partition] >> i) & 1;
+		bool anchor = i == 0 || i == BC7_ANCHORS2[partition];
+		writer.Write(subsets[subset].Indices[member_index[i]], anchor ? 2 : 3);
+	}
+	return subsets[0].Error + subsets[1].Error;
+}
+
+void encodeBC7(const Block& block, BlockQuality quality, uint8_t* out) {
+	float best_error = encodeBC7Mode6(block, quality, out);
+	if (quality == BlockQuality::Fast || best_error == 0.f) {
+		return;
+	}
+
+	bool opaque = std::all_of(block.begin(), block.end(), [](const auto& color) { return color[3] == 255; });
+	if (!opaque) {
+		return;
+	}
+
+	// Rank the partitions by how far each subset strays from a line and only
+	// run the full encoder on the most promising ones.
+	std::array<std::pair<float, int>, 64> ranking;
+	for (int partition = 0; partition < 64; ++partition) {
+		uint8_t members[2][16];
+		int counts[2] = {};
+		for (int i = 0; i < 16; ++i) {
+			int subset = (BC7_PARTITIONS2[partition] >> i) & 1;
+			members[subset][counts[subset]++] = static_cast<uint8_t>(i);
+		}
+		float score = 0.f;
+		for (int s = 0; s < 2; ++s) {
+			float residual = 0.f;
+			fitLine(block, members[s], counts[s], 3, &residual);
+			score += residual;
+		}
+		ranking[partition] = { score, partition };
+	}
+	int candidates = quality == BlockQuality::High ? 16 : 4;
+	std::partial_sort(ranking.begin(), ranking.begin() + candidates, ranking.end());
+
+	for (int i = 0; i < candidates; ++i) {
+		uint8_t candidate[16];
+		float error = encodeBC7Mode1(block, ranking[i].second, quality, candidate);
+		if (error < best_error) {
+			best_error = error;
+			std::memcpy(out, candidate, 16);
+		}
+	}
+}
+
+void encodeBlock(const Block& block, BlockFormat format, BlockQuality quality, uint8_t* out) {
+	switch (format) {
+	case BlockFormat::BC1:
+		encodeBC1(block, quality, out);
+		break;
+	case BlockFormat::BC4:
+		encodeBC4Channel(block, 0, quality, out);
+		break;
+	case BlockFormat::BC5:
+		encodeBC4Channel(block, 0, quality, out);
+		encodeBC4Channel(block, 1, quality, out + 8);
+		break;
+	case BlockFormat::BC7:
+		encodeBC7(block, quality, out);
+		break;
+	}
+}
+
+}
+
+const char* BlockFormatName(BlockFormat format) {
+	switch (format) {
+	case BlockFormat::BC1: return "BC1";
+	case BlockFormat::BC4: return "BC4";
+	case BlockFormat::BC5: return "BC5";
+	default: return "BC7";
+	}
+}
+
+size_t BlockSize(BlockFormat format) {
+	return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+std::vector<uint8_t> CompressBlocks(const Image& image, BlockFormat format, BlockQuality quality) {
+	int blocks_x = (image.Width + 3) / 4;
+	int blocks_y = (image.Height + 3) / 4;
+	size_t block_size = BlockSize(format);
+	std::vector<uint8_t> data(static_cast<size_t>(blocks_x) * blocks_y * block_size);
+
+	ParallelFor(static_cast<size_t>(blocks_y), [&](size_t block_y) {
+		uint8_t* row = data.data() + block_y * blocks_x * block_size;
+		for (int block_x = 0; block_x < blocks_x; ++block_x) {
+			Block block = fetchBlock(image, block_x, static_cast<int>(block_y));
+			encodeBlock(block, format, quality, row + block_x * block_size);
+		}
+	});
+	return data;
+}
@@ -0,0 +1,28 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "../BakeRender/Image.h"
+
+enum class BlockFormat {
+	BC1,
+	BC4,
+	BC5,
+	BC7,
+};
+
+enum class BlockQuality {
+	Fast,
+	Normal,
+	High,
+};
+
+const char* BlockFormatName(BlockFormat format);
+size_t BlockSize(BlockFormat format);
+
+// Encodes the image as 4x4 blocks in row-major block order. BC1 and BC7 read
+// RGB(A), BC4 reads channel 0 and BC5 reads channels 0 and 1. Texels past the
+// right and bottom edges are clamped. Rows of blocks are encoded in parallel.
+std::vector<uint8_t> CompressBlocks(const Image& image, BlockFormat format, BlockQuality quality);
@@ -0,0 +1,881 @@
+﻿#include "Bvh.h"
+#include "../BakeRender/Parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <thread>
+
+using namespace DirectX;
+
+namespace {
+
+constexpr uint32_t MAX_LEAF_SIZE = 4;
+constexpr int BIN_COUNT = 16;
+constexpr int MAX_DEPTH = 64;
+constexpr uint32_t PARALLEL_BINNING_SIZE = 65536;
+constexpr uint32_t BINNING_BLOCK = 16384;
+constexpr int STACK_SIZE = 256;
+// Traversal keeps at most three siblings per level of the path it is on.
+static_assert(STACK_SIZE > 3 * (MAX_DEPTH + 1), "Trees built here never spill the traversal stack");
+
+struct Bounds {
+	XMFLOAT3 Min{ FLT_MAX, FLT_MAX, FLT_MAX };
+	XMFLOAT3 Max{ -FLT_MAX, -FLT_MAX, -FLT_MAX };
+
+	void Grow(const XMFLOAT3& p) {
+		Min = { std::min(Min.x, p.x), std::min(Min.y, p.y), std::min(Min.z, p.z) };
+		Max = { std::max(Max.x, p.x), std::max(Max.y, p.y), std::max(Max.z, p.z) };
+	}
+	void Grow(const Bounds& b) {
+		if (b.Min.x > b.Max.x) {
+			return;
+		}
+		Grow(b.Min);
+		Grow(b.Max);
+	}
+	float HalfArea() const {
+		if (Min.x > Max.x) {
+			return 0.f;
+		}
+		float dx = Max.x - Min.x, dy = Max.y - Min.y, dz = Max.z - Min.z;
+		return dx * dy + dy * dz + dz * dx;
+	}
+};
+
+// LIFO of nodes still to visit, held in the frame up to STACK_SIZE entries
+// and on the heap beyond, so that no child is ever dropped.
+template <typename T>
+struct TraversalStack {
+	T Entries[STACK_SIZE];
+	int Top = 0;
+	std::vector<T> Overflow;
+
+	bool Empty() const {
+		return Top == 0 && Overflow.empty();
+	}
+	void Push(const T& entry) {
+		if (Top < STACK_SIZE) {
+			Entries[Top++] = entry;
+		}
+		else {
+			Overflow.push_back(entry);
+		}
+	}
+	// Entries past the frame were pushed last, so they come off first.
+	T Pop() {
+		if (!Overflow.empty()) {
+			T entry = Overflow.back();
+			Overflow.pop_back();
+			return entry;
+		}
+		return Entries[--Top];
+	}
+	void Clear() {
+		Top = 0;
+		Overflow.clear();
+	}
+};
+
+float axisOf(const XMFLOAT3& v, int axis) {
+	return (&v.x)[axis];
+}
+
+// Node of the binary tree built by the SAH builder. Leaves have Count > 0
+// and cover Order[First, First + Count).
+struct BuildNode {
+	Bounds Box;
+	uint32_t Left = 0;
+	uint32_t Right = 0;
+	uint32_t First = 0;
+	uint32_t Count = 0;
+	int Depth = 0;
+};
+
+struct BuildInput {
+	std::vector<Bounds> Boxes;
+	std::vector<XMFLOAT3> Centroids;
+	std::vector<uint32_t> Order;
+};
+
+struct Bin {
+	Bounds Box;
+	uint32_t Count = 0;
+};
+
+void binRange(const BuildInput& input, uint32_t begin, uint32_t end, const Bounds& centroids, Bin (&bins)[3][BIN_COUNT]) {
+	for (uint32_t i = begin; i < end; ++i) {
+		uint32_t primitive = input.Order[i];
+		for (int axis = 0; axis < 3; ++axis) {
+			float lo = axisOf(centroids.Min, axis);
+			float extent = axisOf(centroids.Max, axis) - lo;
+			if (extent <= 0.f) {
+				continue;
+			}
+			int bin = std::min(BIN_COUNT - 1, static_cast<int>((axisOf(input.Centroids[primitive], axis) - lo) / extent * BIN_COUNT));
+			bins[axis][bin].Box.Grow(input.Boxes[primitive]);
+			++bins[axis][bin].Count;
+		}
+	}
+}
+
+// Splits the node in place when the SAH says it pays off or the node is too
+// big for a leaf. Returns whether it was split; the children are appended to
+// nodes. Large ranges are binned on all threads.
+bool splitNode(BuildInput& input, std::vector<BuildNode>& nodes, uint32_t index, bool parallel) {
+	BuildNode node = nodes[index];
+	uint32_t begin = node.First, end = node.First + node.Count;
+	if (node.Count <= 1) {
+		return false;
+	}
+
+	Bounds centroids;
+	for (uint32_t i = begin; i < end; ++i) {
+		centroids.Grow(input.Centroids[input.Order[i]]);
+	}
+
+	Bin bins[3][BIN_COUNT];
+	if (parallel && node.Count >= PARALLEL_BINNING_SIZE) {
+		size_t block_count = (node.Count + BINNING_BLOCK - 1) / BINNING_BLOCK;
+		std::vector<std::array<std::array<Bin, BIN_COUNT>, 3>> partial(block_count);
+		ParallelFor(block_count, [&](size_t block) {
+			Bin local[3][BIN_COUNT];
+			uint32_t first = begin + static_cast<uint32_t>(block) * BINNING_BLOCK;
+			binRange(input, first, std::min(end, first + BINNING_BLOCK), centroids, local);
+			for (int axis = 0; axis < 3; ++axis) {
+				std::copy(local[axis], local[axis] + BIN_COUNT, partial[block][axis].begin());
+			}
+		});
+		for (const auto& block : partial) {
+			for (int axis = 0; axis < 3; ++axis) {
+				for (int bin = 0; bin < BIN_COUNT; ++bin) {
+					bins[axis][bin].Box.Grow(block[axis][bin].Box);
+					bins[axis][bin].Count += block[axis][bin].Count;
+				}
+			}
+		}
+	}
+	else {
+		binRange(input, begin, end, centroids, bins);
+	}
+
+	float best_cost = FLT_MAX;
+	int best_axis = -1, best_bin = 0;
+	for (int axis = 0; axis < 3; ++axis) {
+		if (axisOf(centroids.Max, axis) - axisOf(centroids.Min, axis) <= 0.f) {
+			continue;
+		}
+		float right_cost[BIN_COUNT] = {};
+		Bounds right;
+		uint32_t right_count = 0;
+		for (int bin = BIN_COUNT - 1; bin > 0; --bin) {
+			right.Grow(bins[axis][bin].Box);
+			right_count += bins[axis][bin].Count;
+			right_cost[bin] = right.HalfArea() * right_count;
+		}
+		Bounds left;
+		uint32_t left_count = 0;
+		for (int bin = 0; bin < BIN_COUNT - 1; ++bin) {
+			left.Grow(bins[axis][bin].Box);
+			left_count += bins[axis][bin].Count;
+			float cost = left.HalfArea() * left_count + right_cost[bin + 1];
+			if (left_count > 0 && left_count < node.Count && cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_bin = bin;
+			}
+		}
+	}
+
+	// Unit traversal and intersection costs, relative to the node's area.
+	float area = node.Box.HalfArea();
+	bool force = node.Count > MAX_LEAF_SIZE;
+	if (!force && (best_axis < 0 || area * node.Count <= area + best_cost)) {
+		return false;
+	}
+
+	uint32_t middle = begin + node.Count / 2;
+	if (best_axis >= 0 && node.Depth < MAX_DEPTH) {
+		float lo = axisOf(centroids.Min, best_axis);
+		float extent = axisOf(centroids.Max, best_axis) - lo;
+		auto split = std::partition(input.Order.begin() + begin, input.Order.begin() + end, [&](uint32_t primitive) {
+			int bin = std::min(BIN_COUNT - 1, static_cast<int>((axisOf(input.Centroids[primitive], best_axis) - lo) / extent * BIN_COUNT));
+			return bin <= best_bin;
+		});
+		middle = static_cast<uint32_t>(split - input.Order.begin());
+	}
+	if (middle == begin || middle == end) {
+		middle = begin + node.Count / 2;
+	}
+
+	BuildNode children[2];
+	uint32_t ranges[2][2] = { { begin, middle }, { middle, end } };
+	for (int c = 0; c < 2; ++c) {
+		children[c].First = ranges[c][0];
+		children[c].Count = ranges[c][1] - ranges[c][0];
+		children[c].Depth = node.Depth + 1;
+		for (uint32_t i = ranges[c][0]; i < ranges[c][1]; ++i) {
+			children[c].Box.Grow(input.Boxes[input.Order[i]]);
+		}
+	}
+	node.Left = static_cast<uint32_t>(nodes.size());
+	node.Right = node.Left + 1;
+	node.Count = 0;
+	nodes[index] = node;
+	nodes.push_back(children[0]);
+	nodes.push_back(children[1]);
+	return true;
+}
+
+// Splits the top of the tree on one thread with parallel binning, then
+// builds the remaining subtrees on all threads and splices them in.
+std::vector<BuildNode> buildBinaryTree(BuildInput& input) {
+	uint32_t count = static_cast<uint32_t>(input.Order.size());
+	std::vector<BuildNode> nodes(1);
+	nodes[0].Count = count;
+	for (uint32_t i = 0; i < count; ++i) {
+		nodes[0].Box.Grow(input.Boxes[i]);
+	}
+
+	uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+	uint32_t subtree_size = std::max<uint32_t>(4096, count / (threads * 8));
+	std::vector<uint32_t> queue = { 0 }, subtrees;
+	while (!queue.empty()) {
+		uint32_t index = queue.back();
+		queue.pop_back();
+		if (nodes[index].Count <= subtree_size) {
+			subtrees.push_back(index);
+		}
+		else if (splitNode(input, nodes, index, true)) {
+			queue.push_back(nodes[index].Left);
+			queue.push_back(nodes[index].Right);
+		}
+	}
+
+	std::vector<std::vector<BuildNode>> built(subtrees.size());
+	ParallelFor(subtrees.size(), [&](size_t i) {
+		auto& local = built[i];
+		local.push_back(nodes[subtrees[i]]);
+		std::vector<uint32_t> pending = { 0 };
+		while (!pending.empty()) {
+			uint32_t index = pending.back();
+			pending.pop_back();
+			if (splitNode(input, local, index, false)) {
+				pending.push_back(local[index].Left);
+				pending.push_back(local[index].Right);
+			}
+		}
+	});
+
+	for (size_t i = 0; i < subtrees.size(); ++i) {
+		uint32_t offset = static_cast<uint32_t>(nodes.size()) - 1;
+		auto remap = [&](uint32_t local_index) {
+			return local_index == 0 ? subtrees[i] : offset + local_index;
+		};
+		for (size_t n = 0; n < built[i].size(); ++n) {
+			BuildNode node = built[i][n];
+			if (node.Count == 0) {
+				node.Left = remap(node.Left);
+				node.Right = remap(node.Right);
+			}
+			if (n == 0) {
+				nodes[subtrees[i]] = node;
+			}
+			else {
+				nodes.push_back(node);
+			}
+		}
+	}
+	return nodes;
+}
+
+BuildInput prepareInput(const std::vector<BvhTriangle>& triangles) {
+	BuildInput input;
+	input.Boxes.resize(triangles.size());
+	input.Centroids.resize(triangles.size());
+	input.Order.resize(triangles.size());
+	ParallelFor((triangles.size() + BINNING_BLOCK - 1) / BINNING_BLOCK, [&](size_t block) {
+		size_t end = std::min(triangles.size(), (block + 1) * BINNING_BLOCK);
+		for (size_t i = block * BINNING_BLOCK; i < end; ++i) {
+			Bounds box;
+			box.Grow(triangles[i].V0);
+			box.Grow(triangles[i].V1);
+			box.Grow(triangles[i].V2);
+			input.Boxes[i] = box;
+			input.Centroids[i] = { (box.Min.x + box.Max.x) * 0.5f, (box.Min.y + box.Max.y) * 0.5f, (box.Min.z + box.Max.z) * 0.5f };
+			input.Order[i] = static_cast<uint32_t>(i);
+		}
+	});
+	return input;
+}
+
+// Chooses up to width binary nodes as the children of one wide node by
+// repeatedly opening the inner child with the largest surface area.
+std::vector<uint32_t> wideChildren(const std::vector<BuildNode>& nodes, uint32_t index, int width) {
+	if (nodes[index].Count > 0) {
+		return { index };
+	}
+	std::vector<uint32_t> children = { nodes[index].Left, nodes[index].Right };
+	while (static_cast<int>(children.size()) < width) {
+		int largest = -1;
+		for (int i = 0; i < static_cast<int>(children.size()); ++i) {
+			if (nodes[children[i]].Count == 0 && (largest < 0 || nodes[children[i]].Box.HalfArea() > nodes[children[largest]].Box.HalfArea())) {
+				largest = i;
+			}
+		}
+		if (largest < 0) {
+			break;
+		}
+		uint32_t opened = children[largest];
+		children[largest] = nodes[opened].Left;
+		children.push_back(nodes[opened].Right);
+	}
+	return children;
+}
+
+// Emits wide nodes in depth-first order. emit(children, child_nodes) receives
+// the binary children of the node and the wide node index of each inner one.
+template <typename Emit>
+uint32_t collapse(const std::vector<BuildNode>& nodes, uint32_t index, int width, uint32_t& next, Emit&& emit) {
+	uint32_t wide = next++;
+	auto children = wideChildren(nodes, index, width);
+	std::vector<uint32_t> child_nodes(children.size(), BVH_EMPTY);
+	for (size_t i = 0; i < children.size(); ++i) {
+		if (nodes[children[i]].Count == 0) {
+			child_nodes[i] = collapse(nodes, children[i], width, next, emit);
+		}
+	}
+	emit(wide, children, child_nodes);
+	return wide;
+}
+
+uint32_t packBinary(const std::vector<BuildNode>& nodes, uint32_t index, std::vector<BvhPackedNode2>& out) {
+	uint32_t packed = static_cast<uint32_t>(out.size());
+	out.emplace_back();
+	const auto& node = nodes[index];
+	BvhPackedNode2 result{ { node.Box.Min.x, node.Box.Min.y, node.Box.Min.z }, node.First, { node.Box.Max.x, node.Box.Max.y, node.Box.Max.z }, node.Count };
+	if (node.Count == 0) {
+		packBinary(nodes, node.Left, out);
+		result.Offset = packBinary(nodes, node.Right, out);
+	}
+	out[packed] = result;
+	return packed;
+}
+
+template <int Width>
+void appendPacked(const std::vector<BuildNode>& nodes, const std::vector<uint32_t>& children, const std::vector<uint32_t>& child_nodes, BvhPackedNode<Width>& out) {
+	for (int i = 0; i < Width; ++i) {
+		bool used = i < static_cast<int>(children.size());
+		const Bounds empty{ { 0.f, 0.f, 0.f }, { 0.f, 0.f, 0.f } };
+		const Bounds& box = used ? nodes[children[i]].Box : empty;
+		for (int axis = 0; axis < 3; ++axis) {
+			out.Min[axis][i] = axisOf(box.Min, axis);
+			out.Max[axis][i] = axisOf(box.Max, axis);
+		}
+		out.Child[i] = !used ? BVH_EMPTY : nodes[children[i]].Count > 0 ? nodes[children[i]].First : child_nodes[i];
+		out.Count[i] = used ? static_cast<uint8_t>(nodes[children[i]].Count) : 0;
+	}
+}
+
+template <int Width>
+void appendQuantized(const std::vector<BuildNode>& nodes, const std::vector<uint32_t>& children, const std::vector<uint32_t>& child_nodes, BvhQuantizedNode<Width>& out) {
+	Bounds node_box;
+	for (auto child : children) {
+		node_box.Grow(nodes[child].Box);
+	}
+	for (int axis = 0; axis < 3; ++axis) {
+		float origin = axisOf(node_box.Min, axis);
+		// Slightly larger than extent / 255 so that 255 steps always reach the max.
+		float scale = (axisOf(node_box.Max, axis) - origin) / 255.f * (1.f + 1e-5f);
+		out.Origin[axis] = origin;
+		out.Scale[axis] = scale;
+		for (int i = 0; i < Width; ++i) {
+			if (i >= static_cast<int>(children.size()) || scale <= 0.f) {
+				out.QMin[axis][i] = 0;
+				out.QMax[axis][i] = 0;
+				continue;
+			}
+			const Bounds& box = nodes[children[i]].Box;
+			int lo = static_cast<int>(std::floor((axisOf(box.Min, axis) - origin) / scale));
+			int hi = static_cast<int>(std::ceil((axisOf(box.Max, axis) - origin) / scale));
+			lo = std::clamp(lo, 0, 255);
+			hi = std::clamp(hi, 0, 255);
+			while (lo > 0 && origin + lo * scale > axisOf(box.Min, axis)) {
+				--lo;
+			}
+			while (hi < 255 && origin + hi * scale < axisOf(box.Max, axis)) {
+				++hi;
+			}
+			out.QMin[axis][i] = static_cast<uint8_t>(lo);
+			out.QMax[axis][i] = static_cast<uint8_t>(hi);
+		}
+	}
+	for (int i = 0; i < Width; ++i) {
+		bool used = i < static_cast<int>(children.size());
+		out.Child[i] = !used ? BVH_EMPTY : nodes[children[i]].Count > 0 ? nodes[children[i]].First : child_nodes[i];
+		out.Count[i] = used ? static_cast<uint8_t>(nodes[children[i]].Count) : 0;
+	}
+}
+
+template <typename Node, typename Fill>
+void serializeWide(const std::vector<BuildNode>& nodes, int width, std::vector<uint8_t>& out, Fill&& fill) {
+	std::vector<Node> packed;
+	uint32_t next = 0;
+	collapse(nodes, 0, width, next, [&](uint32_t wide, const std::vector<uint32_t>& children, const std::vector<uint32_t>& child_nodes) {
+		if (packed.size() <= wide) {
+			packed.resize(wide + 1);
+		}
+		fill(nodes, children, child_nodes, packed[wide]);
+	});
+	packed.resize(next);
+	auto bytes = reinterpret_cast<const uint8_t*>(packed.data());
+	out.insert(out.end(), bytes, bytes + packed.size() * sizeof(Node));
+}
+
+bool intersectTriangle(const BvhTriangle& triangle, FXMVECTOR origin, FXMVECTOR direction, float t_min, float t_max, BvhHit& hit) {
+	XMVECTOR v0 = XMLoadFloat3(&triangle.V0);
+	XMVECTOR e1 = XMVectorSubtract(XMLoadFloat3(&triangle.V1), v0);
+	XMVECTOR e2 = XMVectorSubtract(XMLoadFloat3(&triangle.V2), v0);
+	XMVECTOR p = XMVector3Cross(direction, e2);
+	float det = XMVectorGetX(XMVector3Dot(e1, p));
+	if (std::fabs(det) < 1e-20f) {
+		return false;
+	}
+	float inv_det = 1.f / det;
+	XMVECTOR s = XMVectorSubtract(origin, v0);
+	float u = XMVectorGetX(XMVector3Dot(s, p)) * inv_det;
+	if (u < 0.f || u > 1.f) {
+		return false;
+	}
+	XMVECTOR q = XMVector3Cross(s, e1);
+	float v = XMVectorGetX(XMVector3Dot(direction, q)) * inv_det;
+	if (v < 0.f || u + v > 1.f) {
+		return false;
+	}
+	float t = XMVectorGetX(XMVector3Dot(e2, q)) * inv_det;
+	if (t < t_min || t > t_max) {
+		return false;
+	}
+	hit.T = t;
+	hit.U = u;
+	hit.V = v;
+	return true;
+}
+
+// Walks the tree front to back. With any_hit the walk stops at the first
+// triangle hit, otherwise it keeps shrinking the ray to the closest one.
+bool traverse(const Bvh& bvh, const BvhRay& ray, bool any_hit, BvhHit& closest) {
+	if (bvh.Nodes.empty()) {
+		return false;
+	}
+
+	XMFLOAT3 direction = ray.Direction;
+	for (float* d : { &direction.x, &direction.y, &direction.z }) {
+		if (std::fabs(*d) < 1e-12f) {
+			*d = std::copysign(1e-12f, *d);
+		}
+	}
+	XMVECTOR origin = XMLoadFloat3(&ray.Origin);
+	XMVECTOR dir = XMLoadFloat3(&ray.Direction);
+	XMVECTOR ox = XMVectorReplicate(ray.Origin.x);
+	XMVECTOR oy = XMVectorReplicate(ray.Origin.y);
+	XMVECTOR oz = XMVectorReplicate(ray.Origin.z);
+	XMVECTOR ix = XMVectorReplicate(1.f / direction.x);
+	XMVECTOR iy = XMVectorReplicate(1.f / direction.y);
+	XMVECTOR iz = XMVectorReplicate(1.f / direction.z);
+
+	float t_max = ray.TMax;
+	bool found = false;
+	TraversalStack<uint32_t> stack;
+	stack.Push(0);
+
+	while (!stack.Empty()) {
+		const BvhNode& node = bvh.Nodes[stack.Pop()];
+		XMVECTOR tx0 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat4A(&node.MinX), ox), ix);
+		XMVECTOR tx1 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat4A(&node.MaxX), ox), ix);
+		XMVECTOR ty0 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat4A(&node.MinY), oy), iy);
+		XMVECTOR ty1 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat4A(&node.MaxY), oy), iy);
+		XMVECTOR tz0 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat4A(&node.MinZ), oz), iz);
+		XMVECTOR tz1 = XMVectorMultiply(XMVectorSubtract(XMLoadFloat4A(&node.MaxZ), oz), iz);
+		XMVECTOR t_near = XMVectorMax(XMVectorMax(XMVectorMin(tx0, tx1), XMVectorMin(ty0, ty1)), XMVectorMax(XMVectorMin(tz0, tz1), XMVectorReplicate(ray.TMin)));
+		XMVECTOR t_far = XMVectorMin(XMVectorMin(XMVectorMax(tx0, tx1), XMVectorMax(ty0, ty1)), XMVectorMin(XMVectorMax(tz0, tz1), XMVectorReplicate(t_max)));
+		XMFLOAT4A near_values, far_values;
+		XMStoreFloat4A(&near_values, t_near);
+		XMStoreFloat4A(&far_values, t_far);
+		const float* nears = &near_values.x;
+		const float* fars = &far_values.x;
+
+		std::pair<float, uint32_t> inner[4];
+		int inner_count = 0;
+		for (int slot = 0; slot < 4; ++slot) {
+			if (node.Child[slot] == BVH_EMPTY || nears[slot] > fars[slot]) {
+				continue;
+			}
+			if (node.Count[slot] == 0) {
+				inner[inner_count++] = { nears[slot], node.Child[slot] };
+				continue;
+			}
+			for (uint32_t i = node.Child[slot]; i < node.Child[slot] + node.Count[slot]; ++i) {
+				BvhHit hit;
+				if (intersectTriangle(bvh.Triangles[i], origin, dir, ray.TMin, t_max, hit)) {
+					hit.Triangle = i;
+					closest = hit;
+					found = true;
+					if (any_hit) {
+						return true;
+					}
+					t_max = hit.T;
+				}
+			}
+		}
+
+		// Push the farthest child first so the nearest is visited next.
+		std::sort(inner, inner + inner_count, [](const auto& a, const auto& b) { return a.first > b.first; });
+		for (int i = 0; i < inner_count; ++i) {
+			stack.Push(inner[i].second);
+		}
+	}
+	return found;
+}
+
+bool anyLane(FXMVECTOR mask) {
+	return XMComparisonAnyTrue(XMVector4EqualIntR(mask, XMVectorTrueInt()));
+}
+
+// Four rays in structure-of-arrays form, one per lane.
+struct RayPacket {
+	XMVECTOR Origin[3];
+	XMVECTOR Direction[3];
+	XMVECTOR InverseDirection[3];
+	XMVECTOR TMin;
+	XMVECTOR TMax;
+};
+
+// Lanes of the packet that hit the triangle between TMin and TMax.
+XMVECTOR intersectTrianglePacket(const BvhTriangle& triangle, const RayPacket& packet) {
+	const float* v0 = &triangle.V0.x;
+	const float* v1 = &triangle.V1.x;
+	const float* v2 = &triangle.V2.x;
+	XMVECTOR e1[3], e2[3], s[3];
+	for (int axis = 0; axis < 3; ++axis) {
+		e1[axis] = XMVectorReplicate(v1[axis] - v0[axis]);
+		e2[axis] = XMVectorReplicate(v2[axis] - v0[axis]);
+		s[axis] = XMVectorSubtract(packet.Origin[axis], XMVectorReplicate(v0[axis]));
+	}
+	auto cross = [](const XMVECTOR* a, const XMVECTOR* b, XMVECTOR* out) {
+		out[0] = XMVectorSubtract(XMVectorMultiply(a[1], b[2]), XMVectorMultiply(a[2], b[1]));
+		out[1] = XMVectorSubtract(XMVectorMultiply(a[2], b[0]), XMVectorMultiply(a[0], b[2]));
+		out[2] = XMVectorSubtract(XMVectorMultiply(a[0], b[1]), XMVectorMultiply(a[1], b[0]));
+	};
+	auto dot = [](const XMVECTOR* a, const XMVECTOR* b) {
+		return XMVectorMultiplyAdd(a[0], b[0], XMVectorMultiplyAdd(a[1], b[1], XMVectorMultiply(a[2], b[2])));
+	};
+
+	XMVECTOR p[3], q[3];
+	cross(packet.Direction, e2, p);
+	cross(s, e1, q);
+	XMVECTOR det = dot(e1, p);
+	XMVECTOR inv_det = XMVectorReciprocal(det);
+	XMVECTOR u = XMVectorMultiply(dot(s, p), inv_det);
+	XMVECTOR v = XMVectorMultiply(dot(packet.Direction, q), inv_det);
+	XMVECTOR t = XMVectorMultiply(dot(e2, q), inv_det);
+
+	XMVECTOR zero = XMVectorZero();
+	XMVECTOR mask = XMVectorGreater(XMVectorAbs(det), XMVectorReplicate(1e-20f));
+	mask = XMVectorAndInt(mask, XMVectorGreaterOrEqual(u, zero));
+	mask = XMVectorAndInt(mask, XMVectorGreaterOrEqual(v, zero));
+	mask = XMVectorAndInt(mask, XMVectorLessOrEqual(XMVectorAdd(u, v), XMVectorReplicate(1.f)));
+	mask = XMVectorAndInt(mask, XMVectorGreaterOrEqual(t, packet.TMin));
+	return XMVectorAndInt(mask, XMVectorLessOrEqual(t, packet.TMax));
+}
+
+
+// Closest point of a triangle to p, by the Voronoi regions of its features
+// (Ericson, Real-Time Collision Detection 5.1.5).
+XMVECTOR closestPointOnTriangle(FXMVECTOR p, const BvhTriangle& triangle) {
+	XMVECTOR a = XMLoadFloat3(&triangle.V0);
+	XMVECTOR b = XMLoadFloat3(&triangle.V1);
+	XMVECTOR c = XMLoadFloat3(&triangle.V2);
+	XMVECTOR ab = XMVectorSubtract(b, a);
+	XMVECTOR ac = XMVectorSubtract(c, a);
+	XMVECTOR ap = XMVectorSubtract(p, a);
+	float d1 = XMVectorGetX(XMVector3Dot(ab, ap));
+	float d2 = XMVectorGetX(XMVector3Dot(ac, ap));
+	if (d1 <= 0.f && d2 <= 0.f) {
+		return a;
+	}
+	XMVECTOR bp = XMVectorSubtract(p, b);
+	float d3 = XMVectorGetX(XMVector3Dot(ab, bp));
+	float d4 = XMVectorGetX(XMVector3Dot(ac, bp));
+	if (d3 >= 0.f && d4 <= d3) {
+		return b;
+	}
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f) {
+		return XMVectorAdd(a, XMVectorScale(ab, d1 / (d1 - d3)));
+	}
+	XMVECTOR cp = XMVectorSubtract(p, c);
+	float d5 = XMVectorGetX(XMVector3Dot(ab, cp));
+	float d6 = XMVectorGetX(XMVector3Dot(ac, cp));
+	if (d6 >= 0.f && d5 <= d6) {
+		return c;
+	}
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f) {
+		return XMVectorAdd(a, XMVectorScale(ac, d2 / (d2 - d6)));
+	}
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.f && d4 - d3 >= 0.f && d5 - d6 >= 0.f) {
+		return XMVectorAdd(b, XMVectorScale(XMVectorSubtract(c, b), (d4 - d3) / ((d4 - d3) + (d5 - d6))));
+	}
+	float denominator = va + vb + vc;
+	if (std::fabs(denominator) < 1e-30f) {
+		return a;
+	}
+	float v = vb / denominator;
+	float w = vc / denominator;
+	return XMVectorAdd(a, XMVectorAdd(XMVectorScale(ab, v), XMVectorScale(ac, w)));
+}
+
+}
+
+Bvh BuildBvh(std::vector<BvhTriangle> triangles) {
+	Bvh bvh;
+	if (triangles.empty()) {
+		return bvh;
+	}
+
+	auto input = prepareInput(triangles);
+	auto nodes = buildBinaryTree(input);
+	bvh.Min = nodes[0].Box.Min;
+	bvh.Max = nodes[0].Box.Max;
+	bvh.Triangles.reserve(triangles.size());
+	for (auto primitive : input.Order) {
+		bvh.Triangles.push_back(triangles[primitive]);
+	}
+
+	uint32_t next = 0;
+	collapse(nodes, 0, 4, next, [&](uint32_t wide, const std::vector<uint32_t>& children, const std::vector<uint32_t>& child_nodes) {
+		if (bvh.Nodes.size() <= wide) {
+			bvh.Nodes.resize(wide + 1);
+		}
+		BvhNode& node = bvh.Nodes[wide];
+		float* bounds[6] = { &node.MinX.x, &node.MinY.x, &node.MinZ.x, &node.MaxX.x, &node.MaxY.x, &node.MaxZ.x };
+		for (int i = 0; i < 4; ++i) {
+			bool used = i < static_cast<int>(children.size());
+			const Bounds& box = used ? nodes[children[i]].Box : Bounds{ { 0.f, 0.f, 0.f }, { 0.f, 0.f, 0.f } };
+			for (int axis = 0; axis < 3; ++axis) {
+				bounds[axis][i] = axisOf(box.Min, axis);
+				bounds[axis + 3][i] = axisOf(box.Max, axis);
+			}
+			node.Child[i] = !used ? BVH_EMPTY : nodes[children[i]].Count > 0 ? nodes[children[i]].First : child_nodes[i];
+			node.Count[i] = used ? nodes[children[i]].Count : 0;
+		}
+	});
+	bvh.Nodes.resize(next);
+	return bvh;
+}
+
+std::vector<uint8_t> BuildSerializedBvh(std::vector<BvhTriangle> triangles, int width, bool quantized) {
+	// The 2-wide layout has no quantized form, so it is written unquantized.
+	quantized = quantized && width != 2;
+	BvhSectionHeader header{ { 'B', 'V', 'H', '1' }, static_cast<uint32_t>(width), quantized ? 1u : 0u, 0, static_cast<uint32_t>(triangles.size()), {}, {} };
+	std::vector<uint8_t> nodes_data;
+	std::vector<uint32_t> primitives;
+	if (!triangles.empty()) {
+		auto input = prepareInput(triangles);
+		auto nodes = buildBinaryTree(input);
+		for (int axis = 0; axis < 3; ++axis) {
+			header.Min[axis] = axisOf(nodes[0].Box.Min, axis);
+			header.Max[axis] = axisOf(nodes[0].Box.Max, axis);
+		}
+		for (auto primitive : input.Order) {
+			primitives.push_back(triangles[primitive].Primitive);
+		}
+
+		size_t node_size = 0;
+		if (width == 2) {
+			std::vector<BvhPackedNode2> packed;
+			packBinary(nodes, 0, packed);
+			auto bytes = reinterpret_cast<const uint8_t*>(packed.data());
+			nodes_data.assign(bytes, bytes + packed.size() * sizeof(BvhPackedNode2));
+			node_size = sizeof(BvhPackedNode2);
+		}
+		else if (width == 4 && quantized) {
+			serializeWide<BvhQuantizedNode<4>>(nodes, 4, nodes_data, appendQuantized<4>);
+			node_size = sizeof(BvhQuantizedNode<4>);
+		}
+		else if (width == 4) {
+			serializeWide<BvhPackedNode<4>>(nodes, 4, nodes_data, appendPacked<4>);
+			node_size = sizeof(BvhPackedNode<4>);
+		}
+		else if (quantized) {
+			serializeWide<BvhQuantizedNode<8>>(nodes, 8, nodes_data, appendQuantized<8>);
+			node_size = sizeof(BvhQuantizedNode<8>);
+		}
+		else {
+			serializeWide<BvhPackedNode<8>>(nodes, 8, nodes_data, appendPacked<8>);
+			node_size = sizeof(BvhPackedNode<8>);
+		}
+		header.NodeCount = static_cast<uint32_t>(nodes_data.size() / node_size);
+	}
+
+	std::vector<uint8_t> out(reinterpret_cast<const uint8_t*>(&header), reinterpret_cast<const uint8_t*>(&header) + sizeof(header));
+	out.insert(out.end(), nodes_data.begin(), nodes_data.end());
+	auto bytes = reinterpret_cast<const uint8_t*>(primitives.data());
+	out.insert(out.end(), bytes, bytes + primitives.size() * sizeof(uint32_t));
+	return out;
+}
+
+std::optional<BvhHit> IntersectBvh(const Bvh& bvh, const BvhRay& ray) {
+	BvhHit hit;
+	if (traverse(bvh, ray, false, hit)) {
+		return hit;
+	}
+	return std::nullopt;
+}
+
+bool OccludedBvh(const Bvh& bvh, const BvhRay& ray) {
+	BvhHit hit;
+	return traverse(bvh, ray, true, hit);
+}
+
+void OccludedBvh4(const Bvh& bvh, const BvhRay (&rays)[4], bool (&occluded)[4]) {
+	std::fill(occluded, occluded + 4, false);
+	if (bvh.Nodes.empty()) {
+		return;
+	}
+
+	RayPacket packet;
+	XMFLOAT4A lanes[8];
+	for (int lane = 0; lane < 4; ++lane) {
+		const float* origin = &rays[lane].Origin.x;
+		const float* direction = &rays[lane].Direction.x;
+		for (int axis = 0; axis < 3; ++axis) {
+			float d = std::fabs(direction[axis]) < 1e-12f ? std::copysign(1e-12f, direction[axis]) : direction[axis];
+			(&lanes[axis].x)[lane] = origin[axis];
+			(&lanes[axis + 3].x)[lane] = d;
+		}
+		(&lanes[6].x)[lane] = rays[lane].TMin;
+		(&lanes[7].x)[lane] = rays[lane].TMax;
+	}
+	for (int axis = 0; axis < 3; ++axis) {
+		packet.Origin[axis] = XMLoadFloat4A(&lanes[axis]);
+		packet.Direction[axis] = XMLoadFloat4A(&lanes[axis + 3]);
+		packet.InverseDirection[axis] = XMVectorReciprocal(packet.Direction[axis]);
+	}
+	packet.TMin = XMLoadFloat4A(&lanes[6]);
+	packet.TMax = XMLoadFloat4A(&lanes[7]);
+
+	XMVECTOR active = XMVectorTrueInt();
+	XMVECTOR hit_lanes = XMVectorFalseInt();
+	TraversalStack<uint32_t> stack;
+	stack.Push(0);
+
+	while (!stack.Empty()) {
+		const BvhNode& node = bvh.Nodes[stack.Pop()];
+		const float* bounds[6] = { &node.MinX.x, &node.MinY.x, &node.MinZ.x, &node.MaxX.x, &node.MaxY.x, &node.MaxZ.x };
+		for (int slot = 0; slot < 4; ++slot) {
+			if (node.Child[slot] == BVH_EMPTY) {
+				continue;
+			}
+			XMVECTOR t_near = packet.TMin;
+			XMVECTOR t_far = packet.TMax;
+			for (int axis = 0; axis < 3; ++axis) {
+				XMVECTOR t0 = XMVectorMultiply(XMVectorSubtract(XMVectorReplicate(bounds[axis][slot]), packet.Origin[axis]), packet.InverseDirection[axis]);
+				XMVECTOR t1 = XMVectorMultiply(XMVectorSubtract(XMVectorReplicate(bounds[axis + 3][slot]), packet.Origin[axis]), packet.InverseDirection[axis]);
+				t_near = XMVectorMax(t_near, XMVectorMin(t0, t1));
+				t_far = XMVectorMin(t_far, XMVectorMax(t0, t1));
+			}
+			XMVECTOR entering = XMVectorAndInt(active, XMVectorLessOrEqual(t_near, t_far));
+			if (!anyLane(entering)) {
+				continue;
+			}
+			if (node.Count[slot] == 0) {
+				stack.Push(node.Child[slot]);
+				continue;
+			}
+			for (uint32_t i = node.Child[slot]; i < node.Child[slot] + node.Count[slot]; ++i) {
+				XMVECTOR hits = XMVectorAndInt(active, intersectTrianglePacket(bvh.Triangles[i], packet));
+				hit_lanes = XMVectorOrInt(hit_lanes, hits);
+				active = XMVectorAndCInt(active, hits);
+			}
+			if (!anyLane(active)) {
+				stack.Clear();
+				break;
+			}
+		}
+	}
+
+	uint32_t result[4];
+	XMStoreInt4(result, hit_lanes);
+	for (int lane = 0; lane < 4; ++lane) {
+		occluded[lane] = result[lane] != 0;
+	}
+}
+
+std::optional<BvhClosest> ClosestPointBvh(const Bvh& bvh, const XMFLOAT3& point, float max_distance) {
+	if (bvh.Nodes.empty()) {
+		return std::nullopt;
+	}
+
+	XMVECTOR p = XMLoadFloat3(&point);
+	XMVECTOR px = XMVectorReplicate(point.x);
+	XMVECTOR py = XMVectorReplicate(point.y);
+	XMVECTOR pz = XMVectorReplicate(point.z);
+	XMVECTOR zero = XMVectorZero();
+
+	float best = max_distance < FLT_MAX ? max_distance * max_distance : FLT_MAX;
+	BvhClosest closest;
+	bool found = false;
+	// Nodes are kept with their distance so that ones passed by a closer hit
+	// are skipped when popped.
+	TraversalStack<std::pair<float, uint32_t>> stack;
+	stack.Push({ 0.f, 0 });
+
+	while (!stack.Empty()) {
+		auto [node_distance, node_index] = stack.Pop();
+		if (node_distance >= best) {
+			continue;
+		}
+		const BvhNode& node = bvh.Nodes[node_index];
+		XMVECTOR dx = XMVectorMax(XMVectorMax(XMVectorSubtract(XMLoadFloat4A(&node.MinX), px), XMVectorSubtract(px, XMLoadFloat4A(&node.MaxX))), zero);
+		XMVECTOR dy = XMVectorMax(XMVectorMax(XMVectorSubtract(XMLoadFloat4A(&node.MinY), py), XMVectorSubtract(py, XMLoadFloat4A(&node.MaxY))), zero);
+		XMVECTOR dz = XMVectorMax(XMVectorMax(XMVectorSubtract(XMLoadFloat4A(&node.MinZ), pz), XMVectorSubtract(pz, XMLoadFloat4A(&node.MaxZ))), zero);
+		XMFLOAT4A distances;
+		XMStoreFloat4A(&distances, XMVectorAdd(XMVectorAdd(XMVectorMultiply(dx, dx), XMVectorMultiply(dy, dy)), XMVectorMultiply(dz, dz)));
+		const float* child_distances = &distances.x;
+
+		std::pair<float, uint32_t> inner[4];
+		int inner_count = 0;
+		for (int slot = 0; slot < 4; ++slot) {
+			if (node.Child[slot] == BVH_EMPTY || child_distances[slot] >= best) {
+				continue;
+			}
+			if (node.Count[slot] == 0) {
+				inner[inner_count++] = { child_distances[slot], node.Child[slot] };
+				continue;
+			}
+			for (uint32_t i = node.Child[slot]; i < node.Child[slot] + node.Count[slot]; ++i) {
+				XMVECTOR q = closestPointOnTriangle(p, bvh.Triangles[i]);
+				float distance = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(q, p)));
+				if (distance < best) {
+					best = distance;
+					closest.Triangle = i;
+					XMStoreFloat3(&closest.Point, q);
+					found = true;
+				}
+			}
+		}
+
+		std::sort(inner, inner + inner_count, [](const auto& a, const auto& b) { return a.first > b.first; });
+		for (int i = 0; i < inner_count; ++i) {
+			stack.Push(inner[i]);
+		}
+	}
+	if (!found) {
+		return std::nullopt;
+	}
+	closest.Distance = std::sqrt(best);
+	return closest;
+}
@@ -0,0 +1,137 @@
+﻿#pragma once
+
+#include <DirectXMath.h>
+
+#include <cfloat>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+struct BvhTriangle {
+	DirectX::XMFLOAT3 V0;
+	DirectX::XMFLOAT3 V1;
+	DirectX::XMFLOAT3 V2;
+	// Source mesh and triangle within it, kept through the reordering of the build.
+	uint32_t Mesh = 0;
+	uint32_t Primitive = 0;
+};
+
+constexpr uint32_t BVH_EMPTY = UINT32_MAX;
+
+// Four children per node. The child bounds are stored one vector per axis so
+// a ray tests all four boxes with a handful of vector operations.
+struct alignas(16) BvhNode {
+	DirectX::XMFLOAT4A MinX;
+	DirectX::XMFLOAT4A MinY;
+	DirectX::XMFLOAT4A MinZ;
+	DirectX::XMFLOAT4A MaxX;
+	DirectX::XMFLOAT4A MaxY;
+	DirectX::XMFLOAT4A MaxZ;
+	// Node index of inner children, first triangle of leaves, BVH_EMPTY for
+	// unused slots.
+	uint32_t Child[4];
+	// Triangle count of leaves, 0 for inner children.
+	uint32_t Count[4];
+};
+
+struct Bvh {
+	// Nodes[0] is the root. Empty when there are no triangles.
+	std::vector<BvhNode> Nodes;
+	std::vector<BvhTriangle> Triangles;
+	DirectX::XMFLOAT3 Min{ 0.f, 0.f, 0.f };
+	DirectX::XMFLOAT3 Max{ 0.f, 0.f, 0.f };
+};
+
+struct BvhRay {
+	DirectX::XMFLOAT3 Origin;
+	DirectX::XMFLOAT3 Direction;
+	float TMin = 0.f;
+	float TMax = FLT_MAX;
+};
+
+struct BvhHit {
+	float T = 0.f;
+	// Index into Bvh::Triangles and the barycentric weights of V1 and V2.
+	uint32_t Triangle = 0;
+	float U = 0.f;
+	float V = 0.f;
+};
+
+// Builds a binary tree with binned SAH splits in parallel and collapses it to
+// four children per node. Leaves hold at most four triangles.
+Bvh BuildBvh(std::vector<BvhTriangle> triangles);
+
+// Closest hit between TMin and TMax.
+std::optional<BvhHit> IntersectBvh(const Bvh& bvh, const BvhRay& ray);
+
+// Whether anything is hit between TMin and TMax. Stops at the first hit.
+bool OccludedBvh(const Bvh& bvh, const BvhRay& ray);
+
+// Occlusion of four rays traced as one packet, one ray per SIMD lane. A node
+// is entered while any unfinished ray of the packet hits it, so rays with a
+// shared origin and similar directions share most of the traversal.
+void OccludedBvh4(const Bvh& bvh, const BvhRay (&rays)[4], bool (&occluded)[4]);
+
+struct BvhClosest {
+	float Distance = 0.f;
+	// Index into Bvh::Triangles and the closest point on it.
+	uint32_t Triangle = 0;
+	DirectX::XMFLOAT3 Point{};
+};
+
+// Closest point of any triangle to point, searching no farther than
+// max_distance. Children are visited nearest box first and skipped once a
+// closer triangle is known.
+std::optional<BvhClosest> ClosestPointBvh(const Bvh& bvh, const DirectX::XMFLOAT3& point, float max_distance = FLT_MAX);
+
+// Layout of a serialized BVH: this header, NodeCount nodes of the type given
+// by Width and Quantized, then PrimitiveCount uint32 triangle indices into the
+// mesh's index buffer (triangle i uses indices 3i to 3i+2). Leaves refer to
+// ranges of the primitive list. Nodes are in depth-first order, root first.
+struct BvhSectionHeader {
+	char Magic[4];
+	uint32_t Width;
+	uint32_t Quantized;
+	uint32_t NodeCount;
+	uint32_t PrimitiveCount;
+	float Min[3];
+	float Max[3];
+};
+
+// Binary node. An inner node's first child follows it and the second is at
+// Offset. A leaf lists Count primitives starting at Offset.
+struct BvhPackedNode2 {
+	float Min[3];
+	uint32_t Offset;
+	float Max[3];
+	uint32_t Count;
+};
+
+// Node with Width children. Bounds are stored one array per axis so that the
+// bounds of all children load as one SIMD register. Child and Count follow
+// BvhNode: Count is 0 for inner children and Child is BVH_EMPTY when unused.
+template <int Width>
+struct BvhPackedNode {
+	float Min[3][Width];
+	float Max[3][Width];
+	uint32_t Child[Width];
+	uint8_t Count[Width];
+};
+
+// As BvhPackedNode with child bounds stored as 8-bit offsets from the node
+// origin: min = Origin + QMin * Scale, rounded outwards so they stay
+// conservative.
+template <int Width>
+struct BvhQuantizedNode {
+	float Origin[3];
+	float Scale[3];
+	uint8_t QMin[3][Width];
+	uint8_t QMax[3][Width];
+	uint32_t Child[Width];
+	uint8_t Count[Width];
+};
+
+// Builds the tree like BuildBvh and serializes it with width 2, 4 or 8
+// children per node. Quantized bounds need width 4 or 8; with width 2 the
+// tree is written, and flagged, unquantized.
+std::vector<uint8_t> BuildSerializedBvh(std::vector<BvhTriangle> triangles, int width, bool quantized);
@@ -0,0 +1,553 @@
+﻿#include "Collision.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <unordered_set>
+
+using namespace DirectX;
+
+namespace {
+
+constexpr int SPLIT_CANDIDATES = 7;
+constexpr int MAX_CROSSINGS = 1024;
+
+struct HullFace {
+	uint32_t V[3];
+	XMFLOAT3 Normal;
+	float Offset;
+	// Points in front of the face that are not on the hull yet.
+	std::vector<uint32_t> Outside;
+	bool Alive = true;
+};
+
+float faceDistance(const HullFace& face, const XMFLOAT3& p) {
+	return face.Normal.x * p.x + face.Normal.y * p.y + face.Normal.z * p.z - face.Offset;
+}
+
+// A face over a, b, c facing away from interior.
+HullFace makeFace(const std::vector<XMFLOAT3>& points, uint32_t a, uint32_t b, uint32_t c, const XMFLOAT3& interior) {
+	HullFace face{ { a, b, c } };
+	XMVECTOR pa = XMLoadFloat3(&points[a]);
+	XMVECTOR normal = XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&points[b]), pa), XMVectorSubtract(XMLoadFloat3(&points[c]), pa));
+	if (XMVectorGetX(XMVector3LengthSq(normal)) > 0.f) {
+		normal = XMVector3Normalize(normal);
+	}
+	XMStoreFloat3(&face.Normal, normal);
+	face.Offset = XMVectorGetX(XMVector3Dot(normal, pa));
+	if (faceDistance(face, interior) > 0.f) {
+		std::swap(face.V[1], face.V[2]);
+		face.Normal = XMFLOAT3(-face.Normal.x, -face.Normal.y, -face.Normal.z);
+		face.Offset = -face.Offset;
+	}
+	return face;
+}
+
+float hullVolume(const ConvexHull& hull) {
+	if (hull.Vertices.empty()) {
+		return 0.f;
+	}
+	XMVECTOR reference = XMLoadFloat3(&hull.Vertices[0]);
+	float volume = 0.f;
+	for (size_t i = 0; i + 2 < hull.Indices.size(); i += 3) {
+		XMVECTOR a = XMVectorSubtract(XMLoadFloat3(&hull.Vertices[hull.Indices[i]]), reference);
+		XMVECTOR b = XMVectorSubtract(XMLoadFloat3(&hull.Vertices[hull.Indices[i + 1]]), reference);
+		XMVECTOR c = XMVectorSubtract(XMLoadFloat3(&hull.Vertices[hull.Indices[i + 2]]), reference);
+		volume += XMVectorGetX(XMVector3Dot(a, XMVector3Cross(b, c)));
+	}
+	return volume / 6.f;
+}
+
+ConvexHull boxHull(const XMFLOAT3& lo, const XMFLOAT3& hi, float thickness) {
+	XMFLOAT3 a(std::min(lo.x, hi.x - thickness), std::min(lo.y, hi.y - thickness), std::min(lo.z, hi.z - thickness));
+	XMFLOAT3 b(std::max(hi.x, lo.x + thickness), std::max(hi.y, lo.y + thickness), std::max(hi.z, lo.z + thickness));
+	ConvexHull hull;
+	for (int i = 0; i < 8; ++i) {
+		hull.Vertices.emplace_back(i & 1 ? b.x : a.x, i & 2 ? b.y : a.y, i & 4 ? b.z : a.z);
+	}
+	hull.Indices = {
+		0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6,
+		0, 1, 4, 1, 5, 4, 2, 6, 3, 3, 6, 7,
+		0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5,
+	};
+	hull.Volume = hullVolume(hull);
+	return hull;
+}
+
+struct VoxelGrid {
+	int Size[3] = {};
+	XMFLOAT3 Origin{};
+	float Voxel = 0.f;
+	std::vector<uint8_t> Solid;
+
+	uint32_t Index(int x, int y, int z) const {
+		return static_cast<uint32_t>((z * Size[1] + y) * Size[0] + x);
+	}
+	void Coordinates(uint32_t index, int (&c)[3]) const {
+		c[0] = static_cast<int>(index % Size[0]);
+		c[1] = static_cast<int>(index / Size[0] % Size[1]);
+		c[2] = static_cast<int>(index / (Size[0] * Size[1]));
+	}
+	XMFLOAT3 Center(const int (&c)[3]) const {
+		return XMFLOAT3(Origin.x + (c[0] + 0.5f) * Voxel, Origin.y + (c[1] + 0.5f) * Voxel, Origin.z + (c[2] + 0.5f) * Voxel);
+	}
+};
+
+VoxelGrid voxelize(const Bvh& bvh, int resolution) {
+	VoxelGrid grid;
+	XMFLOAT3 extent(bvh.Max.x - bvh.Min.x, bvh.Max.y - bvh.Min.y, bvh.Max.z - bvh.Min.z);
+	const float* extents = &extent.x;
+	grid.Voxel = std::max({ extent.x, extent.y, extent.z, 1e-6f }) / std::max(resolution, 1);
+	grid.Origin = bvh.Min;
+	for (int axis = 0; axis < 3; ++axis) {
+		grid.Size[axis] = std::max(1, static_cast<int>(std::ceil(extents[axis] / grid.Voxel)));
+	}
+	size_t voxel_count = static_cast<size_t>(grid.Size[0]) * grid.Size[1] * grid.Size[2];
+	std::vector<uint8_t> votes(voxel_count);
+	const float* origin = &grid.Origin.x;
+	float step = grid.Voxel * 1e-4f;
+
+	// One ray per row and axis; a voxel is inside along that axis when an odd
+	// number of crossings lies before its centre.
+	std::vector<float> hits;
+	for (int axis = 0; axis < 3; ++axis) {
+		int u = (axis + 1) % 3, v = (axis + 2) % 3;
+		for (int j = 0; j < grid.Size[v]; ++j) {
+			for (int i = 0; i < grid.Size[u]; ++i) {
+				BvhRay ray;
+				float* ray_origin = &ray.Origin.x;
+				float* ray_direction = &ray.Direction.x;
+				ray_origin[axis] = origin[axis] - grid.Voxel;
+				ray_origin[u] = origin[u] + (i + 0.5f) * grid.Voxel;
+				ray_origin[v] = origin[v] + (j + 0.5f) * grid.Voxel;
+				ray_direction[axis] = 1.f;
+				ray_direction[u] = 0.f;
+				ray_direction[v] = 0.f;
+				hits.clear();
+				while (hits.size() < MAX_CROSSINGS) {
+					auto hit = IntersectBvh(bvh, ray);
+					if (!hit) {
+						break;
+					}
+					hits.push_back(hit->T);
+					ray.TMin = hit->T + step;
+				}
+
+				size_t crossed = 0;
+				for (int k = 0; k < grid.Size[axis]; ++k) {
+					float t = (k + 1.5f) * grid.Voxel;
+					while (crossed < hits.size() && hits[crossed] < t) {
+						++crossed;
+					}
+					if (crossed & 1) {
+						int c[3];
+						c[axis] = k;
+						c[u] = i;
+						c[v] = j;
+						++votes[grid.Index(c[0], c[1], c[2])];
+					}
+				}
+			}
+		}
+	}
+
+	// Voxels the surface passes through count too, so open and thin meshes
+	// still get a shell.
+	grid.Solid.resize(voxel_count);
+	float reach = grid.Voxel * 0.5f * std::sqrt(3.f);
+	for (uint32_t index = 0; index < voxel_count; ++index) {
+		int c[3];
+		grid.Coordinates(index, c);
+		grid.Solid[index] = votes[index] >= 2 || ClosestPointBvh(bvh, grid.Center(c), reach).has_value();
+	}
+	return grid;
+}
+
+// Hull of the centres of the voxels of a part that have an empty side. The
+// centres rather than the corners keep the hulls from growing by a voxel
+// beyond the surface voxels.
+ConvexHull partHull(const VoxelGrid& grid, const std::vector<uint32_t>& voxels, std::vector<uint8_t>& mark, int max_vertices) {
+	for (auto index : voxels) {
+		mark[index] = 1;
+	}
+	std::vector<XMFLOAT3> points;
+	for (auto index : voxels) {
+		int c[3];
+		grid.Coordinates(index, c);
+		bool boundary = false;
+		for (int axis = 0; axis < 3 && !boundary; ++axis) {
+			for (int d = -1; d <= 1 && !boundary; d += 2) {
+				int n[3] = { c[0], c[1], c[2] };
+				n[axis] += d;
+				boundary = n[axis] < 0 || n[axis] >= grid.Size[axis] || !mark[grid.Index(n[0], n[1], n[2])];
+			}
+		}
+		if (boundary) {
+			points.push_back(grid.Center(c));
+		}
+	}
+	for (auto index : voxels) {
+		mark[index] = 0;
+	}
+	return BuildConvexHull(points, max_vertices);
+}
+
+// 6-connected pieces of a set of voxels.
+std::vector<std::vector<uint32_t>> connectedPieces(const VoxelGrid& grid, const std::vector<uint32_t>& voxels, std::vector<uint8_t>& mark) {
+	for (auto index : voxels) {
+		mark[index] = 1;
+	}
+	std::vector<std::vector<uint32_t>> pieces;
+	for (auto seed : voxels) {
+		if (mark[seed] != 1) {
+			continue;
+		}
+		std::vector<uint32_t> piece = { seed };
+		mark[seed] = 2;
+		for (size_t next = 0; next < piece.size(); ++next) {
+			int c[3];
+			grid.Coordinates(piece[next], c);
+			for (int axis = 0; axis < 3; ++axis) {
+				for (int d = -1; d <= 1; d += 2) {
+					int n[3] = { c[0], c[1], c[2] };
+					n[axis] += d;
+					if (n[axis] < 0 || n[axis] >= grid.Size[axis]) {
+						continue;
+					}
+					uint32_t neighbour = grid.Index(n[0], n[1], n[2]);
+					if (mark[neighbour] == 1) {
+						mark[neighbour] = 2;
+						piece.push_back(neighbour);
+					}
+				}
+			}
+		}
+		pieces.push_back(std::move(piece));
+	}
+	for (auto index : voxels) {
+		mark[index] = 0;
+	}
+	return pieces;
+}
+
+struct Part {
+	std::vector<uint32_t> Voxels;
+	ConvexHull Hull;
+	// Whether splitting was tried and did not help.
+	bool Final = false;
+
+	float Excess(float voxel_volume) const {
+		return Hull.Volume - Voxels.size() * voxel_volume;
+	}
+};
+
+// Splits at the axis-aligned plane with the smallest total hull volume and
+// returns the connected pieces of both sides. Empty when the part is a
+// single voxel thick in every direction.
+std::vector<std::vector<uint32_t>> splitPart(const VoxelGrid& grid, const Part& part, std::vector<uint8_t>& mark, int max_vertices) {
+	int lo[3] = { INT32_MAX, INT32_MAX, INT32_MAX }, hi[3] = { INT32_MIN, INT32_MIN, INT32_MIN };
+	for (auto index : part.Voxels) {
+		int c[3];
+		grid.Coordinates(index, c);
+		for (int axis = 0; axis < 3; ++axis) {
+			lo[axis] = std::min(lo[axis], c[axis]);
+			hi[axis] = std::max(hi[axis], c[axis]);
+		}
+	}
+
+	float best_cost = FLT_MAX;
+	std::vector<uint32_t> best_sides[2];
+	for (int axis = 0; axis < 3; ++axis) {
+		int span = hi[axis] - lo[axis] + 1;
+		int previous = lo[axis];
+		for (int k = 1; k <= SPLIT_CANDIDATES; ++k) {
+			int plane = lo[axis] + span * k / (SPLIT_CANDIDATES + 1);
+			if (plane <= previous || plane > hi[axis]) {
+				continue;
+			}
+			previous = plane;
+			std::vector<uint32_t> sides[2];
+			for (auto index : part.Voxels) {
+				int c[3];
+				grid.Coordinates(index, c);
+				sides[c[axis] < plane ? 0 : 1].push_back(index);
+			}
+			float cost = partHull(grid, sides[0], mark, max_vertices).Volume + partHull(grid, sides[1], mark, max_vertices).Volume;
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_sides[0] = std::move(sides[0]);
+				best_sides[1] = std::move(sides[1]);
+			}
+		}
+	}
+
+	std::vector<std::vector<uint32_t>> pieces;
+	for (const auto& side : best_sides) {
+		for (auto& piece : connectedPieces(grid, side, mark)) {
+			pieces.push_back(std::move(piece));
+		}
+	}
+	return pieces;
+}
+
+template <typename T>
+void append(std::vector<uint8_t>& out, const T* data, size_t count) {
+	auto bytes = reinterpret_cast<const uint8_t*>(data);
+	out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+}
+
+ConvexHull BuildConvexHull(const std::vector<XMFLOAT3>& points, int max_vertices) {
+	if (points.empty()) {
+		return {};
+	}
+	XMVECTOR lo = XMLoadFloat3(&points[0]), hi = lo;
+	for (const auto& point : points) {
+		lo = XMVectorMin(lo, XMLoadFloat3(&point));
+		hi = XMVectorMax(hi, XMLoadFloat3(&point));
+	}
+	float scale = std::max(XMVectorGetX(XMVector3Length(XMVectorSubtract(hi, lo))), 1e-12f);
+	float epsilon = scale * 1e-6f;
+	XMFLOAT3 bounds_lo, bounds_hi;
+	XMStoreFloat3(&bounds_lo, lo);
+	XMStoreFloat3(&bounds_hi, hi);
+	auto degenerate = [&]() { return boxHull(bounds_lo, bounds_hi, scale * 1e-3f); };
+	if (points.size() < 4) {
+		return degenerate();
+	}
+
+	// The most distant pair of axis extremes, then the points farthest from
+	// their line and from the plane of all three.
+	uint32_t extremes[6] = {};
+	for (uint32_t i = 0; i < points.size(); ++i) {
+		const float* p = &points[i].x;
+		for (int axis = 0; axis < 3; ++axis) {
+			if (p[axis] < (&points[extremes[axis * 2]].x)[axis]) {
+				extremes[axis * 2] = i;
+			}
+			if (p[axis] > (&points[extremes[axis * 2 + 1]].x)[axis]) {
+				extremes[axis * 2 + 1] = i;
+			}
+		}
+	}
+	uint32_t simplex[4] = {};
+	float best = -1.f;
+	for (int axis = 0; axis < 3; ++axis) {
+		float distance = XMVectorGetX(XMVector3LengthSq(XMVectorSubtract(XMLoadFloat3(&points[extremes[axis * 2 + 1]]), XMLoadFloat3(&points[extremes[axis * 2]]))));
+		if (distance > best) {
+			best = distance;
+			simplex[0] = extremes[axis * 2];
+			simplex[1] = extremes[axis * 2 + 1];
+		}
+	}
+	XMVECTOR p0 = XMLoadFloat3(&points[simplex[0]]);
+	XMVECTOR line = XMVector3Normalize(XMVectorSubtract(XMLoadFloat3(&points[simplex[1]]), p0));
+	best = -1.f;
+	for (uint32_t i = 0; i < points.size(); ++i) {
+		float distance = XMVectorGetX(XMVector3LengthSq(XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&points[i]), p0), line)));
+		if (distance > best) {
+			best = distance;
+			simplex[2] = i;
+		}
+	}
+	if (std::sqrt(best) < epsilon) {
+		return degenerate();
+	}
+	XMVECTOR plane = XMVector3Normalize(XMVector3Cross(line, XMVectorSubtract(XMLoadFloat3(&points[simplex[2]]), p0)));
+	best = -1.f;
+	for (uint32_t i = 0; i < points.size(); ++i) {
+		float distance = std::fabs(XMVectorGetX(XMVector3Dot(XMVectorSubtract(XMLoadFloat3(&points[i]), p0), plane)));
+		if (distance > best) {
+			best = distance;
+			simplex[3] = i;
+		}
+	}
+	if (best < epsilon) {
+		return degenerate();
+	}
+
+	XMFLOAT3 interior;
+	XMStoreFloat3(&interior, XMVectorScale(XMVectorAdd(XMVectorAdd(p0, XMLoadFloat3(&points[simplex[1]])), XMVectorAdd(XMLoadFloat3(&points[simplex[2]]), XMLoadFloat3(&points[simplex[3]]))), 0.25f));
+	std::vector<HullFace> faces = {
+		makeFace(points, simplex[0], simplex[1], simplex[2], interior),
+		makeFace(points, simplex[0], simplex[1], simplex[3], interior),
+		makeFace(points, simplex[0], simplex[2], simplex[3], interior),
+		makeFace(points, simplex[1], simplex[2], simplex[3], interior),
+	};
+	auto assign = [&](uint32_t point, size_t first_face) {
+		for (size_t f = first_face; f < faces.size(); ++f) {
+			if (faces[f].Alive && faceDistance(faces[f], points[point]) > epsilon) {
+				faces[f].Outside.push_back(point);
+				return;
+			}
+		}
+	};
+	for (uint32_t i = 0; i < points.size(); ++i) {
+		if (std::find(simplex, simplex + 4, i) == simplex + 4) {
+			assign(i, 0);
+		}
+	}
+
+	int vertex_count = 4;
+	std::unordered_set<uint64_t> visible_edges;
+	std::vector<uint32_t> orphans;
+	while (vertex_count < std::max(max_vertices, 4)) {
+		// The farthest outside point of any face, so that a capped hull keeps
+		// the points that matter most.
+		uint32_t apex = UINT32_MAX;
+		float apex_distance = epsilon;
+		for (const auto& face : faces) {
+			if (!face.Alive) {
+				continue;
+			}
+			for (auto point : face.Outside) {
+				float distance = faceDistance(face, points[point]);
+				if (distance > apex_distance) {
+					apex_distance = distance;
+					apex = point;
+				}
+			}
+		}
+		if (apex == UINT32_MAX) {
+			break;
+		}
+
+		visible_edges.clear();
+		orphans.clear();
+		for (auto& face : faces) {
+			if (!face.Alive || faceDistance(face, points[apex]) <= epsilon) {
+				continue;
+			}
+			face.Alive = false;
+			for (int e = 0; e < 3; ++e) {
+				visible_edges.insert((static_cast<uint64_t>(face.V[e]) << 32) | face.V[(e + 1) % 3]);
+			}
+			orphans.insert(orphans.end(), face.Outside.begin(), face.Outside.end());
+			face.Outside.clear();
+			face.Outside.shrink_to_fit();
+		}
+
+		// Edges of the visible region without their reverse form the horizon.
+		size_t first_new = faces.size();
+		for (auto edge : visible_edges) {
+			uint32_t a = static_cast<uint32_t>(edge >> 32), b = static_cast<uint32_t>(edge);
+			if (!visible_edges.count((static_cast<uint64_t>(b) << 32) | a)) {
+				faces.push_back(makeFace(points, a, b, apex, interior));
+			}
+		}
+		for (auto point : orphans) {
+			if (point != apex) {
+				assign(point, first_new);
+			}
+		}
+		++vertex_count;
+	}
+
+	ConvexHull hull;
+	std::vector<uint32_t> remap(points.size(), UINT32_MAX);
+	for (const auto& face : faces) {
+		if (!face.Alive) {
+			continue;
+		}
+		for (auto v : face.V) {
+			if (remap[v] == UINT32_MAX) {
+				remap[v] = static_cast<uint32_t>(hull.Vertices.size());
+				hull.Vertices.push_back(points[v]);
+			}
+			hull.Indices.push_back(remap[v]);
+		}
+	}
+	hull.Volume = hullVolume(hull);
+	return hull;
+}
+
+std::vector<ConvexHull> BuildCollisionHulls(std::vector<BvhTriangle> triangles, const CollisionSettings& settings) {
+	if (triangles.empty()) {
+		return {};
+	}
+	if (settings.Mode == CollisionMode::Hull) {
+		std::vector<XMFLOAT3> points;
+		points.reserve(triangles.size() * 3);
+		for (const auto& triangle : triangles) {
+			points.push_back(triangle.V0);
+			points.push_back(triangle.V1);
+			points.push_back(triangle.V2);
+		}
+		return { BuildConvexHull(points, settings.MaxHullVertices) };
+	}
+
+	auto bvh = BuildBvh(std::move(triangles));
+	auto grid = voxelize(bvh, settings.Resolution);
+	float voxel_volume = grid.Voxel * grid.Voxel * grid.Voxel;
+	std::vector<uint8_t> mark(grid.Solid.size());
+
+	std::vector<uint32_t> solid;
+	for (uint32_t index = 0; index < grid.Solid.size(); ++index) {
+		if (grid.Solid[index]) {
+			solid.push_back(index);
+		}
+	}
+	std::vector<Part> parts;
+	for (auto& piece : connectedPieces(grid, solid, mark)) {
+		Part part;
+		part.Hull = partHull(grid, piece, mark, settings.MaxHullVertices);
+		part.Voxels = std::move(piece);
+		parts.push_back(std::move(part));
+	}
+
+	while (static_cast<int>(parts.size()) < settings.MaxHulls) {
+		size_t worst = parts.size();
+		float worst_excess = 0.f;
+		for (size_t i = 0; i < parts.size(); ++i) {
+			float excess = parts[i].Excess(voxel_volume);
+			if (!parts[i].Final && excess > settings.MaxConcavity * parts[i].Hull.Volume && excess > worst_excess) {
+				worst = i;
+				worst_excess = excess;
+			}
+		}
+		if (worst == parts.size()) {
+			break;
+		}
+
+		auto pieces = splitPart(grid, parts[worst], mark, settings.MaxHullVertices);
+		if (pieces.size() < 2 || static_cast<int>(parts.size() + pieces.size() - 1) > settings.MaxHulls) {
+			parts[worst].Final = true;
+			continue;
+		}
+		parts.erase(parts.begin() + worst);
+		for (auto& piece : pieces) {
+			Part part;
+			part.Hull = partHull(grid, piece, mark, settings.MaxHullVertices);
+			part.Voxels = std::move(piece);
+			parts.push_back(std::move(part));
+		}
+	}
+
+	std::vector<ConvexHull> hulls;
+	for (auto& part : parts) {
+		hulls.push_back(std::move(part.Hull));
+	}
+	return hulls;
+}
+
+std::vector<uint8_t> SerializeCollisionHulls(const std::vector<ConvexHull>& hulls) {
+	CollisionSectionHeader header{ { 'C', 'O', 'L', '1' }, static_cast<uint32_t>(hulls.size()) };
+	std::vector<CollisionHullEntry> entries;
+	for (const auto& hull : hulls) {
+		entries.push_back({ header.VertexCount, static_cast<uint32_t>(hull.Vertices.size()), header.IndexCount, static_cast<uint32_t>(hull.Indices.size()), hull.Volume });
+		header.VertexCount += static_cast<uint32_t>(hull.Vertices.size());
+		header.IndexCount += static_cast<uint32_t>(hull.Indices.size());
+	}
+	std::vector<uint8_t> out;
+	append(out, &header, 1);
+	append(out, entries.data(), entries.size());
+	for (const auto& hull : hulls) {
+		append(out, hull.Vertices.data(), hull.Vertices.size());
+	}
+	for (const auto& hull : hulls) {
+		append(out, hull.Indices.data(), hull.Indices.size());
+	}
+	return out;
+}
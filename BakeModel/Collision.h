@@ -0,0 +1,69 @@
+﻿#pragma once
+
+#include "Bvh.h"
+
+#include <DirectXMath.h>
+
+#include <cstdint>
+#include <vector>
+
+enum class CollisionMode {
+	// One hull around all vertices of the mesh.
+	Hull,
+	// Approximate convex decomposition into up to MaxHulls hulls, or one hull
+	// per disconnected piece if there are more.
+	Decompose,
+};
+
+struct CollisionSettings {
+	CollisionMode Mode = CollisionMode::Hull;
+	// Voxels along the longest side of the mesh for the decomposition.
+	int Resolution = 48;
+	int MaxHulls = 16;
+	// Parts whose hull exceeds their volume by less than this fraction are
+	// not split further.
+	float MaxConcavity = 0.05f;
+	// Vertices kept per hull, at least 4. Points are added farthest first and
+	// the rest dropped, so a capped hull lies slightly inside the mesh.
+	int MaxHullVertices = 64;
+};
+
+struct ConvexHull {
+	std::vector<DirectX::XMFLOAT3> Vertices;
+	// Outward-facing triangles over Vertices.
+	std::vector<uint32_t> Indices;
+	float Volume = 0.f;
+};
+
+// Incremental quickhull: starts from the largest tetrahedron of the points and
+// repeatedly adds the farthest point outside a face. Degenerate input, such
+// as a flat mesh, gets a thin box around its bounds instead.
+ConvexHull BuildConvexHull(const std::vector<DirectX::XMFLOAT3>& points, int max_vertices);
+
+// Collision hulls of one mesh. Hull mode wraps every vertex. Decompose mode
+// voxelizes the solid, marking voxels inside by the majority parity of
+// scanlines along the three axes plus voxels touching the surface, and keeps
+// splitting the part with the most volume between it and its hull. Each split
+// takes the axis-aligned plane with the smallest sum of hull volumes, and the
+// halves are separated into connected pieces.
+std::vector<ConvexHull> BuildCollisionHulls(std::vector<BvhTriangle> triangles, const CollisionSettings& settings);
+
+// Layout of the collision section: this header, HullCount CollisionHullEntry,
+// then all vertices as float3 and all indices as uint32. Entries index into
+// those two arrays.
+struct CollisionSectionHeader {
+	char Magic[4];
+	uint32_t HullCount;
+	uint32_t VertexCount;
+	uint32_t IndexCount;
+};
+
+struct CollisionHullEntry {
+	uint32_t FirstVertex;
+	uint32_t VertexCount;
+	uint32_t FirstIndex;
+	uint32_t IndexCount;
+	float Volume;
+};
+
+std::vector<uint8_t> SerializeCollisionHulls(const std::vector<ConvexHull>& hulls);
@@ -0,0 +1,180 @@
+﻿#include "DistanceField.h"
+#include "../BakeRender/Parallel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace DirectX;
+
+namespace {
+
+constexpr uint32_t BRICK_STEP = SDF_BRICK_SIZE - 1;
+constexpr uint32_t BRICK_SAMPLES = SDF_BRICK_SIZE * SDF_BRICK_SIZE * SDF_BRICK_SIZE;
+constexpr int PADDING_VOXELS = 2;
+constexpr int DEFAULT_RESOLUTION = 64;
+constexpr int MAX_CROSSINGS = 1024;
+
+// Directions off every axis and diagonal, so that rays rarely graze an edge.
+const XMFLOAT3 PARITY_DIRECTIONS[3] = {
+	{ 0.9317f, 0.3447f, 0.1149f },
+	{ -0.2051f, 0.8917f, 0.4035f },
+	{ 0.2893f, -0.1587f, -0.9440f },
+};
+
+uint32_t crossings(const Bvh& bvh, const XMFLOAT3& origin, const XMFLOAT3& direction, float step) {
+	BvhRay ray;
+	ray.Origin = origin;
+	ray.Direction = direction;
+	uint32_t count = 0;
+	while (count < MAX_CROSSINGS) {
+		auto hit = IntersectBvh(bvh, ray);
+		if (!hit) {
+			break;
+		}
+		++count;
+		ray.TMin = hit->T + step;
+	}
+	return count;
+}
+
+bool inside(const Bvh& bvh, const XMFLOAT3& point, float step) {
+	int votes = 0;
+	for (const auto& direction : PARITY_DIRECTIONS) {
+		votes += crossings(bvh, point, direction, step) & 1;
+	}
+	return votes >= 2;
+}
+
+int8_t quantize(float distance, float max_distance) {
+	return static_cast<int8_t>(std::lround(std::clamp(distance / max_distance, -1.f, 1.f) * 127.f));
+}
+
+template <typename T>
+void append(std::vector<uint8_t>& out, const T* data, size_t count) {
+	auto bytes = reinterpret_cast<const uint8_t*>(data);
+	out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+}
+
+std::vector<uint8_t> BuildSerializedSdf(std::vector<BvhTriangle> triangles, const SdfSettings& settings) {
+	SdfSectionHeader header{ { 'S', 'D', 'F', '1' }, settings.Sparse ? 1u : 0u };
+	std::vector<uint8_t> out;
+	if (triangles.empty()) {
+		append(out, &header, 1);
+		return out;
+	}
+
+	auto bvh = BuildBvh(std::move(triangles));
+	XMVECTOR min = XMLoadFloat3(&bvh.Min);
+	XMVECTOR extent = XMVectorSubtract(XMLoadFloat3(&bvh.Max), min);
+	XMFLOAT3 extents;
+	XMStoreFloat3(&extents, extent);
+	float diagonal = XMVectorGetX(XMVector3Length(extent));
+	float voxel = settings.VoxelSize > 0.f ? settings.VoxelSize : std::max({ extents.x, extents.y, extents.z, 1e-6f }) / DEFAULT_RESOLUTION;
+	float max_distance = settings.MaxDistance > 0.f ? settings.MaxDistance : settings.Sparse ? voxel * 4.f : diagonal * 0.25f;
+	max_distance = std::max(max_distance, voxel);
+	// Steps past each crossing of the parity rays.
+	float step = std::max(diagonal, voxel) * 1e-6f;
+
+	// Whole bricks with a margin around the bounds.
+	XMStoreFloat3(reinterpret_cast<XMFLOAT3*>(header.Origin), XMVectorSubtract(min, XMVectorReplicate(voxel * PADDING_VOXELS)));
+	const float* extent_values = &extents.x;
+	for (int axis = 0; axis < 3; ++axis) {
+		uint32_t voxels = static_cast<uint32_t>(std::ceil(extent_values[axis] / voxel)) + PADDING_VOXELS * 2;
+		header.BrickCount[axis] = std::max(1u, (voxels + BRICK_STEP - 1) / BRICK_STEP);
+		header.Size[axis] = header.BrickCount[axis] * BRICK_STEP + 1;
+	}
+	header.VoxelSize = voxel;
+	header.MaxDistance = max_distance;
+
+	size_t brick_count = static_cast<size_t>(header.BrickCount[0]) * header.BrickCount[1] * header.BrickCount[2];
+	// Samples of every evaluated brick; empty for bricks away from the surface.
+	std::vector<std::vector<int8_t>> bricks(brick_count);
+	std::vector<uint32_t> table(brick_count, SDF_BRICK_OUTSIDE);
+	float brick_radius = std::sqrt(3.f) * 0.5f * BRICK_STEP * voxel;
+
+	ParallelFor(brick_count, [&](size_t brick) {
+		uint32_t bx = static_cast<uint32_t>(brick % header.BrickCount[0]);
+		uint32_t by = static_cast<uint32_t>(brick / header.BrickCount[0] % header.BrickCount[1]);
+		uint32_t bz = static_cast<uint32_t>(brick / (static_cast<size_t>(header.BrickCount[0]) * header.BrickCount[1]));
+		auto sample_position = [&](uint32_t x, uint32_t y, uint32_t z) {
+			return XMFLOAT3(header.Origin[0] + x * voxel, header.Origin[1] + y * voxel, header.Origin[2] + z * voxel);
+		};
+
+		XMFLOAT3 center = sample_position(bx * BRICK_STEP, by * BRICK_STEP, bz * BRICK_STEP);
+		center.x += 0.5f * BRICK_STEP * voxel;
+		center.y += 0.5f * BRICK_STEP * voxel;
+		center.z += 0.5f * BRICK_STEP * voxel;
+		if (!ClosestPointBvh(bvh, center, max_distance + brick_radius)) {
+			table[brick] = inside(bvh, center, step) ? SDF_BRICK_INSIDE : SDF_BRICK_OUTSIDE;
+			return;
+		}
+
+		auto& samples = bricks[brick];
+		samples.resize(BRICK_SAMPLES);
+		for (uint32_t z = 0; z < SDF_BRICK_SIZE; ++z) {
+			for (uint32_t y = 0; y < SDF_BRICK_SIZE; ++y) {
+				for (uint32_t x = 0; x < SDF_BRICK_SIZE; ++x) {
+					auto position = sample_position(bx * BRICK_STEP + x, by * BRICK_STEP + y, bz * BRICK_STEP + z);
+					auto closest = ClosestPointBvh(bvh, position, max_distance);
+					float distance = closest ? closest->Distance : max_distance;
+					if (inside(bvh, position, step)) {
+						distance = -distance;
+					}
+					samples[(z * SDF_BRICK_SIZE + y) * SDF_BRICK_SIZE + x] = quantize(distance, max_distance);
+				}
+			}
+		}
+
+		// Bricks that only reach the band at their corners can still be dropped.
+		bool all_outside = std::all_of(samples.begin(), samples.end(), [](int8_t value) { return value == 127; });
+		bool all_inside = std::all_of(samples.begin(), samples.end(), [](int8_t value) { return value == -127; });
+		if (all_outside || all_inside) {
+			table[brick] = all_inside ? SDF_BRICK_INSIDE : SDF_BRICK_OUTSIDE;
+			samples.clear();
+		}
+	});
+
+	if (settings.Sparse) {
+		std::vector<int8_t> pool;
+		for (size_t brick = 0; brick < brick_count; ++brick) {
+			if (!bricks[brick].empty()) {
+				table[brick] = header.StoredBrickCount++;
+				pool.insert(pool.end(), bricks[brick].begin(), bricks[brick].end());
+			}
+		}
+		append(out, &header, 1);
+		append(out, table.data(), table.size());
+		append(out, pool.data(), pool.size());
+	}
+	else {
+		size_t row = header.Size[0];
+		size_t slice = row * header.Size[1];
+		std::vector<int8_t> dense(slice * header.Size[2]);
+		for (size_t brick = 0; brick < brick_count; ++brick) {
+			size_t bx = brick % header.BrickCount[0];
+			size_t by = brick / header.BrickCount[0] % header.BrickCount[1];
+			size_t bz = brick / (static_cast<size_t>(header.BrickCount[0]) * header.BrickCount[1]);
+			size_t base = bz * BRICK_STEP * slice + by * BRICK_STEP * row + bx * BRICK_STEP;
+			const auto& samples = bricks[brick];
+			int8_t fill = table[brick] == SDF_BRICK_INSIDE ? -127 : 127;
+			for (uint32_t z = 0; z < SDF_BRICK_SIZE; ++z) {
+				for (uint32_t y = 0; y < SDF_BRICK_SIZE; ++y) {
+					int8_t* target = dense.data() + base + z * slice + y * row;
+					if (samples.empty()) {
+						std::memset(target, static_cast<uint8_t>(fill), SDF_BRICK_SIZE);
+					}
+					else {
+						std::memcpy(target, samples.data() + (z * SDF_BRICK_SIZE + y) * SDF_BRICK_SIZE, SDF_BRICK_SIZE);
+					}
+				}
+			}
+		}
+		append(out, &header, 1);
+		append(out, dense.data(), dense.size());
+	}
+	out.resize((out.size() + 3) & ~size_t(3), 0);
+	return out;
+}
@@ -0,0 +1,56 @@
+﻿#pragma once
+
+#include "Bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+struct SdfSettings {
+	// Edge of one voxel in mesh units. 0 uses the longest side of the mesh
+	// bounds over 64.
+	float VoxelSize = 0.f;
+	// Keep only the bricks near the surface.
+	bool Sparse = false;
+	// Distance that the stored extremes stand for; farther samples are
+	// clamped. 0 uses four voxels when sparse and a quarter of the diagonal of
+	// the mesh bounds when dense.
+	float MaxDistance = 0.f;
+};
+
+// Samples along one edge of a brick. Neighbouring bricks share their border
+// samples, so every brick can be filtered on its own.
+constexpr uint32_t SDF_BRICK_SIZE = 8;
+// Brick table entries of bricks that were not stored because every sample is
+// at least MaxDistance away, outside or inside.
+constexpr uint32_t SDF_BRICK_OUTSIDE = 0xFFFFFFFFu;
+constexpr uint32_t SDF_BRICK_INSIDE = 0xFFFFFFFEu;
+
+// Layout of a serialized distance field. Samples are int8, distance =
+// value / 127 * MaxDistance, negative inside. Sample (x, y, z) sits at
+// Origin + (x, y, z) * VoxelSize in mesh space. Each of the Size[0] x
+// Size[1] x Size[2] samples is covered by BrickCount bricks that start every
+// SDF_BRICK_SIZE - 1 samples.
+//
+// Dense: the header is followed by all samples, x fastest, then z slowest.
+// Sparse: the header is followed by one uint32 per brick, x fastest, holding
+// the index of the brick in the pool or SDF_BRICK_OUTSIDE / SDF_BRICK_INSIDE,
+// then StoredBrickCount bricks of SDF_BRICK_SIZE^3 samples, x fastest.
+// The section is padded to four bytes.
+struct SdfSectionHeader {
+	char Magic[4];
+	uint32_t Sparse;
+	uint32_t Size[3];
+	float Origin[3];
+	float VoxelSize;
+	float MaxDistance;
+	uint32_t BrickCount[3];
+	uint32_t StoredBrickCount;
+};
+
+// Builds the signed distance field of a closed mesh. Bricks are evaluated in
+// parallel. A brick whose centre is farther from the surface than its extent
+// plus MaxDistance takes one query in total; otherwise every sample takes a
+// closest-point query against a BVH of the triangles. The sign comes from the
+// parity of surface crossings along three fixed rays, by majority, so small
+// holes do not flip whole regions.
+std::vector<uint8_t> BuildSerializedSdf(std::vector<BvhTriangle> triangles, const SdfSettings& settings);
@@ -0,0 +1,416 @@
+﻿#include "Lightmap.h"
+#include "../BakeRender/Parallel.h"
+#include "Sampling.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <fstream>
+#include <string>
+
+using namespace DirectX;
+
+namespace {
+
+struct SurfacePoint {
+	XMVECTOR Position;
+	// Both normals face the side the point is seen from.
+	XMVECTOR Normal;
+	XMVECTOR Geometric;
+	XMFLOAT2 TexCoord;
+};
+
+float luminance(const XMFLOAT3& color) {
+	return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+}
+
+// Interpolates a point of a triangle of the scene. With toward, the normals are
+// flipped to face it; otherwise they follow the interpolated vertex normal.
+SurfacePoint surfacePoint(const MeshGeometry& mesh, uint32_t triangle, float b1, float b2, const XMVECTOR* toward) {
+	const uint32_t* corners = &mesh.Indices[triangle * 3];
+	XMVECTOR p0 = XMLoadFloat3(&mesh.Positions[corners[0]]);
+	XMVECTOR p1 = XMLoadFloat3(&mesh.Positions[corners[1]]);
+	XMVECTOR p2 = XMLoadFloat3(&mesh.Positions[corners[2]]);
+	float b0 = 1.f - b1 - b2;
+
+	SurfacePoint point;
+	point.Position = XMVectorAdd(XMVectorAdd(XMVectorScale(p0, b0), XMVectorScale(p1, b1)), XMVectorScale(p2, b2));
+	point.Geometric = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0)));
+	point.Normal = point.Geometric;
+	if (!mesh.Normals.empty()) {
+		XMVECTOR n = XMVectorAdd(XMVectorAdd(
+			XMVectorScale(XMLoadFloat3(&mesh.Normals[corners[0]]), b0),
+			XMVectorScale(XMLoadFloat3(&mesh.Normals[corners[1]]), b1)),
+			XMVectorScale(XMLoadFloat3(&mesh.Normals[corners[2]]), b2));
+		if (XMVectorGetX(XMVector3LengthSq(n)) > 1e-12f) {
+			point.Normal = XMVector3Normalize(n);
+		}
+	}
+	if (toward) {
+		if (XMVectorGetX(XMVector3Dot(point.Geometric, *toward)) < 0.f) {
+			point.Geometric = XMVectorNegate(point.Geometric);
+		}
+		if (XMVectorGetX(XMVector3Dot(point.Normal, point.Geometric)) < 0.f) {
+			point.Normal = XMVectorNegate(point.Normal);
+		}
+	}
+	else if (XMVectorGetX(XMVector3Dot(point.Geometric, point.Normal)) < 0.f) {
+		point.Geometric = XMVectorNegate(point.Geometric);
+	}
+
+	point.TexCoord = XMFLOAT2(0.f, 0.f);
+	if (!mesh.TexCoords.empty()) {
+		const auto& t0 = mesh.TexCoords[corners[0]];
+		const auto& t1 = mesh.TexCoords[corners[1]];
+		const auto& t2 = mesh.TexCoords[corners[2]];
+		point.TexCoord = XMFLOAT2(t0.x * b0 + t1.x * b1 + t2.x * b2, t0.y * b0 + t1.y * b1 + t2.y * b2);
+	}
+	return point;
+}
+
+float srgbToLinear(uint8_t value) {
+	float c = value / 255.f;
+	return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+// Nearest texel with wrapping, row 0 of the texture at v = 1.
+XMVECTOR albedoAt(const SurfaceMaterial& material, const XMFLOAT2& uv) {
+	if (!material.AlbedoTexture || material.AlbedoTexture->Pixels.empty()) {
+		return XMLoadFloat3(&material.Albedo);
+	}
+	const auto& texture = *material.AlbedoTexture;
+	float u = uv.x - std::floor(uv.x);
+	float v = 1.f - uv.y;
+	v -= std::floor(v);
+	int x = std::min(static_cast<int>(u * texture.Width), texture.Width - 1);
+	int y = std::min(static_cast<int>(v * texture.Height), texture.Height - 1);
+	const uint8_t* texel = texture.Texel(x, y);
+	if (texture.Channels < 3) {
+		float grey = srgbToLinear(texel[0]);
+		return XMVectorSet(grey, grey, grey, 0.f);
+	}
+	return XMVectorSet(srgbToLinear(texel[0]), srgbToLinear(texel[1]), srgbToLinear(texel[2]), 0.f);
+}
+
+bool visible(const LightmapScene& scene, XMVECTOR origin, XMVECTOR direction, float distance) {
+	BvhRay ray;
+	XMStoreFloat3(&ray.Origin, origin);
+	XMStoreFloat3(&ray.Direction, direction);
+	ray.TMax = distance;
+	return !OccludedBvh(scene.SceneBvh, ray);
+}
+
+float smoothStep(float edge0, float edge1, float x) {
+	if (edge1 <= edge0) {
+		return x >= edge0 ? 1.f : 0.f;
+	}
+	float t = std::clamp((x - edge0) / (edge1 - edge0), 0.f, 1.f);
+	return t * t * (3.f - 2.f * t);
+}
+
+// Irradiance over pi at a surface point from every light and one emitter.
+XMVECTOR directLight(const LightmapScene& scene, const SurfacePoint& point, Random& random) {
+	XMVECTOR result = XMVectorZero();
+	XMVECTOR origin = XMVectorAdd(point.Position, XMVectorScale(point.Geometric, scene.Bias));
+
+	for (const auto& light : scene.Lights) {
+		XMVECTOR color = XMLoadFloat3(&light.Color);
+		if (light.Type == LightType::Directional) {
+			XMVECTOR to_light = XMVectorNegate(XMVector3Normalize(XMLoadFloat3(&light.Direction)));
+			float cosine = XMVectorGetX(XMVector3Dot(point.Normal, to_light));
+			if (cosine > 0.f && visible(scene, origin, to_light, FLT_MAX)) {
+				result = XMVectorAdd(result, XMVectorScale(color, cosine));
+			}
+			continue;
+		}
+
+		XMVECTOR offset = XMVectorSubtract(XMLoadFloat3(&light.Position), origin);
+		float distance = XMVectorGetX(XMVector3Length(offset));
+		if (distance <= 0.f) {
+			continue;
+		}
+		XMVECTOR to_light = XMVectorScale(offset, 1.f / distance);
+		float cosine = XMVectorGetX(XMVector3Dot(point.Normal, to_light));
+		if (cosine <= 0.f) {
+			continue;
+		}
+		float falloff = light.Constant + light.Linear * distance + light.Quadratic * distance * distance;
+		float attenuation = falloff > 0.f ? 1.f / falloff : 1.f / (distance * distance);
+		if (light.Type == LightType::Spot) {
+			float angle = -XMVectorGetX(XMVector3Dot(to_light, XMVector3Normalize(XMLoadFloat3(&light.Direction))));
+			attenuation *= smoothStep(std::cos(light.OuterCone), std::cos(light.InnerCone), angle);
+		}
+		if (attenuation > 0.f && visible(scene, origin, to_light, distance)) {
+			result = XMVectorAdd(result, XMVectorScale(color, cosine * attenuation));
+		}
+	}
+
+	if (!scene.Emitters.empty()) {
+		float total = scene.EmitterCdf.back();
+		auto picked = std::upper_bound(scene.EmitterCdf.begin(), scene.EmitterCdf.end(), random.Next() * total);
+		size_t index = std::min<size_t>(picked - scene.EmitterCdf.begin(), scene.Emitters.size() - 1);
+		const auto& emitter = scene.Emitters[index];
+		float probability = (scene.EmitterCdf[index] - (index > 0 ? scene.EmitterCdf[index - 1] : 0.f)) / total;
+
+		float root = std::sqrt(random.Next());
+		float b1 = random.Next() * root;
+		float b0 = 1.f - root;
+		XMVECTOR v0 = XMLoadFloat3(&emitter.V0);
+		XMVECTOR v1 = XMLoadFloat3(&emitter.V1);
+		XMVECTOR v2 = XMLoadFloat3(&emitter.V2);
+		XMVECTOR target = XMVectorAdd(XMVectorAdd(XMVectorScale(v0, b0), XMVectorScale(v1, b1)), XMVectorScale(v2, 1.f - b0 - b1));
+		XMVECTOR emitter_normal = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(v1, v0), XMVectorSubtract(v2, v0)));
+
+		XMVECTOR offset = XMVectorSubtract(target, origin);
+		float distance_sq = XMVectorGetX(XMVector3LengthSq(offset));
+		float distance = std::sqrt(distance_sq);
+		if (probability > 0.f && distance > scene.Bias * 2.f) {
+			XMVECTOR to_light = XMVectorScale(offset, 1.f / distance);
+			float cosine = XMVectorGetX(XMVector3Dot(point.Normal, to_light));
+			float emitter_cosine = -XMVectorGetX(XMVector3Dot(emitter_normal, to_light));
+			if (emitter.TwoSided) {
+				emitter_cosine = std::fabs(emitter_cosine);
+			}
+			if (cosine > 0.f && emitter_cosine > 0.f && visible(scene, origin, to_light, distance - scene.Bias * 2.f)) {
+				float weight = cosine * emitter_cosine * emitter.Area / (distance_sq * probability);
+				result = XMVectorAdd(result, XMVectorScale(XMLoadFloat3(&emitter.Radiance), weight));
+			}
+		}
+	}
+	return XMVectorScale(result, XM_1DIV_PI);
+}
+
+// One path from a lightmap texel. Emitters hit by a bounce are not counted,
+// since directLight already samples them.
+XMVECTOR tracePath(const LightmapScene& scene, const LightmapSettings& settings, SurfacePoint point, Random& random) {
+	XMVECTOR radiance = XMVectorZero();
+	XMVECTOR throughput = XMVectorReplicate(1.f);
+	for (int depth = 0;; ++depth) {
+		radiance = XMVectorAdd(radiance, XMVectorMultiply(throughput, directLight(scene, point, random)));
+
+		TangentFrame frame(point.Normal);
+		XMVECTOR direction = XMVector3Normalize(frame.CosineDirection(random.Next(), random.Next()));
+		if (XMVectorGetX(XMVector3Dot(direction, point.Geometric)) <= 0.f) {
+			break;
+		}
+		BvhRay ray;
+		XMStoreFloat3(&ray.Origin, XMVectorAdd(point.Position, XMVectorScale(point.Geometric, scene.Bias)));
+		XMStoreFloat3(&ray.Direction, direction);
+		auto hit = IntersectBvh(scene.SceneBvh, ray);
+		if (!hit) {
+			radiance = XMVectorAdd(radiance, XMVectorMultiply(throughput, XMLoadFloat3(&scene.Ambient)));
+			break;
+		}
+		if (depth == settings.Bounces) {
+			break;
+		}
+
+		const auto& triangle = scene.SceneBvh.Triangles[hit->Triangle];
+		XMVECTOR toward = XMVectorNegate(direction);
+		point = surfacePoint(scene.Geometries[triangle.Mesh], triangle.Primitive, hit->U, hit->V, &toward);
+		throughput = XMVectorMultiply(throughput, albedoAt(scene.Materials[triangle.Mesh], point.TexCoord));
+		if (XMVectorGetX(XMVector3LengthSq(throughput)) == 0.f) {
+			break;
+		}
+	}
+	return radiance;
+}
+
+void addEmitter(LightmapScene& scene, const XMFLOAT3& v0, const XMFLOAT3& v1, const XMFLOAT3& v2, const XMFLOAT3& radiance, bool two_sided) {
+	Emitter emitter{ v0, v1, v2, radiance };
+	XMVECTOR p0 = XMLoadFloat3(&v0);
+	emitter.Area = 0.5f * XMVectorGetX(XMVector3Length(XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&v1), p0), XMVectorSubtract(XMLoadFloat3(&v2), p0))));
+	emitter.TwoSided = two_sided;
+	float power = emitter.Area * luminance(radiance) * (two_sided ? 2.f : 1.f);
+	if (power <= 0.f) {
+		return;
+	}
+	scene.Emitters.push_back(emitter);
+	scene.EmitterCdf.push_back((scene.EmitterCdf.empty() ? 0.f : scene.EmitterCdf.back()) + power);
+}
+
+FloatImage resolve(const LightmapTarget& target, const std::vector<XMFLOAT3>& values, float scale) {
+	FloatImage image;
+	image.Width = target.Size;
+	image.Height = target.Size;
+	image.Texels.assign(values.size(), XMFLOAT3(0.f, 0.f, 0.f));
+	std::vector<uint8_t> covered(values.size());
+	for (size_t i = 0; i < values.size(); ++i) {
+		if (target.Coverage[i].Covered()) {
+			image.Texels[i] = XMFLOAT3(values[i].x * scale, values[i].y * scale, values[i].z * scale);
+			covered[i] = 1;
+		}
+	}
+
+	// Same growth as DilateImage, on floats.
+	int size = target.Size;
+	for (int pass = 0; pass < GUTTER_PASSES; ++pass) {
+		auto next = covered;
+		bool changed = false;
+		for (int y = 0; y < size; ++y) {
+			for (int x = 0; x < size; ++x) {
+				size_t index = static_cast<size_t>(y) * size + x;
+				if (covered[index]) {
+					continue;
+				}
+				XMVECTOR sum = XMVectorZero();
+				int count = 0;
+				for (int dy = -1; dy <= 1; ++dy) {
+					for (int dx = -1; dx <= 1; ++dx) {
+						int nx = x + dx, ny = y + dy;
+						if (nx < 0 || ny < 0 || nx >= size || ny >= size || !covered[static_cast<size_t>(ny) * size + nx]) {
+							continue;
+						}
+						sum = XMVectorAdd(sum, XMLoadFloat3(&image.Texels[static_cast<size_t>(ny) * size + nx]));
+						++count;
+					}
+				}
+				if (count == 0) {
+					continue;
+				}
+				XMStoreFloat3(&image.Texels[index], XMVectorScale(sum, 1.f / count));
+				next[index] = 1;
+				changed = true;
+			}
+		}
+		covered.swap(next);
+		if (!changed) {
+			break;
+		}
+	}
+	return image;
+}
+
+}
+
+LightmapScene BuildLightmapScene(std::vector<MeshGeometry> geometries, std::vector<SurfaceMaterial> materials, const std::vector<SceneLight>& lights) {
+	LightmapScene scene;
+	scene.Geometries = std::move(geometries);
+	scene.Materials = std::move(materials);
+
+	std::vector<BvhTriangle> triangles;
+	for (size_t i = 0; i < scene.Geometries.size(); ++i) {
+		const auto& geometry = scene.Geometries[i];
+		const auto& emission = scene.Materials[i].Emission;
+		bool emissive = luminance(emission) > 0.f;
+		for (size_t t = 0; t < geometry.TriangleCount(); ++t) {
+			const uint32_t* corners = &geometry.Indices[t * 3];
+			const auto& v0 = geometry.Positions[corners[0]];
+			const auto& v1 = geometry.Positions[corners[1]];
+			const auto& v2 = geometry.Positions[corners[2]];
+			triangles.push_back({ v0, v1, v2, static_cast<uint32_t>(i), static_cast<uint32_t>(t) });
+			if (emissive) {
+				addEmitter(scene, v0, v1, v2, emission, true);
+			}
+		}
+	}
+	scene.SceneBvh = BuildBvh(std::move(triangles));
+	scene.Bias = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&scene.SceneBvh.Max), XMLoadFloat3(&scene.SceneBvh.Min)))) * 1e-4f;
+
+	for (const auto& light : lights) {
+		if (light.Type == LightType::Ambient) {
+			XMStoreFloat3(&scene.Ambient, XMVectorAdd(XMLoadFloat3(&scene.Ambient), XMLoadFloat3(&light.Color)));
+			continue;
+		}
+		if (light.Type != LightType::Area) {
+			scene.Lights.push_back(light);
+			continue;
+		}
+		// The rectangle spans Up and the axis across it, wound to face Direction.
+		XMVECTOR normal = XMVector3Normalize(XMLoadFloat3(&light.Direction));
+		XMVECTOR up = XMVector3Normalize(XMLoadFloat3(&light.Up));
+		XMVECTOR across = XMVector3Normalize(XMVector3Cross(up, normal));
+		up = XMVectorScale(XMVector3Cross(normal, across), light.Size.y * 0.5f);
+		across = XMVectorScale(across, light.Size.x * 0.5f);
+		XMVECTOR center = XMLoadFloat3(&light.Position);
+		XMFLOAT3 corners[4];
+		XMStoreFloat3(&corners[0], XMVectorSubtract(XMVectorSubtract(center, across), up));
+		XMStoreFloat3(&corners[1], XMVectorSubtract(XMVectorAdd(center, across), up));
+		XMStoreFloat3(&corners[2], XMVectorAdd(XMVectorAdd(center, across), up));
+		XMStoreFloat3(&corners[3], XMVectorAdd(XMVectorSubtract(center, across), up));
+		addEmitter(scene, corners[0], corners[1], corners[2], light.Color, false);
+		addEmitter(scene, corners[0], corners[2], corners[3], light.Color, false);
+	}
+	return scene;
+}
+
+std::optional<LightmapTarget> PrepareLightmap(const LightmapScene& scene, uint32_t mesh, const std::vector<XMFLOAT2>& lightmap_uvs, int size) {
+	const auto& geometry = scene.Geometries[mesh];
+	if (lightmap_uvs.size() != geometry.Positions.size()) {
+		return std::nullopt;
+	}
+	MeshGeometry atlas;
+	atlas.Indices = geometry.Indices;
+	atlas.TexCoords = lightmap_uvs;
+
+	LightmapTarget target;
+	target.Mesh = mesh;
+	target.Size = size;
+	target.Coverage = RasterizeUv(atlas, size, size);
+	if (std::none_of(target.Coverage.begin(), target.Coverage.end(), [](const TexelCoverage& texel) { return texel.Covered(); })) {
+		return std::nullopt;
+	}
+
+	size_t texel_count = target.Coverage.size();
+	target.Sum.assign(texel_count, XMFLOAT3(0.f, 0.f, 0.f));
+	target.Albedo.assign(texel_count, XMFLOAT3(0.f, 0.f, 0.f));
+	target.Normal.assign(texel_count, XMFLOAT3(0.f, 0.f, 0.f));
+	ParallelFor(size, [&](size_t y) {
+		for (size_t index = y * size; index < (y + 1) * size; ++index) {
+			const auto& texel = target.Coverage[index];
+			if (!texel.Covered()) {
+				continue;
+			}
+			auto point = surfacePoint(geometry, texel.Triangle, texel.B1, texel.B2, nullptr);
+			XMStoreFloat3(&target.Albedo[index], albedoAt(scene.Materials[mesh], point.TexCoord));
+			XMStoreFloat3(&target.Normal[index], point.Normal);
+		}
+	});
+	return target;
+}
+
+void AccumulateLightmap(LightmapTarget& target, const LightmapScene& scene, const LightmapSettings& settings, int samples) {
+	const auto& geometry = scene.Geometries[target.Mesh];
+	int size = target.Size;
+	int first = target.Samples;
+	ParallelFor(size, [&](size_t y) {
+		for (size_t index = y * size; index < (y + 1) * size; ++index) {
+			const auto& texel = target.Coverage[index];
+			if (!texel.Covered()) {
+				continue;
+			}
+			auto point = surfacePoint(geometry, texel.Triangle, texel.B1, texel.B2, nullptr);
+			XMVECTOR sum = XMLoadFloat3(&target.Sum[index]);
+			for (int sample = first; sample < first + samples; ++sample) {
+				uint64_t seed = (static_cast<uint64_t>(HashUint(static_cast<uint32_t>(index) ^ (target.Mesh * 0x9E3779B9u))) << 32) | static_cast<uint32_t>(sample);
+				Random random(seed);
+				sum = XMVectorAdd(sum, tracePath(scene, settings, point, random));
+			}
+			XMStoreFloat3(&target.Sum[index], sum);
+		}
+	});
+	target.Samples += samples;
+}
+
+FloatImage ResolveLightmap(const LightmapTarget& target) {
+	return resolve(target, target.Sum, target.Samples > 0 ? 1.f / target.Samples : 0.f);
+}
+
+FloatImage ResolveLightmapAlbedo(const LightmapTarget& target) {
+	return resolve(target, target.Albedo, 1.f);
+}
+
+FloatImage ResolveLightmapNormal(const LightmapTarget& target) {
+	return resolve(target, target.Normal, 1.f);
+}
+
+bool WritePfm(const std::filesystem::path& path, const FloatImage& image) {
+	std::ofstream file(path, std::ios::binary);
+	// A negative scale marks little-endian data. Rows run bottom to top.
+	std::string header = "PF\n" + std::to_string(image.Width) + " " + std::to_string(image.Height) + "\n-1.0\n";
+	file.write(header.data(), header.size());
+	for (int y = image.Height - 1; y >= 0; --y) {
+		file.write(reinterpret_cast<const char*>(image.Texels.data() + static_cast<size_t>(y) * image.Width), sizeof(XMFLOAT3) * image.Width);
+	}
+	return static_cast<bool>(file);
+}
@@ -0,0 +1,130 @@
+﻿#pragma once
+
+#include "../BakeRender/Geometry.h"
+#include "../BakeRender/Image.h"
+#include "Bvh.h"
+#include "UvRasterizer.h"
+
+#include <DirectXMath.h>
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <vector>
+
+enum class LightType {
+	Directional,
+	Point,
+	Spot,
+	// A one-sided rectangle facing Direction, Size long along Up and across.
+	Area,
+	// Radiance of every ray that leaves the scene.
+	Ambient,
+};
+
+// A light in world space.
+struct SceneLight {
+	LightType Type = LightType::Point;
+	DirectX::XMFLOAT3 Position{ 0.f, 0.f, 0.f };
+	// Where the light travels.
+	DirectX::XMFLOAT3 Direction{ 0.f, 0.f, -1.f };
+	DirectX::XMFLOAT3 Up{ 0.f, 1.f, 0.f };
+	DirectX::XMFLOAT2 Size{ 1.f, 1.f };
+	// Intensity of point and spot lights, irradiance of directional lights
+	// and radiance of area and ambient lights.
+	DirectX::XMFLOAT3 Color{ 1.f, 1.f, 1.f };
+	// Point and spot lights fall off with 1 / (Constant + Linear d +
+	// Quadratic d^2), or the inverse square when all three are zero.
+	float Constant = 0.f;
+	float Linear = 0.f;
+	float Quadratic = 0.f;
+	// Half angles of the spot cone in radians, full intensity inside the inner one.
+	float InnerCone = DirectX::XM_PIDIV4;
+	float OuterCone = DirectX::XM_PIDIV4;
+};
+
+// Diffuse response of one mesh. Albedo is used where the mesh has no
+// AlbedoTexture, which is looked up at its first UV set and decoded from sRGB.
+struct SurfaceMaterial {
+	DirectX::XMFLOAT3 Albedo{ 0.8f, 0.8f, 0.8f };
+	std::shared_ptr<const Image> AlbedoTexture;
+	// Emitted radiance from both sides of every triangle.
+	DirectX::XMFLOAT3 Emission{ 0.f, 0.f, 0.f };
+};
+
+// A triangle that emits light, sampled for direct lighting.
+struct Emitter {
+	DirectX::XMFLOAT3 V0;
+	DirectX::XMFLOAT3 V1;
+	DirectX::XMFLOAT3 V2;
+	DirectX::XMFLOAT3 Radiance;
+	float Area = 0.f;
+	bool TwoSided = true;
+};
+
+struct LightmapScene {
+	std::vector<MeshGeometry> Geometries;
+	std::vector<SurfaceMaterial> Materials;
+	// Directional, point and spot lights. Area lights become Emitters and
+	// ambient lights add to Ambient.
+	std::vector<SceneLight> Lights;
+	std::vector<Emitter> Emitters;
+	// Running sum of emitter power for picking one in proportion to it.
+	std::vector<float> EmitterCdf;
+	// Sum of the ambient lights.
+	DirectX::XMFLOAT3 Ambient{ 0.f, 0.f, 0.f };
+	Bvh SceneBvh;
+	// Offset of ray origins from surfaces.
+	float Bias = 0.f;
+};
+
+// Builds the BVH over the geometries and the emitter list from emissive
+// materials and area lights. Materials has one entry per geometry.
+LightmapScene BuildLightmapScene(std::vector<MeshGeometry> geometries, std::vector<SurfaceMaterial> materials, const std::vector<SceneLight>& lights);
+
+struct LightmapSettings {
+	// Indirect bounces after the first hit. 0 still picks up Ambient.
+	int Bounces = 2;
+};
+
+// Progressive state of one mesh's lightmap. Sum holds the unnormalized
+// radiance of every covered texel; Albedo and Normal are the auxiliary
+// buffers a denoiser expects, fixed when the target is prepared.
+struct LightmapTarget {
+	uint32_t Mesh = 0;
+	int Size = 0;
+	std::vector<TexelCoverage> Coverage;
+	std::vector<DirectX::XMFLOAT3> Sum;
+	std::vector<DirectX::XMFLOAT3> Albedo;
+	std::vector<DirectX::XMFLOAT3> Normal;
+	int Samples = 0;
+};
+
+// Rasterizes the mesh at its lightmap coordinates, one per vertex of
+// scene.Geometries[mesh]. Returns nullopt when they cover no texel.
+std::optional<LightmapTarget> PrepareLightmap(const LightmapScene& scene, uint32_t mesh, const std::vector<DirectX::XMFLOAT2>& lightmap_uvs, int size);
+
+// Traces samples more paths per covered texel with rows in parallel and adds
+// them to the target, continuing the random sequence of earlier calls so that
+// passes can be repeated until the result is clean enough. Each path gathers
+// direct light from every light and one sampled emitter at each vertex, then
+// follows a cosine-weighted bounce. The result is the irradiance divided by
+// pi, so that a shader only multiplies it by the surface albedo.
+void AccumulateLightmap(LightmapTarget& target, const LightmapScene& scene, const LightmapSettings& settings, int samples);
+
+// Linear RGB floats, row 0 at v = 1.
+struct FloatImage {
+	int Width = 0;
+	int Height = 0;
+	std::vector<DirectX::XMFLOAT3> Texels;
+};
+
+// The average of the samples so far and the two auxiliary buffers, each grown
+// into the gutter around the charts.
+FloatImage ResolveLightmap(const LightmapTarget& target);
+FloatImage ResolveLightmapAlbedo(const LightmapTarget& target);
+FloatImage ResolveLightmapNormal(const LightmapTarget& target);
+
+// Writes an uncompressed little-endian PFM, which denoisers read directly.
+bool WritePfm(const std::filesystem::path& path, const FloatImage& image);
@@ -0,0 +1,415 @@
+﻿#include "LightmapUv.h"
+#include "../BakeRender/Parallel.h"
+#include "Sampling.h"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <iterator>
+#include <map>
+#include <numeric>
+#include <string>
+#include <unordered_map>
+
+using namespace DirectX;
+
+namespace {
+
+constexpr int ROTATION_STEPS = 16;
+constexpr int PACK_ITERATIONS = 24;
+// Below this chart angle, charts that still overlap themselves are split into
+// single triangles.
+constexpr float MIN_SPLIT_ANGLE = 1.f;
+
+struct Chart {
+	std::vector<uint32_t> Triangles;
+	XMFLOAT3 Axis{ 0.f, 0.f, 1.f };
+	// Projected position of each source vertex the chart uses.
+	std::unordered_map<uint32_t, XMFLOAT2> Coordinates;
+	float Width = 0.f;
+	float Height = 0.f;
+	// Placement in the atlas, in texels.
+	int X = 0;
+	int Y = 0;
+};
+
+std::vector<std::vector<uint32_t>> triangleNeighbours(const MeshGeometry& mesh, const std::vector<uint32_t>& welded) {
+	size_t triangle_count = mesh.TriangleCount();
+	std::map<std::pair<uint32_t, uint32_t>, std::vector<uint32_t>> edges;
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		for (int e = 0; e < 3; ++e) {
+			uint32_t a = welded[mesh.Indices[t * 3 + e]];
+			uint32_t b = welded[mesh.Indices[t * 3 + (e + 1) % 3]];
+			edges[{ std::min(a, b), std::max(a, b) }].push_back(t);
+		}
+	}
+	std::vector<std::vector<uint32_t>> neighbours(triangle_count);
+	for (const auto& [edge, triangles] : edges) {
+		for (auto a : triangles) {
+			for (auto b : triangles) {
+				if (a != b) {
+					neighbours[a].push_back(b);
+				}
+			}
+		}
+	}
+	return neighbours;
+}
+
+XMVECTOR triangleNormal(const MeshGeometry& mesh, uint32_t triangle) {
+	XMVECTOR p0 = XMLoadFloat3(&mesh.Positions[mesh.Indices[triangle * 3]]);
+	XMVECTOR p1 = XMLoadFloat3(&mesh.Positions[mesh.Indices[triangle * 3 + 1]]);
+	XMVECTOR p2 = XMLoadFloat3(&mesh.Positions[mesh.Indices[triangle * 3 + 2]]);
+	// Unnormalized, so its length is twice the area.
+	return XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+}
+
+// Triangle adjacency and unit normals, shared by every round of chart growth.
+struct Surface {
+	std::vector<std::vector<uint32_t>> Neighbours;
+	std::vector<XMFLOAT3> Normals;
+	std::vector<uint8_t> Degenerate;
+};
+
+Surface buildSurface(const MeshGeometry& mesh) {
+	Surface surface;
+	surface.Neighbours = triangleNeighbours(mesh, WeldPositions(mesh));
+	size_t triangle_count = mesh.TriangleCount();
+	surface.Normals.resize(triangle_count);
+	surface.Degenerate.resize(triangle_count);
+	for (uint32_t t = 0; t < triangle_count; ++t) {
+		XMVECTOR n = triangleNormal(mesh, t);
+		surface.Degenerate[t] = XMVectorGetX(XMVector3LengthSq(n)) < 1e-24f;
+		XMStoreFloat3(&surface.Normals[t], surface.Degenerate[t] ? XMVectorZero() : XMVector3Normalize(n));
+	}
+	return surface;
+}
+
+// Grows charts over the given triangles only, never across to the others.
+std::vector<Chart> growCharts(const Surface& surface, const std::vector<uint32_t>& triangles, float max_angle) {
+	const auto& normals = surface.Normals;
+	const auto& degenerate = surface.Degenerate;
+	float min_cos = std::cos(max_angle * XM_PI / 180.f);
+
+	std::vector<Chart> charts;
+	std::unordered_map<uint32_t, int> chart_of;
+	for (auto t : triangles) {
+		chart_of[t] = -1;
+	}
+	for (auto seed : triangles) {
+		if (chart_of[seed] >= 0) {
+			continue;
+		}
+		int index = static_cast<int>(charts.size());
+		Chart chart;
+		XMVECTOR seed_normal = XMLoadFloat3(&normals[seed]);
+		std::vector<uint32_t> queue = { seed };
+		chart_of[seed] = index;
+		while (!queue.empty()) {
+			uint32_t t = queue.back();
+			queue.pop_back();
+			chart.Triangles.push_back(t);
+			for (auto n : surface.Neighbours[t]) {
+				auto found = chart_of.find(n);
+				if (found == chart_of.end() || found->second >= 0) {
+					continue;
+				}
+				bool fits = degenerate[n] || degenerate[seed] ? degenerate[n] && degenerate[seed]
+					: XMVectorGetX(XMVector3Dot(XMLoadFloat3(&normals[n]), seed_normal)) >= min_cos;
+				if (fits) {
+					found->second = index;
+					queue.push_back(n);
+				}
+			}
+		}
+		chart.Axis = normals[seed];
+		charts.push_back(std::move(chart));
+	}
+	return charts;
+}
+
+// Projects the chart onto the plane of its area-weighted normal, falling back
+// to the seed normal if any triangle would flip, and rotates it to the
+// smallest bounding box with the longer side horizontal.
+void parameterizeChart(const MeshGeometry& mesh, Chart& chart) {
+	XMVECTOR sum = XMVectorZero();
+	for (auto t : chart.Triangles) {
+		sum = XMVectorAdd(sum, triangleNormal(mesh, t));
+	}
+	XMVECTOR axis = XMLoadFloat3(&chart.Axis);
+	if (XMVectorGetX(XMVector3LengthSq(sum)) > 1e-24f) {
+		XMVECTOR average = XMVector3Normalize(sum);
+		bool flips = std::any_of(chart.Triangles.begin(), chart.Triangles.end(), [&](uint32_t t) {
+			return XMVectorGetX(XMVector3Dot(triangleNormal(mesh, t), average)) <= 0.f;
+		});
+		if (!flips || XMVectorGetX(XMVector3LengthSq(axis)) == 0.f) {
+			axis = average;
+		}
+	}
+	if (XMVectorGetX(XMVector3LengthSq(axis)) == 0.f) {
+		axis = XMVectorSet(0.f, 0.f, 1.f, 0.f);
+	}
+
+	TangentFrame frame(axis);
+
+	for (auto t : chart.Triangles) {
+		for (int c = 0; c < 3; ++c) {
+			uint32_t vertex = mesh.Indices[t * 3 + c];
+			if (chart.Coordinates.count(vertex)) {
+				continue;
+			}
+			XMVECTOR p = XMLoadFloat3(&mesh.Positions[vertex]);
+			chart.Coordinates[vertex] = XMFLOAT2(XMVectorGetX(XMVector3Dot(p, frame.Tangent)), XMVectorGetX(XMVector3Dot(p, frame.Bitangent)));
+		}
+	}
+
+	float best_area = FLT_MAX, best_angle = 0.f;
+	for (int step = 0; step < ROTATION_STEPS; ++step) {
+		float angle = step * (XM_PI * 0.5f) / ROTATION_STEPS;
+		float c = std::cos(angle), s = std::sin(angle);
+		float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+		for (const auto& [vertex, uv] : chart.Coordinates) {
+			float x = uv.x * c - uv.y * s, y = uv.x * s + uv.y * c;
+			min_x = std::min(min_x, x);
+			max_x = std::max(max_x, x);
+			min_y = std::min(min_y, y);
+			max_y = std::max(max_y, y);
+		}
+		float area = (max_x - min_x) * (max_y - min_y);
+		if (area < best_area) {
+			best_area = area;
+			best_angle = angle;
+		}
+	}
+
+	float c = std::cos(best_angle), s = std::sin(best_angle);
+	float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+	for (auto& [vertex, uv] : chart.Coordinates) {
+		uv = XMFLOAT2(uv.x * c - uv.y * s, uv.x * s + uv.y * c);
+		min_x = std::min(min_x, uv.x);
+		max_x = std::max(max_x, uv.x);
+		min_y = std::min(min_y, uv.y);
+		max_y = std::max(max_y, uv.y);
+	}
+	bool transpose = max_y - min_y > max_x - min_x;
+	for (auto& [vertex, uv] : chart.Coordinates) {
+		uv = transpose ? XMFLOAT2(uv.y - min_y, uv.x - min_x) : XMFLOAT2(uv.x - min_x, uv.y - min_y);
+	}
+	chart.Width = transpose ? max_y - min_y : max_x - min_x;
+	chart.Height = transpose ? max_x - min_x : max_y - min_y;
+}
+
+// Separating axis test that treats triangles touching along an edge or at a
+// corner as apart.
+bool trianglesOverlap(const XMFLOAT2 (&a)[3], const XMFLOAT2 (&b)[3], float epsilon) {
+	auto separated = [&](const XMFLOAT2 (&edges)[3]) {
+		for (int e = 0; e < 3; ++e) {
+			const auto& p0 = edges[e];
+			const auto& p1 = edges[(e + 1) % 3];
+			float nx = p0.y - p1.y, ny = p1.x - p0.x;
+			float min_a = FLT_MAX, max_a = -FLT_MAX, min_b = FLT_MAX, max_b = -FLT_MAX;
+			for (int c = 0; c < 3; ++c) {
+				float da = a[c].x * nx + a[c].y * ny;
+				float db = b[c].x * nx + b[c].y * ny;
+				min_a = std::min(min_a, da);
+				max_a = std::max(max_a, da);
+				min_b = std::min(min_b, db);
+				max_b = std::max(max_b, db);
+			}
+			float tolerance = epsilon * std::sqrt(nx * nx + ny * ny);
+			if (max_a <= min_b + tolerance || max_b <= min_a + tolerance) {
+				return true;
+			}
+		}
+		return false;
+	};
+	return !separated(a) && !separated(b);
+}
+
+// Whether any two triangles of the parameterized chart cover the same part of
+// its plane. Triangles are bucketed on a grid and only tested per cell.
+bool chartOverlaps(const MeshGeometry& mesh, const Chart& chart) {
+	size_t count = chart.Triangles.size();
+	if (count < 2) {
+		return false;
+	}
+	std::vector<std::array<XMFLOAT2, 3>> corners(count);
+	for (size_t i = 0; i < count; ++i) {
+		for (int c = 0; c < 3; ++c) {
+			corners[i][c] = chart.Coordinates.at(mesh.Indices[chart.Triangles[i] * 3 + c]);
+		}
+	}
+
+	float extent = std::max(chart.Width, chart.Height);
+	if (extent <= 0.f) {
+		return false;
+	}
+	int cells = std::clamp(static_cast<int>(std::sqrt(static_cast<double>(count))), 1, 1024);
+	float cell_size = extent / cells;
+	std::unordered_map<uint64_t, std::vector<uint32_t>> grid;
+	for (uint32_t i = 0; i < count; ++i) {
+		float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+		for (const auto& p : corners[i]) {
+			min_x = std::min(min_x, p.x);
+			max_x = std::max(max_x, p.x);
+			min_y = std::min(min_y, p.y);
+			max_y = std::max(max_y, p.y);
+		}
+		auto cell = [&](float v) { return std::clamp(static_cast<int>(v / cell_size), 0, cells - 1); };
+		for (int y = cell(min_y); y <= cell(max_y); ++y) {
+			for (int x = cell(min_x); x <= cell(max_x); ++x) {
+				grid[(static_cast<uint64_t>(y) << 32) | static_cast<uint32_t>(x)].push_back(i);
+			}
+		}
+	}
+
+	float epsilon = extent * 1e-5f;
+	for (const auto& [key, triangles] : grid) {
+		for (size_t i = 0; i < triangles.size(); ++i) {
+			for (size_t j = i + 1; j < triangles.size(); ++j) {
+				const auto& a = corners[triangles[i]];
+				const auto& b = corners[triangles[j]];
+				if (trianglesOverlap({ a[0], a[1], a[2] }, { b[0], b[1], b[2] }, epsilon)) {
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+int chartTexels(float extent, float scale) {
+	return std::max(1, static_cast<int>(std::ceil(extent * scale)));
+}
+
+// Shelf-packs the charts sorted by height at the given texels per unit.
+// Returns false when they do not fit in the atlas.
+bool packCharts(std::vector<Chart>& charts, const std::vector<size_t>& order, float scale, int size, int padding) {
+	int x = padding, y = padding, shelf_height = 0;
+	for (auto index : order) {
+		auto& chart = charts[index];
+		int width = chartTexels(chart.Width, scale);
+		int height = chartTexels(chart.Height, scale);
+		if (x + width + padding > size) {
+			x = padding;
+			y += shelf_height + padding;
+			shelf_height = 0;
+		}
+		if (x + width + padding > size || y + height + padding > size) {
+			return false;
+		}
+		chart.X = x;
+		chart.Y = y;
+		x += width + padding;
+		shelf_height = std::max(shelf_height, height);
+	}
+	return true;
+}
+
+}
+
+std::optional<LightmapUvResult> GenerateLightmapUv(const MeshGeometry& mesh, const LightmapUvSettings& settings, std::string* error) {
+	LightmapUvResult result;
+	auto surface = buildSurface(mesh);
+	std::vector<uint32_t> all(mesh.TriangleCount());
+	std::iota(all.begin(), all.end(), 0u);
+
+	// Charts whose projection folds over itself are regrown from their own
+	// triangles with half the angle until none overlap.
+	std::vector<Chart> charts;
+	auto pending = growCharts(surface, all, settings.MaxChartAngle);
+	float angle = settings.MaxChartAngle;
+	while (!pending.empty()) {
+		std::vector<uint8_t> overlaps(pending.size());
+		ParallelFor(pending.size(), [&](size_t i) {
+			parameterizeChart(mesh, pending[i]);
+			overlaps[i] = chartOverlaps(mesh, pending[i]);
+		});
+		angle *= 0.5f;
+		std::vector<Chart> split;
+		for (size_t i = 0; i < pending.size(); ++i) {
+			if (!overlaps[i]) {
+				charts.push_back(std::move(pending[i]));
+				continue;
+			}
+			if (angle < MIN_SPLIT_ANGLE) {
+				for (auto t : pending[i].Triangles) {
+					Chart single;
+					single.Triangles = { t };
+					single.Axis = surface.Normals[t];
+					split.push_back(std::move(single));
+				}
+				continue;
+			}
+			auto parts = growCharts(surface, pending[i].Triangles, angle);
+			std::move(parts.begin(), parts.end(), std::back_inserter(split));
+		}
+		pending = std::move(split);
+	}
+	result.ChartCount = charts.size();
+	if (charts.empty()) {
+		return result;
+	}
+
+	std::vector<size_t> order(charts.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return charts[a].Height > charts[b].Height; });
+
+	// Start from the density that would fill the atlas without waste, then
+	// search for the largest density that packs.
+	int size = settings.Size;
+	double area = 0.0;
+	for (const auto& chart : charts) {
+		area += static_cast<double>(chart.Width) * chart.Height;
+	}
+	// Padding is halved down to none when even one texel per chart does not
+	// fit with it.
+	int padding = std::max(settings.Padding, 0);
+	while (!packCharts(charts, order, 0.f, size, padding)) {
+		if (padding == 0) {
+			if (error) {
+				*error = std::to_string(charts.size()) + " lightmap charts do not fit a " + std::to_string(size) + " texel atlas";
+			}
+			return std::nullopt;
+		}
+		padding /= 2;
+	}
+	float high = area > 0.0 ? static_cast<float>(size / std::sqrt(area)) : 1.f;
+	float low = 0.f;
+	for (int i = 0; i < PACK_ITERATIONS; ++i) {
+		float middle = (low + high) * 0.5f;
+		if (packCharts(charts, order, middle, size, padding)) {
+			low = middle;
+		}
+		else {
+			high = middle;
+		}
+	}
+	packCharts(charts, order, low, size, padding);
+
+	std::unordered_map<uint64_t, uint32_t> output_vertex;
+	result.Indices.resize(mesh.Indices.size());
+	for (uint32_t c = 0; c < charts.size(); ++c) {
+		const auto& chart = charts[c];
+		for (auto t : chart.Triangles) {
+			for (int corner = 0; corner < 3; ++corner) {
+				uint32_t vertex = mesh.Indices[t * 3 + corner];
+				uint64_t key = (static_cast<uint64_t>(c) << 32) | vertex;
+				auto found = output_vertex.find(key);
+				if (found == output_vertex.end()) {
+					const auto& uv = chart.Coordinates.at(vertex);
+					float px = chart.X + uv.x * low;
+					float py = chart.Y + uv.y * low;
+					found = output_vertex.emplace(key, static_cast<uint32_t>(result.Remap.size())).first;
+					result.Remap.push_back(vertex);
+					result.TexCoords.emplace_back(px / size, 1.f - py / size);
+				}
+				result.Indices[t * 3 + corner] = found->second;
+			}
+		}
+	}
+	return result;
+}
@@ -0,0 +1,42 @@
+﻿#pragma once
+
+#include "../BakeRender/Geometry.h"
+
+#include <DirectXMath.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct LightmapUvSettings {
+	// Atlas resolution the charts are packed for, in texels.
+	int Size = 1024;
+	// Empty texels between charts and around the atlas border.
+	int Padding = 2;
+	// Largest angle between a triangle and the first triangle of its chart.
+	float MaxChartAngle = 60.f;
+};
+
+struct LightmapUvResult {
+	// Source vertex of every output vertex. Vertices on chart borders appear
+	// once per chart that uses them.
+	std::vector<uint32_t> Remap;
+	// Triangles over the output vertices, in the source order.
+	std::vector<uint32_t> Indices;
+	// Lightmap coordinate of every output vertex, row 0 of the atlas at v = 1.
+	std::vector<DirectX::XMFLOAT2> TexCoords;
+	size_t ChartCount = 0;
+};
+
+// Generates a second, non-overlapping UV set. Triangles are grown into charts
+// across shared edges while their normals stay within MaxChartAngle of the
+// chart's first triangle. Each chart is projected onto the plane of its
+// average normal and rotated to its smallest bounding box, with charts
+// processed in parallel; a chart whose projection overlaps itself is split
+// with a smaller angle, down to single triangles. The charts are then packed
+// into shelves at one common texel density, the largest that fits the atlas,
+// with less padding if they only fit that way. Fails when the charts do not
+// fit even at one texel each without padding.
+std::optional<LightmapUvResult> GenerateLightmapUv(const MeshGeometry& mesh, const LightmapUvSettings& settings, std::string* error = nullptr);
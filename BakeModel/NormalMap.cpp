@@ -0,0 +1,112 @@
+﻿#include "NormalMap.h"
+#include "../BakeRender/Parallel.h"
+#include "Sampling.h"
+#include "UvRasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace {
+
+XMVECTOR interpolate(const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c, float b0, float b1, float b2) {
+	return XMVectorAdd(XMVectorAdd(XMVectorScale(XMLoadFloat3(&a), b0), XMVectorScale(XMLoadFloat3(&b), b1)), XMVectorScale(XMLoadFloat3(&c), b2));
+}
+
+uint8_t encode(float value) {
+	return static_cast<uint8_t>(std::lround(std::clamp(value * 0.5f + 0.5f, 0.f, 1.f) * 255.f));
+}
+
+}
+
+std::optional<Image> BakeNormalMap(const MeshGeometry& low, const std::vector<MeshGeometry>& high, const Bvh& high_bvh, const NormalBakeSettings& settings) {
+	if (low.Tangents.size() != low.Positions.size() || low.Normals.size() != low.Positions.size()) {
+		return std::nullopt;
+	}
+	int size = settings.Size;
+	auto coverage = RasterizeUv(low, size, size);
+	if (std::none_of(coverage.begin(), coverage.end(), [](const TexelCoverage& texel) { return texel.Covered(); })) {
+		return std::nullopt;
+	}
+
+	float distance = settings.Distance;
+	if (distance <= 0.f) {
+		distance = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&high_bvh.Max), XMLoadFloat3(&high_bvh.Min)))) / 50.f;
+	}
+
+	Image image;
+	image.Width = size;
+	image.Height = size;
+	image.Channels = 3;
+	image.Pixels.resize(static_cast<size_t>(size) * size * 3);
+	for (size_t i = 0; i < image.Pixels.size(); i += 3) {
+		image.Pixels[i] = 128;
+		image.Pixels[i + 1] = 128;
+		image.Pixels[i + 2] = 255;
+	}
+
+	int tile_size = std::max(settings.TileSize, 1);
+	int tiles_x = (size + tile_size - 1) / tile_size;
+	int tiles_y = tiles_x;
+	ParallelFor(static_cast<size_t>(tiles_x) * tiles_y, [&](size_t tile) {
+		int x0 = static_cast<int>(tile % tiles_x) * tile_size;
+		int y0 = static_cast<int>(tile / tiles_x) * tile_size;
+		for (int y = y0; y < std::min(y0 + tile_size, size); ++y) {
+			for (int x = x0; x < std::min(x0 + tile_size, size); ++x) {
+				const auto& texel = coverage[static_cast<size_t>(y) * size + x];
+				if (!texel.Covered()) {
+					continue;
+				}
+				const uint32_t* corners = &low.Indices[texel.Triangle * 3];
+				float b0 = 1.f - texel.B1 - texel.B2;
+				XMVECTOR position = interpolate(low.Positions[corners[0]], low.Positions[corners[1]], low.Positions[corners[2]], b0, texel.B1, texel.B2);
+				XMVECTOR normal = interpolate(low.Normals[corners[0]], low.Normals[corners[1]], low.Normals[corners[2]], b0, texel.B1, texel.B2);
+				if (XMVectorGetX(XMVector3LengthSq(normal)) < 1e-12f) {
+					continue;
+				}
+				normal = XMVector3Normalize(normal);
+
+				XMFLOAT3 tangents[3];
+				for (int c = 0; c < 3; ++c) {
+					const auto& t = low.Tangents[corners[c]];
+					tangents[c] = XMFLOAT3(t.x, t.y, t.z);
+				}
+				XMVECTOR tangent = interpolate(tangents[0], tangents[1], tangents[2], b0, texel.B1, texel.B2);
+				tangent = XMVectorSubtract(tangent, XMVectorMultiply(normal, XMVector3Dot(normal, tangent)));
+				if (XMVectorGetX(XMVector3LengthSq(tangent)) < 1e-12f) {
+					continue;
+				}
+				tangent = XMVector3Normalize(tangent);
+				float handedness = low.Tangents[corners[0]].w < 0.f ? -1.f : 1.f;
+				XMVECTOR bitangent = XMVectorScale(XMVector3Cross(normal, tangent), handedness);
+
+				BvhRay ray;
+				XMStoreFloat3(&ray.Origin, XMVectorAdd(position, XMVectorScale(normal, distance)));
+				XMStoreFloat3(&ray.Direction, XMVectorNegate(normal));
+				ray.TMax = distance * 2.f;
+				auto hit = IntersectBvh(high_bvh, ray);
+				if (!hit) {
+					continue;
+				}
+
+				const auto& triangle = high_bvh.Triangles[hit->Triangle];
+				const auto& source = high[triangle.Mesh];
+				const uint32_t* high_corners = &source.Indices[triangle.Primitive * 3];
+				XMVECTOR high_normal = interpolate(source.Normals[high_corners[0]], source.Normals[high_corners[1]], source.Normals[high_corners[2]], 1.f - hit->U - hit->V, hit->U, hit->V);
+				if (XMVectorGetX(XMVector3LengthSq(high_normal)) < 1e-12f) {
+					continue;
+				}
+				high_normal = XMVector3Normalize(high_normal);
+
+				uint8_t* out = image.Texel(x, y);
+				out[0] = encode(XMVectorGetX(XMVector3Dot(high_normal, tangent)));
+				out[1] = encode(XMVectorGetX(XMVector3Dot(high_normal, bitangent)));
+				out[2] = encode(XMVectorGetX(XMVector3Dot(high_normal, normal)));
+			}
+		}
+	});
+
+	DilateImage(image, coverage, GUTTER_PASSES);
+	return image;
+}
@@ -0,0 +1,25 @@
+﻿#pragma once
+
+#include "../BakeRender/Geometry.h"
+#include "../BakeRender/Image.h"
+#include "Bvh.h"
+
+#include <optional>
+#include <vector>
+
+struct NormalBakeSettings {
+	int Size = 1024;
+	// Rays start this far outside the low-poly surface and search twice as
+	// far inwards. 0 uses a fiftieth of the diagonal of the high-poly bounds.
+	float Distance = 0.f;
+	// Texels are baked in square tiles of this size, one tile per task.
+	int TileSize = 64;
+};
+
+// Bakes the normals of the high-poly meshes into a tangent-space normal map
+// laid out by the texture coordinates of the low-poly mesh. Each texel casts
+// a ray along the interpolated low-poly normal against high_bvh, whose
+// triangles refer to high by Mesh and Primitive. Texels without a hit keep the
+// low-poly normal. Needs tangents on the low-poly mesh; returns nullopt
+// without them or when the texture coordinates cover no texel.
+std::optional<Image> BakeNormalMap(const MeshGeometry& low, const std::vector<MeshGeometry>& high, const Bvh& high_bvh, const NormalBakeSettings& settings);
@@ -0,0 +1,169 @@
+﻿#include "Pack.h"
+
+#include "../BakeLoader/BakeFormat.h"
+#include "BinaryManifest.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <string>
+
+namespace {
+
+struct PackedModel {
+	std::string Name;
+	BakePackModel Entry = {};
+};
+
+struct PackWriter {
+	std::fstream Out;
+	uint64_t Size = 0;
+	std::vector<BakePackBlob> Blobs;
+	// Blobs by the FNV-1a hash of their contents. Matches are compared byte
+	// for byte before a blob is shared.
+	std::multimap<uint64_t, uint32_t> Hashes;
+
+	void Pad(uint64_t alignment) {
+		std::vector<char> zeros((alignment - Size % alignment) % alignment);
+		Out.write(zeros.data(), zeros.size());
+		Size += zeros.size();
+	}
+
+	// Appends the bytes at a multiple of alignment, or returns a blob that
+	// already holds the same bytes at such an offset.
+	uint32_t Add(const std::vector<char>& contents, uint64_t alignment) {
+		uint64_t hash = 14695981039346656037ull;
+		for (char c : contents) {
+			hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+		}
+		auto [first, last] = Hashes.equal_range(hash);
+		for (auto it = first; it != last; ++it) {
+			const auto& blob = Blobs[it->second];
+			if (blob.Size != contents.size() || blob.Offset % alignment != 0) {
+				continue;
+			}
+			std::vector<char> stored(contents.size());
+			Out.seekg(static_cast<std::streamoff>(blob.Offset));
+			Out.read(stored.data(), stored.size());
+			Out.seekp(static_cast<std::streamoff>(Size));
+			if (stored == contents) {
+				return it->second;
+			}
+		}
+		Pad(alignment);
+		auto index = static_cast<uint32_t>(Blobs.size());
+		Blobs.push_back({ Size, contents.size() });
+		Hashes.emplace(hash, index);
+		Out.write(contents.data(), contents.size());
+		Size += contents.size();
+		return index;
+	}
+
+	template <typename T>
+	uint64_t WriteTable(const std::vector<T>& table) {
+		Pad(8);
+		uint64_t offset = Size;
+		Out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(T));
+		Size += table.size() * sizeof(T);
+		return offset;
+	}
+};
+
+std::optional<std::vector<char>> readFile(const std::filesystem::path& path) {
+	std::ifstream in(path, std::ios::binary);
+	if (!in) {
+		std::cout << "Failed to read " << path.string() << std::endl;
+		return std::nullopt;
+	}
+	return std::vector<char>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+std::string modelName(const std::filesystem::path& dir) {
+	return (dir.has_filename() ? dir.filename() : dir.parent_path().filename()).string();
+}
+
+}
+
+bool WritePack(const std::filesystem::path& archive_path, std::vector<std::filesystem::path> model_dirs) {
+	// Blobs follow the index order, so the files of one model lie together.
+	std::sort(model_dirs.begin(), model_dirs.end(), [](const auto& a, const auto& b) { return modelName(a) < modelName(b); });
+	for (size_t i = 1; i < model_dirs.size(); ++i) {
+		if (modelName(model_dirs[i - 1]) == modelName(model_dirs[i])) {
+			std::cout << "Two models are named " << modelName(model_dirs[i]) << std::endl;
+			return false;
+		}
+	}
+
+	PackWriter writer;
+	writer.Out.open(archive_path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!writer.Out) {
+		std::cout << "Failed to create " << archive_path.string() << std::endl;
+		return false;
+	}
+	BakePackHeader header = {};
+	writer.Out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	writer.Size = sizeof(header);
+
+	StringTable strings;
+	std::vector<BakePackModel> models;
+	std::vector<BakePackFile> files;
+	for (const auto& dir : model_dirs) {
+		auto name = modelName(dir);
+		auto manifest = readFile(dir / (name + ".bkm"));
+		auto bin = readFile(dir / (name + ".bin"));
+		if (!manifest || !bin) {
+			return false;
+		}
+		BakePackModel model = {};
+		model.Name = strings.Add(name);
+		model.Manifest = writer.Add(manifest.value(), BAKE_PACK_ALIGNMENT);
+		model.Bin = writer.Add(bin.value(), BAKE_PAGE_SIZE);
+		model.FirstFile = static_cast<uint32_t>(files.size());
+
+		std::vector<std::filesystem::path> paths;
+		for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+			auto file_name = entry.path().filename().string();
+			if (entry.is_regular_file() && file_name != name + ".json" && file_name != name + ".bkm" && file_name != name + ".bin") {
+				paths.push_back(entry.path());
+			}
+		}
+		std::sort(paths.begin(), paths.end());
+		for (const auto& path : paths) {
+			auto contents = readFile(path);
+			if (!contents) {
+				return false;
+			}
+			files.push_back({ strings.Add(path.filename().string()), writer.Add(contents.value(), BAKE_PACK_ALIGNMENT) });
+		}
+		model.FileCount = static_cast<uint32_t>(files.size()) - model.FirstFile;
+		models.push_back(model);
+	}
+
+	std::memcpy(header.Magic, BAKE_PACK_MAGIC, sizeof(header.Magic));
+	header.Version = BAKE_PACK_VERSION;
+	header.ModelCount = static_cast<uint32_t>(models.size());
+	header.FileCount = static_cast<uint32_t>(files.size());
+	header.BlobCount = static_cast<uint32_t>(writer.Blobs.size());
+	header.StringTableSize = static_cast<uint32_t>(strings.Data.size());
+	header.ModelTableOffset = writer.WriteTable(models);
+	header.FileTableOffset = writer.WriteTable(files);
+	header.BlobTableOffset = writer.WriteTable(writer.Blobs);
+	header.StringTableOffset = writer.WriteTable(strings.Data);
+	writer.Out.seekp(0);
+	writer.Out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!writer.Out) {
+		std::cout << "Failed to write " << archive_path.string() << std::endl;
+		return false;
+	}
+
+	uint64_t stored = 0;
+	for (const auto& blob : writer.Blobs) {
+		stored += blob.Size;
+	}
+	std::cout << "Packed " << models.size() << " models and " << files.size() << " files into " << writer.Blobs.size() << " blobs, " << stored / (1024.0 * 1024.0) << " MiB" << std::endl;
+	return true;
+}
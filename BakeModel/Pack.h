@@ -0,0 +1,10 @@
+﻿#pragma once
+
+#include <filesystem>
+#include <vector>
+
+// Writes baked output directories into one pack at archive_path, in the
+// layout described in BakeFormat.h. Each directory must hold the .bkm and
+// .bin of the model it is named after; its other files except the .json are
+// stored by file name. Returns false after printing the reason.
+bool WritePack(const std::filesystem::path& archive_path, std::vector<std::filesystem::path> model_dirs);
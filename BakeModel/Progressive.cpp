@@ -0,0 +1,144 @@
+﻿#include "Progressive.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <set>
+#include <unordered_map>
+
+namespace {
+
+struct Cluster {
+	double Sum[3] = {};
+	uint32_t Count = 0;
+	uint32_t Representative = 0;
+	float Distance = std::numeric_limits<float>::max();
+};
+
+// The triangles of one level over source vertices, each vertex replaced by
+// the representative of its cell.
+std::vector<uint32_t> clusterTriangles(const MeshGeometry& mesh, const DirectX::XMFLOAT3& low, float cell) {
+	auto cellOf = [&](const DirectX::XMFLOAT3& p) {
+		// 21 bits per axis hold a million cells along the longest side.
+		auto axis = [&](float value, float origin) {
+			return static_cast<uint64_t>(std::min(std::max((value - origin) / cell, 0.f), 2097151.f));
+		};
+		return axis(p.x, low.x) | axis(p.y, low.y) << 21 | axis(p.z, low.z) << 42;
+	};
+
+	std::vector<uint64_t> cells(mesh.Positions.size());
+	std::unordered_map<uint64_t, Cluster> clusters;
+	for (size_t i = 0; i < mesh.Positions.size(); ++i) {
+		const auto& p = mesh.Positions[i];
+		cells[i] = cellOf(p);
+		auto& cluster = clusters[cells[i]];
+		cluster.Sum[0] += p.x;
+		cluster.Sum[1] += p.y;
+		cluster.Sum[2] += p.z;
+		++cluster.Count;
+	}
+	for (uint32_t i = 0; i < mesh.Positions.size(); ++i) {
+		auto& cluster = clusters[cells[i]];
+		const auto& p = mesh.Positions[i];
+		float dx = static_cast<float>(cluster.Sum[0] / cluster.Count) - p.x;
+		float dy = static_cast<float>(cluster.Sum[1] / cluster.Count) - p.y;
+		float dz = static_cast<float>(cluster.Sum[2] / cluster.Count) - p.z;
+		float distance = dx * dx + dy * dy + dz * dz;
+		if (distance < cluster.Distance) {
+			cluster.Distance = distance;
+			cluster.Representative = i;
+		}
+	}
+
+	std::vector<uint32_t> indices;
+	std::set<std::array<uint32_t, 3>> seen;
+	for (size_t t = 0; t + 2 < mesh.Indices.size(); t += 3) {
+		std::array<uint32_t, 3> corners;
+		for (int k = 0; k < 3; ++k) {
+			corners[k] = clusters[cells[mesh.Indices[t + k]]].Representative;
+		}
+		if (corners[0] == corners[1] || corners[1] == corners[2] || corners[2] == corners[0]) {
+			continue;
+		}
+		// Triangles collapsed onto the same cells are kept once per winding.
+		auto rotated = corners;
+		std::rotate(rotated.begin(), std::min_element(rotated.begin(), rotated.end()), rotated.end());
+		if (seen.insert(rotated).second) {
+			indices.insert(indices.end(), corners.begin(), corners.end());
+		}
+	}
+	return indices;
+}
+
+}
+
+ProgressiveResult BuildProgressiveLevels(const MeshGeometry& mesh, const ProgressiveSettings& settings) {
+	ProgressiveResult result;
+	size_t vertex_count = mesh.Positions.size();
+	if (vertex_count == 0) {
+		result.Indices = mesh.Indices;
+		return result;
+	}
+
+	DirectX::XMFLOAT3 low = mesh.Positions[0], high = mesh.Positions[0];
+	for (const auto& p : mesh.Positions) {
+		low = { std::min(low.x, p.x), std::min(low.y, p.y), std::min(low.z, p.z) };
+		high = { std::max(high.x, p.x), std::max(high.y, p.y), std::max(high.z, p.z) };
+	}
+	float extent = std::max({ high.x - low.x, high.y - low.y, high.z - low.z });
+
+	// Source triangles of every level, in source vertex numbering.
+	std::vector<std::vector<uint32_t>> levels;
+	if (extent > 0.f) {
+		double resolution = std::max(settings.Resolution, 1);
+		for (int level = 0; level < settings.Levels; ++level, resolution *= 4.0) {
+			auto indices = clusterTriangles(mesh, low, static_cast<float>(extent / resolution));
+			if (indices.size() * 2 > mesh.Indices.size()) {
+				break;
+			}
+			if (!indices.empty()) {
+				levels.push_back(std::move(indices));
+			}
+		}
+	}
+
+	// Order the vertices by the coarsest level that uses them, keeping the
+	// source order within a level.
+	std::vector<uint32_t> first_level(vertex_count, static_cast<uint32_t>(levels.size()));
+	for (uint32_t level = static_cast<uint32_t>(levels.size()); level-- > 0;) {
+		for (auto index : levels[level]) {
+			first_level[index] = level;
+		}
+	}
+	result.Remap.resize(vertex_count);
+	for (uint32_t i = 0; i < vertex_count; ++i) {
+		result.Remap[i] = i;
+	}
+	std::stable_sort(result.Remap.begin(), result.Remap.end(), [&](uint32_t a, uint32_t b) {
+		return first_level[a] < first_level[b];
+	});
+	std::vector<uint32_t> output(vertex_count);
+	for (uint32_t i = 0; i < vertex_count; ++i) {
+		output[result.Remap[i]] = i;
+	}
+
+	result.Indices.reserve(mesh.Indices.size());
+	for (auto index : mesh.Indices) {
+		result.Indices.push_back(output[index]);
+	}
+	uint32_t prefix = 0;
+	for (uint32_t level = 0; level < levels.size(); ++level) {
+		while (prefix < vertex_count && first_level[result.Remap[prefix]] <= level) {
+			++prefix;
+		}
+		ProgressiveLevel coarse;
+		coarse.VertexCount = prefix;
+		coarse.Indices.reserve(levels[level].size());
+		for (auto index : levels[level]) {
+			coarse.Indices.push_back(output[index]);
+		}
+		result.Levels.push_back(std::move(coarse));
+	}
+	return result;
+}
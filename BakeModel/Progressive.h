@@ -0,0 +1,41 @@
+﻿#pragma once
+
+#include "../BakeRender/Geometry.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+struct ProgressiveSettings {
+	// Coarse levels at most, coarsest first. Levels that would keep more
+	// than half of the triangles of the mesh are dropped.
+	int Levels = 2;
+	// Grid cells along the longest side of the mesh bounds for the coarsest
+	// level; each further level has four times as many.
+	int Resolution = 16;
+};
+
+// One coarse level: a triangle list over the first VertexCount vertices of
+// the reordered mesh.
+struct ProgressiveLevel {
+	std::vector<uint32_t> Indices;
+	uint32_t VertexCount = 0;
+};
+
+struct ProgressiveResult {
+	// Source vertex of every output vertex. Vertices used by a coarser level
+	// come first, so that every level draws from a prefix of the vertices.
+	std::vector<uint32_t> Remap;
+	// The full triangles over the output vertices, in the source order.
+	std::vector<uint32_t> Indices;
+	// Coarsest first.
+	std::vector<ProgressiveLevel> Levels;
+};
+
+// Builds coarse levels of the mesh by vertex clustering: the positions are
+// snapped to a grid, every cell keeps the vertex nearest the mean of its
+// vertices, and triangles that still span three cells are kept over the kept
+// vertices. The levels reuse the vertices of the mesh instead of adding new
+// ones, so a loader that has read a level only needs the rest of the
+// vertices and the full indices to refine it.
+ProgressiveResult BuildProgressiveLevels(const MeshGeometry& mesh, const ProgressiveSettings& settings);
@@ -0,0 +1,107 @@
+﻿#pragma once
+
+#include <DirectXMath.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Dilation passes that grow a baked map past the borders of its charts, so
+// that filtering and mips do not pull in uncovered texels.
+constexpr int GUTTER_PASSES = 16;
+
+// Van der Corput sequence in base 2, the second Hammersley dimension.
+inline float RadicalInverse(uint32_t bits) {
+	bits = (bits << 16) | (bits >> 16);
+	bits = ((bits & 0x55555555u) << 1) | ((bits & 0xAAAAAAAAu) >> 1);
+	bits = ((bits & 0x33333333u) << 2) | ((bits & 0xCCCCCCCCu) >> 2);
+	bits = ((bits & 0x0F0F0F0Fu) << 4) | ((bits & 0xF0F0F0F0u) >> 4);
+	bits = ((bits & 0x00FF00FFu) << 8) | ((bits & 0xFF00FF00u) >> 8);
+	return bits * 2.3283064365386963e-10f;
+}
+
+inline uint32_t HashUint(uint32_t value) {
+	value ^= value >> 16;
+	value *= 0x7FEB352Du;
+	value ^= value >> 15;
+	value *= 0x846CA68Bu;
+	value ^= value >> 16;
+	return value;
+}
+
+// Uniform in [0, 1) from a hashed integer.
+inline float HashToUnit(uint32_t value) {
+	return (HashUint(value) >> 8) * (1.f / 16777216.f);
+}
+
+// Small PCG generator for paths that need an open-ended number of dimensions.
+struct Random {
+	uint64_t State;
+
+	explicit Random(uint64_t seed) : State(seed * 6364136223846793005ull + 1442695040888963407ull) {
+		Next();
+	}
+
+	uint32_t NextUint() {
+		uint64_t old = State;
+		State = old * 6364136223846793005ull + 1442695040888963407ull;
+		uint32_t shifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+		uint32_t rotation = static_cast<uint32_t>(old >> 59);
+		return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+	}
+
+	float Next() {
+		return (NextUint() >> 8) * (1.f / 16777216.f);
+	}
+};
+
+// Orthonormal basis around a unit normal, without branches on its direction
+// (Duff et al. 2017).
+struct TangentFrame {
+	DirectX::XMVECTOR Normal;
+	DirectX::XMVECTOR Tangent;
+	DirectX::XMVECTOR Bitangent;
+
+	explicit TangentFrame(DirectX::FXMVECTOR normal) : Normal(normal) {
+		DirectX::XMFLOAT3 n;
+		DirectX::XMStoreFloat3(&n, normal);
+		float sign = std::copysign(1.f, n.z);
+		float a = -1.f / (sign + n.z);
+		float b = n.x * n.y * a;
+		Tangent = DirectX::XMVectorSet(1.f + sign * n.x * n.x * a, sign * b, -sign * n.x, 0.f);
+		Bitangent = DirectX::XMVectorSet(b, sign + n.y * n.y * a, -n.y, 0.f);
+	}
+
+	// Cosine-weighted direction over the hemisphere of the normal for a point
+	// of the unit square.
+	DirectX::XMVECTOR CosineDirection(float u, float v) const {
+		float r = std::sqrt(u);
+		float phi = DirectX::XM_2PI * v;
+		return DirectX::XMVectorAdd(DirectX::XMVectorAdd(
+			DirectX::XMVectorScale(Tangent, r * std::cos(phi)),
+			DirectX::XMVectorScale(Bitangent, r * std::sin(phi))),
+			DirectX::XMVectorScale(Normal, std::sqrt(std::max(0.f, 1.f - u))));
+	}
+};
+
+// Cosine-weighted directions around a normal from a Hammersley set, shifted
+// per texel or vertex by seed so that neighbours do not share a pattern.
+struct Hemisphere {
+	TangentFrame Frame;
+	float ShiftU;
+	float ShiftV;
+
+	Hemisphere(DirectX::FXMVECTOR normal, uint32_t seed) : Frame(normal) {
+		ShiftU = HashToUnit(seed);
+		ShiftV = HashToUnit(seed ^ 0x9E3779B9u);
+	}
+
+	// Direction i of samples.
+	DirectX::XMVECTOR Direction(int i, int samples) const {
+		float u = (i + 0.5f) / samples + ShiftU;
+		float v = RadicalInverse(static_cast<uint32_t>(i)) + ShiftV;
+		u -= std::floor(u);
+		v -= std::floor(v);
+		return Frame.CosineDirection(u, v);
+	}
+};
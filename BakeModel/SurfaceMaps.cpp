@@ -0,0 +1,179 @@
+﻿#include "SurfaceMaps.h"
+#include "../BakeRender/Parallel.h"
+#include "Bvh.h"
+#include "Sampling.h"
+#include "UvRasterizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace {
+
+constexpr float CURVATURE_PERCENTILE = 0.95f;
+
+// Mean normal curvature per vertex, positive where the surface bends away
+// from its normal. Along an edge it is dot(n1 - n0, p1 - p0) / |p1 - p0|^2,
+// which is 1 / r on a sphere of radius r.
+std::vector<float> vertexCurvature(const MeshGeometry& mesh) {
+	auto welded = WeldPositions(mesh);
+	size_t vertex_count = mesh.Positions.size();
+
+	// Normals of split vertices are averaged so that hard edges count as bends.
+	std::vector<XMFLOAT3> normals(vertex_count, XMFLOAT3(0.f, 0.f, 0.f));
+	for (size_t i = 0; i < vertex_count; ++i) {
+		auto& sum = normals[welded[i]];
+		XMStoreFloat3(&sum, XMVectorAdd(XMLoadFloat3(&sum), XMLoadFloat3(&mesh.Normals[i])));
+	}
+	for (size_t i = 0; i < vertex_count; ++i) {
+		if (welded[i] == i && XMVectorGetX(XMVector3LengthSq(XMLoadFloat3(&normals[i]))) > 0.f) {
+			XMStoreFloat3(&normals[i], XMVector3Normalize(XMLoadFloat3(&normals[i])));
+		}
+	}
+
+	std::vector<float> sum(vertex_count, 0.f);
+	std::vector<float> weight(vertex_count, 0.f);
+	for (size_t t = 0; t < mesh.TriangleCount(); ++t) {
+		for (int e = 0; e < 3; ++e) {
+			uint32_t a = welded[mesh.Indices[t * 3 + e]];
+			uint32_t b = welded[mesh.Indices[t * 3 + (e + 1) % 3]];
+			if (a == b) {
+				continue;
+			}
+			XMVECTOR edge = XMVectorSubtract(XMLoadFloat3(&mesh.Positions[b]), XMLoadFloat3(&mesh.Positions[a]));
+			float length_sq = XMVectorGetX(XMVector3LengthSq(edge));
+			if (length_sq <= 0.f) {
+				continue;
+			}
+			XMVECTOR bend = XMVectorSubtract(XMLoadFloat3(&normals[b]), XMLoadFloat3(&normals[a]));
+			float curvature = XMVectorGetX(XMVector3Dot(bend, edge)) / length_sq;
+			sum[a] += curvature;
+			sum[b] += curvature;
+			weight[a] += 1.f;
+			weight[b] += 1.f;
+		}
+	}
+
+	std::vector<float> curvature(vertex_count, 0.f);
+	for (size_t i = 0; i < vertex_count; ++i) {
+		uint32_t w = welded[i];
+		curvature[i] = weight[w] > 0.f ? sum[w] / weight[w] : 0.f;
+	}
+	return curvature;
+}
+
+float curvatureRange(const std::vector<float>& curvature) {
+	std::vector<float> magnitudes;
+	magnitudes.reserve(curvature.size());
+	for (auto value : curvature) {
+		magnitudes.push_back(std::fabs(value));
+	}
+	if (magnitudes.empty()) {
+		return 1.f;
+	}
+	auto nth = magnitudes.begin() + static_cast<ptrdiff_t>((magnitudes.size() - 1) * CURVATURE_PERCENTILE);
+	std::nth_element(magnitudes.begin(), nth, magnitudes.end());
+	return *nth > 0.f ? *nth : 1.f;
+}
+
+Bvh meshBvh(const MeshGeometry& mesh) {
+	std::vector<BvhTriangle> triangles;
+	triangles.reserve(mesh.TriangleCount());
+	for (size_t t = 0; t < mesh.TriangleCount(); ++t) {
+		const uint32_t* corners = &mesh.Indices[t * 3];
+		triangles.push_back({ mesh.Positions[corners[0]], mesh.Positions[corners[1]], mesh.Positions[corners[2]], 0, static_cast<uint32_t>(t) });
+	}
+	return BuildBvh(std::move(triangles));
+}
+
+Image singleChannel(int size) {
+	Image image;
+	image.Width = size;
+	image.Height = size;
+	image.Channels = 1;
+	image.Pixels.assign(static_cast<size_t>(size) * size, 0);
+	return image;
+}
+
+}
+
+SurfaceMaps BakeSurfaceMaps(const MeshGeometry& mesh, const SurfaceMapSettings& settings) {
+	SurfaceMaps maps;
+	int size = settings.Size;
+	auto coverage = RasterizeUv(mesh, size, size);
+	if (std::none_of(coverage.begin(), coverage.end(), [](const TexelCoverage& texel) { return texel.Covered(); })) {
+		return maps;
+	}
+
+	std::vector<float> curvature;
+	if (settings.Curvature) {
+		curvature = vertexCurvature(mesh);
+		maps.CurvatureRange = settings.CurvatureRange > 0.f ? settings.CurvatureRange : curvatureRange(curvature);
+		maps.Curvature = singleChannel(size);
+	}
+
+	Bvh bvh;
+	float distance = 0.f, bias = 0.f;
+	int samples = std::max(settings.ThicknessSamples, 1);
+	if (settings.Thickness) {
+		bvh = meshBvh(mesh);
+		float diagonal = XMVectorGetX(XMVector3Length(XMVectorSubtract(XMLoadFloat3(&bvh.Max), XMLoadFloat3(&bvh.Min))));
+		distance = settings.ThicknessDistance > 0.f ? settings.ThicknessDistance : diagonal * 0.25f;
+		bias = diagonal * 1e-4f;
+		maps.Thickness = singleChannel(size);
+		maps.ThicknessDistance = distance;
+	}
+
+	ParallelFor(size, [&](size_t y) {
+		for (size_t index = y * size; index < (y + 1) * size; ++index) {
+			const auto& texel = coverage[index];
+			if (!texel.Covered()) {
+				continue;
+			}
+			const uint32_t* corners = &mesh.Indices[texel.Triangle * 3];
+			float b0 = 1.f - texel.B1 - texel.B2;
+
+			if (maps.Curvature) {
+				float value = curvature[corners[0]] * b0 + curvature[corners[1]] * texel.B1 + curvature[corners[2]] * texel.B2;
+				float encoded = 0.5f + 0.5f * std::clamp(value / maps.CurvatureRange, -1.f, 1.f);
+				maps.Curvature->Pixels[index] = static_cast<uint8_t>(std::lround(encoded * 255.f));
+			}
+
+			if (maps.Thickness) {
+				XMVECTOR p0 = XMLoadFloat3(&mesh.Positions[corners[0]]);
+				XMVECTOR p1 = XMLoadFloat3(&mesh.Positions[corners[1]]);
+				XMVECTOR p2 = XMLoadFloat3(&mesh.Positions[corners[2]]);
+				XMVECTOR position = XMVectorAdd(XMVectorAdd(XMVectorScale(p0, b0), XMVectorScale(p1, texel.B1)), XMVectorScale(p2, texel.B2));
+				XMVECTOR geometric = XMVector3Normalize(XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0)));
+				XMVECTOR normal = XMVector3Normalize(XMVectorAdd(XMVectorAdd(
+					XMVectorScale(XMLoadFloat3(&mesh.Normals[corners[0]]), b0),
+					XMVectorScale(XMLoadFloat3(&mesh.Normals[corners[1]]), texel.B1)),
+					XMVectorScale(XMLoadFloat3(&mesh.Normals[corners[2]]), texel.B2)));
+				if (XMVectorGetX(XMVector3Dot(geometric, normal)) < 0.f) {
+					geometric = XMVectorNegate(geometric);
+				}
+
+				Hemisphere hemisphere(XMVectorNegate(normal), static_cast<uint32_t>(index));
+				BvhRay ray;
+				XMStoreFloat3(&ray.Origin, XMVectorSubtract(position, XMVectorScale(geometric, bias)));
+				ray.TMax = distance;
+				float total = 0.f;
+				for (int i = 0; i < samples; ++i) {
+					XMStoreFloat3(&ray.Direction, hemisphere.Direction(i, samples));
+					auto hit = IntersectBvh(bvh, ray);
+					total += hit ? hit->T : distance;
+				}
+				maps.Thickness->Pixels[index] = static_cast<uint8_t>(std::lround(total / (samples * distance) * 255.f));
+			}
+		}
+	});
+
+	if (maps.Curvature) {
+		DilateImage(maps.Curvature.value(), coverage, GUTTER_PASSES);
+	}
+	if (maps.Thickness) {
+		DilateImage(maps.Thickness.value(), coverage, GUTTER_PASSES);
+	}
+	return maps;
+}
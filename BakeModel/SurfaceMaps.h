@@ -0,0 +1,44 @@
+﻿#pragma once
+
+#include "../BakeRender/Geometry.h"
+#include "../BakeRender/Image.h"
+
+#include <optional>
+
+struct SurfaceMapSettings {
+	int Size = 1024;
+	bool Curvature = false;
+	bool Thickness = false;
+	// Curvature in 1 / scene units that maps to 0 and 255. 0 uses the 95th
+	// percentile of the mesh's vertices.
+	float CurvatureRange = 0.f;
+	int ThicknessSamples = 32;
+	// Thickness that maps to 255. 0 uses a quarter of the diagonal of the
+	// mesh bounds.
+	float ThicknessDistance = 0.f;
+};
+
+struct SurfaceMaps {
+	std::optional<Image> Curvature;
+	// The range the curvature map was encoded with, 128 being flat.
+	float CurvatureRange = 0.f;
+	std::optional<Image> Thickness;
+	// The distance that thickness 255 stands for.
+	float ThicknessDistance = 0.f;
+};
+
+// Bakes the requested single-channel maps of one mesh at its texture
+// coordinates. Both passes share one rasterization of the UV layout, with
+// texels processed in parallel.
+//
+// Curvature comes from the normals of adjacent vertices: along every edge,
+// the change of normal over its length, averaged per welded position and
+// interpolated across triangles. Convex areas are brighter than 128, concave
+// ones darker.
+//
+// Thickness casts cosine-weighted rays from each texel around the inverted
+// normal against a BVH of the mesh itself and averages the distance to the
+// opposite surface. Rays that leave the mesh count as ThicknessDistance.
+//
+// Maps are empty when the texture coordinates cover no texel.
+SurfaceMaps BakeSurfaceMaps(const MeshGeometry& mesh, const SurfaceMapSettings& settings);
@@ -0,0 +1,242 @@
+﻿#include "TextureContainer.h"
+
+#include <fstream>
+
+namespace {
+
+constexpr uint32_t DDS_MAGIC = 0x20534444;
+constexpr uint32_t DDSD_CAPS = 0x1;
+constexpr uint32_t DDSD_HEIGHT = 0x2;
+constexpr uint32_t DDSD_WIDTH = 0x4;
+constexpr uint32_t DDSD_PIXELFORMAT = 0x1000;
+constexpr uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+constexpr uint32_t DDSD_LINEARSIZE = 0x80000;
+constexpr uint32_t DDPF_FOURCC = 0x4;
+constexpr uint32_t DDSCAPS_COMPLEX = 0x8;
+constexpr uint32_t DDSCAPS_TEXTURE = 0x1000;
+constexpr uint32_t DDSCAPS_MIPMAP = 0x400000;
+constexpr uint32_t FOURCC_DX10 = 0x30315844;
+constexpr uint32_t D3D10_RESOURCE_DIMENSION_TEXTURE2D = 3;
+
+struct DdsPixelFormat {
+	uint32_t Size;
+	uint32_t Flags;
+	uint32_t FourCC;
+	uint32_t RGBBitCount;
+	uint32_t RBitMask;
+	uint32_t GBitMask;
+	uint32_t BBitMask;
+	uint32_t ABitMask;
+};
+
+struct DdsHeader {
+	uint32_t Size;
+	uint32_t Flags;
+	uint32_t Height;
+	uint32_t Width;
+	uint32_t PitchOrLinearSize;
+	uint32_t Depth;
+	uint32_t MipMapCount;
+	uint32_t Reserved1[11];
+	DdsPixelFormat PixelFormat;
+	uint32_t Caps;
+	uint32_t Caps2;
+	uint32_t Caps3;
+	uint32_t Caps4;
+	uint32_t Reserved2;
+};
+
+struct DdsHeaderDX10 {
+	uint32_t DxgiFormat;
+	uint32_t ResourceDimension;
+	uint32_t MiscFlag;
+	uint32_t ArraySize;
+	uint32_t MiscFlags2;
+};
+
+static_assert(sizeof(DdsHeader) == 124);
+static_assert(sizeof(DdsHeaderDX10) == 20);
+
+constexpr uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+#pragma pack(push, 4)
+struct Ktx2Header {
+	uint32_t VkFormat;
+	uint32_t TypeSize;
+	uint32_t PixelWidth;
+	uint32_t PixelHeight;
+	uint32_t PixelDepth;
+	uint32_t LayerCount;
+	uint32_t FaceCount;
+	uint32_t LevelCount;
+	uint32_t SupercompressionScheme;
+	uint32_t DfdByteOffset;
+	uint32_t DfdByteLength;
+	uint32_t KvdByteOffset;
+	uint32_t KvdByteLength;
+	uint64_t SgdByteOffset;
+	uint64_t SgdByteLength;
+};
+#pragma pack(pop)
+
+struct Ktx2Level {
+	uint64_t ByteOffset;
+	uint64_t ByteLength;
+	uint64_t UncompressedByteLength;
+};
+
+static_assert(sizeof(Ktx2Header) == 68);
+static_assert(sizeof(Ktx2Level) == 24);
+
+// Khronos data format descriptor values for the block formats.
+constexpr uint8_t KHR_DF_MODEL_BC1A = 128;
+constexpr uint8_t KHR_DF_MODEL_BC4 = 131;
+constexpr uint8_t KHR_DF_MODEL_BC5 = 132;
+constexpr uint8_t KHR_DF_MODEL_BC7 = 134;
+constexpr uint8_t KHR_DF_PRIMARIES_BT709 = 1;
+constexpr uint8_t KHR_DF_TRANSFER_LINEAR = 1;
+constexpr uint8_t KHR_DF_TRANSFER_SRGB = 2;
+
+uint32_t dxgiFormat(BlockFormat format, bool srgb) {
+	switch (format) {
+	case BlockFormat::BC1: return srgb ? 72 : 71;
+	case BlockFormat::BC4: return 80;
+	case BlockFormat::BC5: return 83;
+	default: return srgb ? 99 : 98;
+	}
+}
+
+uint32_t vkFormat(BlockFormat format, bool srgb) {
+	switch (format) {
+	case BlockFormat::BC1: return srgb ? 132 : 131;
+	case BlockFormat::BC4: return 139;
+	case BlockFormat::BC5: return 141;
+	default: return srgb ? 146 : 145;
+	}
+}
+
+void appendU32(std::vector<uint8_t>& out, uint32_t value) {
+	for (int i = 0; i < 4; ++i) {
+		out.push_back(static_cast<uint8_t>(value >> (i * 8)));
+	}
+}
+
+std::vector<uint8_t> dataFormatDescriptor(BlockFormat format, bool srgb) {
+	uint8_t model = KHR_DF_MODEL_BC7;
+	switch (format) {
+	case BlockFormat::BC1: model = KHR_DF_MODEL_BC1A; break;
+	case BlockFormat::BC4: model = KHR_DF_MODEL_BC4; break;
+	case BlockFormat::BC5: model = KHR_DF_MODEL_BC5; break;
+	case BlockFormat::BC7: model = KHR_DF_MODEL_BC7; break;
+	}
+	uint32_t block_size = static_cast<uint32_t>(BlockSize(format));
+	// BC5 is two independent 64-bit BC4 blocks, one sample each; the other
+	// formats describe the whole block as one sample.
+	uint32_t samples = format == BlockFormat::BC5 ? 2 : 1;
+	uint32_t block_bytes = 24 + 16 * samples;
+
+	std::vector<uint8_t> dfd;
+	appendU32(dfd, 4 + block_bytes);
+	appendU32(dfd, 0);
+	appendU32(dfd, 2 | (block_bytes << 16));
+	dfd.push_back(model);
+	dfd.push_back(KHR_DF_PRIMARIES_BT709);
+	dfd.push_back(srgb ? KHR_DF_TRANSFER_SRGB : KHR_DF_TRANSFER_LINEAR);
+	dfd.push_back(0);
+	dfd.insert(dfd.end(), { 3, 3, 0, 0 });
+	dfd.push_back(static_cast<uint8_t>(block_size));
+	dfd.insert(dfd.end(), 7, uint8_t(0));
+
+	uint32_t sample_bits = block_size * 8 / samples;
+	for (uint32_t i = 0; i < samples; ++i) {
+		uint32_t bit_offset = i * sample_bits;
+		appendU32(dfd, bit_offset | ((sample_bits - 1) << 16) | (i << 24));
+		appendU32(dfd, 0);
+		appendU32(dfd, 0);
+		appendU32(dfd, 0xFFFFFFFF);
+	}
+	return dfd;
+}
+
+}
+
+const char* ContainerExtension(ContainerFormat container) {
+	return container == ContainerFormat::KTX2 ? ".ktx2" : ".dds";
+}
+
+bool WriteDds(const std::filesystem::path& path, const CompressedTexture& texture) {
+	DdsHeader header{};
+	header.Size = sizeof(DdsHeader);
+	header.Flags = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE | DDSD_MIPMAPCOUNT;
+	header.Height = static_cast<uint32_t>(texture.Height);
+	header.Width = static_cast<uint32_t>(texture.Width);
+	header.PitchOrLinearSize = static_cast<uint32_t>(texture.Levels[0].size());
+	header.MipMapCount = static_cast<uint32_t>(texture.Levels.size());
+	header.PixelFormat.Size = sizeof(DdsPixelFormat);
+	header.PixelFormat.Flags = DDPF_FOURCC;
+	header.PixelFormat.FourCC = FOURCC_DX10;
+	header.Caps = DDSCAPS_TEXTURE;
+	if (texture.Levels.size() > 1) {
+		header.Caps |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+	}
+
+	DdsHeaderDX10 header_dx10{};
+	header_dx10.DxgiFormat = dxgiFormat(texture.Format, texture.SRGB);
+	header_dx10.ResourceDimension = D3D10_RESOURCE_DIMENSION_TEXTURE2D;
+	header_dx10.ArraySize = 1;
+
+	std::ofstream out(path, std::ios::binary);
+	out.write(reinterpret_cast<const char*>(&DDS_MAGIC), sizeof(DDS_MAGIC));
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(&header_dx10), sizeof(header_dx10));
+	for (const auto& level : texture.Levels) {
+		out.write(reinterpret_cast<const char*>(level.data()), level.size());
+	}
+	return static_cast<bool>(out);
+}
+
+bool WriteKtx2(const std::filesystem::path& path, const CompressedTexture& texture) {
+	auto dfd = dataFormatDescriptor(texture.Format, texture.SRGB);
+	size_t level_count = texture.Levels.size();
+	size_t alignment = BlockSize(texture.Format);
+
+	Ktx2Header header{};
+	header.VkFormat = vkFormat(texture.Format, texture.SRGB);
+	header.TypeSize = 1;
+	header.PixelWidth = static_cast<uint32_t>(texture.Width);
+	header.PixelHeight = static_cast<uint32_t>(texture.Height);
+	header.FaceCount = 1;
+	header.LevelCount = static_cast<uint32_t>(level_count);
+	header.DfdByteOffset = static_cast<uint32_t>(sizeof(KTX2_IDENTIFIER) + sizeof(Ktx2Header) + level_count * sizeof(Ktx2Level));
+	header.DfdByteLength = static_cast<uint32_t>(dfd.size());
+
+	// The smallest level comes first in the file.
+	std::vector<Ktx2Level> levels(level_count);
+	uint64_t offset = header.DfdByteOffset + header.DfdByteLength;
+	for (size_t i = level_count; i-- > 0;) {
+		offset = (offset + alignment - 1) / alignment * alignment;
+		levels[i].ByteOffset = offset;
+		levels[i].ByteLength = texture.Levels[i].size();
+		levels[i].UncompressedByteLength = texture.Levels[i].size();
+		offset += texture.Levels[i].size();
+	}
+
+	std::ofstream out(path, std::ios::binary);
+	out.write(reinterpret_cast<const char*>(KTX2_IDENTIFIER), sizeof(KTX2_IDENTIFIER));
+	out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	out.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(Ktx2Level));
+	out.write(reinterpret_cast<const char*>(dfd.data()), dfd.size());
+
+	uint64_t position = header.DfdByteOffset + header.DfdByteLength;
+	const char padding[16] = {};
+	for (size_t i = level_count; i-- > 0;) {
+		out.write(padding, levels[i].ByteOffset - position);
+		out.write(reinterpret_cast<const char*>(texture.Levels[i].data()), texture.Levels[i].size());
+		position = levels[i].ByteOffset + levels[i].ByteLength;
+	}
+	return static_cast<bool>(out);
+}
+
+bool WriteContainer(const std::filesystem::path& path, ContainerFormat container, const CompressedTexture& texture) {
+	return container == ContainerFormat::KTX2 ? WriteKtx2(path, texture) : WriteDds(path, texture);
+}
@@ -0,0 +1,33 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include "BlockCompression.h"
+
+enum class ContainerFormat {
+	DDS,
+	KTX2,
+};
+
+struct CompressedTexture {
+	BlockFormat Format = BlockFormat::BC7;
+	bool SRGB = false;
+	int Width = 0;
+	int Height = 0;
+	// Block data of every mip level, largest first.
+	std::vector<std::vector<uint8_t>> Levels;
+};
+
+const char* ContainerExtension(ContainerFormat container);
+
+// DDS with a DX10 header so that BC7 and the sRGB variants are expressible.
+// Levels follow the header back to back, largest first.
+bool WriteDds(const std::filesystem::path& path, const CompressedTexture& texture);
+
+// KTX2 without supercompression. Levels are stored smallest first, each at an
+// offset aligned to the block size, as the format requires.
+bool WriteKtx2(const std::filesystem::path& path, const CompressedTexture& texture);
+
+bool WriteContainer(const std::filesystem::path& path, ContainerFormat container, const CompressedTexture& texture);
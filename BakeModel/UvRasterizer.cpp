@@ -0,0 +1,121 @@
+﻿#include "UvRasterizer.h"
+#include "../BakeRender/Parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+
+constexpr int BAND_HEIGHT = 16;
+
+}
+
+std::vector<TexelCoverage> RasterizeUv(const MeshGeometry& mesh, int width, int height) {
+	std::vector<TexelCoverage> coverage(static_cast<size_t>(width) * height);
+	if (mesh.TexCoords.empty()) {
+		return coverage;
+	}
+
+	// Triangles in texel space, binned by the bands of rows they touch.
+	size_t triangle_count = mesh.TriangleCount();
+	std::vector<std::array<float, 6>> corners(triangle_count);
+	std::vector<std::vector<uint32_t>> bands((height + BAND_HEIGHT - 1) / BAND_HEIGHT);
+	for (size_t triangle = 0; triangle < triangle_count; ++triangle) {
+		auto& c = corners[triangle];
+		for (int i = 0; i < 3; ++i) {
+			const auto& uv = mesh.TexCoords[mesh.Indices[triangle * 3 + i]];
+			c[i * 2] = uv.x * width;
+			c[i * 2 + 1] = (1.f - uv.y) * height;
+		}
+		int y0 = std::max(0, static_cast<int>(std::floor(std::min({ c[1], c[3], c[5] }))));
+		int y1 = std::min(height - 1, static_cast<int>(std::ceil(std::max({ c[1], c[3], c[5] }))));
+		for (int band = y0 / BAND_HEIGHT; band <= y1 / BAND_HEIGHT && y0 <= y1; ++band) {
+			bands[band].push_back(static_cast<uint32_t>(triangle));
+		}
+	}
+
+	// Bands are independent, and within one the triangles keep their order.
+	ParallelFor(bands.size(), [&](size_t band) {
+		int band_y0 = static_cast<int>(band) * BAND_HEIGHT;
+		int band_y1 = std::min(height, band_y0 + BAND_HEIGHT) - 1;
+		for (auto triangle : bands[band]) {
+			const auto& c = corners[triangle];
+			const float px[3] = { c[0], c[2], c[4] };
+			const float py[3] = { c[1], c[3], c[5] };
+			float area = (px[1] - px[0]) * (py[2] - py[0]) - (py[1] - py[0]) * (px[2] - px[0]);
+			if (std::fabs(area) < 1e-12f) {
+				continue;
+			}
+
+			int x0 = std::max(0, static_cast<int>(std::floor(std::min({ px[0], px[1], px[2] }))));
+			int x1 = std::min(width - 1, static_cast<int>(std::ceil(std::max({ px[0], px[1], px[2] }))));
+			int y0 = std::max(band_y0, static_cast<int>(std::floor(std::min({ py[0], py[1], py[2] }))));
+			int y1 = std::min(band_y1, static_cast<int>(std::ceil(std::max({ py[0], py[1], py[2] }))));
+			for (int y = y0; y <= y1; ++y) {
+				float sy = y + 0.5f;
+				for (int x = x0; x <= x1; ++x) {
+					float sx = x + 0.5f;
+					float w1 = ((px[2] - px[0]) * (sy - py[0]) - (py[2] - py[0]) * (sx - px[0])) / -area;
+					float w2 = ((px[1] - px[0]) * (sy - py[0]) - (py[1] - py[0]) * (sx - px[0])) / area;
+					if (w1 < 0.f || w2 < 0.f || w1 + w2 > 1.f) {
+						continue;
+					}
+					auto& texel = coverage[static_cast<size_t>(y) * width + x];
+					texel.Triangle = triangle;
+					texel.B1 = w1;
+					texel.B2 = w2;
+				}
+			}
+		}
+	});
+	return coverage;
+}
+
+void DilateImage(Image& image, const std::vector<TexelCoverage>& coverage, int passes) {
+	std::vector<uint8_t> covered(coverage.size());
+	for (size_t i = 0; i < coverage.size(); ++i) {
+		covered[i] = coverage[i].Covered();
+	}
+
+	for (int pass = 0; pass < passes; ++pass) {
+		auto next = covered;
+		bool changed = false;
+		for (int y = 0; y < image.Height; ++y) {
+			for (int x = 0; x < image.Width; ++x) {
+				size_t index = static_cast<size_t>(y) * image.Width + x;
+				if (covered[index]) {
+					continue;
+				}
+				int sum[4] = {};
+				int count = 0;
+				for (int dy = -1; dy <= 1; ++dy) {
+					for (int dx = -1; dx <= 1; ++dx) {
+						int nx = x + dx, ny = y + dy;
+						if (nx < 0 || ny < 0 || nx >= image.Width || ny >= image.Height || !covered[static_cast<size_t>(ny) * image.Width + nx]) {
+							continue;
+						}
+						const uint8_t* texel = image.Texel(nx, ny);
+						for (int c = 0; c < image.Channels; ++c) {
+							sum[c] += texel[c];
+						}
+						++count;
+					}
+				}
+				if (count == 0) {
+					continue;
+				}
+				uint8_t* texel = image.Texel(x, y);
+				for (int c = 0; c < image.Channels; ++c) {
+					texel[c] = static_cast<uint8_t>((sum[c] + count / 2) / count);
+				}
+				next[index] = 1;
+				changed = true;
+			}
+		}
+		covered.swap(next);
+		if (!changed) {
+			break;
+		}
+	}
+}
@@ -0,0 +1,29 @@
+﻿#pragma once
+
+#include "../BakeRender/Geometry.h"
+#include "../BakeRender/Image.h"
+
+#include <cstdint>
+#include <vector>
+
+// The triangle covering a texel centre and the barycentric weights of its
+// second and third vertex there.
+struct TexelCoverage {
+	uint32_t Triangle = UINT32_MAX;
+	float B1 = 0.f;
+	float B2 = 0.f;
+
+	bool Covered() const {
+		return Triangle != UINT32_MAX;
+	}
+};
+
+// Rasterizes the mesh at its texture coordinates into a width x height grid.
+// Row 0 is at v = 1, matching the layout of the source textures. Triangles
+// are binned into bands of rows that are filled in parallel. Where triangles
+// overlap in UV space the last one wins.
+std::vector<TexelCoverage> RasterizeUv(const MeshGeometry& mesh, int width, int height);
+
+// Grows covered texels into their uncovered neighbours, one texel per pass, so
+// that filtering and mips do not pull in the background across UV seams.
+void DilateImage(Image& image, const std::vector<TexelCoverage>& coverage, int passes);
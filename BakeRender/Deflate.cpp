@@ -0,0 +1,534 @@
+﻿#include "Deflate.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <queue>
+
+namespace {
+
+constexpr size_t CHUNK_SIZE = 256 * 1024;
+constexpr size_t MAX_BLOCK_TOKENS = 32768;
+constexpr size_t MAX_STORED_BLOCK = 65535;
+constexpr int WINDOW_SIZE = 32768;
+constexpr int MIN_MATCH = 3;
+constexpr int MAX_MATCH = 258;
+constexpr int HASH_BITS = 15;
+
+constexpr uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+constexpr uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+constexpr uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+constexpr uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+constexpr uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+struct LevelParams {
+	int Chain;
+	int Nice;
+	bool Lazy;
+};
+
+constexpr LevelParams LEVELS[10] = {
+	{ 0, 0, false },
+	{ 4, 8, false },
+	{ 8, 16, false },
+	{ 16, 32, false },
+	{ 16, 32, true },
+	{ 32, 64, true },
+	{ 128, 128, true },
+	{ 256, 258, true },
+	{ 1024, 258, true },
+	{ 4096, 258, true },
+};
+
+// A literal when Distance is 0, otherwise a match of Length bytes.
+struct Token {
+	uint16_t Length;
+	uint16_t Distance;
+};
+
+struct BitWriter {
+	std::vector<uint8_t>& Out;
+	uint64_t Bits = 0;
+	int Count = 0;
+
+	void Write(uint32_t value, int bits) {
+		Bits |= static_cast<uint64_t>(value) << Count;
+		Count += bits;
+		while (Count >= 8) {
+			Out.push_back(static_cast<uint8_t>(Bits));
+			Bits >>= 8;
+			Count -= 8;
+		}
+	}
+
+	void Align() {
+		if (Count > 0) {
+			Out.push_back(static_cast<uint8_t>(Bits));
+			Bits = 0;
+			Count = 0;
+		}
+	}
+};
+
+const std::array<uint8_t, MAX_MATCH + 1>& lengthCodes() {
+	static const auto TABLE = [] {
+		std::array<uint8_t, MAX_MATCH + 1> table{};
+		for (int code = 0; code < 29; ++code) {
+			int last = code == 28 ? MAX_MATCH : LENGTH_BASE[code] + (1 << LENGTH_EXTRA[code]) - 1;
+			for (int length = LENGTH_BASE[code]; length <= last; ++length) {
+				table[length] = static_cast<uint8_t>(code);
+			}
+		}
+		// 258 has its own code even though code 27 could reach it.
+		table[MAX_MATCH] = 28;
+		return table;
+	}();
+	return TABLE;
+}
+
+int distanceCode(int distance) {
+	int d = distance - 1;
+	if (d < 4) {
+		return d;
+	}
+	int log2 = 31;
+	while (!((d >> log2) & 1)) {
+		--log2;
+	}
+	return 2 * log2 + ((d >> (log2 - 1)) & 1);
+}
+
+// Huffman code lengths for the frequencies. When the tree is deeper than
+// max_bits the frequencies are flattened and the tree rebuilt.
+std::vector<uint8_t> huffmanLengths(std::vector<uint32_t> frequencies, int max_bits) {
+	size_t symbols = frequencies.size();
+	std::vector<uint8_t> lengths(symbols, 0);
+
+	while (true) {
+		struct Node {
+			uint32_t Frequency;
+			int Left;
+			int Right;
+		};
+		std::vector<Node> nodes;
+		using Entry = std::pair<uint32_t, int>;
+		std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+		for (size_t i = 0; i < symbols; ++i) {
+			if (frequencies[i] > 0) {
+				nodes.push_back({ frequencies[i], -1, static_cast<int>(i) });
+				queue.push({ frequencies[i], static_cast<int>(nodes.size() - 1) });
+			}
+		}
+		if (nodes.empty()) {
+			return lengths;
+		}
+		if (nodes.size() == 1) {
+			lengths[nodes[0].Right] = 1;
+			return lengths;
+		}
+
+		while (queue.size() > 1) {
+			auto a = queue.top();
+			queue.pop();
+			auto b = queue.top();
+			queue.pop();
+			nodes.push_back({ a.first + b.first, a.second, b.second });
+			queue.push({ a.first + b.first, static_cast<int>(nodes.size() - 1) });
+		}
+
+		int max_depth = 0;
+		std::vector<std::pair<int, int>> stack = { { queue.top().second, 0 } };
+		while (!stack.empty()) {
+			auto [node, depth] = stack.back();
+			stack.pop_back();
+			if (nodes[node].Left < 0) {
+				lengths[nodes[node].Right] = static_cast<uint8_t>(depth);
+				max_depth = std::max(max_depth, depth);
+			}
+			else {
+				stack.push_back({ nodes[node].Left, depth + 1 });
+				stack.push_back({ nodes[node].Right, depth + 1 });
+			}
+		}
+		if (max_depth <= max_bits) {
+			return lengths;
+		}
+		for (auto& frequency : frequencies) {
+			if (frequency > 0) {
+				frequency = (frequency + 1) / 2;
+			}
+		}
+	}
+}
+
+// Canonical codes, bit-reversed because deflate writes them MSB first into an
+// LSB-first stream.
+std::vector<uint16_t> canonicalCodes(const std::vector<uint8_t>& lengths) {
+	uint16_t counts[16] = {};
+	for (auto length : lengths) {
+		++counts[length];
+	}
+	counts[0] = 0;
+	uint16_t next[16] = {};
+	uint16_t code = 0;
+	for (int bits = 1; bits < 16; ++bits) {
+		code = static_cast<uint16_t>((code + counts[bits - 1]) << 1);
+		next[bits] = code;
+	}
+
+	std::vector<uint16_t> codes(lengths.size(), 0);
+	for (size_t i = 0; i < lengths.size(); ++i) {
+		int length = lengths[i];
+		if (length == 0) {
+			continue;
+		}
+		uint16_t value = next[length]++;
+		uint16_t reversed = 0;
+		for (int bit = 0; bit < length; ++bit) {
+			reversed = static_cast<uint16_t>((reversed << 1) | ((value >> bit) & 1));
+		}
+		codes[i] = reversed;
+	}
+	return codes;
+}
+
+// Some decoders reject trees with a single code, so keep at least two.
+void ensureTwoSymbols(std::vector<uint32_t>& frequencies) {
+	int used = static_cast<int>(std::count_if(frequencies.begin(), frequencies.end(), [](uint32_t f) { return f > 0; }));
+	for (size_t i = 0; used < 2 && i < frequencies.size(); ++i) {
+		if (frequencies[i] == 0) {
+			frequencies[i] = 1;
+			++used;
+		}
+	}
+}
+
+void writeDynamicBlock(BitWriter& writer, const Token* tokens, size_t count, bool final) {
+	const auto& length_codes = lengthCodes();
+	std::vector<uint32_t> literal_frequencies(286, 0), distance_frequencies(30, 0);
+	for (size_t i = 0; i < count; ++i) {
+		if (tokens[i].Distance == 0) {
+			++literal_frequencies[tokens[i].Length];
+		}
+		else {
+			++literal_frequencies[257 + length_codes[tokens[i].Length]];
+			++distance_frequencies[distanceCode(tokens[i].Distance)];
+		}
+	}
+	literal_frequencies[256] = 1;
+	ensureTwoSymbols(literal_frequencies);
+	ensureTwoSymbols(distance_frequencies);
+
+	auto literal_lengths = huffmanLengths(literal_frequencies, 15);
+	auto distance_lengths = huffmanLengths(distance_frequencies, 15);
+	auto literal_codes = canonicalCodes(literal_lengths);
+	auto distance_codes = canonicalCodes(distance_lengths);
+
+	int hlit = 286;
+	while (hlit > 257 && literal_lengths[hlit - 1] == 0) {
+		--hlit;
+	}
+	int hdist = 30;
+	while (hdist > 1 && distance_lengths[hdist - 1] == 0) {
+		--hdist;
+	}
+
+	// Run-length encode both length tables with the code length alphabet.
+	std::vector<uint8_t> all_lengths(literal_lengths.begin(), literal_lengths.begin() + hlit);
+	all_lengths.insert(all_lengths.end(), distance_lengths.begin(), distance_lengths.begin() + hdist);
+	struct LengthSymbol {
+		uint8_t Symbol;
+		uint8_t Extra;
+	};
+	std::vector<LengthSymbol> length_symbols;
+	for (size_t i = 0; i < all_lengths.size();) {
+		uint8_t value = all_lengths[i];
+		size_t run = 1;
+		while (i + run < all_lengths.size() && all_lengths[i + run] == value) {
+			++run;
+		}
+		i += run;
+		if (value == 0) {
+			while (run >= 11) {
+				size_t n = std::min<size_t>(run, 138);
+				length_symbols.push_back({ 18, static_cast<uint8_t>(n - 11) });
+				run -= n;
+			}
+			if (run >= 3) {
+				length_symbols.push_back({ 17, static_cast<uint8_t>(run - 3) });
+				run = 0;
+			}
+		}
+		else {
+			length_symbols.push_back({ value, 0 });
+			--run;
+			while (run >= 3) {
+				size_t n = std::min<size_t>(run, 6);
+				length_symbols.push_back({ 16, static_cast<uint8_t>(n - 3) });
+				run -= n;
+			}
+		}
+		for (; run > 0; --run) {
+			length_symbols.push_back({ value, 0 });
+		}
+	}
+
+	std::vector<uint32_t> code_length_frequencies(19, 0);
+	for (const auto& symbol : length_symbols) {
+		++code_length_frequencies[symbol.Symbol];
+	}
+	ensureTwoSymbols(code_length_frequencies);
+	auto code_length_lengths = huffmanLengths(code_length_frequencies, 7);
+	auto code_length_codes = canonicalCodes(code_length_lengths);
+	int hclen = 19;
+	while (hclen > 4 && code_length_lengths[CODE_LENGTH_ORDER[hclen - 1]] == 0) {
+		--hclen;
+	}
+
+	writer.Write(final ? 1 : 0, 1);
+	writer.Write(2, 2);
+	writer.Write(hlit - 257, 5);
+	writer.Write(hdist - 1, 5);
+	writer.Write(hclen - 4, 4);
+	for (int i = 0; i < hclen; ++i) {
+		writer.Write(code_length_lengths[CODE_LENGTH_ORDER[i]], 3);
+	}
+	for (const auto& symbol : length_symbols) {
+		writer.Write(code_length_codes[symbol.Symbol], code_length_lengths[symbol.Symbol]);
+		if (symbol.Symbol == 16) {
+			writer.Write(symbol.Extra, 2);
+		}
+		else if (symbol.Symbol == 17) {
+			writer.Write(symbol.Extra, 3);
+		}
+		else if (symbol.Symbol == 18) {
+			writer.Write(symbol.Extra, 7);
+		}
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		const auto& token = tokens[i];
+		if (token.Distance == 0) {
+			writer.Write(literal_codes[token.Length], literal_lengths[token.Length]);
+			continue;
+		}
+		int length_code = length_codes[token.Length];
+		writer.Write(literal_codes[257 + length_code], literal_lengths[257 + length_code]);
+		writer.Write(token.Length - LENGTH_BASE[length_code], LENGTH_EXTRA[length_code]);
+		int distance_code = distanceCode(token.Distance);
+		writer.Write(distance_codes[distance_code], distance_lengths[distance_code]);
+		writer.Write(token.Distance - DISTANCE_BASE[distance_code], DISTANCE_EXTRA[distance_code]);
+	}
+	writer.Write(literal_codes[256], literal_lengths[256]);
+}
+
+std::vector<Token> rleTokens(const uint8_t* data, size_t size) {
+	std::vector<Token> tokens;
+	for (size_t i = 0; i < size;) {
+		if (i > 0) {
+			size_t run = 0;
+			while (run < MAX_MATCH && i + run < size && data[i + run] == data[i - 1]) {
+				++run;
+			}
+			if (run >= MIN_MATCH) {
+				tokens.push_back({ static_cast<uint16_t>(run), 1 });
+				i += run;
+				continue;
+			}
+		}
+		tokens.push_back({ data[i], 0 });
+		++i;
+	}
+	return tokens;
+}
+
+std::vector<Token> lz77Tokens(const uint8_t* data, size_t size, const LevelParams& params) {
+	std::vector<Token> tokens;
+	std::vector<int32_t> head(size_t(1) << HASH_BITS, -1);
+	std::vector<int32_t> previous(size, -1);
+	size_t inserted = 0;
+
+	auto hash = [&](size_t i) {
+		uint32_t value = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+		return (value * 2654435761u) >> (32 - HASH_BITS);
+	};
+	// Makes every position before i visible to the match finder.
+	auto insertUpTo = [&](size_t i) {
+		for (; inserted < i; ++inserted) {
+			if (inserted + MIN_MATCH <= size) {
+				auto h = hash(inserted);
+				previous[inserted] = head[h];
+				head[h] = static_cast<int32_t>(inserted);
+			}
+		}
+	};
+	auto findMatch = [&](size_t i, int& distance) {
+		if (i + MIN_MATCH > size) {
+			return 0;
+		}
+		insertUpTo(i);
+		int max_length = static_cast<int>(std::min<size_t>(MAX_MATCH, size - i));
+		int best = 0;
+		int chain = params.Chain;
+		for (int32_t j = head[hash(i)]; j >= 0 && i - j <= WINDOW_SIZE && chain-- > 0; j = previous[j]) {
+			if (data[j + best] != data[i + best]) {
+				continue;
+			}
+			int length = 0;
+			while (length < max_length && data[j + length] == data[i + length]) {
+				++length;
+			}
+			if (length > best) {
+				best = length;
+				distance = static_cast<int>(i - j);
+				if (length >= params.Nice || length == max_length) {
+					break;
+				}
+			}
+		}
+		return best >= MIN_MATCH ? best : 0;
+	};
+
+	for (size_t i = 0; i < size;) {
+		int distance = 0;
+		int length = findMatch(i, distance);
+		if (length > 0 && params.Lazy && length < params.Nice) {
+			int next_distance = 0;
+			if (findMatch(i + 1, next_distance) > length) {
+				tokens.push_back({ data[i], 0 });
+				++i;
+				continue;
+			}
+		}
+		if (length > 0) {
+			tokens.push_back({ static_cast<uint16_t>(length), static_cast<uint16_t>(distance) });
+			i += length;
+		}
+		else {
+			tokens.push_back({ data[i], 0 });
+			++i;
+		}
+	}
+	return tokens;
+}
+
+// Raw deflate data for one chunk. Chunks other than the last end with a sync
+// flush so that the next chunk starts on a byte boundary.
+std::vector<uint8_t> deflateChunk(const uint8_t* data, size_t size, int level, DeflateStrategy strategy, bool final) {
+	std::vector<uint8_t> out;
+	BitWriter writer{ out };
+
+	if (level == 0) {
+		size_t offset = 0;
+		do {
+			size_t length = std::min(size - offset, MAX_STORED_BLOCK);
+			bool last = offset + length == size;
+			writer.Write(final && last ? 1 : 0, 1);
+			writer.Write(0, 2);
+			writer.Align();
+			writer.Write(static_cast<uint32_t>(length), 16);
+			writer.Write(static_cast<uint32_t>(~length & 0xFFFF), 16);
+			out.insert(out.end(), data + offset, data + offset + length);
+			offset += length;
+		} while (offset < size);
+		return out;
+	}
+
+	auto tokens = strategy == DeflateStrategy::RLE ? rleTokens(data, size) : lz77Tokens(data, size, LEVELS[level]);
+	size_t offset = 0;
+	do {
+		size_t count = std::min(tokens.size() - offset, MAX_BLOCK_TOKENS);
+		writeDynamicBlock(writer, tokens.data() + offset, count, final && offset + count == tokens.size());
+		offset += count;
+	} while (offset < tokens.size());
+
+	if (!final) {
+		writer.Write(0, 1);
+		writer.Write(0, 2);
+		writer.Align();
+		writer.Write(0x0000, 16);
+		writer.Write(0xFFFF, 16);
+	}
+	writer.Align();
+	return out;
+}
+
+uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t length2) {
+	constexpr uint32_t BASE = 65521;
+	uint32_t remainder = static_cast<uint32_t>(length2 % BASE);
+	uint32_t sum1 = adler1 & 0xFFFF;
+	uint32_t sum2 = (remainder * sum1) % BASE;
+	sum1 += (adler2 & 0xFFFF) + BASE - 1;
+	sum2 += (adler1 >> 16) + (adler2 >> 16) + BASE - remainder;
+	if (sum1 >= BASE) sum1 -= BASE;
+	if (sum1 >= BASE) sum1 -= BASE;
+	if (sum2 >= (BASE << 1)) sum2 -= (BASE << 1);
+	if (sum2 >= BASE) sum2 -= BASE;
+	return sum1 | (sum2 << 16);
+}
+
+}
+
+uint32_t Adler32(const uint8_t* data, size_t size, uint32_t adler) {
+	constexpr uint32_t BASE = 65521;
+	constexpr size_t NMAX = 5552;
+	uint32_t a = adler & 0xFFFF;
+	uint32_t b = adler >> 16;
+	while (size > 0) {
+		size_t n = std::min(size, NMAX);
+		size -= n;
+		for (size_t i = 0; i < n; ++i) {
+			a += data[i];
+			b += a;
+		}
+		data += n;
+		a %= BASE;
+		b %= BASE;
+	}
+	return a | (b << 16);
+}
+
+uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc) {
+	static const auto TABLE = [] {
+		std::array<uint32_t, 256> table{};
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int k = 0; k < 8; ++k) {
+				c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			}
+			table[i] = c;
+		}
+		return table;
+	}();
+
+	crc = ~crc;
+	for (size_t i = 0; i < size; ++i) {
+		crc = TABLE[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+std::vector<uint8_t> ZlibCompress(const uint8_t* data, size_t size, int level, DeflateStrategy strategy) {
+	level = std::clamp(level, 0, 9);
+	size_t chunk_count = std::max<size_t>(1, (size + CHUNK_SIZE - 1) / CHUNK_SIZE);
+	std::vector<std::vector<uint8_t>> chunks(chunk_count);
+	std::vector<uint32_t> checksums(chunk_count);
+	ParallelFor(chunk_count, [&](size_t i) {
+		size_t offset = i * CHUNK_SIZE;
+		size_t length = std::min(CHUNK_SIZE, size - offset);
+		chunks[i] = deflateChunk(data + offset, length, level, strategy, i + 1 == chunk_count);
+		checksums[i] = Adler32(data + offset, length);
+	});
+
+	constexpr uint8_t LEVEL_FLAGS[4] = { 0x01, 0x5E, 0x9C, 0xDA };
+	std::vector<uint8_t> out = { 0x78, LEVEL_FLAGS[level < 2 ? 0 : level < 6 ? 1 : level == 6 ? 2 : 3] };
+	uint32_t adler = 1;
+	for (size_t i = 0; i < chunk_count; ++i) {
+		out.insert(out.end(), chunks[i].begin(), chunks[i].end());
+		adler = adler32Combine(adler, checksums[i], std::min(CHUNK_SIZE, size - i * CHUNK_SIZE));
+	}
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		out.push_back(static_cast<uint8_t>(adler >> shift));
+	}
+	return out;
+}
@@ -0,0 +1,19 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+enum class DeflateStrategy {
+	Default,
+	// Only matches against the previous byte, for long runs of one value.
+	RLE,
+};
+
+uint32_t Adler32(const uint8_t* data, size_t size, uint32_t adler = 1);
+uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0);
+
+// Produces a zlib stream at level 0 (stored) to 9. The input is cut into
+// chunks that are deflated independently on all threads and joined with
+// sync flushes, so every chunk starts with an empty window.
+std::vector<uint8_t> ZlibCompress(const uint8_t* data, size_t size, int level, DeflateStrategy strategy);
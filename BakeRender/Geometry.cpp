@@ -0,0 +1,28 @@
+﻿#include "Geometry.h"
+
+#include <cstring>
+#include <unordered_map>
+
+std::vector<uint32_t> WeldPositions(const MeshGeometry& mesh) {
+	std::vector<uint32_t> welded(mesh.Positions.size());
+	std::unordered_map<uint64_t, std::vector<uint32_t>> buckets;
+	for (uint32_t i = 0; i < mesh.Positions.size(); ++i) {
+		const auto& p = mesh.Positions[i];
+		uint32_t bits[3];
+		std::memcpy(bits, &p.x, sizeof(bits));
+		uint64_t hash = (bits[0] * 73856093ull) ^ (bits[1] * 19349663ull) ^ (bits[2] * 83492791ull);
+		auto& bucket = buckets[hash];
+		welded[i] = i;
+		for (auto other : bucket) {
+			const auto& q = mesh.Positions[other];
+			if (p.x == q.x && p.y == q.y && p.z == q.z) {
+				welded[i] = other;
+				break;
+			}
+		}
+		if (welded[i] == i) {
+			bucket.push_back(i);
+		}
+	}
+	return welded;
+}
@@ -0,0 +1,26 @@
+﻿#pragma once
+
+#include <DirectXMath.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A triangle mesh in world space, the common input of the bakers.
+struct MeshGeometry {
+	std::vector<DirectX::XMFLOAT3> Positions;
+	std::vector<DirectX::XMFLOAT3> Normals;
+	std::vector<DirectX::XMFLOAT2> TexCoords;
+	// Tangent in xyz and the sign of the bitangent in w. Empty when the
+	// source had no tangents.
+	std::vector<DirectX::XMFLOAT4> Tangents;
+	std::vector<uint32_t> Indices;
+
+	size_t TriangleCount() const {
+		return Indices.size() / 3;
+	}
+};
+
+// Maps every vertex to the first vertex with the same position, so that
+// triangles split by normal or UV seams can still be joined.
+std::vector<uint32_t> WeldPositions(const MeshGeometry& mesh);
@@ -0,0 +1,347 @@
+﻿#define _CRT_SECURE_NO_WARNINGS
+
+#include "Image.h"
+#include "Parallel.h"
+
+#include <DirectXMath.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+// SSSE3 is guaranteed when the compiler targets it. MSVC compiles the
+// intrinsics for any x64 target, which only implies SSE2, so there the CPU is
+// asked at run time.
+#if defined(__SSSE3__) || defined(__AVX__)
+#include <tmmintrin.h>
+#define HAS_SSSE3 1
+#elif defined(_M_X64)
+#include <intrin.h>
+#include <tmmintrin.h>
+#define HAS_SSSE3 1
+#define CHECK_SSSE3 1
+#endif
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+std::optional<Image> ReadImage(const std::filesystem::path& path, int channels) {
+	int width = 0, height = 0, file_channels = 0;
+	stbi_uc* data = stbi_load(path.string().c_str(), &width, &height, &file_channels, channels);
+	if (!data) {
+		return std::nullopt;
+	}
+
+	Image image;
+	image.Width = width;
+	image.Height = height;
+	image.Channels = channels;
+	image.Pixels.assign(data, data + static_cast<size_t>(width) * height * channels);
+	stbi_image_free(data);
+	return image;
+}
+
+bool ReadImageSize(const std::filesystem::path& path, int& width, int& height, int& channels) {
+	return stbi_info(path.string().c_str(), &width, &height, &channels) != 0;
+}
+
+Image MakeConstantImage(int width, int height, int channels, const uint8_t* color) {
+	Image image;
+	image.Width = width;
+	image.Height = height;
+	image.Channels = channels;
+	image.Pixels.resize(static_cast<size_t>(width) * height * channels);
+	for (size_t i = 0; i < image.Pixels.size(); i += channels) {
+		std::copy(color, color + channels, image.Pixels.data() + i);
+	}
+	return image;
+}
+
+Image ResizeImage(const Image& image, int width, int height) {
+	Image result;
+	result.Width = width;
+	result.Height = height;
+	result.Channels = image.Channels;
+	result.Pixels.resize(static_cast<size_t>(width) * height * image.Channels);
+
+	float scale_x = static_cast<float>(image.Width) / width;
+	float scale_y = static_cast<float>(image.Height) / height;
+	for (int y = 0; y < height; ++y) {
+		float source_y = std::clamp((y + 0.5f) * scale_y - 0.5f, 0.f, static_cast<float>(image.Height - 1));
+		int y0 = static_cast<int>(source_y);
+		int y1 = std::min(y0 + 1, image.Height - 1);
+		float fy = source_y - y0;
+		for (int x = 0; x < width; ++x) {
+			float source_x = std::clamp((x + 0.5f) * scale_x - 0.5f, 0.f, static_cast<float>(image.Width - 1));
+			int x0 = static_cast<int>(source_x);
+			int x1 = std::min(x0 + 1, image.Width - 1);
+			float fx = source_x - x0;
+			uint8_t* dst = result.Texel(x, y);
+			for (int c = 0; c < image.Channels; ++c) {
+				float top = image.Texel(x0, y0)[c] * (1.f - fx) + image.Texel(x1, y0)[c] * fx;
+				float bottom = image.Texel(x0, y1)[c] * (1.f - fx) + image.Texel(x1, y1)[c] * fx;
+				dst[c] = static_cast<uint8_t>(std::lround(top * (1.f - fy) + bottom * fy));
+			}
+		}
+	}
+	return result;
+}
+
+namespace {
+
+#ifdef HAS_SSSE3
+bool hasSsse3() {
+#ifdef CHECK_SSSE3
+	static const bool supported = [] {
+		int info[4];
+		__cpuid(info, 1);
+		return (info[2] & (1 << 9)) != 0;
+	}();
+	return supported;
+#else
+	return true;
+#endif
+}
+#endif
+
+float srgbToLinear(float c) {
+	return c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+float linearToSrgb(float c) {
+	return c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+}
+
+struct FilterTap {
+	int Index;
+	float Weight;
+};
+
+float lanczos3(float x) {
+	x = std::fabs(x);
+	if (x < 1e-6f) {
+		return 1.f;
+	}
+	if (x >= 3.f) {
+		return 0.f;
+	}
+	constexpr float PI = 3.14159265f;
+	float px = PI * x;
+	return 3.f * std::sin(px) * std::sin(px / 3.f) / (px * px);
+}
+
+// Normalised filter taps for every target coordinate along one axis.
+std::vector<std::vector<FilterTap>> lanczosTaps(int source_size, int target_size) {
+	float scale = static_cast<float>(source_size) / target_size;
+	float filter_scale = std::max(scale, 1.f);
+	float support = 3.f * filter_scale;
+
+	std::vector<std::vector<FilterTap>> taps(target_size);
+	for (int i = 0; i < target_size; ++i) {
+		float center = (i + 0.5f) * scale - 0.5f;
+		int first = static_cast<int>(std::floor(center - support));
+		int last = static_cast<int>(std::ceil(center + support));
+		float total = 0.f;
+		for (int j = first; j <= last; ++j) {
+			float weight = lanczos3((j - center) / filter_scale);
+			if (weight == 0.f) {
+				continue;
+			}
+			taps[i].push_back({ std::clamp(j, 0, source_size - 1), weight });
+			total += weight;
+		}
+		for (auto& tap : taps[i]) {
+			tap.Weight /= total;
+		}
+	}
+	return taps;
+}
+
+}
+
+Image DownscaleImage(const Image& image, int width, int height, bool srgb) {
+	using namespace DirectX;
+
+	size_t source_texels = static_cast<size_t>(image.Width) * image.Height;
+	std::vector<XMFLOAT4> source(source_texels, XMFLOAT4(0.f, 0.f, 0.f, 0.f));
+	ParallelFor(static_cast<size_t>(image.Height), [&](size_t y) {
+		for (int x = 0; x < image.Width; ++x) {
+			const uint8_t* texel = image.Texel(x, static_cast<int>(y));
+			float* dst = &source[y * image.Width + x].x;
+			for (int c = 0; c < std::min(image.Channels, 4); ++c) {
+				dst[c] = texel[c] / 255.f;
+				if (srgb && c < 3) {
+					dst[c] = srgbToLinear(dst[c]);
+				}
+			}
+		}
+	});
+
+	auto horizontal_taps = lanczosTaps(image.Width, width);
+	auto vertical_taps = lanczosTaps(image.Height, height);
+
+	std::vector<XMFLOAT4> horizontal(static_cast<size_t>(width) * image.Height);
+	ParallelFor(static_cast<size_t>(image.Height), [&](size_t y) {
+		const XMFLOAT4* row = source.data() + y * image.Width;
+		for (int x = 0; x < width; ++x) {
+			XMVECTOR sum = XMVectorZero();
+			for (const auto& tap : horizontal_taps[x]) {
+				sum = XMVectorMultiplyAdd(XMLoadFloat4(&row[tap.Index]), XMVectorReplicate(tap.Weight), sum);
+			}
+			XMStoreFloat4(&horizontal[y * width + x], sum);
+		}
+	});
+
+	Image result;
+	result.Width = width;
+	result.Height = height;
+	result.Channels = image.Channels;
+	result.Pixels.resize(static_cast<size_t>(width) * height * image.Channels);
+	ParallelFor(static_cast<size_t>(height), [&](size_t y) {
+		for (int x = 0; x < width; ++x) {
+			XMVECTOR sum = XMVectorZero();
+			for (const auto& tap : vertical_taps[y]) {
+				sum = XMVectorMultiplyAdd(XMLoadFloat4(&horizontal[static_cast<size_t>(tap.Index) * width + x]), XMVectorReplicate(tap.Weight), sum);
+			}
+			XMFLOAT4 value;
+			XMStoreFloat4(&value, XMVectorSaturate(sum));
+			const float* channels = &value.x;
+			uint8_t* dst = result.Texel(x, static_cast<int>(y));
+			for (int c = 0; c < std::min(image.Channels, 4); ++c) {
+				float encoded = srgb && c < 3 ? linearToSrgb(channels[c]) : channels[c];
+				dst[c] = static_cast<uint8_t>(std::lround(encoded * 255.f));
+			}
+		}
+	});
+	return result;
+}
+
+Image HalveImage(const Image& image, bool srgb) {
+	static const auto SRGB_TO_LINEAR = [] {
+		std::array<float, 256> table{};
+		for (int i = 0; i < 256; ++i) {
+			float c = i / 255.f;
+			table[i] = srgbToLinear(c);
+		}
+		return table;
+	}();
+
+	Image result;
+	result.Width = std::max(image.Width / 2, 1);
+	result.Height = std::max(image.Height / 2, 1);
+	result.Channels = image.Channels;
+	result.Pixels.resize(static_cast<size_t>(result.Width) * result.Height * result.Channels);
+
+	for (int y = 0; y < result.Height; ++y) {
+		int y0 = std::min(y * 2, image.Height - 1);
+		int y1 = std::min(y * 2 + 1, image.Height - 1);
+		for (int x = 0; x < result.Width; ++x) {
+			int x0 = std::min(x * 2, image.Width - 1);
+			int x1 = std::min(x * 2 + 1, image.Width - 1);
+			const uint8_t* texels[4] = { image.Texel(x0, y0), image.Texel(x1, y0), image.Texel(x0, y1), image.Texel(x1, y1) };
+			uint8_t* dst = result.Texel(x, y);
+			for (int c = 0; c < image.Channels; ++c) {
+				if (srgb && c < 3) {
+					float sum = 0.f;
+					for (auto* texel : texels) {
+						sum += SRGB_TO_LINEAR[texel[c]];
+					}
+					float linear = sum * 0.25f;
+					float encoded = linearToSrgb(linear);
+					dst[c] = static_cast<uint8_t>(std::lround(std::clamp(encoded, 0.f, 1.f) * 255.f));
+				}
+				else {
+					int sum = texels[0][c] + texels[1][c] + texels[2][c] + texels[3][c];
+					dst[c] = static_cast<uint8_t>((sum + 2) / 4);
+				}
+			}
+		}
+	}
+	return result;
+}
+
+Image ExtractChannels(const Image& image, const std::vector<int>& channels) {
+	Image result;
+	result.Width = image.Width;
+	result.Height = image.Height;
+	result.Channels = static_cast<int>(channels.size());
+	result.Pixels.resize(static_cast<size_t>(image.Width) * image.Height * result.Channels);
+
+	const uint8_t* src = image.Pixels.data();
+	uint8_t* dst = result.Pixels.data();
+	size_t texel_count = static_cast<size_t>(image.Width) * image.Height;
+	for (size_t i = 0; i < texel_count; ++i) {
+		for (int c = 0; c < result.Channels; ++c) {
+			dst[c] = src[channels[c]];
+		}
+		src += image.Channels;
+		dst += result.Channels;
+	}
+	return result;
+}
+
+Image PackChannels(int width, int height, const std::vector<ChannelSource>& sources) {
+	Image result;
+	result.Width = width;
+	result.Height = height;
+	result.Channels = static_cast<int>(sources.size());
+	result.Pixels.resize(static_cast<size_t>(width) * height * result.Channels);
+
+	size_t texel_count = static_cast<size_t>(width) * height;
+	size_t channels = sources.size();
+	size_t done = 0;
+
+#ifdef HAS_SSSE3
+	bool vectorizable = hasSsse3() && channels <= 4 && std::all_of(sources.begin(), sources.end(), [](const ChannelSource& source) {
+		return !source.Source || source.Source->Channels == 4;
+	});
+	if (vectorizable) {
+		// Each step reads four RGBA texels from every image source and writes
+		// four packed texels. Shuffle masks route the wanted source byte to its
+		// packed position and zero everything else, so the sources just OR.
+		alignas(16) uint8_t constants[16] = {};
+		__m128i masks[4];
+		const uint8_t* inputs[4];
+		size_t input_count = 0;
+		for (size_t d = 0; d < channels; ++d) {
+			const auto& source = sources[d];
+			if (!source.Source) {
+				for (size_t k = 0; k < 4; ++k) {
+					constants[k * channels + d] = source.Constant;
+				}
+				continue;
+			}
+			alignas(16) uint8_t mask[16];
+			std::fill(std::begin(mask), std::end(mask), uint8_t(0x80));
+			for (size_t k = 0; k < 4; ++k) {
+				mask[k * channels + d] = static_cast<uint8_t>(k * 4 + source.Channel);
+			}
+			masks[input_count] = _mm_load_si128(reinterpret_cast<const __m128i*>(mask));
+			inputs[input_count++] = source.Source->Pixels.data();
+		}
+		__m128i constant = _mm_load_si128(reinterpret_cast<const __m128i*>(constants));
+
+		// The 16-byte store runs past the four packed texels, so stop while
+		// there is still room for it.
+		uint8_t* dst = result.Pixels.data();
+		while (done + 4 <= texel_count && done * channels + 16 <= texel_count * channels) {
+			__m128i packed = constant;
+			for (size_t s = 0; s < input_count; ++s) {
+				__m128i texels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(inputs[s] + done * 4));
+				packed = _mm_or_si128(packed, _mm_shuffle_epi8(texels, masks[s]));
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + done * channels), packed);
+			done += 4;
+		}
+	}
+#endif
+
+	for (size_t i = done; i < texel_count; ++i) {
+		uint8_t* dst = result.Pixels.data() + i * channels;
+		for (size_t d = 0; d < channels; ++d) {
+			const auto& source = sources[d];
+			dst[d] = source.Source ? source.Source->Pixels[i * source.Source->Channels + source.Channel] : source.Constant;
+		}
+	}
+	return result;
+}
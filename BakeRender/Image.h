@@ -0,0 +1,58 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <vector>
+
+struct Image {
+	int Width = 0;
+	int Height = 0;
+	int Channels = 0;
+	std::vector<uint8_t> Pixels;
+
+	uint8_t* Texel(int x, int y) {
+		return Pixels.data() + (static_cast<size_t>(y) * Width + x) * Channels;
+	}
+	const uint8_t* Texel(int x, int y) const {
+		return Pixels.data() + (static_cast<size_t>(y) * Width + x) * Channels;
+	}
+};
+
+// Decodes any format stb_image understands, converted to the requested number
+// of channels.
+std::optional<Image> ReadImage(const std::filesystem::path& path, int channels);
+
+// Reads only the dimensions and channel count from the file header.
+bool ReadImageSize(const std::filesystem::path& path, int& width, int& height, int& channels);
+
+Image MakeConstantImage(int width, int height, int channels, const uint8_t* color);
+
+// Bilinear resample to an arbitrary size.
+Image ResizeImage(const Image& image, int width, int height);
+
+// Separable Lanczos-3 resample for large reductions. Each texel is filtered as
+// one four-wide vector and rows are processed in parallel. With srgb, colour
+// channels are filtered in linear space.
+Image DownscaleImage(const Image& image, int width, int height, bool srgb);
+
+// Box-filters the image to half size for the next mip level. Odd sizes round
+// down and stop at one texel. With srgb, colour channels are averaged in
+// linear space; a fourth channel is always treated as linear alpha.
+Image HalveImage(const Image& image, bool srgb);
+
+// Builds a new image whose channel i is channel channels[i] of the source.
+Image ExtractChannels(const Image& image, const std::vector<int>& channels);
+
+// One output channel of PackChannels: a channel of an image, or a constant
+// when Source is null.
+struct ChannelSource {
+	const Image* Source = nullptr;
+	int Channel = 0;
+	uint8_t Constant = 0;
+};
+
+// Interleaves the sources into a new image with one channel per source.
+// Image sources must already have the requested size. Four-channel sources
+// are shuffled four texels at a time with SSSE3 where available.
+Image PackChannels(int width, int height, const std::vector<ChannelSource>& sources);
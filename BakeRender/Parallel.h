@@ -0,0 +1,37 @@
+﻿#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+// Runs func(i) for every i in [0, count) on all hardware threads. Indices are
+// handed out one at a time, so uneven work items balance themselves.
+template <typename Func>
+void ParallelFor(size_t count, Func&& func) {
+	size_t thread_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+	if (thread_count <= 1) {
+		for (size_t i = 0; i < count; ++i) {
+			func(i);
+		}
+		return;
+	}
+
+	std::atomic<size_t> next{ 0 };
+	auto worker = [&]() {
+		for (size_t i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+			func(i);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	threads.reserve(thread_count - 1);
+	for (size_t i = 1; i < thread_count; ++i) {
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
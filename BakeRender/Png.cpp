@@ -0,0 +1,142 @@
+﻿#include "Png.h"
+#include "Deflate.h"
+#include "Parallel.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+namespace {
+
+constexpr uint8_t PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+constexpr uint8_t PNG_COLOR_TYPES[5] = { 0, 0, 4, 2, 6 };
+constexpr PngFilter FIXED_FILTERS[5] = { PngFilter::None, PngFilter::Sub, PngFilter::Up, PngFilter::Average, PngFilter::Paeth };
+
+uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+	int p = a + b - c;
+	int pa = std::abs(p - a);
+	int pb = std::abs(p - b);
+	int pc = std::abs(p - c);
+	if (pa <= pb && pa <= pc) {
+		return a;
+	}
+	return pb <= pc ? b : c;
+}
+
+// Writes the filtered bytes of one row to out, which has room for the row.
+void filterRow(PngFilter filter, const uint8_t* row, const uint8_t* above, size_t stride, int bpp, uint8_t* out) {
+	for (size_t i = 0; i < stride; ++i) {
+		uint8_t left = i >= static_cast<size_t>(bpp) ? row[i - bpp] : 0;
+		uint8_t up = above ? above[i] : 0;
+		uint8_t up_left = above && i >= static_cast<size_t>(bpp) ? above[i - bpp] : 0;
+		uint8_t predicted = 0;
+		switch (filter) {
+		case PngFilter::Sub:
+			predicted = left;
+			break;
+		case PngFilter::Up:
+			predicted = up;
+			break;
+		case PngFilter::Average:
+			predicted = static_cast<uint8_t>((left + up) / 2);
+			break;
+		case PngFilter::Paeth:
+			predicted = paeth(left, up, up_left);
+			break;
+		default:
+			break;
+		}
+		out[i] = static_cast<uint8_t>(row[i] - predicted);
+	}
+}
+
+size_t filterCost(const uint8_t* data, size_t size) {
+	size_t cost = 0;
+	for (size_t i = 0; i < size; ++i) {
+		cost += std::abs(static_cast<int8_t>(data[i]));
+	}
+	return cost;
+}
+
+bool isConstant(const Image& image) {
+	size_t texel_count = static_cast<size_t>(image.Width) * image.Height;
+	for (size_t i = 1; i < texel_count; ++i) {
+		if (std::memcmp(image.Pixels.data() + i * image.Channels, image.Pixels.data(), image.Channels) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void appendChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size) {
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		out.push_back(static_cast<uint8_t>(size >> shift));
+	}
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data, data + size);
+	uint32_t crc = Crc32(out.data() + start, out.size() - start);
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		out.push_back(static_cast<uint8_t>(crc >> shift));
+	}
+}
+
+}
+
+std::vector<uint8_t> EncodePng(const Image& image, const PngOptions& options) {
+	bool constant = isConstant(image);
+	PngFilter filter = constant ? PngFilter::Sub : options.Filter;
+	size_t stride = static_cast<size_t>(image.Width) * image.Channels;
+
+	// Each row only reads the unfiltered row above, so rows filter independently.
+	std::vector<uint8_t> filtered((stride + 1) * image.Height);
+	ParallelFor(image.Height, [&](size_t y) {
+		const uint8_t* row = image.Pixels.data() + y * stride;
+		const uint8_t* above = y > 0 ? row - stride : nullptr;
+		uint8_t* out = filtered.data() + y * (stride + 1);
+
+		if (filter != PngFilter::Adaptive) {
+			out[0] = static_cast<uint8_t>(filter);
+			filterRow(filter, row, above, stride, image.Channels, out + 1);
+			return;
+		}
+
+		std::vector<uint8_t> candidate(stride);
+		size_t best_cost = SIZE_MAX;
+		for (auto fixed : FIXED_FILTERS) {
+			filterRow(fixed, row, above, stride, image.Channels, candidate.data());
+			size_t cost = filterCost(candidate.data(), stride);
+			if (cost < best_cost) {
+				best_cost = cost;
+				out[0] = static_cast<uint8_t>(fixed);
+				std::copy(candidate.begin(), candidate.end(), out + 1);
+			}
+		}
+	});
+
+	auto compressed = constant
+		? ZlibCompress(filtered.data(), filtered.size(), std::max(options.Level, 1), DeflateStrategy::RLE)
+		: ZlibCompress(filtered.data(), filtered.size(), options.Level, DeflateStrategy::Default);
+
+	uint8_t header[13] = {};
+	for (int i = 0; i < 4; ++i) {
+		header[i] = static_cast<uint8_t>(image.Width >> (24 - 8 * i));
+		header[4 + i] = static_cast<uint8_t>(image.Height >> (24 - 8 * i));
+	}
+	header[8] = 8;
+	header[9] = PNG_COLOR_TYPES[image.Channels];
+
+	std::vector<uint8_t> png(PNG_SIGNATURE, PNG_SIGNATURE + sizeof(PNG_SIGNATURE));
+	appendChunk(png, "IHDR", header, sizeof(header));
+	appendChunk(png, "IDAT", compressed.data(), compressed.size());
+	appendChunk(png, "IEND", nullptr, 0);
+	return png;
+}
+
+bool WritePng(const std::filesystem::path& path, const Image& image, const PngOptions& options) {
+	auto png = EncodePng(image, options);
+	std::ofstream file(path, std::ios::binary);
+	file.write(reinterpret_cast<const char*>(png.data()), png.size());
+	return static_cast<bool>(file);
+}
@@ -0,0 +1,30 @@
+﻿#pragma once
+
+#include "Image.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+enum class PngFilter {
+	None,
+	Sub,
+	Up,
+	Average,
+	Paeth,
+	// Picks the filter with the smallest sum of absolute differences per row.
+	Adaptive,
+};
+
+struct PngOptions {
+	// 0 stores the data uncompressed, 9 searches hardest for matches.
+	int Level = 6;
+	PngFilter Filter = PngFilter::Adaptive;
+};
+
+// Filters rows in parallel and deflates the result with ZlibCompress. Images
+// that hold a single colour skip the options and use the Sub filter with
+// run-length matching, which compresses them to a few hundred bytes.
+std::vector<uint8_t> EncodePng(const Image& image, const PngOptions& options);
+
+bool WritePng(const std::filesystem::path& path, const Image& image, const PngOptions& options);
@@ -0,0 +1,37 @@
+﻿#include "Preview.h"
+
+namespace {
+
+bool writePreview(const std::filesystem::path& directory, const std::string& name, const Image& image, const PngOptions& options, std::string* error) {
+	if (WritePng(directory / name, image, options)) {
+		return true;
+	}
+	if (error) {
+		*error = "Cannot write " + (directory / name).string();
+	}
+	return false;
+}
+
+}
+
+std::optional<PreviewFiles> RenderPreviews(const std::vector<RasterMesh>& meshes, const std::filesystem::path& directory, const std::string& base_name, const PreviewSettings& settings, std::string* error) {
+	PreviewFiles files;
+	if (settings.ThumbnailSize > 0) {
+		files.Thumbnail = base_name + "Thumbnail.png";
+		if (!writePreview(directory, files.Thumbnail, RenderThumbnail(meshes, settings.ThumbnailSize), settings.Png, error)) {
+			return std::nullopt;
+		}
+	}
+	if (settings.Impostor) {
+		auto atlas = RenderImpostorAtlas(meshes, settings.ImpostorViews, settings.ImpostorCellSize);
+		files.ImpostorAlbedo = base_name + "ImpostorAlbedo.png";
+		files.ImpostorNormalDepth = base_name + "ImpostorNormalDepth.png";
+		if (!writePreview(directory, files.ImpostorAlbedo, atlas.Albedo, settings.Png, error) ||
+			!writePreview(directory, files.ImpostorNormalDepth, atlas.NormalDepth, settings.Png, error)) {
+			return std::nullopt;
+		}
+		files.ImpostorCenter = atlas.Center;
+		files.ImpostorRadius = atlas.Radius;
+	}
+	return files;
+}
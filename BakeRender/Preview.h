@@ -0,0 +1,38 @@
+﻿#pragma once
+
+#include "Png.h"
+#include "Rasterizer.h"
+
+#include <DirectXMath.h>
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Which previews RenderPreviews writes and how.
+struct PreviewSettings {
+	// Texels along each side of the thumbnail, or 0 for none.
+	int ThumbnailSize = 0;
+	bool Impostor = false;
+	int ImpostorViews = 8;
+	int ImpostorCellSize = 128;
+	PngOptions Png;
+};
+
+// Names of the written files, relative to the output directory and empty when
+// not rendered, and the bounding sphere of the impostor views.
+struct PreviewFiles {
+	std::string Thumbnail;
+	std::string ImpostorAlbedo;
+	std::string ImpostorNormalDepth;
+	DirectX::XMFLOAT3 ImpostorCenter{ 0.f, 0.f, 0.f };
+	float ImpostorRadius = 0.f;
+};
+
+// Renders the thumbnail and impostor atlas of meshes on the CPU and writes
+// them to directory as <base_name>Thumbnail.png, <base_name>ImpostorAlbedo.png
+// and <base_name>ImpostorNormalDepth.png. Needs neither a GPU nor a display,
+// so it runs on headless build machines. Returns nullopt with the reason in
+// error when a file cannot be written.
+std::optional<PreviewFiles> RenderPreviews(const std::vector<RasterMesh>& meshes, const std::filesystem::path& directory, const std::string& base_name, const PreviewSettings& settings, std::string* error = nullptr);
@@ -0,0 +1,591 @@
+﻿#include "Rasterizer.h"
+
+#include "Parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+
+using namespace DirectX;
+
+namespace {
+
+constexpr int TILE_SIZE = 32;
+// Source triangles per setup and binning task.
+constexpr size_t SETUP_BATCH = 4096;
+constexpr int THUMBNAIL_SAMPLES = 2;
+constexpr float THUMBNAIL_FOV = XM_PI / 6.f;
+// Share of the thumbnail light that reaches faces turned away from it.
+constexpr float THUMBNAIL_AMBIENT = 0.3f;
+
+struct ClipVertex {
+	XMVECTOR Position;
+	// Weights of the second and third source vertex, carried through clipping.
+	float B1;
+	float B2;
+};
+
+// A clipped triangle in pixel space. Edge functions and interpolants are
+// planes a * x + b * y + c evaluated at pixel centres.
+struct RasterTriangle {
+	XMFLOAT3 Edges[3];
+	bool TopLeft[3];
+	XMFLOAT3 Depth;
+	XMFLOAT3 InverseW;
+	// B1 / w and B2 / w, divided by the interpolated 1 / w per pixel.
+	XMFLOAT3 B1;
+	XMFLOAT3 B2;
+	int MinX, MinY, MaxX, MaxY;
+	uint32_t Mesh;
+	uint32_t Triangle;
+};
+
+// The triangles set up by one task and, per tile, the ones touching it.
+struct TriangleBatch {
+	std::vector<RasterTriangle> Triangles;
+	std::vector<uint32_t> TileStart;
+	std::vector<uint32_t> TileTriangles;
+};
+
+bool outsideFrustum(const ClipVertex (&v)[3]) {
+	XMFLOAT4 p[3];
+	for (int i = 0; i < 3; ++i) {
+		XMStoreFloat4(&p[i], v[i].Position);
+	}
+	auto all = [&](auto outside) {
+		return outside(p[0]) && outside(p[1]) && outside(p[2]);
+	};
+	return all([](const XMFLOAT4& q) { return q.x > q.w; }) || all([](const XMFLOAT4& q) { return q.x < -q.w; })
+		|| all([](const XMFLOAT4& q) { return q.y > q.w; }) || all([](const XMFLOAT4& q) { return q.y < -q.w; })
+		|| all([](const XMFLOAT4& q) { return q.z > q.w; }) || all([](const XMFLOAT4& q) { return q.z < 0.f; });
+}
+
+// Clips against z >= 0, the near plane of D3D-style projections. The result
+// is a convex polygon of up to four vertices.
+int clipNear(const ClipVertex (&in)[3], ClipVertex (&out)[4]) {
+	int count = 0;
+	for (int i = 0; i < 3; ++i) {
+		const auto& a = in[i];
+		const auto& b = in[(i + 1) % 3];
+		float za = XMVectorGetZ(a.Position), zb = XMVectorGetZ(b.Position);
+		if (za >= 0.f) {
+			out[count++] = a;
+		}
+		if ((za >= 0.f) != (zb >= 0.f)) {
+			float t = za / (za - zb);
+			out[count++] = { XMVectorLerp(a.Position, b.Position, t), a.B1 + (b.B1 - a.B1) * t, a.B2 + (b.B2 - a.B2) * t };
+		}
+	}
+	return count;
+}
+
+XMFLOAT3 interpolant(const RasterTriangle& triangle, float f0, float f1, float f2, float inverse_area) {
+	const auto& e = triangle.Edges;
+	return XMFLOAT3((f0 * e[0].x + f1 * e[1].x + f2 * e[2].x) * inverse_area,
+		(f0 * e[0].y + f1 * e[1].y + f2 * e[2].y) * inverse_area,
+		(f0 * e[0].z + f1 * e[1].z + f2 * e[2].z) * inverse_area);
+}
+
+bool setupTriangle(const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, int width, int height, RasterTriangle& triangle) {
+	const ClipVertex* v[3] = { &v0, &v1, &v2 };
+	float x[3], y[3], z[3], inverse_w[3];
+	for (int i = 0; i < 3; ++i) {
+		XMFLOAT4 p;
+		XMStoreFloat4(&p, v[i]->Position);
+		inverse_w[i] = 1.f / p.w;
+		x[i] = (p.x * inverse_w[i] * 0.5f + 0.5f) * width;
+		y[i] = (0.5f - p.y * inverse_w[i] * 0.5f) * height;
+		z[i] = p.z * inverse_w[i];
+	}
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+	if (!(std::fabs(area) > 1e-8f)) {
+		return false;
+	}
+	// Both windings are drawn; flip clockwise triangles so that the edge
+	// functions are positive inside.
+	if (area < 0.f) {
+		std::swap(v[1], v[2]);
+		std::swap(x[1], x[2]);
+		std::swap(y[1], y[2]);
+		std::swap(z[1], z[2]);
+		std::swap(inverse_w[1], inverse_w[2]);
+		area = -area;
+	}
+
+	// Pixels whose centres lie within the vertex bounds.
+	auto first = [](float lo, int size) { return static_cast<int>(std::ceil(std::clamp(lo - 0.5f, -1.f, static_cast<float>(size)))); };
+	auto last = [](float hi, int size) { return static_cast<int>(std::floor(std::clamp(hi - 0.5f, -1.f, static_cast<float>(size)))); };
+	triangle.MinX = std::max(first(std::min({ x[0], x[1], x[2] }), width), 0);
+	triangle.MaxX = std::min(last(std::max({ x[0], x[1], x[2] }), width), width - 1);
+	triangle.MinY = std::max(first(std::min({ y[0], y[1], y[2] }), height), 0);
+	triangle.MaxY = std::min(last(std::max({ y[0], y[1], y[2] }), height), height - 1);
+	if (triangle.MinX > triangle.MaxX || triangle.MinY > triangle.MaxY) {
+		return false;
+	}
+
+	// Edge k runs between the two other vertices and is zero at them. Pixels
+	// on an edge belong to the triangle only for top and left edges, so that
+	// shared edges are drawn once.
+	for (int k = 0; k < 3; ++k) {
+		int i = (k + 1) % 3, j = (k + 2) % 3;
+		float a = y[i] - y[j];
+		float b = x[j] - x[i];
+		triangle.Edges[k] = XMFLOAT3(a, b, -(a * x[i] + b * y[i]));
+		triangle.TopLeft[k] = a > 0.f || (a == 0.f && b > 0.f);
+	}
+	float inverse_area = 1.f / area;
+	triangle.Depth = interpolant(triangle, z[0], z[1], z[2], inverse_area);
+	triangle.InverseW = interpolant(triangle, inverse_w[0], inverse_w[1], inverse_w[2], inverse_area);
+	triangle.B1 = interpolant(triangle, v[0]->B1 * inverse_w[0], v[1]->B1 * inverse_w[1], v[2]->B1 * inverse_w[2], inverse_area);
+	triangle.B2 = interpolant(triangle, v[0]->B2 * inverse_w[0], v[1]->B2 * inverse_w[1], v[2]->B2 * inverse_w[2], inverse_area);
+	return true;
+}
+
+// Draws the part of the triangle within the inclusive pixel rectangle, four
+// pixels of a row at a time. x0 is rounded down to a multiple of four, which
+// stays inside the tile.
+void rasterizeTriangle(const RasterTriangle& triangle, int x0, int y0, int x1, int y1, RasterFrame& frame) {
+	const XMVECTOR lanes = XMVectorSet(0.5f, 1.5f, 2.5f, 3.5f);
+	const XMVECTOR zero = XMVectorZero();
+	const XMVECTOR end = XMVectorReplicate(static_cast<float>(x1 + 1));
+	XMVECTOR edge_x[3];
+	for (int k = 0; k < 3; ++k) {
+		edge_x[k] = XMVectorReplicate(triangle.Edges[k].x);
+	}
+	XMVECTOR depth_x = XMVectorReplicate(triangle.Depth.x);
+	XMVECTOR inverse_w_x = XMVectorReplicate(triangle.InverseW.x);
+	XMVECTOR b1_x = XMVectorReplicate(triangle.B1.x);
+	XMVECTOR b2_x = XMVectorReplicate(triangle.B2.x);
+
+	for (int y = y0; y <= y1; ++y) {
+		float py = y + 0.5f;
+		XMVECTOR edge_row[3];
+		for (int k = 0; k < 3; ++k) {
+			edge_row[k] = XMVectorReplicate(triangle.Edges[k].y * py + triangle.Edges[k].z);
+		}
+		XMVECTOR depth_row = XMVectorReplicate(triangle.Depth.y * py + triangle.Depth.z);
+		XMVECTOR inverse_w_row = XMVectorReplicate(triangle.InverseW.y * py + triangle.InverseW.z);
+		XMVECTOR b1_row = XMVectorReplicate(triangle.B1.y * py + triangle.B1.z);
+		XMVECTOR b2_row = XMVectorReplicate(triangle.B2.y * py + triangle.B2.z);
+
+		for (int x = x0 & ~3; x <= x1; x += 4) {
+			XMVECTOR px = XMVectorAdd(XMVectorReplicate(static_cast<float>(x)), lanes);
+			XMVECTOR mask = XMVectorLess(px, end);
+			for (int k = 0; k < 3; ++k) {
+				XMVECTOR edge = XMVectorMultiplyAdd(edge_x[k], px, edge_row[k]);
+				mask = XMVectorAndInt(mask, triangle.TopLeft[k] ? XMVectorGreaterOrEqual(edge, zero) : XMVectorGreater(edge, zero));
+			}
+			if (XMComparisonAllTrue(XMVector4EqualIntR(mask, zero))) {
+				continue;
+			}
+
+			size_t pixel = static_cast<size_t>(y) * frame.Width + x;
+			int count = std::min(4, frame.Width - x);
+			XMFLOAT4 stored(1.f, 1.f, 1.f, 1.f);
+			std::copy(frame.Depth.begin() + pixel, frame.Depth.begin() + pixel + count, &stored.x);
+			XMVECTOR depth = XMVectorMultiplyAdd(depth_x, px, depth_row);
+			mask = XMVectorAndInt(mask, XMVectorLess(depth, XMLoadFloat4(&stored)));
+			if (XMComparisonAllTrue(XMVector4EqualIntR(mask, zero))) {
+				continue;
+			}
+
+			XMVECTOR w = XMVectorReciprocal(XMVectorMultiplyAdd(inverse_w_x, px, inverse_w_row));
+			XMFLOAT4 depths, b1, b2;
+			XMStoreFloat4(&depths, depth);
+			XMStoreFloat4(&b1, XMVectorMultiply(XMVectorMultiplyAdd(b1_x, px, b1_row), w));
+			XMStoreFloat4(&b2, XMVectorMultiply(XMVectorMultiplyAdd(b2_x, px, b2_row), w));
+			uint32_t passed[4];
+			XMStoreInt4(passed, mask);
+			for (int lane = 0; lane < count; ++lane) {
+				if (passed[lane]) {
+					frame.Depth[pixel + lane] = (&depths.x)[lane];
+					frame.Mesh[pixel + lane] = triangle.Mesh;
+					frame.Triangle[pixel + lane] = triangle.Triangle;
+					frame.Barycentrics[pixel + lane] = XMFLOAT2((&b1.x)[lane], (&b2.x)[lane]);
+				}
+			}
+		}
+	}
+}
+
+bool sceneBounds(const std::vector<RasterMesh>& meshes, XMVECTOR& center, float& radius) {
+	XMVECTOR lo = XMVectorReplicate(FLT_MAX), hi = XMVectorReplicate(-FLT_MAX);
+	bool any = false;
+	for (const auto& mesh : meshes) {
+		if (!mesh.Geometry) {
+			continue;
+		}
+		for (const auto& position : mesh.Geometry->Positions) {
+			lo = XMVectorMin(lo, XMLoadFloat3(&position));
+			hi = XMVectorMax(hi, XMLoadFloat3(&position));
+			any = true;
+		}
+	}
+	if (!any) {
+		return false;
+	}
+	center = XMVectorScale(XMVectorAdd(lo, hi), 0.5f);
+	radius = std::max(XMVectorGetX(XMVector3Length(XMVectorSubtract(hi, lo))) * 0.5f, 1e-6f);
+	return true;
+}
+
+const std::array<float, 256>& srgbTable() {
+	static const auto table = [] {
+		std::array<float, 256> values;
+		for (int i = 0; i < 256; ++i) {
+			float c = i / 255.f;
+			values[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+		}
+		return values;
+	}();
+	return table;
+}
+
+uint8_t linearToSrgb(float value) {
+	value = std::clamp(value, 0.f, 1.f);
+	float c = value <= 0.0031308f ? value * 12.92f : 1.055f * std::pow(value, 1.f / 2.4f) - 0.055f;
+	return static_cast<uint8_t>(std::lround(c * 255.f));
+}
+
+uint8_t encodeUnit(float value) {
+	return static_cast<uint8_t>(std::lround(std::clamp(value * 0.5f + 0.5f, 0.f, 1.f) * 255.f));
+}
+
+XMVECTOR fetchTexel(const Image& image, int x, int y, const float* decode) {
+	const uint8_t* texel = image.Texel(x, y);
+	if (image.Channels < 3) {
+		float grey = decode ? decode[texel[0]] : texel[0] / 255.f;
+		return XMVectorSet(grey, grey, grey, 0.f);
+	}
+	if (decode) {
+		return XMVectorSet(decode[texel[0]], decode[texel[1]], decode[texel[2]], 0.f);
+	}
+	return XMVectorSet(texel[0] / 255.f, texel[1] / 255.f, texel[2] / 255.f, 0.f);
+}
+
+// Bilinear with wrapping, row 0 of the texture at v = 1. Colour channels go
+// through decode when it is given.
+XMVECTOR sampleTexture(const Image& image, const XMFLOAT2& uv, const float* decode) {
+	float fx = (uv.x - std::floor(uv.x)) * image.Width - 0.5f;
+	float v = 1.f - uv.y;
+	float fy = (v - std::floor(v)) * image.Height - 0.5f;
+	float x_floor = std::floor(fx), y_floor = std::floor(fy);
+	float tx = fx - x_floor, ty = fy - y_floor;
+	int x0 = (static_cast<int>(x_floor) % image.Width + image.Width) % image.Width;
+	int y0 = (static_cast<int>(y_floor) % image.Height + image.Height) % image.Height;
+	int x1 = (x0 + 1) % image.Width, y1 = (y0 + 1) % image.Height;
+	XMVECTOR top = XMVectorLerp(fetchTexel(image, x0, y0, decode), fetchTexel(image, x1, y0, decode), tx);
+	XMVECTOR bottom = XMVectorLerp(fetchTexel(image, x0, y1, decode), fetchTexel(image, x1, y1, decode), tx);
+	return XMVectorLerp(top, bottom, ty);
+}
+
+// Where the camera is: a position for perspective views, the direction
+// towards the camera for orthographic ones.
+struct ViewPoint {
+	XMFLOAT3 Eye;
+	bool Orthographic;
+};
+
+struct Surface {
+	// Linear base colour.
+	XMVECTOR Albedo;
+	// Shading normal in world space, turned towards the camera.
+	XMVECTOR Normal;
+};
+
+Surface surfaceAt(const RasterMesh& mesh, uint32_t triangle, const XMFLOAT2& barycentrics, const ViewPoint& view) {
+	const auto& geometry = *mesh.Geometry;
+	const uint32_t* corners = &geometry.Indices[static_cast<size_t>(triangle) * 3];
+	float weights[3] = { 1.f - barycentrics.x - barycentrics.y, barycentrics.x, barycentrics.y };
+	auto interpolate3 = [&](const std::vector<XMFLOAT3>& values) {
+		XMVECTOR sum = XMVectorZero();
+		for (int i = 0; i < 3; ++i) {
+			sum = XMVectorMultiplyAdd(XMLoadFloat3(&values[corners[i]]), XMVectorReplicate(weights[i]), sum);
+		}
+		return sum;
+	};
+
+	XMFLOAT2 uv(0.f, 0.f);
+	if (!geometry.TexCoords.empty()) {
+		for (int i = 0; i < 3; ++i) {
+			uv.x += geometry.TexCoords[corners[i]].x * weights[i];
+			uv.y += geometry.TexCoords[corners[i]].y * weights[i];
+		}
+	}
+
+	Surface surface;
+	surface.Albedo = XMLoadFloat3(&mesh.BaseColorFactor);
+	if (mesh.BaseColor && !mesh.BaseColor->Pixels.empty() && !geometry.TexCoords.empty()) {
+		surface.Albedo = sampleTexture(*mesh.BaseColor, uv, srgbTable().data());
+	}
+
+	XMVECTOR p0 = XMLoadFloat3(&geometry.Positions[corners[0]]);
+	XMVECTOR face = XMVector3Cross(XMVectorSubtract(XMLoadFloat3(&geometry.Positions[corners[1]]), p0), XMVectorSubtract(XMLoadFloat3(&geometry.Positions[corners[2]]), p0));
+	XMVECTOR toward = view.Orthographic ? XMLoadFloat3(&view.Eye) : XMVectorSubtract(XMLoadFloat3(&view.Eye), interpolate3(geometry.Positions));
+	XMVECTOR normal = geometry.Normals.empty() ? face : interpolate3(geometry.Normals);
+	if (XMVectorGetX(XMVector3LengthSq(normal)) <= 0.f) {
+		normal = toward;
+	}
+	normal = XMVector3Normalize(normal);
+
+	if (mesh.Normal && !mesh.Normal->Pixels.empty() && !geometry.Tangents.empty() && !geometry.TexCoords.empty()) {
+		XMVECTOR tangent = XMVectorZero();
+		for (int i = 0; i < 3; ++i) {
+			tangent = XMVectorMultiplyAdd(XMLoadFloat4(&geometry.Tangents[corners[i]]), XMVectorReplicate(weights[i]), tangent);
+		}
+		tangent = XMVectorSubtract(tangent, XMVectorScale(normal, XMVectorGetX(XMVector3Dot(tangent, normal))));
+		if (XMVectorGetX(XMVector3LengthSq(tangent)) > 0.f) {
+			tangent = XMVector3Normalize(tangent);
+			XMVECTOR bitangent = XMVectorScale(XMVector3Cross(normal, tangent), geometry.Tangents[corners[0]].w);
+			XMVECTOR texel = XMVectorSubtract(XMVectorScale(sampleTexture(*mesh.Normal, uv, nullptr), 2.f), XMVectorReplicate(1.f));
+			XMVECTOR mapped = XMVectorAdd(XMVectorAdd(XMVectorScale(tangent, XMVectorGetX(texel)), XMVectorScale(bitangent, XMVectorGetY(texel))), XMVectorScale(normal, XMVectorGetZ(texel)));
+			if (XMVectorGetX(XMVector3LengthSq(mapped)) > 0.f) {
+				normal = XMVector3Normalize(mapped);
+			}
+		}
+	}
+
+	// The back of an open surface is lit like its front.
+	if (XMVectorGetX(XMVector3Dot(face, toward)) < 0.f) {
+		normal = XMVectorNegate(normal);
+	}
+	surface.Normal = normal;
+	return surface;
+}
+
+}
+
+RasterFrame RasterizeMeshes(const std::vector<RasterMesh>& meshes, FXMMATRIX view_projection, int width, int height) {
+	RasterFrame frame;
+	if (width <= 0 || height <= 0) {
+		return frame;
+	}
+	frame.Width = width;
+	frame.Height = height;
+	size_t pixel_count = static_cast<size_t>(width) * height;
+	frame.Depth.assign(pixel_count, 1.f);
+	frame.Mesh.assign(pixel_count, UINT32_MAX);
+	frame.Triangle.assign(pixel_count, UINT32_MAX);
+	frame.Barycentrics.assign(pixel_count, XMFLOAT2(0.f, 0.f));
+
+	XMMATRIX transform = view_projection;
+	std::vector<std::vector<XMFLOAT4>> clip_positions(meshes.size());
+	for (size_t m = 0; m < meshes.size(); ++m) {
+		if (!meshes[m].Geometry) {
+			continue;
+		}
+		const auto& positions = meshes[m].Geometry->Positions;
+		auto& clip = clip_positions[m];
+		clip.resize(positions.size());
+		ParallelFor((positions.size() + SETUP_BATCH - 1) / SETUP_BATCH, [&](size_t block) {
+			size_t end = std::min(positions.size(), (block + 1) * SETUP_BATCH);
+			for (size_t i = block * SETUP_BATCH; i < end; ++i) {
+				XMStoreFloat4(&clip[i], XMVector4Transform(XMVectorSetW(XMLoadFloat3(&positions[i]), 1.f), transform));
+			}
+		});
+	}
+
+	struct BatchRange {
+		uint32_t Mesh;
+		size_t First;
+		size_t Count;
+	};
+	std::vector<BatchRange> ranges;
+	for (size_t m = 0; m < meshes.size(); ++m) {
+		size_t triangle_count = meshes[m].Geometry ? meshes[m].Geometry->TriangleCount() : 0;
+		for (size_t first = 0; first < triangle_count; first += SETUP_BATCH) {
+			ranges.push_back({ static_cast<uint32_t>(m), first, std::min(SETUP_BATCH, triangle_count - first) });
+		}
+	}
+
+	int tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+	size_t tile_count = static_cast<size_t>(tiles_x) * tiles_y;
+	std::vector<TriangleBatch> batches(ranges.size());
+	ParallelFor(ranges.size(), [&](size_t b) {
+		const auto& range = ranges[b];
+		const auto& geometry = *meshes[range.Mesh].Geometry;
+		const auto& clip = clip_positions[range.Mesh];
+		auto& batch = batches[b];
+		for (size_t t = range.First; t < range.First + range.Count; ++t) {
+			ClipVertex corners[3];
+			for (int k = 0; k < 3; ++k) {
+				corners[k] = { XMLoadFloat4(&clip[geometry.Indices[t * 3 + k]]), k == 1 ? 1.f : 0.f, k == 2 ? 1.f : 0.f };
+			}
+			if (outsideFrustum(corners)) {
+				continue;
+			}
+			ClipVertex polygon[4];
+			int count = clipNear(corners, polygon);
+			for (int i = 1; i + 1 < count; ++i) {
+				RasterTriangle triangle;
+				if (setupTriangle(polygon[0], polygon[i], polygon[i + 1], width, height, triangle)) {
+					triangle.Mesh = range.Mesh;
+					triangle.Triangle = static_cast<uint32_t>(t);
+					batch.Triangles.push_back(triangle);
+				}
+			}
+		}
+
+		// Counting sort of the triangles into every tile their bounds touch,
+		// keeping submission order within a tile.
+		auto for_each_tile = [&](const RasterTriangle& triangle, auto&& func) {
+			for (int ty = triangle.MinY / TILE_SIZE; ty <= triangle.MaxY / TILE_SIZE; ++ty) {
+				for (int tx = triangle.MinX / TILE_SIZE; tx <= triangle.MaxX / TILE_SIZE; ++tx) {
+					func(static_cast<size_t>(ty) * tiles_x + tx);
+				}
+			}
+		};
+		batch.TileStart.assign(tile_count + 1, 0);
+		for (const auto& triangle : batch.Triangles) {
+			for_each_tile(triangle, [&](size_t tile) { ++batch.TileStart[tile + 1]; });
+		}
+		for (size_t tile = 0; tile < tile_count; ++tile) {
+			batch.TileStart[tile + 1] += batch.TileStart[tile];
+		}
+		batch.TileTriangles.resize(batch.TileStart.back());
+		std::vector<uint32_t> cursor(batch.TileStart.begin(), batch.TileStart.end() - 1);
+		for (uint32_t i = 0; i < batch.Triangles.size(); ++i) {
+			for_each_tile(batch.Triangles[i], [&](size_t tile) { batch.TileTriangles[cursor[tile]++] = i; });
+		}
+	});
+
+	ParallelFor(tile_count, [&](size_t tile) {
+		int x0 = static_cast<int>(tile % tiles_x) * TILE_SIZE;
+		int y0 = static_cast<int>(tile / tiles_x) * TILE_SIZE;
+		int x1 = std::min(x0 + TILE_SIZE, width) - 1;
+		int y1 = std::min(y0 + TILE_SIZE, height) - 1;
+		for (const auto& batch : batches) {
+			for (uint32_t j = batch.TileStart[tile]; j < batch.TileStart[tile + 1]; ++j) {
+				const auto& triangle = batch.Triangles[batch.TileTriangles[j]];
+				rasterizeTriangle(triangle, std::max(triangle.MinX, x0), std::max(triangle.MinY, y0), std::min(triangle.MaxX, x1), std::min(triangle.MaxY, y1), frame);
+			}
+		}
+	});
+	return frame;
+}
+
+Image RenderThumbnail(const std::vector<RasterMesh>& meshes, int size) {
+	Image thumbnail;
+	thumbnail.Width = std::max(size, 0);
+	thumbnail.Height = thumbnail.Width;
+	thumbnail.Channels = 4;
+	thumbnail.Pixels.assign(static_cast<size_t>(thumbnail.Width) * thumbnail.Height * 4, 0);
+	XMVECTOR center;
+	float radius;
+	if (size <= 0 || !sceneBounds(meshes, center, radius)) {
+		return thumbnail;
+	}
+
+	XMVECTOR toward = XMVector3Normalize(XMVectorSet(0.6f, 0.5f, 1.f, 0.f));
+	float distance = radius / std::sin(THUMBNAIL_FOV * 0.5f);
+	ViewPoint view{ {}, false };
+	XMVECTOR eye = XMVectorMultiplyAdd(toward, XMVectorReplicate(distance), center);
+	XMStoreFloat3(&view.Eye, eye);
+	XMMATRIX view_matrix = XMMatrixLookAtRH(eye, center, XMVectorSet(0.f, 1.f, 0.f, 0.f));
+	XMMATRIX projection = XMMatrixPerspectiveFovRH(THUMBNAIL_FOV, 1.f, (distance - radius) * 0.5f, distance + radius);
+	int samples = size * THUMBNAIL_SAMPLES;
+	auto frame = RasterizeMeshes(meshes, XMMatrixMultiply(view_matrix, projection), samples, samples);
+
+	XMVECTOR light = XMVector3Normalize(XMVectorAdd(toward, XMVectorSet(0.f, 1.f, 0.f, 0.f)));
+	ParallelFor(static_cast<size_t>(size), [&](size_t y) {
+		for (int x = 0; x < size; ++x) {
+			XMVECTOR sum = XMVectorZero();
+			int covered = 0;
+			for (int sy = 0; sy < THUMBNAIL_SAMPLES; ++sy) {
+				for (int sx = 0; sx < THUMBNAIL_SAMPLES; ++sx) {
+					size_t pixel = (y * THUMBNAIL_SAMPLES + sy) * static_cast<size_t>(samples) + x * THUMBNAIL_SAMPLES + sx;
+					if (!frame.Covered(pixel)) {
+						continue;
+					}
+					auto surface = surfaceAt(meshes[frame.Mesh[pixel]], frame.Triangle[pixel], frame.Barycentrics[pixel], view);
+					float diffuse = std::max(XMVectorGetX(XMVector3Dot(surface.Normal, light)), 0.f);
+					sum = XMVectorMultiplyAdd(surface.Albedo, XMVectorReplicate(THUMBNAIL_AMBIENT + (1.f - THUMBNAIL_AMBIENT) * diffuse), sum);
+					++covered;
+				}
+			}
+			if (!covered) {
+				continue;
+			}
+			XMFLOAT3 color;
+			XMStoreFloat3(&color, XMVectorScale(sum, 1.f / covered));
+			uint8_t* out = thumbnail.Texel(x, static_cast<int>(y));
+			out[0] = linearToSrgb(color.x);
+			out[1] = linearToSrgb(color.y);
+			out[2] = linearToSrgb(color.z);
+			out[3] = static_cast<uint8_t>(covered * 255 / (THUMBNAIL_SAMPLES * THUMBNAIL_SAMPLES));
+		}
+	});
+	return thumbnail;
+}
+
+XMFLOAT3 OctahedralDirection(float u, float v) {
+	float x = u, z = v;
+	float y = 1.f - std::fabs(u) - std::fabs(v);
+	if (y < 0.f) {
+		x = (1.f - std::fabs(v)) * std::copysign(1.f, u);
+		z = (1.f - std::fabs(u)) * std::copysign(1.f, v);
+	}
+	XMFLOAT3 direction;
+	XMStoreFloat3(&direction, XMVector3Normalize(XMVectorSet(x, y, z, 0.f)));
+	return direction;
+}
+
+ImpostorAtlas RenderImpostorAtlas(const std::vector<RasterMesh>& meshes, int views, int cell_size) {
+	ImpostorAtlas atlas;
+	views = std::max(views, 0);
+	cell_size = std::max(cell_size, 0);
+	int size = views * cell_size;
+	for (auto* image : { &atlas.Albedo, &atlas.NormalDepth }) {
+		image->Width = size;
+		image->Height = size;
+		image->Channels = 4;
+	}
+	atlas.Albedo.Pixels.assign(static_cast<size_t>(size) * size * 4, 0);
+	const uint8_t empty[4] = { 128, 128, 128, 255 };
+	atlas.NormalDepth = MakeConstantImage(size, size, 4, empty);
+	XMVECTOR center;
+	if (size == 0 || !sceneBounds(meshes, center, atlas.Radius)) {
+		return atlas;
+	}
+	XMStoreFloat3(&atlas.Center, center);
+
+	float radius = atlas.Radius;
+	XMMATRIX projection = XMMatrixOrthographicRH(radius * 2.f, radius * 2.f, 0.f, radius * 2.f);
+	for (int cell_y = 0; cell_y < views; ++cell_y) {
+		for (int cell_x = 0; cell_x < views; ++cell_x) {
+			auto direction = OctahedralDirection((cell_x + 0.5f) / views * 2.f - 1.f, (cell_y + 0.5f) / views * 2.f - 1.f);
+			XMVECTOR toward = XMLoadFloat3(&direction);
+			XMVECTOR up = std::fabs(direction.y) > 0.999f ? XMVectorSet(0.f, 0.f, -1.f, 0.f) : XMVectorSet(0.f, 1.f, 0.f, 0.f);
+			XMVECTOR eye = XMVectorMultiplyAdd(toward, XMVectorReplicate(radius), center);
+			auto frame = RasterizeMeshes(meshes, XMMatrixMultiply(XMMatrixLookToRH(eye, XMVectorNegate(toward), up), projection), cell_size, cell_size);
+
+			ViewPoint view{ direction, true };
+			ParallelFor(static_cast<size_t>(cell_size), [&](size_t y) {
+				for (int x = 0; x < cell_size; ++x) {
+					size_t pixel = y * cell_size + x;
+					if (!frame.Covered(pixel)) {
+						continue;
+					}
+					auto surface = surfaceAt(meshes[frame.Mesh[pixel]], frame.Triangle[pixel], frame.Barycentrics[pixel], view);
+					XMFLOAT3 albedo, normal;
+					XMStoreFloat3(&albedo, surface.Albedo);
+					XMStoreFloat3(&normal, surface.Normal);
+					int atlas_x = cell_x * cell_size + x, atlas_y = cell_y * cell_size + static_cast<int>(y);
+					uint8_t* out = atlas.Albedo.Texel(atlas_x, atlas_y);
+					out[0] = linearToSrgb(albedo.x);
+					out[1] = linearToSrgb(albedo.y);
+					out[2] = linearToSrgb(albedo.z);
+					out[3] = 255;
+					out = atlas.NormalDepth.Texel(atlas_x, atlas_y);
+					out[0] = encodeUnit(normal.x);
+					out[1] = encodeUnit(normal.y);
+					out[2] = encodeUnit(normal.z);
+					out[3] = static_cast<uint8_t>(std::lround(std::clamp(frame.Depth[pixel], 0.f, 1.f) * 255.f));
+				}
+			});
+		}
+	}
+	return atlas;
+}
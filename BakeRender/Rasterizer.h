@@ -0,0 +1,74 @@
+﻿#pragma once
+
+#include "Geometry.h"
+#include "Image.h"
+
+#include <DirectXMath.h>
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A world-space mesh with the textures its material resolved to. Without a
+// BaseColor texture BaseColorFactor is used; the Normal texture is only used
+// when the mesh has tangents.
+struct RasterMesh {
+	const MeshGeometry* Geometry = nullptr;
+	std::shared_ptr<const Image> BaseColor;
+	std::shared_ptr<const Image> Normal;
+	DirectX::XMFLOAT3 BaseColorFactor{ 1.f, 1.f, 1.f };
+};
+
+// Visibility buffer of one view: the nearest triangle of every pixel and its
+// perspective-correct barycentric weights. Shading reads it afterwards, so
+// every pixel samples its textures once however many triangles overlap it.
+struct RasterFrame {
+	int Width = 0;
+	int Height = 0;
+	// Normalized device depth, 1 where nothing was drawn.
+	std::vector<float> Depth;
+	// UINT32_MAX where nothing was drawn.
+	std::vector<uint32_t> Mesh;
+	std::vector<uint32_t> Triangle;
+	// Weights of the second and third vertex of the triangle.
+	std::vector<DirectX::XMFLOAT2> Barycentrics;
+
+	bool Covered(size_t pixel) const {
+		return Mesh[pixel] != UINT32_MAX;
+	}
+};
+
+// Draws the meshes through a row-vector view_projection with depth in [0, 1],
+// as the DirectXMath projections produce. Triangles are clipped at the near
+// plane and binned into square tiles in parallel batches. Tiles are then
+// rasterized in parallel, evaluating edge functions and depth four pixels at
+// a time. Faces are not culled, so open meshes draw from both sides.
+RasterFrame RasterizeMeshes(const std::vector<RasterMesh>& meshes, DirectX::FXMMATRIX view_projection, int width, int height);
+
+// An RGBA thumbnail of all meshes seen from the front, above and to the right,
+// lit by a light above the camera. Rendered with 2x2 supersampling onto a
+// transparent background. Alpha textures are ignored.
+Image RenderThumbnail(const std::vector<RasterMesh>& meshes, int size);
+
+struct ImpostorAtlas {
+	// sRGB base colour, alpha is coverage.
+	Image Albedo;
+	// World normal mapped to [0, 1] in RGB and depth in A, 0 at the near side
+	// of the bounding sphere and 1 at the far side. Empty texels are 128,
+	// 128, 128, 255.
+	Image NormalDepth;
+	// Bounding sphere the views are fitted to.
+	DirectX::XMFLOAT3 Center{ 0.f, 0.f, 0.f };
+	float Radius = 0.f;
+};
+
+// Unit vector towards the camera for octahedral coordinates in [-1, 1]. The
+// centre maps to +Y, the edges to the horizon and the corners to -Y.
+DirectX::XMFLOAT3 OctahedralDirection(float u, float v);
+
+// Octahedral impostor of all meshes: views x views orthographic views of the
+// bounding sphere of cell_size texels each. Cell (x, y), with y counted from
+// the top, looks from OctahedralDirection((x + 0.5) / views * 2 - 1,
+// (y + 0.5) / views * 2 - 1) towards the centre. Its up axis is world +Y
+// projected onto the view plane, or -Z when looking straight down or up.
+ImpostorAtlas RenderImpostorAtlas(const std::vector<RasterMesh>& meshes, int views, int cell_size);